@@ -0,0 +1,87 @@
+package com.xixibase.benchmark;
+
+import java.util.Properties;
+import java.util.concurrent.CyclicBarrier;
+import java.util.concurrent.atomic.AtomicLong;
+
+import com.google.code.yanf4j.util.ResourcesUtils;
+import com.xixibase.cache.CacheClient;
+import com.xixibase.cache.CacheClientManager;
+import com.xixibase.cache.DeltaItem;
+
+// Measures increments per second of a single counter shared by all threads,
+// and checks that no increment was lost.
+// usage: HotCounter [threads] [repeats]
+public class HotCounter {
+	private static final String KEY = "benchmark_hot_counter";
+
+	public static void main(String[] args) throws Exception {
+		Properties properties = ResourcesUtils
+		.getResourceAsProperties("xixibase.properties");
+		String servers = (String) properties.get("servers");
+		String[] serverlist = servers.split(",");
+		CacheClientManager manager = CacheClientManager.getInstance("HotCounter");
+		manager.initialize(serverlist);
+
+		int threads = args.length > 0 ? Integer.parseInt(args[0]) : Runtime.getRuntime().availableProcessors() * 4;
+		int repeats = args.length > 1 ? Integer.parseInt(args[1]) : 100000;
+
+		test(manager, threads, repeats / 10, false);
+		System.out.println("warm up");
+		test(manager, threads, repeats, true);
+		manager.shutdown();
+	}
+
+	private static void test(CacheClientManager manager, int threads,
+			int repeats, boolean print) throws Exception {
+		CacheClient cc = manager.createClient();
+		cc.set(KEY, "0");
+		final AtomicLong fail = new AtomicLong(0);
+		final CyclicBarrier barrier = new CyclicBarrier(threads + 1);
+		for (int i = 0; i < threads; i++) {
+			new Worker(manager.createClient(), repeats, barrier, fail).start();
+		}
+		barrier.await();
+		long start = System.nanoTime();
+		barrier.await();
+		long duration = System.nanoTime() - start;
+		if (print) {
+			long total = (long)threads * repeats;
+			DeltaItem item = cc.incr(KEY, 0);
+			long value = item != null ? item.value : -1;
+			System.out.println("threads=" + threads + " increments=" + total
+				+ " fail=" + fail.get() + " value=" + value
+				+ (value + fail.get() == total ? "" : " LOST=" + (total - fail.get() - value))
+				+ " duration=" + duration / 1000000 + "ms"
+				+ " ops=" + total * 1000000000L / duration);
+		}
+	}
+
+	private static class Worker extends Thread {
+		private CacheClient cc;
+		private int repeats;
+		private CyclicBarrier barrier;
+		private AtomicLong fail;
+
+		public Worker(CacheClient cc, int repeats, CyclicBarrier barrier, AtomicLong fail) {
+			this.cc = cc;
+			this.repeats = repeats;
+			this.barrier = barrier;
+			this.fail = fail;
+		}
+
+		public void run() {
+			try {
+				barrier.await();
+				for (int i = 0; i < repeats; i++) {
+					if (cc.incr(KEY) == null) {
+						fail.incrementAndGet();
+					}
+				}
+				barrier.await();
+			} catch (Exception e) {
+				e.printStackTrace();
+			}
+		}
+	}
+}
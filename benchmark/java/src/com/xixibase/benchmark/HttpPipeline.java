@@ -0,0 +1,141 @@
+package com.xixibase.benchmark;
+
+import java.io.BufferedInputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.OutputStream;
+import java.net.Socket;
+import java.util.Properties;
+import java.util.concurrent.CyclicBarrier;
+import java.util.concurrent.atomic.AtomicLong;
+
+import com.google.code.yanf4j.util.ResourcesUtils;
+
+// Measures pipelined HTTP manager requests per second.
+// usage: HttpPipeline [threads] [depth] [repeats]
+public class HttpPipeline {
+	public static void main(String[] args) throws Exception {
+		Properties properties = ResourcesUtils
+		.getResourceAsProperties("xixibase.properties");
+		String servers = (String) properties.get("servers");
+		String[] server = servers.split(",")[0].split(":");
+		String host = server[0];
+		int port = Integer.parseInt(server[1]);
+
+		int threads = args.length > 0 ? Integer.parseInt(args[0]) : 1;
+		int depth = args.length > 1 ? Integer.parseInt(args[1]) : 16;
+		int repeats = args.length > 2 ? Integer.parseInt(args[2]) : 100000;
+
+		Socket socket = new Socket(host, port);
+		request(socket, new BufferedInputStream(socket.getInputStream()),
+			"/manager/set?k=benchmark&v=0123456789", 1);
+		socket.close();
+
+		test(host, port, threads, 1, repeats / 10, false);
+		System.out.println("warm up");
+		test(host, port, threads, 1, repeats, true);
+		test(host, port, threads, depth, repeats, true);
+	}
+
+	private static void test(String host, int port, int threads, int depth,
+			int repeats, boolean print) throws Exception {
+		final AtomicLong fail = new AtomicLong(0);
+		final CyclicBarrier barrier = new CyclicBarrier(threads + 1);
+		for (int i = 0; i < threads; i++) {
+			new Worker(host, port, depth, repeats, barrier, fail).start();
+		}
+		barrier.await();
+		long start = System.nanoTime();
+		barrier.await();
+		long duration = System.nanoTime() - start;
+		if (print) {
+			long total = (long)threads * repeats;
+			System.out.println("threads=" + threads + " depth=" + depth
+				+ " requests=" + total + " fail=" + fail.get()
+				+ " duration=" + duration / 1000000 + "ms"
+				+ " rps=" + total * 1000000000L / duration);
+		}
+	}
+
+	private static int request(Socket socket, InputStream in, String uri, int depth) throws IOException {
+		byte[] req = ("GET " + uri + " HTTP/1.1\r\nHost: xixibase\r\n\r\n").getBytes();
+		byte[] batch = new byte[req.length * depth];
+		for (int i = 0; i < depth; i++) {
+			System.arraycopy(req, 0, batch, i * req.length, req.length);
+		}
+		OutputStream out = socket.getOutputStream();
+		out.write(batch);
+		out.flush();
+		int ok = 0;
+		for (int i = 0; i < depth; i++) {
+			if (readResponse(in)) {
+				ok++;
+			}
+		}
+		return ok;
+	}
+
+	private static boolean readResponse(InputStream in) throws IOException {
+		StringBuilder header = new StringBuilder();
+		while (header.length() < 4 || !header.substring(header.length() - 4).equals("\r\n\r\n")) {
+			int c = in.read();
+			if (c < 0) {
+				throw new IOException("connection closed");
+			}
+			header.append((char)c);
+		}
+		String h = header.toString();
+		int length = 0;
+		int pos = h.indexOf("Content-Length: ");
+		if (pos >= 0) {
+			length = Integer.parseInt(h.substring(pos + 16, h.indexOf("\r\n", pos)).trim());
+		}
+		while (length > 0) {
+			long n = in.skip(length);
+			if (n <= 0) {
+				if (in.read() < 0) {
+					throw new IOException("connection closed");
+				}
+				n = 1;
+			}
+			length -= n;
+		}
+		return h.startsWith("HTTP/1.1 200");
+	}
+
+	private static class Worker extends Thread {
+		private String host;
+		private int port;
+		private int depth;
+		private int repeats;
+		private CyclicBarrier barrier;
+		private AtomicLong fail;
+
+		public Worker(String host, int port, int depth, int repeats,
+				CyclicBarrier barrier, AtomicLong fail) {
+			this.host = host;
+			this.port = port;
+			this.depth = depth;
+			this.repeats = repeats;
+			this.barrier = barrier;
+			this.fail = fail;
+		}
+
+		public void run() {
+			try {
+				Socket socket = new Socket(host, port);
+				socket.setTcpNoDelay(true);
+				InputStream in = new BufferedInputStream(socket.getInputStream());
+				barrier.await();
+				for (int i = 0; i < repeats; i += depth) {
+					int n = Math.min(depth, repeats - i);
+					fail.addAndGet(n - request(socket, in, "/manager/get?k=benchmark", n));
+				}
+				socket.close();
+				barrier.await();
+			} catch (Exception e) {
+				e.printStackTrace();
+			}
+		}
+	}
+}
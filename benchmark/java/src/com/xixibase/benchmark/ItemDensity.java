@@ -0,0 +1,85 @@
+package com.xixibase.benchmark;
+
+import java.util.Iterator;
+import java.util.Map;
+import java.util.Properties;
+
+import com.google.code.yanf4j.util.ResourcesUtils;
+import com.xixibase.cache.CacheClient;
+import com.xixibase.cache.CacheClientManager;
+
+// Loads items of one key and value size into an empty group and reports the
+// memory_used and group_items the server counts for them, so the item layouts
+// (USING_COMPACT_ITEM or not) can be compared by bytes per item and items per
+// GB. memory_used counts whole slab chunks, not the hash table. Freed items stay
+// counted for reuse, so run it against a freshly started server.
+// usage: ItemDensity [items] [keySize] [valueSize] [groupID]
+public class ItemDensity {
+	public static void main(String[] args) throws Exception {
+		Properties properties = ResourcesUtils
+		.getResourceAsProperties("xixibase.properties");
+		String servers = (String) properties.get("servers");
+		String[] serverlist = servers.split(",");
+		CacheClientManager manager = CacheClientManager.getInstance("ItemDensity");
+		manager.initialize(serverlist);
+
+		int items = args.length > 0 ? Integer.parseInt(args[0]) : 1000000;
+		int keySize = args.length > 1 ? Integer.parseInt(args[1]) : 16;
+		int valueSize = args.length > 2 ? Integer.parseInt(args[2]) : 30;
+		int groupID = args.length > 3 ? Integer.parseInt(args[3]) : 318;
+
+		CacheClient cc = manager.createClient(groupID);
+		cc.flush();
+		long memoryBefore = getStat(cc, groupID, "memory_used");
+		long itemsBefore = getStat(cc, groupID, "group_items");
+		long bytesBefore = getStat(cc, groupID, "group_bytes");
+
+		String value = makeString('v', valueSize);
+		String pad = makeString('0', keySize);
+		int fail = 0;
+		for (int i = 0; i < items; i++) {
+			String index = Integer.toString(i);
+			String key = "k" + pad.substring(0, keySize - 1 - index.length()) + index;
+			if (cc.set(key, value) == 0) {
+				fail++;
+			}
+		}
+
+		long memory = getStat(cc, groupID, "memory_used") - memoryBefore;
+		long count = getStat(cc, groupID, "group_items") - itemsBefore;
+		long bytes = getStat(cc, groupID, "group_bytes") - bytesBefore;
+		System.out.println("item_header_size=" + getStat(cc, groupID, "item_header_size")
+			+ " key_size=" + keySize + " value_size=" + valueSize
+			+ " items=" + count + " fail=" + fail
+			+ " memory_used=" + memory
+			+ " bytes_per_item=" + (count > 0 ? memory / count : 0)
+			+ " raw_bytes_per_item=" + (count > 0 ? bytes / count : 0)
+			+ " items_per_gb=" + (memory > 0 ? count * 1073741824L / memory : 0));
+		cc.flush();
+		manager.shutdown();
+	}
+
+	private static String makeString(char c, int size) {
+		StringBuilder sb = new StringBuilder(size);
+		for (int i = 0; i < size; i++) {
+			sb.append(c);
+		}
+		return sb.toString();
+	}
+
+	// summed over the servers, -1 if no server reported it
+	private static long getStat(CacheClient cc, int groupID, String name) {
+		Map<String, Map<String, String>> stats = cc.statsGetGroupStats(null, groupID, (byte)0);
+		long sum = -1;
+		if (stats != null) {
+			Iterator<Map<String, String>> it = stats.values().iterator();
+			while (it.hasNext()) {
+				String v = it.next().get(name);
+				if (v != null) {
+					sum = (sum < 0 ? 0 : sum) + Long.parseLong(v);
+				}
+			}
+		}
+		return sum;
+	}
+}
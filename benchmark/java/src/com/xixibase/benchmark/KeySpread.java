@@ -0,0 +1,106 @@
+package com.xixibase.benchmark;
+
+import java.util.Properties;
+import java.util.Random;
+import java.util.concurrent.CyclicBarrier;
+import java.util.concurrent.atomic.AtomicLong;
+
+import com.google.code.yanf4j.util.ResourcesUtils;
+import com.xixibase.cache.CacheClient;
+import com.xixibase.cache.CacheClientManager;
+
+// Measures gets and sets per second on keys spread uniformly over the key space,
+// one connection per thread. Run it against the server with execution-mode shared
+// and again with partitioned to compare the two.
+// usage: KeySpread [threads] [repeats] [keys] [set percent]
+public class KeySpread {
+	public static void main(String[] args) throws Exception {
+		Properties properties = ResourcesUtils
+		.getResourceAsProperties("xixibase.properties");
+		String servers = (String) properties.get("servers");
+		String[] serverlist = servers.split(",");
+		CacheClientManager manager = CacheClientManager.getInstance("KeySpread");
+		manager.initialize(serverlist);
+
+		int threads = args.length > 0 ? Integer.parseInt(args[0]) : Runtime.getRuntime().availableProcessors() * 4;
+		int repeats = args.length > 1 ? Integer.parseInt(args[1]) : 100000;
+		int keys = args.length > 2 ? Integer.parseInt(args[2]) : 100000;
+		int setPercent = args.length > 3 ? Integer.parseInt(args[3]) : 10;
+
+		CacheClient cc = manager.createClient();
+		for (int i = 0; i < keys; i++) {
+			cc.set("key_spread_" + i, "value_" + i);
+		}
+
+		test(manager, threads, repeats / 10, keys, setPercent, false);
+		System.out.println("warm up");
+		test(manager, threads, repeats, keys, setPercent, true);
+		manager.shutdown();
+	}
+
+	private static void test(CacheClientManager manager, int threads, int repeats,
+			int keys, int setPercent, boolean print) throws Exception {
+		final AtomicLong hits = new AtomicLong(0);
+		final AtomicLong sets = new AtomicLong(0);
+		final CyclicBarrier barrier = new CyclicBarrier(threads + 1);
+		for (int i = 0; i < threads; i++) {
+			new Worker(manager.createClient(), repeats, keys, setPercent, i, barrier, hits, sets).start();
+		}
+		barrier.await();
+		long start = System.nanoTime();
+		barrier.await();
+		long duration = System.nanoTime() - start;
+		if (print) {
+			long total = (long)threads * repeats;
+			System.out.println("threads=" + threads + " keys=" + keys + " set_percent=" + setPercent
+				+ " ops=" + total + " sets=" + sets.get() + " hits=" + hits.get()
+				+ " duration=" + duration / 1000000 + "ms"
+				+ " ops_per_second=" + total * 1000000000L / duration);
+		}
+	}
+
+	private static class Worker extends Thread {
+		private CacheClient cc;
+		private int repeats;
+		private int keys;
+		private int setPercent;
+		private Random random;
+		private CyclicBarrier barrier;
+		private AtomicLong hits;
+		private AtomicLong sets;
+
+		public Worker(CacheClient cc, int repeats, int keys, int setPercent, int seed,
+				CyclicBarrier barrier, AtomicLong hits, AtomicLong sets) {
+			this.cc = cc;
+			this.repeats = repeats;
+			this.keys = keys;
+			this.setPercent = setPercent;
+			this.random = new Random(seed);
+			this.barrier = barrier;
+			this.hits = hits;
+			this.sets = sets;
+		}
+
+		public void run() {
+			try {
+				barrier.await();
+				long hitCount = 0;
+				long setCount = 0;
+				for (int i = 0; i < repeats; i++) {
+					int k = random.nextInt(keys);
+					if (random.nextInt(100) < setPercent) {
+						cc.set("key_spread_" + k, "value_" + i);
+						setCount++;
+					} else if (cc.get("key_spread_" + k) != null) {
+						hitCount++;
+					}
+				}
+				hits.addAndGet(hitCount);
+				sets.addAndGet(setCount);
+				barrier.await();
+			} catch (Exception e) {
+				e.printStackTrace();
+			}
+		}
+	}
+}
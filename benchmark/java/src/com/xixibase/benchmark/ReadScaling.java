@@ -0,0 +1,95 @@
+package com.xixibase.benchmark;
+
+import java.util.Properties;
+import java.util.concurrent.CyclicBarrier;
+import java.util.concurrent.atomic.AtomicLong;
+
+import com.google.code.yanf4j.util.ResourcesUtils;
+import com.xixibase.cache.CacheClient;
+import com.xixibase.cache.CacheClientManager;
+
+// Measures gets per second of a read-only key set as the number of threads
+// doubles up to maxThreads. Run it once against a server with
+// <lock-free-get>true</lock-free-get> and once with false to compare the
+// lock-free get path with the locked one.
+// usage: ReadScaling [maxThreads] [repeats] [keys]
+public class ReadScaling {
+	public static void main(String[] args) throws Exception {
+		Properties properties = ResourcesUtils
+		.getResourceAsProperties("xixibase.properties");
+		String servers = (String) properties.get("servers");
+		String[] serverlist = servers.split(",");
+		CacheClientManager manager = CacheClientManager.getInstance("ReadScaling");
+		manager.initialize(serverlist);
+
+		int maxThreads = args.length > 0 ? Integer.parseInt(args[0]) : Runtime.getRuntime().availableProcessors() * 4;
+		int repeats = args.length > 1 ? Integer.parseInt(args[1]) : 100000;
+		int keys = args.length > 2 ? Integer.parseInt(args[2]) : 1000;
+
+		CacheClient cc = manager.createClient();
+		for (int i = 0; i < keys; i++) {
+			cc.set("read_scaling_" + i, "value_" + i);
+		}
+
+		test(manager, maxThreads, repeats / 10, keys, false);
+		System.out.println("warm up");
+		for (int threads = 1; threads <= maxThreads; threads *= 2) {
+			test(manager, threads, repeats, keys, true);
+		}
+		manager.shutdown();
+	}
+
+	private static void test(CacheClientManager manager, int threads,
+			int repeats, int keys, boolean print) throws Exception {
+		final AtomicLong miss = new AtomicLong(0);
+		final CyclicBarrier barrier = new CyclicBarrier(threads + 1);
+		for (int i = 0; i < threads; i++) {
+			new Worker(manager.createClient(), repeats, keys, i, barrier, miss).start();
+		}
+		barrier.await();
+		long start = System.nanoTime();
+		barrier.await();
+		long duration = System.nanoTime() - start;
+		if (print) {
+			long total = (long)threads * repeats;
+			System.out.println("threads=" + threads + " gets=" + total
+				+ " miss=" + miss.get()
+				+ " duration=" + duration / 1000000 + "ms"
+				+ " ops=" + total * 1000000000L / duration
+				+ " ops_per_thread=" + repeats * 1000000000L / duration);
+		}
+	}
+
+	private static class Worker extends Thread {
+		private CacheClient cc;
+		private int repeats;
+		private int keys;
+		private int offset;
+		private CyclicBarrier barrier;
+		private AtomicLong miss;
+
+		public Worker(CacheClient cc, int repeats, int keys, int offset,
+				CyclicBarrier barrier, AtomicLong miss) {
+			this.cc = cc;
+			this.repeats = repeats;
+			this.keys = keys;
+			this.offset = offset;
+			this.barrier = barrier;
+			this.miss = miss;
+		}
+
+		public void run() {
+			try {
+				barrier.await();
+				for (int i = 0; i < repeats; i++) {
+					if (cc.get("read_scaling_" + (i + offset) % keys) == null) {
+						miss.incrementAndGet();
+					}
+				}
+				barrier.await();
+			} catch (Exception e) {
+				e.printStackTrace();
+			}
+		}
+	}
+}
@@ -512,6 +512,101 @@ public class CacheClientImpl extends Defines {
 		return NO_CAS;
 	}
 
+	// A get that hands out leases. A miss grants the lease to fill the key, or
+	// answers with neither value nor lease while another client holds it.
+	public LeaseResult leaseGet(String key) {
+		lastError = null;
+		if (key == null) {
+			lastError = "leaseGet, key == null";
+			log.error(lastError);
+			return null;
+		}
+
+		byte[] keyBuf = transCoder.encodeKey(key);
+		if (keyBuf == null) {
+			lastError = "leaseGet, failed to encode key";
+			log.error(lastError);
+			return null;
+		}
+
+		XixiSocket socket = manager.getSocket(key);
+		if (socket == null) {
+			lastError = "leaseGet, failed to get socket";
+			log.error(lastError);
+			return null;
+		}
+
+		try {
+			ByteBuffer writeBuffer = socket.getWriteBuffer();
+			writeBuffer.clear();
+			writeBuffer.put(XIXI_CATEGORY_CACHE);
+			writeBuffer.put(XIXI_LEASE_GET_REQ);
+			writeBuffer.putInt(groupID);
+			writeBuffer.putInt(0); // watchID
+			writeBuffer.putShort((short) keyBuf.length);
+			writeBuffer.put(keyBuf);
+			socket.flush();
+
+			LeaseResult lr = new LeaseResult();
+			byte category = socket.readByte();
+			byte type = socket.readByte();
+			if (category == XIXI_CATEGORY_CACHE && type == XIXI_LEASE_REFRESH_RES) {
+				lr.leaseToken = socket.readLong();
+				category = socket.readByte();
+				type = socket.readByte();
+			}
+			if (category == XIXI_CATEGORY_CACHE && type == XIXI_TYPE_GET_RES) {
+				long cacheID = socket.readLong();
+				int flags = socket.readInt();
+				int expiration = socket.readInt();
+				int dataSize = socket.readInt();
+				byte[] data = socket.read(dataSize);
+				int[] objectSize = new int[1];
+				Object obj = transCoder.decode(data, flags, objectSize);
+				lr.item = new CacheItem(
+						key,
+						cacheID,
+						expiration,
+						groupID,
+						flags,
+						obj,
+						objectSize[0],
+						dataSize);
+				return lr;
+			} else if (category == XIXI_CATEGORY_CACHE && type == XIXI_LEASE_GET_RES) {
+				lr.leaseToken = socket.readLong();
+				return lr;
+			} else {
+				short reason = socket.readShort();
+				if (reason == XIXI_REASON_PLEASE_TRY_AGAIN) {
+					return lr;
+				}
+				lastError = "leaseGet, response error, reason=" + reason;
+				log.debug(lastError);
+				if (reason == XIXI_REASON_UNKNOWN_COMMAND) {
+					socket.trueClose();
+					socket = null;
+				}
+			}
+		} catch (IOException e) {
+			lastError = "leaseGet, exception=" + e;
+			log.error(lastError);
+			socket.trueClose();
+			socket = null;
+		} finally {
+			if (socket != null) {
+				socket.close();
+				socket = null;
+			}
+		}
+		return null;
+	}
+
+	// stores the value only while leaseToken is the live lease of the key
+	public long leaseSet(String key, Object value, int expiration, long leaseToken) {
+		return update(XIXI_UPDATE_SUB_OP_LEASE_SET, key, value, expiration, leaseToken, false);
+	}
+
 	public boolean delete(String key, long cacheID) {
 		lastError = null;
 		if (key == null) {
@@ -989,4 +1084,64 @@ public class CacheClientImpl extends Defines {
 		}
 		return null;
 	}
+
+	// Changes of the whole group starting at sequence, 0 subscribes at the current
+	// end. Waits up to checkTimeout seconds when nothing changed yet.
+	public FeedResult checkFeed(String host, long sequence, int maxCount, int checkTimeout) {
+		lastError = null;
+		XixiSocket socket = manager.getSocketByHost(host);
+		if (socket == null) {
+			lastError = "checkFeed, failed to get by host:" + host;
+			log.error(lastError);
+			return null;
+		}
+		try {
+			ByteBuffer writeBuffer = socket.getWriteBuffer();
+			writeBuffer.clear();
+			writeBuffer.put(XIXI_CATEGORY_CACHE);
+			writeBuffer.put(XIXI_CHECK_FEED_REQ);
+			writeBuffer.putInt(groupID);
+			writeBuffer.putLong(sequence);
+			writeBuffer.putInt(maxCount);
+			writeBuffer.putInt(checkTimeout);
+			socket.flush();
+
+			byte category = socket.readByte();
+			byte type = socket.readByte();
+			if (category == XIXI_CATEGORY_CACHE && type == XIXI_CHECK_FEED_RES) {
+				FeedResult fr = new FeedResult();
+				fr.firstSequence = socket.readLong();
+				fr.nextSequence = socket.readLong();
+				int eventCount = socket.readInt();
+				fr.cacheIDs = new long[eventCount];
+				fr.keyHashes = new int[eventCount];
+				fr.types = new byte[eventCount];
+				for (int i = 0; i < eventCount; i++) {
+					fr.cacheIDs[i] = socket.readLong();
+					fr.keyHashes[i] = socket.readInt();
+					fr.types[i] = socket.readByte();
+				}
+				return fr;
+			} else {
+				short reason = socket.readShort();
+				lastError = "checkFeed, response error, reason=" + reason;
+				log.debug(lastError);
+				if (reason == XIXI_REASON_UNKNOWN_COMMAND) {
+					socket.trueClose();
+					socket = null;
+				}
+			}
+		} catch (IOException e) {
+			lastError = "checkFeed, e=" + e;
+			log.error(lastError);
+			socket.trueClose();
+			socket = null;
+		} finally {
+			if (socket != null) {
+				socket.close();
+				socket = null;
+			}
+		}
+		return null;
+	}
 }
@@ -49,6 +49,7 @@ public class Defines {
 	public static final byte XIXI_UPDATE_SUB_OP_REPLACE = 2;
 	public static final byte XIXI_UPDATE_SUB_OP_APPEND = 3;
 	public static final byte XIXI_UPDATE_SUB_OP_PREPEND = 4;
+	public static final byte XIXI_UPDATE_SUB_OP_LEASE_SET = 5;
 	public static final byte XIXI_UPDATE_REPLY = (byte)128;
 	
 	public static final byte XIXI_TYPE_UPDATE_FLAGS_REQ = 8;
@@ -86,14 +87,21 @@ public class Defines {
 	public static final byte XIXI_CREATE_WATCH_RES = 23;
 	public static final byte XIXI_CHECK_WATCH_REQ = 24;
 	public static final byte XIXI_CHECK_WATCH_RES = 25;
+	public static final byte XIXI_CHECK_FEED_REQ = 29;
+	public static final byte XIXI_CHECK_FEED_RES = 30;
+	public static final byte XIXI_LEASE_GET_REQ = 31;
+	public static final byte XIXI_LEASE_GET_RES = 32;
+	public static final byte XIXI_LEASE_REFRESH_RES = 33;
 	
 	public static final short XIXI_REASON_UNKNOWN_COMMAND = 10;
 
 	public static final short XIXI_REASON_SUCCESS = 0;
+	public static final short XIXI_REASON_PLEASE_TRY_AGAIN = 11;
 	
 	public static final byte WATCH_NOTIFY_TYPE_BASE_INFO_UPDATED = 1;
 	public static final byte WATCH_NOTIFY_TYPE_DATA_UPDATED = 2;
 	public static final byte WATCH_NOTIFY_TYPE_DELETED = 3;
 	public static final byte WATCH_NOTIFY_TYPE_EXPIRED = 4;
 	public static final byte WATCH_NOTIFY_TYPE_FLUSHED = 5;
+	public static final byte WATCH_NOTIFY_TYPE_EVICTED = 6;
 }
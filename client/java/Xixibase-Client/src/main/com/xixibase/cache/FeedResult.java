@@ -0,0 +1,15 @@
+package com.xixibase.cache;
+
+public class FeedResult {
+	public long firstSequence;
+	public long nextSequence;
+	public long[] cacheIDs;
+	public int[] keyHashes;
+	public byte[] types;
+
+	// events between the expected sequence and firstSequence were dropped, the
+	// caller should resynchronize from scratch
+	public boolean hasGap(long expectedSequence) {
+		return expectedSequence != 0 && firstSequence != expectedSequence;
+	}
+}
@@ -0,0 +1,14 @@
+package com.xixibase.cache;
+
+public class LeaseResult {
+	// the value on a hit, null on a miss
+	public CacheItem item;
+	// on a miss the lease to fill the key with leaseSet, on a hit the lease to
+	// refresh a stale value, 0 when another client holds the lease
+	public long leaseToken;
+
+	// another client is filling the key, try again later
+	public boolean isRetry() {
+		return item == null && leaseToken == 0;
+	}
+}
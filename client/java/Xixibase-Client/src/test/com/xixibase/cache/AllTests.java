@@ -28,6 +28,13 @@ public class AllTests {
 		suite.addTestSuite(CacheClientTest.class);
 		suite.addTestSuite(MultiOperationTest.class);
 		suite.addTestSuite(LocalCacheTest.class);
+		suite.addTestSuite(PartitionWatchTest.class);
+		suite.addTestSuite(LeaseTest.class);
+		suite.addTestSuite(QuotaTest.class);
+		suite.addTestSuite(ConcurrentGetTest.class);
+		suite.addTestSuite(ChunkedValueTest.class);
+		suite.addTestSuite(HttpUpdateTest.class);
+		suite.addTestSuite(WatchTest.class);
 
 		return suite;
 	}
@@ -1009,6 +1009,42 @@ public class CacheClientTest extends TestCase {
 		st.runIt(servers, enableSSL, threadCount, keyCount, setCount, getCount);
 	}
 	
+	public void testCheckFeed() {
+		CacheClient cc = mgr1.createClient(11);
+		CacheClientImpl cci = new CacheClientImpl(mgr1, 11);
+		String host = mgr1.getHost("xixi");
+
+		FeedResult fr = cci.checkFeed(host, 0, 100, 0);
+		assertNotNull(fr);
+		assertEquals(0, fr.cacheIDs.length);
+		long sequence = fr.nextSequence;
+
+		cc.set("xixi", "0315");
+		long cacheID = cc.gets("xixi").getCacheID();
+		cc.set("xixi", "20080315");
+		long cacheID2 = cc.gets("xixi").getCacheID();
+		cc.delete("xixi");
+
+		fr = cci.checkFeed(host, sequence, 100, 1);
+		assertNotNull(fr);
+		assertFalse(fr.hasGap(sequence));
+		assertEquals(2, fr.cacheIDs.length);
+		assertEquals(cacheID, fr.cacheIDs[0]);
+		assertEquals(Defines.WATCH_NOTIFY_TYPE_DATA_UPDATED, fr.types[0]);
+		assertEquals(cacheID2, fr.cacheIDs[1]);
+		assertEquals(Defines.WATCH_NOTIFY_TYPE_DELETED, fr.types[1]);
+		assertEquals(sequence + 2, fr.nextSequence);
+
+		sequence = fr.nextSequence;
+		fr = cci.checkFeed(host, sequence, 100, 1);
+		assertNotNull(fr);
+		assertEquals(0, fr.cacheIDs.length);
+
+		fr = cci.checkFeed(host, sequence + 100, 100, 1);
+		assertNotNull(fr);
+		assertTrue(fr.hasGap(sequence + 100));
+	}
+
 	public void testUpdateFlags() {
 		CacheClientManager mgr = CacheClientManager.getInstance("testUpdateFlags");
 		mgr.setSocketWriteBufferSize(64 * 1024);
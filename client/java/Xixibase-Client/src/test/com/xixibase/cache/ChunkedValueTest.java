@@ -0,0 +1,190 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+package com.xixibase.cache;
+
+import java.io.BufferedInputStream;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.net.InetSocketAddress;
+import java.net.Socket;
+import java.util.Arrays;
+import java.util.Map;
+import java.util.Properties;
+import java.util.Random;
+
+import junit.framework.TestCase;
+
+// Values above max-item-size are stored in chunks of the chunk_size the server
+// reports in its stats. Appends share the full chunks of the old version when
+// the server has <max-segments>0</max-segments>, otherwise they link segments.
+// maxItemSize defaults to 10485760.
+public class ChunkedValueTest extends TestCase {
+	static String servers;
+	static boolean enableSSL = false;
+	static int maxItemSize = 10485760;
+	static {
+		servers = System.getProperty("hosts");
+		enableSSL = System.getProperty("enableSSL") != null && System.getProperty("enableSSL").equals("true");
+		if (servers == null) {
+			try {
+				InputStream in = new BufferedInputStream(new FileInputStream("test.properties"));
+				Properties p = new Properties(); 
+				p.load(in);
+				in.close();
+				servers = p.getProperty("hosts");
+				enableSSL = p.getProperty("enableSSL") != null && p.getProperty("enableSSL").equals("true");
+			} catch (IOException e) {
+				e.printStackTrace();
+			} 
+		}
+		if (System.getProperty("maxItemSize") != null) {
+			maxItemSize = Integer.parseInt(System.getProperty("maxItemSize"));
+		}
+	}
+
+	CacheClientManager mgr;
+	CacheClient cc;
+	int chunkSize;
+
+	protected void setUp() throws Exception {
+		super.setUp();
+		mgr = CacheClientManager.getInstance("ChunkedValueTest");
+		if (!mgr.isInitialized()) {
+			mgr.initialize(servers.split(","), enableSSL);
+		}
+		cc = mgr.createClient();
+		// random bytes would not shrink anyway, and append refuses gzipped values
+		ObjectTransCoder coder = new ObjectTransCoder();
+		coder.setCompressionThreshold(0);
+		cc.setTransCoder(coder);
+		cc.flush();
+
+		String[] host = new String[1];
+		host[0] = servers.split(",")[0];
+		Map<String, Map<String, String>> stats = cc.statsGetStats(host, (byte)0);
+		assertNotNull(stats);
+		String size = stats.get(host[0]).get("chunk_size");
+		assertNotNull("chunked values are disabled", size);
+		chunkSize = Integer.parseInt(size);
+	}
+
+	protected void tearDown() throws Exception {
+		super.tearDown();
+		cc.flush();
+	}
+
+	static byte[] makeData(int size, long seed) {
+		byte[] data = new byte[size];
+		new Random(seed).nextBytes(data);
+		return data;
+	}
+
+	static byte[] concat(byte[] a, byte[] b) {
+		byte[] c = new byte[a.length + b.length];
+		System.arraycopy(a, 0, c, 0, a.length);
+		System.arraycopy(b, 0, c, a.length, b.length);
+		return c;
+	}
+
+	public void testLargerThanMaxItemSize() {
+		byte[] value = makeData(maxItemSize + maxItemSize / 2, 1);
+		assertTrue(cc.set("chunked", value) != 0);
+		assertTrue(Arrays.equals(value, (byte[])cc.get("chunked")));
+	}
+
+	void checkAppend(int size) {
+		byte[] value = makeData(size, 2);
+		assertTrue(cc.set("chunked", value) != 0);
+		for (int i = 0; i < 3; i++) {
+			byte[] data = makeData(5000, 3 + i);
+			assertTrue(cc.append("chunked", data) != 0);
+			value = concat(value, data);
+			assertTrue(Arrays.equals(value, (byte[])cc.get("chunked")));
+		}
+	}
+
+	public void testAppendShortLastChunk() {
+		checkAppend(10 * chunkSize + 1000);
+	}
+
+	public void testAppendFullLastChunk() {
+		checkAppend(10 * chunkSize);
+	}
+
+	// the appended data fills the short last chunk and starts a new one
+	public void testAppendAcrossChunks() {
+		checkAppend(11 * chunkSize - 10);
+	}
+
+	// A get whose reply is not read yet still refers to the old version, an
+	// append sharing its chunks must leave those bytes alone.
+	void checkOldVersion(int size) throws IOException {
+		if (enableSSL) {
+			return;
+		}
+		byte[] value = makeData(size, 4);
+		assertTrue(cc.set("old", value) != 0);
+
+		String[] host = servers.split(",")[0].split(":");
+		Socket s = new Socket();
+		try {
+			s.setReceiveBufferSize(4096);
+			s.connect(new InetSocketAddress(host[0], Integer.parseInt(host[1])));
+			DataOutputStream out = new DataOutputStream(s.getOutputStream());
+			byte[] keyBuf = "old".getBytes("UTF-8");
+			out.writeByte(Defines.XIXI_CATEGORY_CACHE);
+			out.writeByte(Defines.XIXI_TYPE_GET_REQ);
+			out.writeInt(0); // groupID
+			out.writeInt(0); // watchID
+			out.writeShort(keyBuf.length);
+			out.write(keyBuf);
+			out.flush();
+			Thread.sleep(500);
+
+			byte[] data = makeData(chunkSize, 5);
+			assertTrue(cc.append("old", data) != 0);
+			byte[] data2 = makeData(300, 6);
+			assertTrue(cc.append("old", data2) != 0);
+			assertTrue(Arrays.equals(concat(concat(value, data), data2), (byte[])cc.get("old")));
+
+			DataInputStream in = new DataInputStream(s.getInputStream());
+			assertEquals(Defines.XIXI_CATEGORY_CACHE, in.readByte());
+			assertEquals(Defines.XIXI_TYPE_GET_RES, in.readByte());
+			in.readLong(); // cacheID
+			in.readInt(); // flags
+			in.readInt(); // expiration
+			assertEquals(value.length, in.readInt());
+			byte[] old = new byte[value.length];
+			in.readFully(old);
+			assertTrue(Arrays.equals(value, old));
+		} catch (InterruptedException e) {
+			fail(e.toString());
+		} finally {
+			s.close();
+		}
+	}
+
+	public void testOldVersionShortLastChunk() throws IOException {
+		checkOldVersion(12 * chunkSize + 500);
+	}
+
+	public void testOldVersionFullLastChunk() throws IOException {
+		checkOldVersion(12 * chunkSize);
+	}
+}
@@ -0,0 +1,233 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+package com.xixibase.cache;
+
+import java.io.BufferedInputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.DataOutputStream;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.net.InetSocketAddress;
+import java.net.Socket;
+import java.util.ArrayList;
+import java.util.Properties;
+
+import junit.framework.TestCase;
+
+// Gets racing sets and deletes of the same keys, these go through the lock-free
+// get path and the retire list. testReferenceCap opens 1100 connections, the
+// client and the server need an open file limit above that.
+public class ConcurrentGetTest extends TestCase {
+	static final int KEY_COUNT = 16;
+	static final int ITEM_REF_MAX = 0x7F00;
+	static final int PIPELINED_GETS = 32; // gets one read batch of the server holds
+
+	static String servers;
+	static boolean enableSSL = false;
+	static {
+		servers = System.getProperty("hosts");
+		enableSSL = System.getProperty("enableSSL") != null && System.getProperty("enableSSL").equals("true");
+		if (servers == null) {
+			try {
+				InputStream in = new BufferedInputStream(new FileInputStream("test.properties"));
+				Properties p = new Properties(); 
+				p.load(in);
+				in.close();
+				servers = p.getProperty("hosts");
+				enableSSL = p.getProperty("enableSSL") != null && p.getProperty("enableSSL").equals("true");
+			} catch (IOException e) {
+				e.printStackTrace();
+			} 
+		}
+	}
+
+	CacheClientManager mgr;
+	CacheClient cc;
+
+	protected void setUp() throws Exception {
+		super.setUp();
+		mgr = CacheClientManager.getInstance("ConcurrentGetTest");
+		if (!mgr.isInitialized()) {
+			mgr.initialize(servers.split(","), enableSSL);
+		}
+		cc = mgr.createClient();
+		// a gzipped value would be small enough to be written out at once
+		ObjectTransCoder coder = new ObjectTransCoder();
+		coder.setCompressionThreshold(0);
+		cc.setTransCoder(coder);
+		cc.flush();
+	}
+
+	protected void tearDown() throws Exception {
+		super.tearDown();
+		cc.flush();
+	}
+
+	// a value is one character repeated, its length tells which character
+	static String makeValue(int version) {
+		char c = (char)('a' + version % 26);
+		int size = 100 + (version % 26) * 1000;
+		StringBuilder sb = new StringBuilder(size);
+		for (int i = 0; i < size; i++) {
+			sb.append(c);
+		}
+		return sb.toString();
+	}
+
+	static boolean isValidValue(String value) {
+		int version = value.charAt(0) - 'a';
+		return value.equals(makeValue(version));
+	}
+
+	class Reader extends Thread {
+		volatile String error = null;
+		volatile int hits = 0;
+		volatile boolean stop = false;
+		public void run() {
+			CacheClient c = mgr.createClient();
+			int i = 0;
+			while (!stop) {
+				Object value = c.get("key" + (i++ % KEY_COUNT));
+				if (value != null) {
+					if (!(value instanceof String) || !isValidValue((String)value)) {
+						error = "torn value " + value;
+						return;
+					}
+					hits++;
+				}
+			}
+		}
+	}
+
+	class Writer extends Thread {
+		volatile String error = null;
+		int loops;
+		boolean delete;
+		Writer(int loops, boolean delete) {
+			this.loops = loops;
+			this.delete = delete;
+		}
+		public void run() {
+			CacheClient c = mgr.createClient();
+			for (int i = 0; i < loops; i++) {
+				String key = "key" + (i % KEY_COUNT);
+				if (delete && i % 3 == 0) {
+					c.delete(key);
+				} else if (c.set(key, makeValue(i)) == 0) {
+					error = "set " + key + " " + c.getLastError();
+					return;
+				}
+			}
+		}
+	}
+
+	public void testGetWithSetAndDelete() throws InterruptedException {
+		ArrayList<Reader> readers = new ArrayList<Reader>();
+		for (int i = 0; i < 4; i++) {
+			Reader r = new Reader();
+			readers.add(r);
+			r.start();
+		}
+		Writer setter = new Writer(20000, false);
+		Writer deleter = new Writer(20000, true);
+		setter.start();
+		deleter.start();
+		setter.join();
+		deleter.join();
+		int hits = 0;
+		for (int i = 0; i < readers.size(); i++) {
+			Reader r = readers.get(i);
+			r.stop = true;
+			r.join();
+			assertNull(r.error, r.error);
+			hits += r.hits;
+		}
+		assertNull(setter.error, setter.error);
+		assertNull(deleter.error, deleter.error);
+		assertTrue(hits > 0);
+
+		for (int i = 0; i < KEY_COUNT; i++) {
+			String key = "key" + i;
+			assertTrue(cc.set(key, makeValue(i)) != 0);
+			assertEquals(makeValue(i), cc.get(key));
+		}
+	}
+
+	static byte[] makeGets(String key, int count) throws IOException {
+		byte[] keyBuf = key.getBytes("UTF-8");
+		ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+		DataOutputStream out = new DataOutputStream(bytes);
+		for (int i = 0; i < count; i++) {
+			out.writeByte(Defines.XIXI_CATEGORY_CACHE);
+			out.writeByte(Defines.XIXI_TYPE_GET_REQ);
+			out.writeInt(0); // groupID
+			out.writeInt(0); // watchID
+			out.writeShort(keyBuf.length);
+			out.write(keyBuf);
+		}
+		out.flush();
+		return bytes.toByteArray();
+	}
+
+	// Connections that never read their replies keep the item referenced, past
+	// ITEM_REF_MAX a get asks to try again while set and delete still work.
+	public void testReferenceCap() throws IOException, InterruptedException {
+		if (enableSSL) {
+			return;
+		}
+		String value = makeValue(0);
+		while (value.length() < 256 * 1024) {
+			value = value + value;
+		}
+		assertTrue(cc.set("held", value) != 0);
+		assertTrue(cc.set("free", "free") != 0);
+
+		String[] host = servers.split(",")[0].split(":");
+		byte[] gets = makeGets("held", PIPELINED_GETS);
+		int connections = ITEM_REF_MAX / PIPELINED_GETS + 100;
+		ArrayList<Socket> sockets = new ArrayList<Socket>();
+		try {
+			for (int i = 0; i < connections; i++) {
+				Socket s = new Socket();
+				s.setReceiveBufferSize(4096);
+				s.connect(new InetSocketAddress(host[0], Integer.parseInt(host[1])));
+				s.getOutputStream().write(gets);
+				s.getOutputStream().flush();
+				sockets.add(s);
+			}
+			Thread.sleep(1000);
+
+			assertNull(cc.get("held"));
+			assertTrue(cc.getLastError().endsWith("reason=" + Defines.XIXI_REASON_PLEASE_TRY_AGAIN));
+			assertEquals("free", cc.get("free"));
+
+			assertTrue(cc.set("held", "new") != 0);
+			assertEquals("new", cc.get("held"));
+			assertTrue(cc.delete("held"));
+			assertNull(cc.get("held"));
+		} finally {
+			for (int i = 0; i < sockets.size(); i++) {
+				sockets.get(i).close();
+			}
+		}
+		Thread.sleep(1000);
+
+		// the replaced item left with its last reference
+		assertTrue(cc.set("held", value) != 0);
+		assertEquals(value, cc.get("held"));
+	}
+}
@@ -0,0 +1,261 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+package com.xixibase.cache;
+
+import java.io.BufferedInputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.DataInputStream;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.OutputStream;
+import java.net.InetSocketAddress;
+import java.net.Socket;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.Properties;
+import java.util.Random;
+
+import junit.framework.TestCase;
+
+// HTTP updates whose body arrives over several reads: a streamed PUT larger
+// than the read buffer, and multipart forms whose delimiters are split
+// between writes or lie across the 4096 byte head the server reads first.
+// managerBaseUrl defaults to /manager/.
+public class HttpUpdateTest extends TestCase {
+	static final int FORM_HEAD_SIZE = 4096;
+	static final String BOUNDARY = "xXxBoundaryxXx";
+
+	static String servers;
+	static boolean enableSSL = false;
+	static String managerBaseUrl = "/manager/";
+	static {
+		servers = System.getProperty("hosts");
+		enableSSL = System.getProperty("enableSSL") != null && System.getProperty("enableSSL").equals("true");
+		if (servers == null) {
+			try {
+				InputStream in = new BufferedInputStream(new FileInputStream("test.properties"));
+				Properties p = new Properties(); 
+				p.load(in);
+				in.close();
+				servers = p.getProperty("hosts");
+				enableSSL = p.getProperty("enableSSL") != null && p.getProperty("enableSSL").equals("true");
+			} catch (IOException e) {
+				e.printStackTrace();
+			} 
+		}
+		if (System.getProperty("managerBaseUrl") != null) {
+			managerBaseUrl = System.getProperty("managerBaseUrl");
+		}
+	}
+
+	CacheClientManager mgr;
+	CacheClient cc;
+
+	protected void setUp() throws Exception {
+		super.setUp();
+		mgr = CacheClientManager.getInstance("HttpUpdateTest");
+		if (!mgr.isInitialized()) {
+			mgr.initialize(servers.split(","), enableSSL);
+		}
+		cc = mgr.createClient();
+		cc.flush();
+	}
+
+	protected void tearDown() throws Exception {
+		super.tearDown();
+		cc.flush();
+	}
+
+	static class Response {
+		int status;
+		String contentType;
+		byte[] body;
+	}
+
+	static byte[] makeData(int size, long seed) {
+		byte[] data = new byte[size];
+		new Random(seed).nextBytes(data);
+		return data;
+	}
+
+	static byte[] slice(byte[] data, int from, int to) {
+		byte[] b = new byte[to - from];
+		System.arraycopy(data, from, b, 0, b.length);
+		return b;
+	}
+
+	static String readLine(InputStream in) throws IOException {
+		StringBuilder sb = new StringBuilder();
+		int c;
+		while ((c = in.read()) != -1 && c != '\n') {
+			if (c != '\r') {
+				sb.append((char)c);
+			}
+		}
+		return sb.toString();
+	}
+
+	// writes the parts with a pause in between, so each one arrives in its own read
+	static Response request(ArrayList<byte[]> parts) throws IOException, InterruptedException {
+		String[] host = servers.split(",")[0].split(":");
+		Socket s = new Socket();
+		try {
+			s.setTcpNoDelay(true);
+			s.connect(new InetSocketAddress(host[0], Integer.parseInt(host[1])));
+			OutputStream out = s.getOutputStream();
+			for (int i = 0; i < parts.size(); i++) {
+				if (i > 0) {
+					Thread.sleep(100);
+				}
+				out.write(parts.get(i));
+				out.flush();
+			}
+
+			DataInputStream in = new DataInputStream(new BufferedInputStream(s.getInputStream()));
+			Response r = new Response();
+			r.status = Integer.parseInt(readLine(in).split(" ")[1]);
+			int contentLength = 0;
+			String line;
+			while ((line = readLine(in)).length() > 0) {
+				int colon = line.indexOf(':');
+				String name = line.substring(0, colon).trim();
+				String value = line.substring(colon + 1).trim();
+				if (name.equalsIgnoreCase("Content-Length")) {
+					contentLength = Integer.parseInt(value);
+				} else if (name.equalsIgnoreCase("Content-Type")) {
+					r.contentType = value;
+				}
+			}
+			r.body = new byte[contentLength];
+			in.readFully(r.body);
+			return r;
+		} finally {
+			s.close();
+		}
+	}
+
+	static Response get(String key) throws IOException, InterruptedException {
+		ArrayList<byte[]> parts = new ArrayList<byte[]>();
+		parts.add(("GET " + managerBaseUrl + "get?k=" + key + " HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n").getBytes("UTF-8"));
+		return request(parts);
+	}
+
+	public void testStreamedPut() throws IOException, InterruptedException {
+		if (enableSSL) {
+			return;
+		}
+		byte[] value = makeData(1024 * 1024 + 7, 1);
+		ArrayList<byte[]> parts = new ArrayList<byte[]>();
+		parts.add(("PUT " + managerBaseUrl + "set?k=put HTTP/1.1\r\nHost: test\r\n"
+			+ "Content-Type: application/octet-stream\r\nContent-Length: " + value.length
+			+ "\r\nConnection: close\r\n\r\n").getBytes("UTF-8"));
+		for (int i = 0; i < value.length; i += 65536) {
+			parts.add(slice(value, i, Math.min(i + 65536, value.length)));
+		}
+		assertEquals(200, request(parts).status);
+
+		Response r = get("put");
+		assertEquals(200, r.status);
+		assertEquals("application/octet-stream", r.contentType);
+		assertTrue(Arrays.equals(value, r.body));
+	}
+
+	static void addPart(ByteArrayOutputStream body, String name, String contentType, byte[] value) throws IOException {
+		body.write(("--" + BOUNDARY + "\r\nContent-Disposition: form-data; name=\"" + name + "\"\r\n").getBytes("UTF-8"));
+		if (contentType != null) {
+			body.write(("Content-Type: " + contentType + "\r\n").getBytes("UTF-8"));
+		}
+		body.write("\r\n".getBytes("UTF-8"));
+		body.write(value);
+		body.write("\r\n".getBytes("UTF-8"));
+	}
+
+	static int indexOf(byte[] data, byte[] pattern, int from) {
+		for (int i = from; i <= data.length - pattern.length; i++) {
+			int j = 0;
+			while (j < pattern.length && data[i + j] == pattern[j]) {
+				j++;
+			}
+			if (j == pattern.length) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// The form holds k, a padding field x and then v. The body is written in
+	// two parts split inside the delimiter in front of v (or its closing
+	// delimiter), padding moves that delimiter relative to the 4096 byte head.
+	void checkForm(String key, int padding, boolean splitClosing) throws IOException, InterruptedException {
+		if (enableSSL) {
+			return;
+		}
+		byte[] value = makeData(100000, key.hashCode());
+		ByteArrayOutputStream form = new ByteArrayOutputStream();
+		addPart(form, "k", null, key.getBytes("UTF-8"));
+		byte[] pad = new byte[padding];
+		Arrays.fill(pad, (byte)'p');
+		addPart(form, "x", null, pad);
+		int valueDelimiter = form.size() - 2;
+		addPart(form, "v", "image/png", value);
+		int closingDelimiter = form.size() - 2;
+		form.write(("--" + BOUNDARY + "--\r\n").getBytes("UTF-8"));
+		byte[] body = form.toByteArray();
+		assertEquals(valueDelimiter, indexOf(body, ("\r\n--" + BOUNDARY + "\r\nContent-Disposition: form-data; name=\"v\"").getBytes("UTF-8"), 0));
+
+		int split = (splitClosing ? closingDelimiter : valueDelimiter) + 5;
+		ArrayList<byte[]> parts = new ArrayList<byte[]>();
+		parts.add(("POST " + managerBaseUrl + "set HTTP/1.1\r\nHost: test\r\n"
+			+ "Content-Type: multipart/form-data; boundary=" + BOUNDARY
+			+ "\r\nContent-Length: " + body.length + "\r\nConnection: close\r\n\r\n").getBytes("UTF-8"));
+		parts.add(slice(body, 0, split));
+		parts.add(slice(body, split, body.length));
+		assertEquals(200, request(parts).status);
+
+		Response r = get(key);
+		assertEquals(200, r.status);
+		assertEquals("image/png", r.contentType);
+		assertTrue(Arrays.equals(value, r.body));
+	}
+
+	// the size of the k and x parts without the padding
+	static int formPrefix(String key) throws IOException {
+		ByteArrayOutputStream form = new ByteArrayOutputStream();
+		addPart(form, "k", null, key.getBytes("UTF-8"));
+		addPart(form, "x", null, new byte[0]);
+		return form.size() - 2;
+	}
+
+	// the value starts in the head and is read straight into the item
+	public void testFormValueDelimiterSplit() throws IOException, InterruptedException {
+		checkForm("form_open", 100, false);
+	}
+
+	public void testFormClosingDelimiterSplit() throws IOException, InterruptedException {
+		checkForm("form_close", 100, true);
+	}
+
+	// the delimiter in front of v crosses the end of the head
+	public void testFormDelimiterAcrossHead() throws IOException, InterruptedException {
+		checkForm("form_head", FORM_HEAD_SIZE - formPrefix("form_head") - 10, false);
+	}
+
+	// the part headers of v cross the end of the head
+	public void testFormPartHeadersAcrossHead() throws IOException, InterruptedException {
+		checkForm("form_part", FORM_HEAD_SIZE - formPrefix("form_part") - 40, false);
+	}
+}
@@ -0,0 +1,137 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+package com.xixibase.cache;
+
+import java.io.BufferedInputStream;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.util.Properties;
+
+import junit.framework.TestCase;
+
+public class LeaseTest extends TestCase {
+	static final int GROUP_ID = 316;
+
+	static String servers;
+	static boolean enableSSL = false;
+	static int leaseTimeout = 10; // <lease-timeout> of the server
+	static {
+		servers = System.getProperty("hosts");
+		enableSSL = System.getProperty("enableSSL") != null && System.getProperty("enableSSL").equals("true");
+		if (servers == null) {
+			try {
+				InputStream in = new BufferedInputStream(new FileInputStream("test.properties"));
+				Properties p = new Properties(); 
+				p.load(in);
+				in.close();
+				servers = p.getProperty("hosts");
+				enableSSL = p.getProperty("enableSSL") != null && p.getProperty("enableSSL").equals("true");
+			} catch (IOException e) {
+				e.printStackTrace();
+			} 
+		}
+		if (System.getProperty("leaseTimeout") != null) {
+			leaseTimeout = Integer.parseInt(System.getProperty("leaseTimeout"));
+		}
+	}
+
+	CacheClientManager mgr;
+	CacheClient cc;
+	CacheClientImpl cci1;
+	CacheClientImpl cci2;
+
+	protected void setUp() throws Exception {
+		super.setUp();
+		mgr = CacheClientManager.getInstance("LeaseTest");
+		if (!mgr.isInitialized()) {
+			mgr.initialize(servers.split(","), enableSSL);
+		}
+		cc = mgr.createClient(GROUP_ID);
+		cci1 = new CacheClientImpl(mgr, GROUP_ID);
+		cci2 = new CacheClientImpl(mgr, GROUP_ID);
+	}
+
+	protected void tearDown() throws Exception {
+		super.tearDown();
+		cc.flush();
+	}
+
+	public void testGrant() {
+		cc.delete("lease1");
+		LeaseResult lr = cci1.leaseGet("lease1");
+		assertNotNull(lr);
+		assertNull(lr.item);
+		assertTrue(lr.leaseToken != 0);
+
+		assertTrue(cci1.leaseSet("lease1", "value1", 0, lr.leaseToken) != 0);
+		assertEquals("value1", cc.get("lease1"));
+
+		lr = cci2.leaseGet("lease1");
+		assertNotNull(lr);
+		assertNotNull(lr.item);
+		assertEquals("value1", lr.item.getValue());
+		assertFalse(lr.isRetry());
+	}
+
+	public void testContention() {
+		cc.delete("lease2");
+		LeaseResult lr1 = cci1.leaseGet("lease2");
+		assertNotNull(lr1);
+		assertTrue(lr1.leaseToken != 0);
+
+		// the second misser waits while the first one fills the key
+		LeaseResult lr2 = cci2.leaseGet("lease2");
+		assertNotNull(lr2);
+		assertTrue(lr2.isRetry());
+		assertEquals(0, cci2.leaseSet("lease2", "value2", 0, lr1.leaseToken + 1));
+		assertNull(cc.get("lease2"));
+
+		assertTrue(cci1.leaseSet("lease2", "value1", 0, lr1.leaseToken) != 0);
+		lr2 = cci2.leaseGet("lease2");
+		assertNotNull(lr2);
+		assertEquals("value1", lr2.item.getValue());
+
+		// a plain set of the key drops the lease
+		cc.delete("lease2");
+		lr1 = cci1.leaseGet("lease2");
+		assertTrue(lr1.leaseToken != 0);
+		assertTrue(cc.set("lease2", "value3") != 0);
+		assertEquals(0, cci1.leaseSet("lease2", "value1", 0, lr1.leaseToken));
+		assertEquals("value3", cc.get("lease2"));
+	}
+
+	public void testExpiry() throws InterruptedException {
+		cc.delete("lease3");
+		LeaseResult lr1 = cci1.leaseGet("lease3");
+		assertNotNull(lr1);
+		assertTrue(lr1.leaseToken != 0);
+		assertTrue(cci2.leaseGet("lease3").isRetry());
+
+		Thread.sleep((leaseTimeout + 2) * 1000);
+
+		// the abandoned lease expired, the next misser gets a new one
+		LeaseResult lr2 = cci2.leaseGet("lease3");
+		assertNotNull(lr2);
+		assertNull(lr2.item);
+		assertTrue(lr2.leaseToken != 0);
+		assertTrue(lr2.leaseToken != lr1.leaseToken);
+		assertEquals(0, cci1.leaseSet("lease3", "value1", 0, lr1.leaseToken));
+		assertTrue(cci2.leaseSet("lease3", "value2", 0, lr2.leaseToken) != 0);
+		assertEquals("value2", cc.get("lease3"));
+	}
+}
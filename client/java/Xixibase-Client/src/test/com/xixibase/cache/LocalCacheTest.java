@@ -715,4 +715,30 @@ public class LocalCacheTest extends TestCase {
 
 		mgr.shutdown();
 	}
+
+	public void testDeltaUpdate() throws InterruptedException {
+		CacheClientManager mgr = CacheClientManager.getInstance("testDeltaUpdate");
+		String[] serverlist = servers.split(",");
+		mgr.initialize(serverlist, enableSSL);
+		mgr.enableLocalCache();
+		Thread.sleep(50);
+		LocalCache lc = mgr.getLocalCache();
+		CacheClient cc = mgr.createClient();
+		cc.flush();
+
+		cc.set("xixi", "1");
+		assertEquals(2, cc.incr("xixi").value);
+		// the counter is changed in place from here on
+		assertEquals("2", cc.getW("xixi"));
+		assertNotNull(lc.get(cc.getGroupID(), "xixi"));
+		assertEquals(3, cc.incr("xixi").value);
+		for (int n = 0; n < 100 && lc.get(cc.getGroupID(), "xixi") != null; n++) {
+			Thread.sleep(20);
+		}
+		assertNull(lc.get(cc.getGroupID(), "xixi"));
+		assertEquals("3", cc.getW("xixi"));
+
+		cc.flush();
+		mgr.shutdown();
+	}
 }
@@ -0,0 +1,181 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+package com.xixibase.cache;
+
+import java.io.BufferedInputStream;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.util.Properties;
+
+import junit.framework.TestCase;
+
+// Runs against the server in partitionedHosts, started with
+// <execution-mode>partitioned</execution-mode> and a thread-number of
+// partitions, or against hosts when partitionedHosts is not set.
+public class PartitionWatchTest extends TestCase {
+	static final int KEY_COUNT = 256;
+
+	static String servers;
+	static boolean enableSSL = false;
+	static int partitions = 4;
+	static {
+		Properties p = new Properties();
+		try {
+			InputStream in = new BufferedInputStream(new FileInputStream("test.properties"));
+			p.load(in);
+			in.close();
+		} catch (IOException e) {
+			e.printStackTrace();
+		}
+		servers = System.getProperty("partitionedHosts", p.getProperty("partitionedHosts"));
+		if (servers == null) {
+			servers = System.getProperty("hosts", p.getProperty("hosts"));
+		}
+		String ssl = System.getProperty("enableSSL", p.getProperty("enableSSL"));
+		enableSSL = ssl != null && ssl.equals("true");
+		partitions = Integer.parseInt(System.getProperty("partitions", p.getProperty("partitions", "4")));
+	}
+
+	// the partition of a key, as hash32 % partitions in Cache_Router::get_owner
+	static int getPartition(String key, int groupID) {
+		byte[] k = key.getBytes();
+		int length = k.length;
+		int a, b, c;
+		a = b = c = 0xdeadbeef + length + groupID;
+		int off = 0;
+		while (length > 12) {
+			a += (k[off] & 0xff) + ((k[off + 1] & 0xff) << 8) + ((k[off + 2] & 0xff) << 16) + ((k[off + 3] & 0xff) << 24);
+			b += (k[off + 4] & 0xff) + ((k[off + 5] & 0xff) << 8) + ((k[off + 6] & 0xff) << 16) + ((k[off + 7] & 0xff) << 24);
+			c += (k[off + 8] & 0xff) + ((k[off + 9] & 0xff) << 8) + ((k[off + 10] & 0xff) << 16) + ((k[off + 11] & 0xff) << 24);
+			a -= c; a ^= Integer.rotateLeft(c, 4); c += b;
+			b -= a; b ^= Integer.rotateLeft(a, 6); a += c;
+			c -= b; c ^= Integer.rotateLeft(b, 8); b += a;
+			a -= c; a ^= Integer.rotateLeft(c, 16); c += b;
+			b -= a; b ^= Integer.rotateLeft(a, 19); a += c;
+			c -= b; c ^= Integer.rotateLeft(b, 4); b += a;
+			length -= 12;
+			off += 12;
+		}
+		if (length > 0) {
+			switch (length) {
+			case 12: c += (k[off + 11] & 0xff) << 24;
+			case 11: c += (k[off + 10] & 0xff) << 16;
+			case 10: c += (k[off + 9] & 0xff) << 8;
+			case 9: c += k[off + 8] & 0xff;
+			case 8: b += (k[off + 7] & 0xff) << 24;
+			case 7: b += (k[off + 6] & 0xff) << 16;
+			case 6: b += (k[off + 5] & 0xff) << 8;
+			case 5: b += k[off + 4] & 0xff;
+			case 4: a += (k[off + 3] & 0xff) << 24;
+			case 3: a += (k[off + 2] & 0xff) << 16;
+			case 2: a += (k[off + 1] & 0xff) << 8;
+			case 1: a += k[off] & 0xff;
+			}
+			c ^= b; c -= Integer.rotateLeft(b, 14);
+			a ^= c; a -= Integer.rotateLeft(c, 11);
+			b ^= a; b -= Integer.rotateLeft(a, 25);
+			c ^= b; c -= Integer.rotateLeft(b, 16);
+			a ^= c; a -= Integer.rotateLeft(c, 4);
+			b ^= a; b -= Integer.rotateLeft(a, 14);
+			c ^= b; c -= Integer.rotateLeft(b, 24);
+		}
+		return (int)((c & 0xffffffffL) % partitions);
+	}
+
+	public void testWatchAllPartitions() throws InterruptedException {
+		CacheClientManager mgr = CacheClientManager.getInstance("PartitionWatchTest");
+		String[] serverlist = servers.split(",");
+		mgr.initialize(serverlist, enableSSL);
+		mgr.enableLocalCache();
+		Thread.sleep(50);
+		LocalCache lc = mgr.getLocalCache();
+		CacheClient cc = mgr.createClient();
+		cc.flush();
+
+		for (int i = 0; i < KEY_COUNT; i++) {
+			assertTrue(cc.setW("pw" + i, "value" + i) != 0);
+		}
+		for (int i = 0; i < KEY_COUNT; i++) {
+			assertEquals("value" + i, cc.getW("pw" + i));
+			assertNotNull(lc.get(cc.getGroupID(), "pw" + i));
+		}
+
+		for (int i = 0; i < KEY_COUNT; i++) {
+			assertTrue(cc.set("pw" + i, "update" + i) != 0);
+		}
+		int watched = KEY_COUNT;
+		for (int n = 0; n < 100 && watched > 0; n++) {
+			Thread.sleep(20);
+			watched = 0;
+			for (int i = 0; i < KEY_COUNT; i++) {
+				if (lc.get(cc.getGroupID(), "pw" + i) != null) {
+					watched++;
+				}
+			}
+		}
+		assertEquals(0, watched);
+		for (int i = 0; i < KEY_COUNT; i++) {
+			assertEquals("update" + i, cc.getW("pw" + i));
+		}
+
+		cc.flush();
+		mgr.shutdown();
+	}
+
+	// With a cache id counter per partition the two keys could share an id, an
+	// update of one would then drop the other from the local cache.
+	public void testKeysOnTwoPartitions() throws InterruptedException {
+		CacheClientManager mgr = CacheClientManager.getInstance("PartitionWatchTest2");
+		String[] serverlist = servers.split(",");
+		mgr.initialize(serverlist, enableSSL);
+		mgr.enableLocalCache();
+		Thread.sleep(50);
+		LocalCache lc = mgr.getLocalCache();
+		CacheClient cc = mgr.createClient();
+		cc.flush();
+
+		String key1 = "pw0";
+		String key2 = null;
+		for (int i = 1; i < KEY_COUNT && key2 == null; i++) {
+			if (getPartition("pw" + i, cc.getGroupID()) != getPartition(key1, cc.getGroupID())) {
+				key2 = "pw" + i;
+			}
+		}
+		assertNotNull(key2);
+
+		long cacheID1 = cc.setW(key1, "value1");
+		long cacheID2 = cc.setW(key2, "value2");
+		assertTrue(cacheID1 != 0);
+		assertTrue(cacheID2 != 0);
+		assertTrue(cacheID1 != cacheID2);
+		assertEquals("value1", cc.getW(key1));
+		assertEquals("value2", cc.getW(key2));
+
+		assertTrue(cc.set(key1, "update1") != 0);
+		for (int n = 0; n < 100 && lc.get(cc.getGroupID(), key1) != null; n++) {
+			Thread.sleep(20);
+		}
+		assertNull(lc.get(cc.getGroupID(), key1));
+		assertNotNull(lc.get(cc.getGroupID(), key2));
+		assertEquals("value2", cc.getW(key2));
+		assertEquals("update1", cc.getW(key1));
+
+		cc.flush();
+		mgr.shutdown();
+	}
+}
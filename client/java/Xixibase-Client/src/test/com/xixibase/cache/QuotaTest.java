@@ -0,0 +1,132 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+package com.xixibase.cache;
+
+import java.io.BufferedInputStream;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.util.Properties;
+
+import junit.framework.TestCase;
+
+// Needs <group-quota group-id="317">groupQuota</group-quota> on a server in
+// shared execution-mode, groupQuota defaults to 1048576.
+public class QuotaTest extends TestCase {
+	static final int GROUP_ID = 317;
+
+	static String servers;
+	static boolean enableSSL = false;
+	static int groupQuota = 1048576;
+	static {
+		servers = System.getProperty("hosts");
+		enableSSL = System.getProperty("enableSSL") != null && System.getProperty("enableSSL").equals("true");
+		if (servers == null) {
+			try {
+				InputStream in = new BufferedInputStream(new FileInputStream("test.properties"));
+				Properties p = new Properties(); 
+				p.load(in);
+				in.close();
+				servers = p.getProperty("hosts");
+				enableSSL = p.getProperty("enableSSL") != null && p.getProperty("enableSSL").equals("true");
+			} catch (IOException e) {
+				e.printStackTrace();
+			} 
+		}
+		if (System.getProperty("groupQuota") != null) {
+			groupQuota = Integer.parseInt(System.getProperty("groupQuota"));
+		}
+	}
+
+	CacheClientManager mgr;
+	CacheClient cc;
+
+	protected void setUp() throws Exception {
+		super.setUp();
+		mgr = CacheClientManager.getInstance("QuotaTest");
+		if (!mgr.isInitialized()) {
+			mgr.initialize(servers.split(","), enableSSL);
+		}
+		cc = mgr.createClient(GROUP_ID);
+		// the values below would be gzipped, and a gzipped value is neither
+		// appended to nor as large as it looks
+		ObjectTransCoder coder = new ObjectTransCoder();
+		coder.setCompressionThreshold(0);
+		cc.setTransCoder(coder);
+		cc.flush();
+	}
+
+	protected void tearDown() throws Exception {
+		super.tearDown();
+		cc.flush();
+	}
+
+	static String makeValue(char c, int size) {
+		StringBuilder sb = new StringBuilder(size);
+		for (int i = 0; i < size; i++) {
+			sb.append(c);
+		}
+		return sb.toString();
+	}
+
+	// Only the added bytes count against the quota, the old version leaves the
+	// group when the new one is linked. Nothing is evicted and nothing rejected.
+	void checkGrow(boolean append) {
+		String other = makeValue('o', groupQuota * 3 / 10);
+		String big = makeValue('b', groupQuota * 6 / 10);
+		String small = makeValue('s', 1024);
+		assertTrue(cc.set("other", other) != 0);
+		assertTrue(cc.set("big", big) != 0);
+
+		String expected = big;
+		for (int i = 0; i < 8; i++) {
+			if (append) {
+				assertTrue(cc.append("big", small) != 0);
+				expected = expected + small;
+			} else {
+				assertTrue(cc.prepend("big", small) != 0);
+				expected = small + expected;
+			}
+			assertEquals(other, cc.get("other"));
+		}
+		assertEquals(expected, cc.get("big"));
+	}
+
+	public void testAppend() {
+		checkGrow(true);
+	}
+
+	public void testPrepend() {
+		checkGrow(false);
+	}
+
+	// the replaced value is not counted twice either
+	public void testReplace() {
+		String other = makeValue('o', groupQuota * 3 / 10);
+		String big = makeValue('b', groupQuota * 6 / 10);
+		assertTrue(cc.set("other", other) != 0);
+		assertTrue(cc.set("big", big) != 0);
+		String big2 = makeValue('c', groupQuota * 6 / 10);
+		assertTrue(cc.set("big", big2) != 0);
+		assertEquals(other, cc.get("other"));
+		assertEquals(big2, cc.get("big"));
+	}
+
+	public void testOverQuota() {
+		assertEquals(0, cc.set("huge", makeValue('h', groupQuota + 1)));
+		assertNull(cc.get("huge"));
+	}
+}
@@ -0,0 +1,189 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+package com.xixibase.cache;
+
+import java.io.BufferedInputStream;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.net.InetSocketAddress;
+import java.net.Socket;
+import java.util.HashMap;
+import java.util.Map;
+import java.util.Properties;
+
+import junit.framework.TestCase;
+
+// Watches live in reusable slots, a watch id is the slot index in its low 20
+// bits and the slot generation above. Expiry goes through a 1024 second wheel.
+public class WatchTest extends TestCase {
+	static final int WATCH_INDEX_MASK = 0xFFFFF;
+	static final int WATCH_WHEEL_SIZE = 1024;
+
+	static String servers;
+	static boolean enableSSL = false;
+	static {
+		servers = System.getProperty("hosts");
+		enableSSL = System.getProperty("enableSSL") != null && System.getProperty("enableSSL").equals("true");
+		if (servers == null) {
+			try {
+				InputStream in = new BufferedInputStream(new FileInputStream("test.properties"));
+				Properties p = new Properties(); 
+				p.load(in);
+				in.close();
+				servers = p.getProperty("hosts");
+				enableSSL = p.getProperty("enableSSL") != null && p.getProperty("enableSSL").equals("true");
+			} catch (IOException e) {
+				e.printStackTrace();
+			} 
+		}
+	}
+
+	CacheClientManager mgr;
+	CacheClient cc;
+	CacheClientImpl cci;
+	String host;
+
+	protected void setUp() throws Exception {
+		super.setUp();
+		mgr = CacheClientManager.getInstance("WatchTest");
+		if (!mgr.isInitialized()) {
+			mgr.initialize(servers.split(","), enableSSL);
+		}
+		cc = mgr.createClient();
+		cci = new CacheClientImpl(mgr, 0);
+		// the server holding "watched", watches are kept per server
+		host = mgr.getHost("watched");
+		cc.flush();
+	}
+
+	protected void tearDown() throws Exception {
+		super.tearDown();
+		cc.flush();
+	}
+
+	long getStat(String name) {
+		String[] hosts = new String[1];
+		hosts[0] = host;
+		Map<String, Map<String, String>> stats = cc.statsGetStats(hosts, (byte)0);
+		assertNotNull(stats);
+		String v = stats.get(host).get(name);
+		return v != null ? Long.parseLong(v) : 0;
+	}
+
+	// a get on host that adds watchID to the item, returns its cacheID
+	long getWithWatch(String key, int watchID) throws IOException {
+		String[] h = host.split(":");
+		Socket s = new Socket();
+		try {
+			s.connect(new InetSocketAddress(h[0], Integer.parseInt(h[1])));
+			DataOutputStream out = new DataOutputStream(s.getOutputStream());
+			byte[] keyBuf = key.getBytes("UTF-8");
+			out.writeByte(Defines.XIXI_CATEGORY_CACHE);
+			out.writeByte(Defines.XIXI_TYPE_GET_REQ);
+			out.writeInt(0); // groupID
+			out.writeInt(watchID);
+			out.writeShort(keyBuf.length);
+			out.write(keyBuf);
+			out.flush();
+
+			DataInputStream in = new DataInputStream(s.getInputStream());
+			assertEquals(Defines.XIXI_CATEGORY_CACHE, in.readByte());
+			assertEquals(Defines.XIXI_TYPE_GET_RES, in.readByte());
+			long cacheID = in.readLong();
+			in.readInt(); // flags
+			in.readInt(); // expiration
+			in.readFully(new byte[in.readInt()]);
+			return cacheID;
+		} finally {
+			s.close();
+		}
+	}
+
+	// A watch not checked within its interval is gone, one expiring after a full
+	// round of the wheel is passed over when its bucket comes up early.
+	public void testExpire() throws InterruptedException {
+		int shortWatch = cci.createWatch(host, 2);
+		int lapWatch = cci.createWatch(host, WATCH_WHEEL_SIZE + 6);
+		assertTrue(shortWatch != 0);
+		assertTrue(lapWatch != 0);
+		assertNotNull(cci.checkWatch(host, shortWatch, 0, 2, 0));
+		Thread.sleep(9000);
+		assertNull(cci.checkWatch(host, shortWatch, 0, 2, 0));
+		assertNotNull(cci.checkWatch(host, lapWatch, 0, 1, 0));
+	}
+
+	// Expired slots are handed out again with a new generation, the old ids
+	// stay invalid and no slots are added while free ones are left.
+	public void testSlotReuse() throws InterruptedException {
+		int[] old = new int[300];
+		for (int i = 0; i < old.length; i++) {
+			old[i] = cci.createWatch(host, 1);
+			assertTrue(old[i] != 0);
+		}
+		long slots = getStat("watch_slots");
+		Thread.sleep(3000);
+
+		// slot 0 is never used
+		long free = slots - 1 - getStat("curr_watches");
+		assertTrue(free >= old.length);
+		HashMap<Integer, Integer> oldByIndex = new HashMap<Integer, Integer>();
+		for (int i = 0; i < old.length; i++) {
+			oldByIndex.put(old[i] & WATCH_INDEX_MASK, old[i]);
+		}
+		int reused = 0;
+		for (long i = 0; i < free; i++) {
+			int watchID = cci.createWatch(host, 100);
+			assertTrue(watchID != 0);
+			Integer oldID = oldByIndex.get(watchID & WATCH_INDEX_MASK);
+			if (oldID != null) {
+				assertTrue(oldID.intValue() != watchID);
+				reused++;
+			}
+		}
+		assertEquals(old.length, reused);
+		assertEquals(slots, getStat("watch_slots"));
+		for (int i = 0; i < old.length; i++) {
+			assertNull(cci.checkWatch(host, old[i], 0, 100, 0));
+		}
+	}
+
+	// more watches than an item keeps inline, one of them expired before the update
+	public void testManyWatchesOnItem() throws IOException, InterruptedException {
+		assertTrue(cc.set("watched", "v1") != 0);
+		int[] watches = new int[6];
+		long cacheID = 0;
+		for (int i = 0; i < watches.length; i++) {
+			watches[i] = cci.createWatch(host, 100);
+			cacheID = getWithWatch("watched", watches[i]);
+		}
+		int shortWatch = cci.createWatch(host, 1);
+		assertEquals(cacheID, getWithWatch("watched", shortWatch));
+		Thread.sleep(3000);
+		assertNull(cci.checkWatch(host, shortWatch, 0, 1, 0));
+
+		assertTrue(cc.set("watched", "v2") != 0);
+		for (int i = 0; i < watches.length; i++) {
+			WatchResult wr = cci.checkWatch(host, watches[i], 0, 100, 0);
+			assertNotNull(wr);
+			assertEquals(1, wr.cacheIDs.length);
+			assertEquals(cacheID, wr.cacheIDs[0]);
+			assertEquals(Defines.WATCH_NOTIFY_TYPE_DATA_UPDATED, wr.types[0]);
+		}
+	}
+}
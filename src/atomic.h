@@ -0,0 +1,88 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "defines.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#include <intrin.h>
+
+inline int64_t atomic_add64(volatile int64_t* p, int64_t delta) {
+	return InterlockedExchangeAdd64((volatile LONGLONG*)p, delta) + delta;
+}
+
+inline int64_t atomic_load64(volatile int64_t* p) {
+	return InterlockedCompareExchange64((volatile LONGLONG*)p, 0, 0);
+}
+
+inline void memory_barrier() {
+	MemoryBarrier();
+}
+
+inline uint16_t atomic_inc16(volatile uint16_t* p) {
+	return (uint16_t)_InterlockedIncrement16((volatile short*)p);
+}
+
+inline uint16_t atomic_dec16(volatile uint16_t* p) {
+	return (uint16_t)_InterlockedDecrement16((volatile short*)p);
+}
+
+inline bool atomic_cas16(volatile uint16_t* p, uint16_t old_value, uint16_t new_value) {
+	return _InterlockedCompareExchange16((volatile short*)p, (short)new_value, (short)old_value) == (short)old_value;
+}
+
+inline bool atomic_cas32(volatile uint32_t* p, uint32_t old_value, uint32_t new_value) {
+	return InterlockedCompareExchange((volatile LONG*)p, (LONG)new_value, (LONG)old_value) == (LONG)old_value;
+}
+#else
+// returns the new value
+inline int64_t atomic_add64(volatile int64_t* p, int64_t delta) {
+	return __sync_add_and_fetch(p, delta);
+}
+
+// a plain load may tear on 32 bit targets
+inline int64_t atomic_load64(volatile int64_t* p) {
+	return __sync_fetch_and_add(p, 0);
+}
+
+inline void memory_barrier() {
+	__sync_synchronize();
+}
+
+// returns the new value
+inline uint16_t atomic_inc16(volatile uint16_t* p) {
+	return __sync_add_and_fetch(p, 1);
+}
+
+// returns the new value
+inline uint16_t atomic_dec16(volatile uint16_t* p) {
+	return __sync_sub_and_fetch(p, 1);
+}
+
+inline bool atomic_cas16(volatile uint16_t* p, uint16_t old_value, uint16_t new_value) {
+	return __sync_bool_compare_and_swap(p, old_value, new_value);
+}
+
+inline bool atomic_cas32(volatile uint32_t* p, uint32_t old_value, uint32_t new_value) {
+	return __sync_bool_compare_and_swap(p, old_value, new_value);
+}
+#endif // defined(_WIN32) || defined(_WIN64)
+
+#endif // ATOMIC_H
@@ -15,7 +15,9 @@
 */
 
 #include <new>
+#include <algorithm>
 #include <assert.h>
+#include <math.h>
 #include "cache.h"
 #include "currtime.h"
 #include "stats.h"
@@ -23,20 +25,93 @@
 #include "log.h"
 #include "peer_cache_pdu.h"
 #include "settings.h"
+#include "hotkey.h"
+#include "file_monitor.h"
 
-Cache_Mgr cache_mgr_;
+// every partition allocates against the one max-bytes limit, see Cache_Router
+volatile int64_t Cache_Mgr::mem_used_ = 0;
+volatile int64_t Cache_Mgr::last_cache_id_ = 0;
 
-#define CALC_ITEM_SIZE(k, d, e) (sizeof(Cache_Item) + k + d + e)
+#define CALC_ITEM_SIZE(k, d, e) (ITEM_HEADER_SIZE + k + d + e)
 #define CHUNK_ALIGN_BYTES 8
+#define FLUSH_SWEEP_MAX_COUNT 10000
+#define EVICT_SEARCH_MAX_COUNT 50
+#define EVICT_MAX_COUNT 64
+#define QUOTA_TRIM_MAX_COUNT 10000
+#define RETIRE_ADVANCE_COUNT 256
+#define RECLAIM_MAX_BYTES (64 * 1024 * 1024)
+
+void Cache_Item::write_data(uint32_t offset, const uint8_t* data, uint32_t size) {
+	while (size > 0) {
+		uint32_t segment_size;
+		uint8_t* p = get_data_segment(offset, segment_size);
+		if (segment_size > size) {
+			segment_size = size;
+		}
+		memcpy(p, data, segment_size);
+		offset += segment_size;
+		data += segment_size;
+		size -= segment_size;
+	}
+}
+
+void Cache_Item::write_data(uint32_t offset, Cache_Item* src) {
+	uint32_t src_offset = 0;
+	while (src_offset < src->data_size) {
+		uint32_t size;
+		const uint8_t* p = src->get_data_segment(src_offset, size);
+		write_data(offset + src_offset, p, size);
+		src_offset += size;
+	}
+}
 
-Cache_Watch::Cache_Watch(uint32_t watch_id, uint32_t expire_time) {
+void Cache_Watch_Item::add_watch(uint32_t watch_id) {
+	for (uint32_t i = 0; i < size; i++) {
+		if (watch_ids[i] == watch_id) {
+			return;
+		}
+	}
+	if (size == capacity) {
+		uint32_t* p = new uint32_t[capacity * 2];
+		memcpy(p, watch_ids, size * sizeof(uint32_t));
+		if (watch_ids != inline_ids) {
+			delete[] watch_ids;
+		}
+		watch_ids = p;
+		capacity *= 2;
+	}
+	watch_ids[size++] = watch_id;
+}
+
+Cache_Watch::Cache_Watch() {
+	watch_id_ = 0;
+	index_ = 0;
+	generation_ = 0;
+	expire_time_ = 0;
+	wheel_slot_ = 0;
+	sequence_ = 0;
+	has_sink_ = false;
+}
+
+void Cache_Watch::init(uint32_t watch_id, uint32_t expire_time) {
 	watch_id_ = watch_id;
 	expire_time_ = expire_time;
 	sequence_ = 0;
 }
 
+void Cache_Watch::clear() {
+	watch_id_ = 0;
+	std::vector<uint64_t>().swap(updated_list_);
+	std::vector<uint64_t>().swap(wait_updated_list_);
+	std::vector<watch_notify_type>().swap(updated_type_list_);
+	std::vector<watch_notify_type>().swap(wait_updated_type_list_);
+	wp_.reset();
+	has_sink_ = false;
+}
+
 void Cache_Watch::check_and_set_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t ack_sequence, uint32_t expire_time,
-										 uint32_t& sequence, std::vector<uint64_t>& updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list) {
+										 uint32_t& sequence, std::vector<uint64_t>& updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list,
+										 Cache_Watch_Wake_List& wake_list) {
 	expire_time_ = expire_time;
 	if (!wait_updated_list_.empty()) {
 		if (ack_sequence == sequence_) {
@@ -71,11 +146,11 @@ void Cache_Watch::check_and_set_callback(boost::shared_ptr<Cache_Watch_Sink>& sp
 		sequence = next_sequence();
 		return;
 	} else {
-		boost::shared_ptr<Cache_Watch_Sink> p = wp_.lock();
-		if (p != NULL) {
-			p->on_cache_watch_notify(watch_id_);
+		if (has_sink_) {
+			wake_sink(wake_list);
 		}
 		wp_ = sp;
+		has_sink_ = true;
 		sequence = 0;
 		return;
 	}
@@ -100,24 +175,25 @@ void Cache_Watch::check_and_clear_callback(boost::shared_ptr<Cache_Watch_Sink>&
 			sequence = next_sequence();
 		}
 		wp_.reset();
+		has_sink_ = false;
 	}
 }
 
-void Cache_Watch::notify_watch(uint64_t cache_id, watch_notify_type type) {
+void Cache_Watch::notify_watch(uint64_t cache_id, watch_notify_type type, Cache_Watch_Wake_List& wake_list) {
 	updated_list_.push_back(cache_id);
 	updated_type_list_.push_back(type);
-	boost::shared_ptr<Cache_Watch_Sink> p = wp_.lock();
-	if (p != NULL) {
-		p->on_cache_watch_notify(watch_id_);
-		wp_.reset();
+	if (has_sink_) {
+		wake_sink(wake_list);
 	}
 }
 
-Cache_Mgr::Cache_Mgr() {
-	last_cache_id_ = 0;
+Cache_Mgr::Cache_Mgr() : delta_(&Cache_Mgr::keep_delta), reader_(&Cache_Mgr::keep_reader) {
 	class_id_max_ = 0;
+	chunk_class_id_ = 0;
+	chunk_size_ = 0;
+	value_size_max_ = 0;
 	mem_limit_ = 0;
-	mem_used_ = 0;
+	part_stats_ = &stats_;
 	memset(max_size_, 0, sizeof(max_size_));
 #ifdef USING_BOOST_POOL
 	memset(&pools_, 0, sizeof(pools_));
@@ -127,7 +203,20 @@ Cache_Mgr::Cache_Mgr() {
 	last_print_stats_time_ = 0;
 
 	last_check_expired_time_ = 0;
-	last_watch_id_ = 0;
+	last_expire_watch_time_ = 0;
+	curr_watches_ = 0;
+	curr_feeds_ = 0;
+	watch_home_ = this;
+	refresh_random_ = 2463534242U;
+	delta_list_ = NULL;
+	reader_list_ = NULL;
+	epoch_ = 1;
+	retire_count_ = 0;
+	reclaim_bytes_ = 0;
+	reclaim_deferred_bytes_ = 0;
+	reclaim_overflows_ = 0;
+
+	flushed_items_ = 0;
 
 	memset(expire_check_time_, 0, sizeof(expire_check_time_));
 	for (int i = 0; i < 32; i++) {
@@ -141,18 +230,30 @@ Cache_Mgr::Cache_Mgr() {
 }
 
 Cache_Mgr::~Cache_Mgr() {
+	while (delta_list_ != NULL) {
+		Cache_Delta* d = delta_list_;
+		delta_list_ = d->next;
+		delete d;
+	}
+	while (reader_list_ != NULL) {
+		Cache_Reader* r = reader_list_;
+		reader_list_ = r->next;
+		delete r;
+	}
+	reclaim_.release();
 }
 
-void Cache_Mgr::init(uint64_t limit, uint32_t item_size_max, uint32_t item_size_min, double factor) {
+void Cache_Mgr::init(uint64_t limit, uint32_t item_size_max, uint32_t item_size_min, double factor, Stats* stats) {
 	LOG_INFO("Cache_Mgr::init, limit=" << limit << " item_size_max=" << item_size_max << " item_size_min=" << item_size_min
-		<< " factor=" << factor << " sizeof_item=" << sizeof(Cache_Item));
+		<< " factor=" << factor << " item_header_size=" << ITEM_HEADER_SIZE);
 
-	uint32_t size = sizeof(Cache_Item) + item_size_min;
+	uint32_t size = ITEM_HEADER_SIZE + item_size_min;
 
 	mem_limit_ = limit;
+	part_stats_ = stats;
 
 	class_id_max_ = CLASSID_MIN;
-	for (; class_id_max_ < CLASSID_MAX && size <= (sizeof(Cache_Item) + item_size_max) / factor; ++class_id_max_) {
+	for (; class_id_max_ < CLASSID_MAX && size <= (ITEM_HEADER_SIZE + item_size_max) / factor; ++class_id_max_) {
 
 		if (size % CHUNK_ALIGN_BYTES) {
 			size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
@@ -168,9 +269,17 @@ void Cache_Mgr::init(uint64_t limit, uint32_t item_size_max, uint32_t item_size_
 #endif
 		size = (uint32_t)(size * factor);
 	}
-	max_size_[class_id_max_] = sizeof(Cache_Item) + item_size_max;
-	stats_.set_max_class_id(class_id_max_);
+	max_size_[class_id_max_] = ITEM_HEADER_SIZE + item_size_max;
+	part_stats_->set_max_class_id(class_id_max_);
 	LOG_INFO("Cache_Mgr::init, class_id_max=" << class_id_max_ << " max_size=" << max_size_[class_id_max_]);
+
+	if (settings_.value_size_max > item_size_max) {
+		uint32_t size = settings_.chunk_size < item_size_max ? settings_.chunk_size : item_size_max;
+		chunk_class_id_ = get_class_id(ITEM_HEADER_SIZE + size);
+		chunk_size_ = max_size_[chunk_class_id_] - ITEM_HEADER_SIZE;
+		value_size_max_ = settings_.value_size_max;
+		LOG_INFO("Cache_Mgr::init, chunk_class_id=" << chunk_class_id_ << " chunk_size=" << chunk_size_ << " value_size_max=" << value_size_max_);
+	}
 }
 
 uint32_t Cache_Mgr::get_class_id(uint32_t size) {
@@ -198,72 +307,160 @@ uint32_t Cache_Mgr::get_class_id(uint32_t size) {
 	return 0;
 }
 
-uint64_t Cache_Mgr::get_cache_id() {
-	if (++last_cache_id_ == 0) {
-		last_cache_id_ = 1;
+void Cache_Mgr::lock_cache() {
+	if (reclaim_buf_.get() == NULL) {
+		reclaim_buf_.reset(new Cache_Reclaim());
+	}
+	if (cache_lock_.try_lock()) {
+		stats_.latency(LATENCY_LOCK_WAIT, 0);
+	} else {
+		uint64_t start_tick = Current_Time::get_tick_us();
+		cache_lock_.lock();
+		stats_.latency(LATENCY_LOCK_WAIT, Current_Time::get_tick_us() - start_tick);
 	}
-	return last_cache_id_;
+}
+
+// Memory freed and sinks woken under the lock are handled after it is released,
+// sinks once per peer.
+void Cache_Mgr::unlock_cache() {
+	Cache_Reclaim* reclaim = NULL;
+	if (!reclaim_.empty()) {
+		reclaim = reclaim_buf_.get();
+		reclaim->swap(reclaim_);
+		reclaim_bytes_ = 0;
+	}
+	if (watch_wake_list_.empty()) {
+		cache_lock_.unlock();
+		if (reclaim != NULL) {
+			reclaim->release();
+		}
+		return;
+	}
+	Cache_Watch_Wake_List wake_list;
+	wake_list.swap(watch_wake_list_);
+	cache_lock_.unlock();
+	if (reclaim != NULL) {
+		reclaim->release();
+	}
+
+	std::vector<std::pair<boost::shared_ptr<Cache_Watch_Sink>, uint32_t> > sinks;
+	sinks.reserve(wake_list.size());
+	for (size_t i = 0; i < wake_list.size(); i++) {
+		boost::shared_ptr<Cache_Watch_Sink> p = wake_list[i].sink.lock();
+		if (p != NULL) {
+			sinks.push_back(std::make_pair(p, wake_list[i].watch_id));
+		}
+	}
+	std::sort(sinks.begin(), sinks.end());
+	for (size_t i = 0; i < sinks.size(); i++) {
+		if (i == 0 || sinks[i].first != sinks[i - 1].first) {
+			sinks[i].first->on_cache_watch_notify(sinks[i].second);
+		}
+	}
+}
+
+uint64_t Cache_Mgr::get_cache_id() {
+	return (uint64_t)atomic_add64(&last_cache_id_, 1);
 }
 
 void Cache_Mgr::check_expired() {
 	uint32_t curr_time = curr_time_.get_current_time();
 	if (curr_time != last_check_expired_time_) {
 		last_check_expired_time_ = curr_time;
-		cache_lock_.lock();
+		lock_cache();
 
 		expire_watchs(curr_time);
+		expire_feeds(curr_time);
+		expire_leases(curr_time);
 		expire_items(curr_time);
 		free_flushed_items();
+		sweep_flushed_items();
+		trim_over_quota_groups();
+		advance_epoch();
+		hot_keys_.decay(curr_time);
+		part_stats_->snapshot();
 
-		cache_lock_.unlock();
+		unlock_cache();
 	}
 }
 
-void Cache_Mgr::stats(const XIXI_Stats_Req_Pdu* pdu, std::string& result) {
-	cache_lock_.lock();
+void Cache_Mgr::stats(const XIXI_Stats_Req_Pdu* pdu, std::string& result, const Cache_Stats_Merge* others) {
+	lock_cache();
 	switch (pdu->sub_op()) {
 	case XIXI_STATS_SUB_OP_ADD_GROUP:
-		if (stats_.add_group(pdu->group_id)) {
+		if (part_stats_->add_group(pdu->group_id)) {
 			result = "success";
 		} else {
 			result = "fail";
 		}
 		break;
 	case XIXI_STATS_SUB_OP_REMOVE_GROUP:
-		if (stats_.remove_group(pdu->group_id)) {
+		if (part_stats_->remove_group(pdu->group_id)) {
 			result = "success";
 		} else {
 			result = "fail";
 		}
 		break;
 	case XIXI_STATS_SUB_OP_GET_STATS_GROUP_ONLY:
-		stats_.get_stats(pdu->group_id, pdu->class_id, result);
+		part_stats_->get_stats(pdu->group_id, pdu->class_id, result, others != NULL ? &others->stats : NULL);
+		get_group_stats(pdu->group_id, result, others != NULL ? &others->group : NULL);
 		break;
 //	case XIXI_STATS_SUB_OP_GET_AND_CLEAR_STATS_GROUP_ONLY:
-//		stats_.get_and_clear_stats(pdu->group_id, pdu->class_id, result);
+//		part_stats_->get_and_clear_stats(pdu->group_id, pdu->class_id, result);
 //		break;
 	case XIXI_STATS_SUB_OP_GET_STATS_SUM_ONLY:
-		stats_.get_stats(pdu->class_id, result);
+		part_stats_->get_stats(pdu->class_id, result, others != NULL ? &others->stats : NULL);
+		Group_Stats_Item::append("curr_watches", curr_watches_, result);
+		Group_Stats_Item::append("watch_slots", (uint64_t)watch_blocks_.size() * WATCH_BLOCK_SIZE, result);
 		break;
 //	case XIXI_STATS_SUB_OP_GET_AND_CLEAR_STATS_SUM_ONLY:
-//		stats_.get_and_clear_stats(pdu->class_id, result);
+//		part_stats_->get_and_clear_stats(pdu->class_id, result);
 //		break;
+	case XIXI_STATS_SUB_OP_GET_HOT_KEYS:
+		hot_keys_.get_stats(curr_time_.get_current_time(), result);
+		break;
+	case XIXI_STATS_SUB_OP_GET_LATENCY:
+		part_stats_->get_latency_stats(result);
+		break;
 	default:
 		result = "unknown sub command";
 		break;
 	}
-	cache_lock_.unlock();
+	unlock_cache();
+}
+
+// adds the counters asked for by pdu to those of the other partitions
+void Cache_Mgr::merge_stats(const XIXI_Stats_Req_Pdu* pdu, Cache_Stats_Merge& others) {
+	lock_cache();
+	Group_Stats_Item* item;
+	if (pdu->sub_op() == XIXI_STATS_SUB_OP_GET_STATS_SUM_ONLY) {
+		item = &part_stats_->group_sum_;
+	} else {
+		item = part_stats_->get_group_item(pdu->group_id);
+	}
+	if (item != NULL) {
+		item->merge(others.stats);
+	}
+	Cache_Group* group = group_map_.find(&others.group.group_id, others.group.group_id);
+	if (group != NULL) {
+		others.group.curr_items += group->curr_items;
+		others.group.curr_bytes += group->curr_bytes;
+		others.group.flushed_items += group->flushed_items;
+		others.group.flushed_bytes += group->flushed_bytes;
+		others.group.max_bytes += group->max_bytes;
+	}
+	unlock_cache();
 }
 
 void Cache_Mgr::print_stats() {
 	uint32_t curr_time = curr_time_.get_current_time();
 	if (curr_time >= last_print_stats_time_ + 30) {
 		last_print_stats_time_ = curr_time;
-		cache_lock_.lock();
+		lock_cache();
 
-		stats_.print();
+		part_stats_->print();
 
-		cache_lock_.unlock();
+		unlock_cache();
 	}
 }
 
@@ -274,9 +471,15 @@ void Cache_Mgr::expire_items(uint32_t curr_time) {
 
 			Cache_Item* it = expire_list_[i].front();
 			while (it != NULL) {
-				if (it->expire_time <= curr_time) {
+				if (is_flushed(it)) {
 					Cache_Item* next = it->next();
-					do_unlink(it, WATCH_NOTIFY_TYPE_EXPIRED);
+					do_unlink(it, WATCH_NOTIFY_TYPE_FLUSHED);
+					it = next;
+				} else if (it->expire_time <= curr_time) {
+					Cache_Item* next = it->next();
+					if (!is_servable_stale(it, curr_time)) {
+						do_unlink(it, WATCH_NOTIFY_TYPE_EXPIRED);
+					}
 					it = next;
 				} else {
 					Cache_Item* next = it->next();
@@ -296,19 +499,58 @@ void Cache_Mgr::expire_items(uint32_t curr_time) {
 	}
 }
 
+// replaced_size is the size of the linked item the new one replaces, it leaves
+// the group when the new one is linked.
+bool Cache_Mgr::check_quota(uint32_t group_id, uint64_t item_size, uint64_t replaced_size) {
+	uint32_t count = 0;
+	uint32_t class_id = 0;
+	Cache_Group* group = group_map_.find(&group_id, group_id);
+	if (group != NULL && group->max_bytes > 0) {
+		while (group->used_bytes() + item_size > group->max_bytes + replaced_size) {
+			if (item_size > group->max_bytes || count++ >= EVICT_MAX_COUNT || !evict_item(group, class_id)) {
+				part_stats_->quota_reject(group_id);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
 Cache_Item* Cache_Mgr::do_alloc(uint32_t group_id, uint32_t key_length, uint32_t flags, 
-								uint32_t expire_time, uint32_t data_size, uint32_t ext_size) {
+								uint32_t expire_time, uint32_t data_size, uint32_t ext_size, uint32_t replaced_size) {
 	uint32_t item_size = CALC_ITEM_SIZE(key_length, data_size, ext_size);
 
 	uint32_t id = get_class_id(item_size);
 	if (id == 0) {
 		return NULL;
 	}
-	item_size = max_size_[id];
 
-	Cache_Item* it = free_cache_list_[id].pop_front();
+	if (!check_quota(group_id, item_size, replaced_size)) {
+		return NULL;
+	}
+
+	Cache_Item* it = alloc_from_class(id, group_id);
 	if (it == NULL) {
-		if (mem_used_ + item_size <= mem_limit_) {
+		return NULL;
+	}
+
+	it->expiration_id = (uint8_t)get_expiration_id(curr_time_.get_current_time(), expire_time);
+	it->key_length = key_length;
+	it->data_size = data_size;
+	it->expire_time = expire_time;
+	it->flags = flags;
+	it->ext_size = ext_size;
+
+	return it;
+}
+
+Cache_Item* Cache_Mgr::alloc_from_class(uint32_t id, uint32_t group_id) {
+	uint32_t item_size = max_size_[id];
+	uint32_t count = 0;
+	uint32_t class_id = 0;
+	Cache_Item* it = free_cache_list_[id].pop_front();
+	while (it == NULL) {
+		if (mem_available(item_size)) {
 #ifdef USING_BOOST_POOL
 			void* buf = pools_[id]->malloc();
 #else
@@ -316,33 +558,295 @@ Cache_Item* Cache_Mgr::do_alloc(uint32_t group_id, uint32_t key_length, uint32_t
 #endif
 			if (buf != NULL) {
 				it = new (buf) Cache_Item;
-				mem_used_ += item_size;
+				add_mem_used(item_size);
 			} else {
 				return NULL;
 			}
+		} else if (count++ < EVICT_MAX_COUNT && evict_for_memory(group_id, class_id)) {
+			it = free_cache_list_[id].pop_front();
+			if (it == NULL && class_id != id) {
+				release_free_item(class_id);
+			}
+		} else if (retire_count_ > 0 && advance_epoch()) {
+			it = free_cache_list_[id].pop_front();
 		} else {
 			return NULL;
 		}
 	}
 
 	it->class_id = (uint8_t)id;
-	it->expiration_id = (uint8_t)get_expiration_id(curr_time_.get_current_time(), expire_time);
 	it->ref_count = 1;
 	it->group_id = group_id;
+
+	return it;
+}
+
+Cache_Item* Cache_Mgr::do_alloc_value(uint32_t group_id, uint32_t key_length, uint32_t flags,
+								uint32_t expire_time, uint32_t data_size, uint32_t ext_size, uint32_t replaced_size) {
+	if (!is_chunked_size(key_length, data_size, ext_size)) {
+		return do_alloc(group_id, key_length, flags, expire_time, data_size, ext_size, replaced_size);
+	}
+	Cache_Item* it = do_alloc_chunked(group_id, key_length, flags, expire_time, data_size, ext_size, replaced_size);
+	if (it != NULL && !alloc_chunks(it, 0)) {
+		do_release_reference(it);
+		it = NULL;
+	}
+	return it;
+}
+
+bool Cache_Mgr::is_chunked_size(uint32_t key_length, uint32_t data_size, uint32_t ext_size) {
+	return value_size_max_ > 0 && data_size <= value_size_max_
+		&& get_class_id(CALC_ITEM_SIZE(key_length, data_size, ext_size)) == 0;
+}
+
+// The header of a chunked item: key, ext and an empty chunk table sized for data_size.
+Cache_Item* Cache_Mgr::do_alloc_chunked(uint32_t group_id, uint32_t key_length, uint32_t flags,
+								uint32_t expire_time, uint32_t data_size, uint32_t ext_size, uint32_t replaced_size) {
+	if (!check_quota(group_id, (uint64_t)CALC_ITEM_SIZE(key_length, ext_size, 0) + data_size, replaced_size)) {
+		return NULL;
+	}
+	uint32_t count = (data_size + chunk_size_ - 1) / chunk_size_;
+	uint32_t id = get_class_id(ITEM_HEADER_SIZE + CHUNK_TABLE_OFFSET(key_length, ext_size) + CHUNK_TABLE_SIZE(count));
+	if (id == 0) {
+		return NULL;
+	}
+	Cache_Item* it = alloc_from_class(id, group_id);
+	if (it == NULL) {
+		return NULL;
+	}
+
+	it->expiration_id = (uint8_t)get_expiration_id(curr_time_.get_current_time(), expire_time);
 	it->key_length = key_length;
 	it->data_size = data_size;
 	it->expire_time = expire_time;
 	it->flags = flags;
 	it->ext_size = ext_size;
+	it->item_flag |= ITEM_FLAG_CHUNKED;
 
+	Cache_Chunk_Table* table = it->get_chunk_table();
+	table->count = 0;
+	table->chunk_size = chunk_size_;
 	return it;
 }
 
+// Fills the chunk table from index first on. The last chunk comes from the
+// smallest class that holds the rest of the data.
+bool Cache_Mgr::alloc_chunks(Cache_Item* it, uint32_t first) {
+	Cache_Chunk_Table* table = it->get_chunk_table();
+	uint32_t count = (it->data_size + table->chunk_size - 1) / table->chunk_size;
+	for (uint32_t i = first; i < count; i++) {
+		uint32_t id = chunk_class_id_;
+		if (i + 1 == count) {
+			id = get_class_id(ITEM_HEADER_SIZE + it->data_size - i * table->chunk_size);
+		}
+		Cache_Item* chunk = alloc_from_class(id, it->group_id);
+		if (chunk == NULL) {
+			return false;
+		}
+		chunk->expiration_id = (uint8_t)get_expiration_id(curr_time_.get_current_time(), 0);
+		chunk->data_size = max_size_[id] - ITEM_HEADER_SIZE;
+		table->chunks[i] = chunk;
+		table->count = i + 1;
+	}
+	return true;
+}
+
+// The new version shares the full chunks of old_it, only the appended data is copied.
+// Bytes behind the end of old_it in its last chunk are never read through old_it.
+Cache_Item* Cache_Mgr::do_append_chunks(Cache_Item* old_it, Cache_Item* it) {
+	uint64_t size = (uint64_t)old_it->data_size + it->data_size;
+	if (size > value_size_max_) {
+		return NULL;
+	}
+	Cache_Item* new_it = do_alloc_chunked(old_it->group_id, old_it->key_length, old_it->flags,
+		old_it->expire_time, (uint32_t)size, old_it->ext_size, old_it->total_size());
+	if (new_it == NULL) {
+		return NULL;
+	}
+
+	Cache_Chunk_Table* old_table = old_it->get_chunk_table();
+	Cache_Chunk_Table* table = new_it->get_chunk_table();
+	uint32_t shared = old_table->count;
+	Cache_Item* last = old_table->chunks[shared - 1];
+	if (last->data_size < old_table->chunk_size) {
+		shared--; // a short last chunk is copied into a full one
+	}
+	for (uint32_t i = 0; i < shared; i++) {
+		table->chunks[i] = old_table->chunks[i];
+		table->chunks[i]->add_ref();
+	}
+	table->count = shared;
+	if (!alloc_chunks(new_it, shared)) {
+		do_release_reference(new_it);
+		return NULL;
+	}
+	if (shared < old_table->count) {
+		uint32_t offset = shared * old_table->chunk_size;
+		new_it->write_data(offset, last->get_data(), old_it->data_size - offset);
+	}
+	new_it->write_data(old_it->data_size, it);
+	return new_it;
+}
+
+// Segments pile up until compact_segments coalesces them, past
+// SEGMENT_COPY_FACTOR times segment_max an append copies the value instead.
+#define SEGMENT_COPY_FACTOR 4
+#define SEGMENT_COMPACT_BYTES (16 * 1024 * 1024)
+
+bool Cache_Mgr::use_segments(Cache_Item* old_it) {
+	return settings_.segment_max > 0
+		&& (!old_it->is_segmented() || old_it->get_segment_table()->count < settings_.segment_max * SEGMENT_COPY_FACTOR);
+}
+
+// The new version of old_it holds the data of first followed by the data of second.
+Cache_Item* Cache_Mgr::do_link_segments(Cache_Item* old_it, Cache_Item* first, Cache_Item* second) {
+	uint64_t size = (uint64_t)first->data_size + second->data_size;
+	uint64_t size_max = value_size_max_ > 0 ? value_size_max_ : max_size_[class_id_max_] - ITEM_HEADER_SIZE;
+	if (size > size_max) {
+		return NULL;
+	}
+	uint32_t count = (first->is_segmented() ? first->get_segment_table()->count : 1)
+		+ (second->is_segmented() ? second->get_segment_table()->count : 1);
+	// the new version replaces old_it, so only the appended or prepended data is charged
+	if (!check_quota(old_it->group_id, (uint64_t)CALC_ITEM_SIZE(old_it->key_length, old_it->ext_size, 0) + size, old_it->total_size())) {
+		return NULL;
+	}
+	uint32_t id = get_class_id(ITEM_HEADER_SIZE + CHUNK_TABLE_OFFSET(old_it->key_length, old_it->ext_size) + SEGMENT_TABLE_SIZE(count));
+	if (id == 0) {
+		return NULL;
+	}
+	Cache_Item* it = alloc_from_class(id, old_it->group_id);
+	if (it == NULL) {
+		return NULL;
+	}
+
+	it->expiration_id = (uint8_t)get_expiration_id(curr_time_.get_current_time(), old_it->expire_time);
+	it->key_length = old_it->key_length;
+	it->data_size = (uint32_t)size;
+	it->expire_time = old_it->expire_time;
+	it->flags = old_it->flags;
+	it->ext_size = old_it->ext_size;
+	it->item_flag |= ITEM_FLAG_SEGMENTED;
+
+	Cache_Segment_Table* table = it->get_segment_table();
+	table->count = 0;
+	add_segments(table, first);
+	add_segments(table, second);
+	return it;
+}
+
+void Cache_Mgr::add_segments(Cache_Segment_Table* table, Cache_Item* it) {
+	if (it->is_segmented()) {
+		Cache_Segment_Table* t = it->get_segment_table();
+		for (uint32_t i = 0; i < t->count; i++) {
+			t->segments[i]->add_ref();
+			table->segments[table->count++] = t->segments[i];
+		}
+	} else if (it->data_size > 0) {
+		it->add_ref();
+		table->segments[table->count++] = it;
+	}
+}
+
+void Cache_Mgr::release_segments(Cache_Item* it) {
+	Cache_Segment_Table* table = it->get_segment_table();
+	for (uint32_t i = 0; i < table->count; i++) {
+		do_release_reference(table->segments[i]);
+	}
+}
+
+// queues a just linked version with too many segments for compact_segments
+void Cache_Mgr::check_segments(Cache_Item* it) {
+	if (it->is_segmented() && it->get_segment_table()->count > settings_.segment_max) {
+		it->add_ref();
+		compact_list_.push_back(it);
+	}
+}
+
+// Coalesces the segments of the queued items into one value, about
+// SEGMENT_COMPACT_BYTES per call. The data is copied without cache_lock_, and
+// the table is swapped in place only while no peer holds the item, so its
+// cache_id and watches are kept.
+void Cache_Mgr::compact_segments() {
+	std::vector<Cache_Item*> items;
+	lock_cache();
+	items.swap(compact_list_);
+	unlock_cache();
+
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		Cache_Item* it = items[i];
+		lock_cache();
+		if (!expire_list_[it->expiration_id].is_linked(it)) {
+			do_release_reference(it);
+			unlock_cache();
+			continue;
+		}
+		Cache_Item* data_it = NULL;
+		if (bytes < SEGMENT_COMPACT_BYTES) {
+			data_it = do_alloc_value(it->group_id, 0, 0, 0, it->data_size, 0, 0);
+		}
+		if (data_it == NULL) {
+			compact_list_.push_back(it);
+			unlock_cache();
+			continue;
+		}
+		unlock_cache();
+
+		data_it->write_data(0, it);
+		bytes += it->data_size;
+
+		lock_cache();
+		// lock free gets cannot pin the item while its segments are swapped
+		if (expire_list_[it->expiration_id].is_linked(it) && atomic_cas16(&it->ref_count, 2, 2 | ITEM_REF_EXCLUSIVE)) {
+			release_segments(it);
+			Cache_Segment_Table* table = it->get_segment_table();
+			table->count = 1;
+			table->segments[0] = data_it;
+			memory_barrier();
+			it->ref_count = 2;
+			part_stats_->segment_compact(it->group_id);
+			do_release_reference(it);
+		} else {
+			do_release_reference(data_it);
+			if (expire_list_[it->expiration_id].is_linked(it)) {
+				compact_list_.push_back(it);
+			} else {
+				do_release_reference(it);
+			}
+		}
+		unlock_cache();
+	}
+}
+
+void Cache_Mgr::release_chunks(Cache_Item* it) {
+	Cache_Chunk_Table* table = it->get_chunk_table();
+	for (uint32_t i = 0; i < table->count; i++) {
+		do_release_reference(table->chunks[i]);
+	}
+}
+
 void Cache_Mgr::free_item(Cache_Item* it) {
 	assert(!expire_list_[it->expiration_id].is_linked(it));
 	assert(it->ref_count == 0);
 
 	uint32_t id = it->class_id;
+	add_mem_used(-(int64_t)it->http_header_size());
+	if (it->is_chunked()) {
+		release_chunks(it);
+	} else if (it->is_segmented()) {
+		release_segments(it);
+	}
+	Cache_Watch_Item* watch_item = get_watch_item(it);
+	if (watch_item != NULL) {
+		free_watch_item(watch_item);
+		set_watch_item(it, NULL);
+	}
+	while (it->http_header != NULL) {
+		Http_Header_Template* t = it->http_header;
+		it->http_header = t->next;
+		defer_free(t, HTTP_HEADER_TEMPLATE_SIZE(t->size));
+	}
 	it->reset();
 	if (free_cache_list_[id].size() < free_cache_max_count[id]) {
 		free_cache_list_[id].push_front(it);
@@ -351,14 +855,79 @@ void Cache_Mgr::free_item(Cache_Item* it) {
 #ifdef USING_BOOST_POOL
 		pools_[id]->free(it);
 #else
-		::free(it);
+		defer_free(it, item_size);
 #endif
-		mem_used_ -= item_size;
+		add_mem_used(-(int64_t)item_size);
 	}
 }
 
+// Swaps an unlinked item for a compressed copy when its group has a compression
+// policy and the copy fits a smaller slab class. The codec runs without cache_lock_.
+Cache_Item* Cache_Mgr::compress_item(Cache_Item* it) {
+	if (settings_.group_compressions.empty() || it->is_chunked() || it->is_compressed()) {
+		return it;
+	}
+	std::map<uint32_t, Group_Compression>::const_iterator gc = settings_.group_compressions.find(it->group_id);
+	if (gc == settings_.group_compressions.end() || it->data_size < gc->second.min_size) {
+		return it;
+	}
+	Codec* codec = get_codec(gc->second.codec_id);
+	uint32_t buf_size = codec->compress_bound(it->data_size);
+	uint8_t* buf = (uint8_t*)malloc(buf_size);
+	if (buf == NULL) {
+		return it;
+	}
+	uint64_t start_tick = Current_Time::get_tick_us();
+	uint32_t size = codec->compress(it->get_data(), it->data_size, buf, buf_size, gc->second.level);
+	uint64_t us = Current_Time::get_tick_us() - start_tick;
+
+	Cache_Item* new_it = NULL;
+	lock_cache();
+	if (size > 0 && get_class_id(CALC_ITEM_SIZE(it->key_length, size, it->ext_size)) < it->class_id) {
+		new_it = do_alloc(it->group_id, it->key_length, it->flags, it->expire_time, size, it->ext_size, 0);
+	}
+	part_stats_->compress(it->group_id, it->data_size, new_it != NULL ? size : it->data_size, us);
+	unlock_cache();
+
+	if (new_it != NULL) {
+		new_it->set_key_with_hash(it->get_key(), it->hash_value_);
+		memcpy(new_it->get_data(), buf, size);
+		new_it->set_ext(it->get_ext());
+		new_it->cache_id = it->cache_id;
+		new_it->item_flag |= (uint8_t)(gc->second.codec_id << ITEM_FLAG_CODEC_SHIFT);
+		release_reference(it);
+		it = new_it;
+	}
+	free(buf);
+	return it;
+}
+
 bool Cache_Mgr::item_size_ok(uint32_t key_length, uint32_t data_size, uint32_t ext_size) {
-	return get_class_id(CALC_ITEM_SIZE(key_length, data_size, ext_size)) != 0;
+	return get_class_id(CALC_ITEM_SIZE(key_length, data_size, ext_size)) != 0 || is_chunked_size(key_length, data_size, ext_size);
+}
+
+// Shares a header template rendered by a reader. Returns NULL when the caller has to
+// keep using its own copy: too many superseded versions or no memory left.
+const Http_Header_Template* Cache_Mgr::set_http_header(Cache_Item* item, const Http_Header_Template* t) {
+	uint32_t size = HTTP_HEADER_TEMPLATE_SIZE(t->size);
+	const Http_Header_Template* ret = NULL;
+	lock_cache();
+	Http_Header_Template* curr = item->http_header;
+	if (curr != NULL && curr->cache_id == t->cache_id) {
+		ret = curr;
+	} else if ((curr == NULL || curr->depth < HTTP_HEADER_TEMPLATE_MAX_DEPTH) && mem_available(size)) {
+		Http_Header_Template* nt = (Http_Header_Template*)malloc(size);
+		if (nt != NULL) {
+			memcpy(nt, t, size);
+			nt->next = curr;
+			nt->depth = (curr == NULL) ? 1 : curr->depth + 1;
+			item->http_header = nt;
+			add_mem_used(size);
+			ret = nt;
+		}
+	}
+	unlock_cache();
+	return ret;
 }
 
 uint32_t Cache_Mgr::get_expiration_id(uint32_t curr_time, uint32_t expire_time) {
@@ -378,58 +947,379 @@ uint32_t Cache_Mgr::get_expiration_id(uint32_t curr_time, uint32_t expire_time)
 	}
 }
 
+Cache_Group* Cache_Mgr::get_group(uint32_t group_id) {
+	Cache_Group* group = group_map_.find(&group_id, group_id);
+	if (group == NULL) {
+		group = new Cache_Group(group_id);
+		group_map_.insert(group, group_id);
+	}
+	return group;
+}
+
+Cache_Group* Cache_Mgr::group_link(Cache_Item* it) {
+	Cache_Group* group = get_group(it->group_id);
+	group->curr_items++;
+	group->curr_bytes += it->total_size();
+	group->item_list.push_back(it);
+	return group;
+}
+
+void Cache_Mgr::group_unlink(Cache_Item* it) {
+	Cache_Group* group = group_map_.find(&it->group_id, it->group_id);
+	assert(group != NULL);
+	group->item_list.remove(it);
+	if (it->cache_id <= group->flush_cache_id) {
+		group->flushed_items--;
+		group->flushed_bytes -= it->total_size();
+		flushed_items_--;
+		if (group->flushed_items == 0) {
+			flushed_group_list_.remove(group);
+		}
+	} else {
+		group->curr_items--;
+		group->curr_bytes -= it->total_size();
+	}
+	Cache_Watch_Item* watch_item = get_watch_item(it);
+	if (watch_item != NULL) {
+		group->watch_list.remove(watch_item);
+	}
+	if (group->empty()) {
+		assert(group->watch_list.empty());
+		group_map_.remove(group);
+		delete group;
+	}
+}
+
+bool Cache_Mgr::evict_item(Cache_Group* group, uint32_t&/*out*/ class_id) {
+	Cache_Item* it = group->item_list.front();
+	for (uint32_t i = 0; i < EVICT_SEARCH_MAX_COUNT && it != NULL; i++) {
+		// skip items still referenced by a peer or by the caller
+		if (it->ref_count == 1) {
+			class_id = it->class_id;
+			part_stats_->evict(it->group_id, it->class_id);
+			do_unlink(it, WATCH_NOTIFY_TYPE_EVICTED);
+			return true;
+		}
+		it = group->item_list.next(it);
+	}
+	return false;
+}
+
+bool Cache_Mgr::evict_for_memory(uint32_t group_id, uint32_t&/*out*/ class_id) {
+	Cache_Group* group = quota_group_list_.front();
+	while (group != NULL) {
+		if (group->is_over_quota() && evict_item(group, class_id)) {
+			return true;
+		}
+		group = quota_group_list_.next(group);
+	}
+	group = group_map_.find(&group_id, group_id);
+	return group != NULL && evict_item(group, class_id);
+}
+
+void Cache_Mgr::release_free_item(uint32_t class_id) {
+	Cache_Item* it = free_cache_list_[class_id].pop_front();
+	if (it != NULL) {
+#ifdef USING_BOOST_POOL
+		pools_[class_id]->free(it);
+#else
+		defer_free(it, max_size_[class_id]);
+#endif
+		add_mem_used(-(int64_t)max_size_[class_id]);
+	}
+}
+
+void Cache_Mgr::update_lru(Cache_Item* it) {
+	Cache_Group* group = group_map_.find(&it->group_id, it->group_id);
+	assert(group != NULL);
+	group->item_list.move_to_back(it);
+}
+
+bool Cache_Mgr::is_flushed(Cache_Item* it) {
+	if (flushed_items_ == 0) {
+		return false;
+	}
+	Cache_Group* group = group_map_.find(&it->group_id, it->group_id);
+	return group != NULL && it->cache_id <= group->flush_cache_id;
+}
+
+void Cache_Mgr::add_watch(Cache_Item* it, uint32_t watch_id) {
+	Cache_Watch_Item* watch_item = get_watch_item(it);
+	if (watch_item == NULL) {
+		watch_item = alloc_watch_item(it);
+		set_watch_item(it, watch_item);
+		if (expire_list_[it->expiration_id].is_linked(it)) {
+			Cache_Group* group = group_map_.find(&it->group_id, it->group_id);
+			assert(group != NULL);
+			group->watch_list.push_back(watch_item);
+		}
+	}
+	watch_item->add_watch(watch_id);
+}
+
+Cache_Watch_Item* Cache_Mgr::alloc_watch_item(Cache_Item* it) {
+	Cache_Watch_Item* watch_item = free_watch_item_list_.pop_front();
+	if (watch_item == NULL) {
+		watch_item = new Cache_Watch_Item();
+	}
+	watch_item->item = it;
+	return watch_item;
+}
+
+void Cache_Mgr::free_watch_item(Cache_Watch_Item* watch_item) {
+	if (free_watch_item_list_.size() < WATCH_ITEM_FREE_MAX) {
+		watch_item->reset();
+		free_watch_item_list_.push_front(watch_item);
+	} else {
+		defer_delete(watch_item);
+	}
+}
+
+// Pool memory stays under the lock, boost::pool is not thread safe. Past
+// RECLAIM_MAX_BYTES or the reserved capacity blocks are freed in place.
+void Cache_Mgr::defer_free(void* p, uint32_t size) {
+	if (reclaim_bytes_ + size > RECLAIM_MAX_BYTES || reclaim_.blocks.size() == reclaim_.blocks.capacity()) {
+		reclaim_overflows_++;
+		::free(p);
+		return;
+	}
+	reclaim_.blocks.push_back(p);
+	reclaim_bytes_ += size;
+	reclaim_deferred_bytes_ += size;
+}
+
+void Cache_Mgr::defer_delete(Cache_Watch_Item* watch_item) {
+	if (reclaim_bytes_ + sizeof(Cache_Watch_Item) > RECLAIM_MAX_BYTES || reclaim_.watch_items.size() == reclaim_.watch_items.capacity()) {
+		reclaim_overflows_++;
+		delete watch_item;
+		return;
+	}
+	reclaim_.watch_items.push_back(watch_item);
+	reclaim_bytes_ += sizeof(Cache_Watch_Item);
+	reclaim_deferred_bytes_ += sizeof(Cache_Watch_Item);
+}
+
+#ifdef USING_COMPACT_ITEM
+Cache_Watch_Item* Cache_Mgr::get_watch_item(Cache_Item* it) {
+	if ((it->item_flag & ITEM_FLAG_WATCHED) == 0) {
+		return NULL;
+	}
+	return watch_items_[it];
+}
+
+void Cache_Mgr::set_watch_item(Cache_Item* it, Cache_Watch_Item* watch_item) {
+	if (watch_item != NULL) {
+		watch_items_[it] = watch_item;
+		it->item_flag |= ITEM_FLAG_WATCHED;
+	} else if ((it->item_flag & ITEM_FLAG_WATCHED) != 0) {
+		watch_items_.erase(it);
+		it->item_flag &= ~ITEM_FLAG_WATCHED;
+	}
+}
+#else
+Cache_Watch_Item* Cache_Mgr::get_watch_item(Cache_Item* it) {
+	return it->watch_item;
+}
+
+void Cache_Mgr::set_watch_item(Cache_Item* it, Cache_Watch_Item* watch_item) {
+	it->watch_item = watch_item;
+}
+#endif
+
 void Cache_Mgr::do_link(Cache_Item* it) {
+	drop_lease(it->group_id, it->get_key(), it->key_length, it->hash_value_);
 	cache_hash_map_.insert(it, it->hash_value_);
 
-	stats_.item_link(it->group_id, it->class_id, it->total_size());
+	part_stats_->item_link(it->group_id, it->class_id, it->total_size());
 
 	it->cache_id = get_cache_id();
-	it->last_update_time = curr_time_.get_current_time();
+	it->set_update_time(curr_time_.get_current_time());
 
-	it->ref_count++;
+	Cache_Group* group = group_link(it);
+	Cache_Watch_Item* watch_item = get_watch_item(it);
+	if (watch_item != NULL) {
+		group->watch_list.push_back(watch_item);
+	}
+
+	it->add_ref();
 	expire_list_[it->expiration_id].push_back(it);
 }
 
 void Cache_Mgr::do_unlink(Cache_Item* it, watch_notify_type type) {
 	assert(expire_list_[it->expiration_id].is_linked(it));
 
-	stats_.item_unlink(it->group_id, it->class_id, it->total_size());
+	part_stats_->item_unlink(it->group_id, it->class_id, it->total_size());
 
 	Cache_Key ck(it->group_id, it->get_key(), it->key_length);
 	cache_hash_map_.remove(&ck, it->hash_value_);
 
 	expire_list_[it->expiration_id].remove(it);
+	group_unlink(it);
 
-	if (it->watch_item != NULL) {
+	Cache_Watch_Item* watch_item = get_watch_item(it);
+	if (watch_item != NULL) {
 		notify_watch(it, type);
-		delete it->watch_item;
-		it->watch_item = NULL;
+		free_watch_item(watch_item);
+		set_watch_item(it, NULL);
 	}
+	feed_item(it, type);
 	do_release_reference(it);
 }
 
 void Cache_Mgr::do_unlink_flush(Cache_Item* it) {
 	assert(expire_list_[it->expiration_id].is_linked(it));
 
-	stats_.item_unlink(it->group_id, it->class_id, it->total_size());
+	part_stats_->item_unlink(it->group_id, it->class_id, it->total_size());
 	Cache_Key ck(it->group_id, it->get_key(), it->key_length);
 	cache_hash_map_.remove(&ck, it->hash_value_);
 
 	expire_list_[it->expiration_id].remove(it);
-	if (it->watch_item != NULL) {
+	group_unlink(it);
+	Cache_Watch_Item* watch_item = get_watch_item(it);
+	if (watch_item != NULL) {
 		notify_watch(it, WATCH_NOTIFY_TYPE_FLUSHED);
-		delete it->watch_item;
-		it->watch_item = NULL;
+		free_watch_item(watch_item);
+		set_watch_item(it, NULL);
+	}
+	flush_cache_list_.push_back(it);
+}
+
+void Cache_Mgr::do_release_reference(Cache_Item* it) {
+	assert(it->ref_count > 0);
+	if (it->release_ref() == 0) {
+		retire_item(it);
+	}
+}
+
+// An unlinked item may still be walked by a lock free get, so it is freed only
+// after every reader active at its unlink has left, two epochs later.
+void Cache_Mgr::retire_item(Cache_Item* it) {
+	memory_barrier();
+	if (!has_readers()) {
+		free_item(it);
+		return;
+	}
+	retire_list_[epoch_ % 3].push_back(it);
+	if (++retire_count_ >= RETIRE_ADVANCE_COUNT) {
+		advance_epoch();
+	}
+}
+
+bool Cache_Mgr::has_readers() {
+	for (Cache_Reader* r = reader_list_; r != NULL; r = r->next) {
+		if (r->epoch != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// fails while a reader is still in the previous epoch. The hits of the readers
+// are flushed on the way, an idle reader would keep them otherwise.
+bool Cache_Mgr::advance_epoch() {
+	for (Cache_Reader* r = reader_list_; r != NULL; r = r->next) {
+		if (r->hit_count > 0 && atomic_cas32(&r->busy, 0, 1)) {
+			flush_read_hits(r);
+			memory_barrier();
+			r->busy = 0;
+		}
+	}
+
+	uint32_t epoch = epoch_;
+	memory_barrier();
+	for (Cache_Reader* r = reader_list_; r != NULL; r = r->next) {
+		uint32_t e = r->epoch;
+		if (e != 0 && e != epoch) {
+			return false;
+		}
+	}
+	if (++epoch == 0) {
+		epoch = 1;
+	}
+	epoch_ = epoch;
+
+	xixi::list<Cache_Item>& safe_list = retire_list_[(epoch + 1) % 3];
+	Cache_Item* it = safe_list.pop_front();
+	while (it != NULL) {
+		retire_count_--;
+		free_item(it);
+		it = safe_list.pop_front();
+	}
+	return true;
+}
+
+Cache_Reader* Cache_Mgr::get_reader() {
+	Cache_Reader* r = reader_.get();
+	if (r == NULL) {
+		r = new Cache_Reader();
+		reader_.reset(r);
+		delta_list_lock_.lock();
+		r->next = reader_list_;
+		memory_barrier();
+		reader_list_ = r;
+		delta_list_lock_.unlock();
+	}
+	return r;
+}
+
+void Cache_Mgr::flush_read_hits(Cache_Reader* r) {
+	for (uint32_t i = 0; i < r->hit_count; i++) {
+		part_stats_->get_hit_no_watch(r->hits[i].group_id, r->hits[i].class_id, r->hits[i].bytes);
+	}
+	r->hit_count = 0;
+}
+
+// A fresh hit without cache_lock_. Everything else, including stale and flushed
+// items, is left to the locked path, as is the LRU position of the item.
+Cache_Item* Cache_Mgr::get_shared(uint32_t group_id, const uint8_t* key, uint32_t key_length,
+								  uint32_t hash_value, uint32_t&/*out*/ expiration) {
+	if (flushed_items_ != 0) {
+		return NULL;
+	}
+	Cache_Reader* r = get_reader();
+	r->epoch = epoch_;
+	memory_barrier();
+
+	Cache_Key ck(group_id, key, key_length);
+	Cache_Item* it = cache_hash_map_.find_shared(&ck, hash_value);
+	if (it != NULL) {
+		uint32_t expire_time = it->expire_time;
+		if (expire_time == 0) {
+			expiration = 0;
+		} else {
+			uint32_t currtime = curr_time_.get_current_time();
+			if (expire_time > currtime) {
+				expiration = expire_time - currtime;
+			} else {
+				it = NULL;
+			}
+		}
+		if (it != NULL && !it->try_add_ref()) {
+			it = NULL;
+		}
 	}
-	flush_cache_list_.push_back(it);
-}
 
-void Cache_Mgr::do_release_reference(Cache_Item* it) {
-	assert(it->ref_count > 0);
-	it->ref_count--;
-	if (it->ref_count == 0) {
-		free_item(it);
+	memory_barrier();
+	r->epoch = 0;
+
+	if (it != NULL) {
+		while (!atomic_cas32(&r->busy, 0, 1)) {
+			boost::this_thread::yield();
+		}
+		Cache_Read_Hit& hit = r->hits[r->hit_count++];
+		hit.group_id = group_id;
+		hit.class_id = it->class_id;
+		hit.bytes = it->total_size();
+		bool full = r->hit_count == READ_HIT_BATCH;
+		memory_barrier();
+		r->busy = 0;
+		if (full) {
+			lock_cache();
+			flush_read_hits(r);
+			unlock_cache();
+		}
 	}
+	return it;
 }
 
 void Cache_Mgr::do_replace(Cache_Item* it, Cache_Item* new_it) {
@@ -441,9 +1331,14 @@ Cache_Item* Cache_Mgr::do_get(uint32_t group_id, const uint8_t* key, uint32_t ke
 	Cache_Key ck(group_id, key, key_length);
 	Cache_Item* it = cache_hash_map_.find(&ck, hash_value);
 
+	if (it != NULL && is_flushed(it)) {
+		do_unlink(it, WATCH_NOTIFY_TYPE_FLUSHED);
+		it = NULL;
+	}
+
 	if (it != NULL) {
 		LOG_TRACE("Cache_Mgr.do_get, found, key " << string((char*)key, key_length));
-		it->ref_count++;
+		it->add_ref();
 	} else {
 		LOG_TRACE("Cache_Mgr.do_get, not found, key " << string((char*)key, key_length));
 	}
@@ -456,22 +1351,35 @@ Cache_Item* Cache_Mgr::do_get(uint32_t group_id, const uint8_t* key, uint32_t ke
 	Cache_Key ck(group_id, key, key_length);
 	Cache_Item* it = cache_hash_map_.find(&ck, hash_value);
 
+	if (it != NULL && is_flushed(it)) {
+		do_unlink(it, WATCH_NOTIFY_TYPE_FLUSHED);
+		it = NULL;
+	}
+
 	if (it != NULL) {
 		LOG_TRACE("Cache_Mgr.do_get, found, key " << string((char*)key, key_length));
 
 		if (it->expire_time == 0) {
-			it->ref_count++;
+			it->add_ref();
 			expiration = 0;
 		} else {
 			uint32_t currtime = curr_time_.get_current_time();
 			if (it->expire_time > currtime) {
-				it->ref_count++;
+				it->add_ref();
 				expiration = it->expire_time - currtime;
+			} else if (is_servable_stale(it, currtime)) {
+				// a stale value may be kept by clients for one more second only
+				it->add_ref();
+				expiration = 1;
+				part_stats_->stale_hit(it->group_id);
 			} else {
 				do_unlink(it, WATCH_NOTIFY_TYPE_EXPIRED);
 				it = NULL;
 			}
 		}
+		if (it != NULL) {
+			update_lru(it);
+		}
 	} else {
 		LOG_TRACE("Cache_Mgr.do_get, not found, key " << string((char*)key, key_length));
 	}
@@ -484,11 +1392,17 @@ Cache_Item* Cache_Mgr::do_get_touch(uint32_t group_id, const uint8_t* key, uint3
 	Cache_Key ck(group_id, key, key_length);
 	Cache_Item* it = cache_hash_map_.find(&ck, hash_value);
 
+	if (it != NULL && is_flushed(it)) {
+		do_unlink(it, WATCH_NOTIFY_TYPE_FLUSHED);
+		it = NULL;
+	}
+
 	if (it != NULL) {
 		LOG_TRACE("Cache_Mgr.do_get_touch, found, key " << string((char*)key, key_length));
 
-		it->ref_count++;
+		it->add_ref();
 		it->expire_time = curr_time_.realtime(expiration);
+		update_lru(it);
 	} else {
 		LOG_TRACE("Cache_Mgr.do_get_touch, not found, key " << string((char*)key, key_length));
 	}
@@ -496,12 +1410,22 @@ Cache_Item* Cache_Mgr::do_get_touch(uint32_t group_id, const uint8_t* key, uint3
 	return it;
 }
 
-Cache_Item* Cache_Mgr::alloc_item(uint32_t group_id, uint32_t key_length, uint32_t flags,
+// The item a set would replace is held while the quota is checked, so it is
+// not evicted to make room for its own successor.
+Cache_Item* Cache_Mgr::alloc_item(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t flags,
 								  uint32_t expiration, uint32_t data_size, uint32_t ext_size) {
 	Cache_Item* it;
-	cache_lock_.lock();
-	it = do_alloc(group_id, key_length, flags, curr_time_.realtime(expiration), data_size, ext_size);
-	cache_lock_.unlock();
+	lock_cache();
+	Cache_Item* old_it = do_get(group_id, key, key_length, hash_value);
+	it = do_alloc_value(group_id, key_length, flags, curr_time_.realtime(expiration), data_size, ext_size,
+		old_it != NULL ? old_it->total_size() : 0);
+	if (old_it != NULL) {
+		do_release_reference(old_it);
+	}
+	unlock_cache();
+	if (it != NULL) {
+		it->set_key_with_hash(key, hash_value);
+	}
 	return it;
 }
 
@@ -510,36 +1434,55 @@ Cache_Item*  Cache_Mgr::get(uint32_t group_id, const uint8_t* key, uint32_t key_
 	Cache_Item* item;
 	uint32_t hash_value = hash32(key, key_length, group_id);
 	reason = XIXI_REASON_SUCCESS;
-	cache_lock_.lock();
+	// sampled gets take the lock to feed hot_keys_ and move the item in the LRU
+	bool sampled = hot_keys_.sample();
+	if (settings_.lock_free_get && watch_id == 0 && !is_base && !sampled) {
+		item = get_shared(group_id, key, key_length, hash_value, expiration);
+		if (item != NULL) {
+			return item;
+		}
+	}
+	lock_cache();
 
+	Cache_Reader* r = reader_.get();
+	if (r != NULL && r->hit_count > 0) {
+		flush_read_hits(r);
+	}
 	item = do_get(group_id, key, key_length, hash_value, expiration);
-	if (item != NULL) {
+	if (sampled) {
+		hot_keys_.record(group_id, key, key_length, hash_value, item != NULL ? item->data_size : 0);
+	}
+	if (item != NULL && item->is_ref_full()) {
+		do_release_reference(item);
+		item = NULL;
+		reason = XIXI_REASON_PLEASE_TRY_AGAIN;
+	} else if (item != NULL) {
 		if (watch_id != 0) {
 			if (is_valid_watch_id(watch_id)) {
-				item->add_watch(watch_id);
-				stats_.get_hit_watch(group_id, item->class_id, item->total_size());
+				add_watch(item, watch_id);
+				part_stats_->get_hit_watch(group_id, item->class_id, item->total_size());
 			} else {
 				reason = XIXI_REASON_WATCH_NOT_FOUND;
-				stats_.get_hit_watch_miss(group_id, item->class_id);
+				part_stats_->get_hit_watch_miss(group_id, item->class_id);
 				do_release_reference(item);
 				item = NULL;
 			}
 		} else {
 			if (is_base) {
-				stats_.get_base_hit(item->group_id, item->class_id);
+				part_stats_->get_base_hit(item->group_id, item->class_id);
 			} else {
-				stats_.get_hit_no_watch(group_id, item->class_id, item->total_size());
+				part_stats_->get_hit_no_watch(group_id, item->class_id, item->total_size());
 			}
 		}
 	} else {
 		reason = XIXI_REASON_NOT_FOUND;
 		if (is_base) {
-			stats_.get_base_miss(group_id);
+			part_stats_->get_base_miss(group_id);
 		} else {
-			stats_.get_miss(group_id);
+			part_stats_->get_miss(group_id);
 		}
 	}
-	cache_lock_.unlock();
+	unlock_cache();
 	return item;
 }
 
@@ -548,28 +1491,35 @@ Cache_Item* Cache_Mgr::get_touch(uint32_t group_id, const uint8_t* key, uint32_t
 	Cache_Item* item;
 	uint32_t hash_value = hash32(key, key_length, group_id);
 	reason = XIXI_REASON_SUCCESS;
-	cache_lock_.lock();
+	lock_cache();
 
 	item = do_get_touch(group_id, key, key_length, hash_value, expiration);
-	if (item != NULL) {
+	if (hot_keys_.sample()) {
+		hot_keys_.record(group_id, key, key_length, hash_value, item != NULL ? item->data_size : 0);
+	}
+	if (item != NULL && item->is_ref_full()) {
+		do_release_reference(item);
+		item = NULL;
+		reason = XIXI_REASON_PLEASE_TRY_AGAIN;
+	} else if (item != NULL) {
 	  if (watch_id != 0) {
 		  if (is_valid_watch_id(watch_id)) {
-			  item->add_watch(watch_id);
-			  stats_.get_touch_hit_watch(group_id, item->class_id, item->total_size());
+			  add_watch(item, watch_id);
+			  part_stats_->get_touch_hit_watch(group_id, item->class_id, item->total_size());
 		  } else {
 			  reason = XIXI_REASON_WATCH_NOT_FOUND;
-			  stats_.get_touch_hit_watch_miss(group_id, item->class_id);
+			  part_stats_->get_touch_hit_watch_miss(group_id, item->class_id);
 			  do_release_reference(item);
 			  item = NULL;
 		  }
 	  } else {
-		  stats_.get_touch_hit_no_watch(group_id, item->class_id, item->total_size());
+		  part_stats_->get_touch_hit_no_watch(group_id, item->class_id, item->total_size());
 	  }
 	} else {
 		reason = XIXI_REASON_NOT_FOUND;
-		stats_.get_touch_miss(group_id);
+		part_stats_->get_touch_miss(group_id);
 	}
-	cache_lock_.unlock();
+	unlock_cache();
 	return item;
 }
 /*
@@ -578,7 +1528,7 @@ bool Cache_Mgr::get_base(uint32_t group_id, const uint8_t* key, uint32_t key_len
 	Cache_Item* it;
 	bool ret;
 	uint32_t hash_value = hash32(key, key_length, group_id);
-	cache_lock_.lock();
+	lock_cache();
 	it = do_get(group_id, key, key_length, hash_value, expiration);
 	if (it != NULL) {
 		cache_id = it->cache_id;
@@ -591,14 +1541,14 @@ bool Cache_Mgr::get_base(uint32_t group_id, const uint8_t* key, uint32_t key_len
 		} else {
 			ext_size = 0;
 		}
-		stats_.get_base_hit(it->group_id, it->class_id);
+		part_stats_->get_base_hit(it->group_id, it->class_id);
 		do_release_reference(it);
 		ret = true;
 	} else {
-		stats_.get_base_miss(group_id);
+		part_stats_->get_base_miss(group_id);
 		ret = false;
 	}
-	cache_lock_.unlock();
+	unlock_cache();
 	return ret;
 }
 */
@@ -607,30 +1557,31 @@ bool Cache_Mgr::update_flags(uint32_t group_id, const uint8_t* key, uint32_t key
 	bool ret = true;
 	cache_id = 0;
 	uint32_t hash_value = hash32(key, key_length, group_id);
-	cache_lock_.lock();
+	lock_cache();
 	it = do_get(group_id, key, key_length, hash_value);
 	if (it != NULL) {
 		if (pdu->cache_id == 0 || pdu->cache_id == it->cache_id) {
 			it->flags = pdu->flags;
-			if (it->watch_item != NULL) {
+			if (get_watch_item(it) != NULL) {
 				notify_watch(it, WATCH_NOTIFY_TYPE_BASE_INFO_UPDATED);
 			}
+			feed_item(it, WATCH_NOTIFY_TYPE_BASE_INFO_UPDATED);
 			it->cache_id = get_cache_id();
-			it->last_update_time = curr_time_.get_current_time();
+			it->set_update_time(curr_time_.get_current_time());
 
 			cache_id = it->cache_id;
-			stats_.update_flags_success(it->group_id, it->class_id);
+			part_stats_->update_flags_success(it->group_id, it->class_id);
 			do_release_reference(it);
 		} else {
 			cache_id = it->cache_id;
-			stats_.update_flags_mismatch(it->group_id, it->class_id);
+			part_stats_->update_flags_mismatch(it->group_id, it->class_id);
 			ret = false;
 		}
 	} else {
-		stats_.update_flags_miss(group_id);
+		part_stats_->update_flags_miss(group_id);
 		ret = false;
 	}
-	cache_lock_.unlock();
+	unlock_cache();
 	return ret;
 }
 
@@ -639,7 +1590,7 @@ bool Cache_Mgr::update_expiration(uint32_t group_id, const uint8_t* key, uint32_
 	bool ret = true;
 	cache_id = 0;
 	uint32_t hash_value = hash32(key, key_length, group_id);
-	cache_lock_.lock();
+	lock_cache();
 	it = do_get(group_id, key, key_length, hash_value);
 	if (it != NULL) {
 		if (pdu->cache_id == 0 || pdu->cache_id == it->cache_id) {
@@ -653,25 +1604,28 @@ bool Cache_Mgr::update_expiration(uint32_t group_id, const uint8_t* key, uint32_
 			it->expire_time = expire_time;
 
 			cache_id = it->cache_id;
-			stats_.update_expiration_success(it->group_id, it->class_id);
+			part_stats_->update_expiration_success(it->group_id, it->class_id);
 			do_release_reference(it);
 		} else {
 			cache_id = -1;
-			stats_.update_expiration_mismatch(it->group_id, it->class_id);
+			part_stats_->update_expiration_mismatch(it->group_id, it->class_id);
 			ret = false;
 		}
 	} else {
-		stats_.update_expiration_miss(group_id);
+		part_stats_->update_expiration_miss(group_id);
 		ret = false;
 	}
-	cache_lock_.unlock();
+	unlock_cache();
 	return ret;
 }
 
+// only the last reference takes the lock
 void Cache_Mgr::release_reference(Cache_Item* item) {
-	cache_lock_.lock();
-	do_release_reference(item);
-	cache_lock_.unlock();
+	if (item->release_ref() == 0) {
+		lock_cache();
+		retire_item(item);
+		unlock_cache();
+	}
 }
 
 #include <boost/filesystem.hpp>
@@ -694,7 +1648,7 @@ Cache_Item* Cache_Mgr::load_from_file(uint32_t group_id, const uint8_t* key, uin
 	uint32_t mime_type_length = 0;
 	const uint8_t* mime_type = settings_.get_mime_type((const uint8_t*)suffix, suffix_size, mime_type_length);
 
-	Cache_Item* item = alloc_item(group_id, key_length, 0,
+	Cache_Item* item = alloc_item(group_id, key, key_length, hash32(key, key_length, group_id), 0,
 		expiration, (uint32_t)file_size, mime_type_length);
 
 	if (item == NULL) {
@@ -708,8 +1662,15 @@ Cache_Item* Cache_Mgr::load_from_file(uint32_t group_id, const uint8_t* key, uin
 		return NULL;
 	}
 
-	memcpy(item->get_key(), key, key_length);
-	size_t count = fread(item->get_data(), (uint32_t)file_size, 1, file);
+	uint32_t offset = 0;
+	while (offset < item->data_size) {
+		uint32_t size;
+		uint8_t* data = item->get_data_segment(offset, size);
+		if (fread(data, size, 1, file) != 1) {
+			break;
+		}
+		offset += size;
+	}
 	fclose(file);
 	file = NULL;
 
@@ -717,28 +1678,28 @@ Cache_Item* Cache_Mgr::load_from_file(uint32_t group_id, const uint8_t* key, uin
 		item->set_ext(mime_type);
 	}
 
-	item->calc_hash_value();
-
 	reason = XIXI_REASON_SUCCESS;
+	uint64_t cache_id = 0;
 
-	cache_lock_.lock();
+	lock_cache();
 
 	Cache_Item* old_it = do_get(group_id, key, key_length, item->hash_value_);
 	if (old_it == NULL) {
 		if (watch_id != 0) {
 			if (is_valid_watch_id(watch_id)) {
-				item->add_watch(watch_id);
-				stats_.add_success_watch(item->group_id, item->class_id, item->total_size());
+				add_watch(item, watch_id);
+				part_stats_->add_success_watch(item->group_id, item->class_id, item->total_size());
 			} else {
-				stats_.add_watch_miss(item->group_id, item->class_id);
+				part_stats_->add_watch_miss(item->group_id, item->class_id);
 				reason = XIXI_REASON_WATCH_NOT_FOUND;
 			}
 		} else {
-			stats_.add_success(item->group_id, item->class_id, item->total_size());
+			part_stats_->add_success(item->group_id, item->class_id, item->total_size());
 		}
 
 		if (reason == XIXI_REASON_SUCCESS) {
 			do_link(item);
+			cache_id = item->cache_id;
 		} else {
 			do_release_reference(item);
 			item = NULL;
@@ -748,28 +1709,75 @@ Cache_Item* Cache_Mgr::load_from_file(uint32_t group_id, const uint8_t* key, uin
 		item = old_it;
 	}
 
-	cache_lock_.unlock();
+	unlock_cache();
+
+	if (cache_id != 0) {
+		file_monitor_.add_file_item(group_id, key, key_length, cache_id);
+	}
 
 	return item;
 }
 
+// Single flight for read-through loaders. Returns true if the caller is to load
+// the key and then call end_load. Otherwise a load of the key by another peer
+// was in flight, begin_load returns once it ended and reason is its result.
+bool Cache_Mgr::begin_load(uint32_t group_id, const uint8_t* key, uint32_t key_length, xixi_reason& reason) {
+	Cache_Key ck(group_id, key, key_length);
+	uint32_t hash_value = ck.hash_value();
+	lock_cache();
+	Cache_Load* load = load_map_.find(&ck, hash_value);
+	if (load == NULL) {
+		load = new Cache_Load(group_id, key, key_length);
+		load_map_.insert(load, hash_value);
+		unlock_cache();
+		return true;
+	}
+	load->waiters++;
+	part_stats_->load_wait(group_id);
+	while (!load->done) {
+		load_done_.wait(cache_lock_);
+	}
+	reason = load->reason;
+	if (--load->waiters == 0) {
+		delete load;
+	}
+	unlock_cache();
+	return false;
+}
+
+void Cache_Mgr::end_load(uint32_t group_id, const uint8_t* key, uint32_t key_length, xixi_reason reason) {
+	Cache_Key ck(group_id, key, key_length);
+	uint32_t hash_value = ck.hash_value();
+	lock_cache();
+	Cache_Load* load = load_map_.remove(&ck, hash_value);
+	assert(load != NULL);
+	if (load->waiters == 0) {
+		delete load;
+	} else {
+		load->done = true;
+		load->reason = reason;
+		load_done_.notify_all();
+	}
+	unlock_cache();
+}
+
 xixi_reason Cache_Mgr::add(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
 	xixi_reason reason = XIXI_REASON_SUCCESS;
 
-	cache_lock_.lock();
+	lock_cache();
 
 	Cache_Item* old_it = do_get(item->group_id, item->get_key(), item->key_length, item->hash_value_);
 	if (old_it == NULL) {
 		if (watch_id != 0) {
 			if (is_valid_watch_id(watch_id)) {
-				item->add_watch(watch_id);
-				stats_.add_success_watch(item->group_id, item->class_id, item->total_size());
+				add_watch(item, watch_id);
+				part_stats_->add_success_watch(item->group_id, item->class_id, item->total_size());
 			} else {
-				stats_.add_watch_miss(item->group_id, item->class_id);
+				part_stats_->add_watch_miss(item->group_id, item->class_id);
 				reason = XIXI_REASON_WATCH_NOT_FOUND;
 			}
 		} else {
-			stats_.add_success(item->group_id, item->class_id, item->total_size());
+			part_stats_->add_success(item->group_id, item->class_id, item->total_size());
 		}
 
 		if (reason == XIXI_REASON_SUCCESS) {
@@ -778,205 +1786,387 @@ xixi_reason Cache_Mgr::add(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/
 		}
 	} else {
 		do_release_reference(old_it);
-		stats_.add_fail(item->group_id, item->class_id);
+		part_stats_->add_fail(item->group_id, item->class_id);
 		reason = XIXI_REASON_EXISTS;
 	}
 
-	cache_lock_.unlock();
+	unlock_cache();
 	return reason;
 }
 
 xixi_reason Cache_Mgr::set(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
-	xixi_reason reason = XIXI_REASON_SUCCESS;
+	lock_cache();
+	xixi_reason reason = do_set(item, watch_id, cache_id);
+	unlock_cache();
+	return reason;
+}
 
-	cache_lock_.lock();
+xixi_reason Cache_Mgr::do_set(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
+	xixi_reason reason = XIXI_REASON_SUCCESS;
 
+	if (hot_keys_.sample()) {
+		hot_keys_.record(item->group_id, item->get_key(), item->key_length, item->hash_value_, item->data_size);
+	}
 	Cache_Item* old_it = do_get(item->group_id, item->get_key(), item->key_length, item->hash_value_);
 	if (old_it != NULL) {
 		//    LOG_ERROR("Cache_Mgr set, key " << string((char*)item->get_key(), item->key_length) << " hash_value=" << it->hash_value);
 		if (item->cache_id == 0 || item->cache_id == old_it->cache_id) {
 			if (watch_id != 0) {
 				if (is_valid_watch_id(watch_id)) {
-					stats_.set_success_watch(item->group_id, item->class_id, item->total_size());
+					part_stats_->set_success_watch(item->group_id, item->class_id, item->total_size());
 				} else {
-					stats_.set_watch_miss(item->group_id, item->class_id);
+					part_stats_->set_watch_miss(item->group_id, item->class_id);
 					reason = XIXI_REASON_WATCH_NOT_FOUND;
 				}
 			} else {
-				stats_.set_success(item->group_id, item->class_id, item->total_size());
+				part_stats_->set_success(item->group_id, item->class_id, item->total_size());
 			}
 			if (reason == XIXI_REASON_SUCCESS) {
 				do_replace(old_it, item);
 				// after notify last watch, then add new watch
 				if (watch_id != 0) {
-					item->add_watch(watch_id);
+					add_watch(item, watch_id);
 				}
 				cache_id = item->cache_id;
 			}
 		} else {
-			stats_.set_mismatch(item->group_id, item->class_id);
+			part_stats_->set_mismatch(item->group_id, item->class_id);
 			reason = XIXI_REASON_MISMATCH;
 		}
 		do_release_reference(old_it);
 	} else {
 		if (watch_id != 0) {
 			if (is_valid_watch_id(watch_id)) {
-				item->add_watch(watch_id);
-				stats_.set_success_watch(item->group_id, item->class_id, item->total_size());
+				add_watch(item, watch_id);
+				part_stats_->set_success_watch(item->group_id, item->class_id, item->total_size());
 			} else {
-				stats_.set_watch_miss(item->group_id, item->class_id);
+				part_stats_->set_watch_miss(item->group_id, item->class_id);
 				reason = XIXI_REASON_WATCH_NOT_FOUND;
 			}
 		} else {
-			stats_.set_success(item->group_id, item->class_id, item->total_size());
+			part_stats_->set_success(item->group_id, item->class_id, item->total_size());
 		}
 		if (reason == XIXI_REASON_SUCCESS) {
 			do_link(item);
 			cache_id = item->cache_id;
 		}
 	}
-	cache_lock_.unlock();
 	return reason;
 }
 
+// Grants a lease on a missing key. While the lease is held, other callers are
+// told to try again instead of all rebuilding the value.
+xixi_reason Cache_Mgr::get_lease(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t& lease_token) {
+	xixi_reason reason = XIXI_REASON_SUCCESS;
+	Cache_Key ck(group_id, key, key_length);
+	uint32_t hash_value = ck.hash_value();
+
+	lock_cache();
+	Cache_Item* it = do_get(group_id, key, key_length, hash_value);
+	if (it != NULL) {
+		// filled since the miss
+		do_release_reference(it);
+		reason = XIXI_REASON_PLEASE_TRY_AGAIN;
+	} else if (!do_grant_lease(group_id, key, key_length, hash_value, lease_token)) {
+		part_stats_->lease_retry(group_id);
+		reason = XIXI_REASON_PLEASE_TRY_AGAIN;
+	}
+	unlock_cache();
+	return reason;
+}
+
+// A get that also hands out leases. A miss is answered as get_lease does, a hit
+// on a stale or early expiring value may come with the lease to refresh it.
+Cache_Item* Cache_Mgr::lease_get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id,
+		uint32_t& expiration, uint64_t& lease_token, xixi_reason& reason) {
+	lease_token = 0;
+	Cache_Item* it = get(group_id, key, key_length, watch_id, false, expiration, reason);
+	if (it == NULL) {
+		if (reason == XIXI_REASON_NOT_FOUND) {
+			reason = get_lease(group_id, key, key_length, lease_token);
+		}
+		return NULL;
+	}
+	get_refresh_lease(it, lease_token);
+	return it;
+}
+
+// Hands out the lease to refresh a stale or early expiring item to one caller
+bool Cache_Mgr::get_refresh_lease(Cache_Item* it, uint64_t& lease_token) {
+	if (it->expire_time == 0 || settings_.group_stales.empty()) {
+		return false;
+	}
+	bool ret = false;
+	lock_cache();
+	if (needs_refresh(it) && do_grant_lease(it->group_id, it->get_key(), it->key_length, it->hash_value_, lease_token)) {
+		part_stats_->refresh_hint(it->group_id);
+		ret = true;
+	}
+	unlock_cache();
+	return ret;
+}
+
+// Grants the lease of the key unless another caller holds a live one
+bool Cache_Mgr::do_grant_lease(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint64_t& lease_token) {
+	uint32_t curr_time = curr_time_.get_current_time();
+	Cache_Key ck(group_id, key, key_length);
+	Cache_Lease* lease = lease_map_.find(&ck, hash_value);
+	if (lease != NULL && lease->expire_time > curr_time) {
+		return false;
+	}
+	if (lease == NULL) {
+		lease = new Cache_Lease(group_id, key, key_length);
+		lease_map_.insert(lease, hash_value);
+	} else {
+		lease_list_.remove(lease);
+	}
+	lease->token = get_cache_id();
+	lease->expire_time = curr_time + settings_.lease_timeout;
+	lease_list_.push_back(lease);
+	lease_token = lease->token;
+	part_stats_->lease_grant(group_id);
+	return true;
+}
+
+const Group_Stale* Cache_Mgr::get_group_stale(uint32_t group_id) {
+	if (settings_.group_stales.empty()) {
+		return NULL;
+	}
+	std::map<uint32_t, Group_Stale>::const_iterator gs = settings_.group_stales.find(group_id);
+	return (gs != settings_.group_stales.end()) ? &gs->second : NULL;
+}
+
+bool Cache_Mgr::is_servable_stale(Cache_Item* it, uint32_t curr_time) {
+	const Group_Stale* gs = get_group_stale(it->group_id);
+	return gs != NULL && it->expire_time + gs->grace > curr_time;
+}
+
+// Stale values always want a refresh. Before the expire time a refresh is
+// picked with the XFetch probability, exp(-remaining / early).
+bool Cache_Mgr::needs_refresh(Cache_Item* it) {
+	const Group_Stale* gs = get_group_stale(it->group_id);
+	if (gs == NULL) {
+		return false;
+	}
+	uint32_t curr_time = curr_time_.get_current_time();
+	if (it->expire_time <= curr_time) {
+		return true;
+	}
+	if (gs->early == 0) {
+		return false;
+	}
+	refresh_random_ ^= refresh_random_ << 13;
+	refresh_random_ ^= refresh_random_ >> 17;
+	refresh_random_ ^= refresh_random_ << 5;
+	double u = ((double)refresh_random_ + 1.0) / 4294967296.0;
+	return (double)(it->expire_time - curr_time) < -(double)gs->early * log(u);
+}
+
+// A set that only succeeds while lease_token is the live lease of the key
+xixi_reason Cache_Mgr::lease_set(Cache_Item* item, uint64_t lease_token, uint32_t watch_id, uint64_t& cache_id) {
+	xixi_reason reason;
+	uint32_t curr_time = curr_time_.get_current_time();
+	Cache_Key ck(item->group_id, item->get_key(), item->key_length);
+
+	lock_cache();
+	Cache_Lease* lease = lease_map_.find(&ck, item->hash_value_);
+	if (lease != NULL && lease->token == lease_token && lease->expire_time > curr_time) {
+		reason = do_set(item, watch_id, cache_id);
+	} else {
+		part_stats_->set_mismatch(item->group_id, item->class_id);
+		reason = XIXI_REASON_MISMATCH;
+	}
+	unlock_cache();
+	return reason;
+}
+
+void Cache_Mgr::drop_lease(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value) {
+	if (lease_map_.empty()) {
+		return;
+	}
+	Cache_Key ck(group_id, key, key_length);
+	Cache_Lease* lease = lease_map_.remove(&ck, hash_value);
+	if (lease != NULL) {
+		lease_list_.remove(lease);
+		delete lease;
+	}
+}
+
+void Cache_Mgr::expire_leases(uint32_t curr_time) {
+	Cache_Lease* lease = lease_list_.front();
+	while (lease != NULL && lease->expire_time <= curr_time) {
+		lease_list_.remove(lease);
+		lease_map_.remove(lease);
+		delete lease;
+		lease = lease_list_.front();
+	}
+}
+
 xixi_reason Cache_Mgr::replace(Cache_Item* it, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
 	xixi_reason reason = XIXI_REASON_SUCCESS;
 
-	cache_lock_.lock();
+	lock_cache();
 
 	Cache_Item* old_it = do_get(it->group_id, it->get_key(), it->key_length, it->hash_value_);
 
 	if (old_it == NULL) {
 		reason = XIXI_REASON_NOT_FOUND;
-		stats_.replace_miss(it->group_id);
+		part_stats_->replace_miss(it->group_id);
 	} else if (it->cache_id == 0 || it->cache_id == old_it->cache_id) {
 		if (watch_id != 0) {
 			if (is_valid_watch_id(watch_id)) {
-				stats_.replace_success_watch(it->group_id, it->class_id, it->total_size());
+				part_stats_->replace_success_watch(it->group_id, it->class_id, it->total_size());
 			} else {
-				stats_.replace_watch_miss(it->group_id, it->class_id);
+				part_stats_->replace_watch_miss(it->group_id, it->class_id);
 				reason = XIXI_REASON_WATCH_NOT_FOUND;
 			}
 		} else {
-			stats_.replace_success(old_it->group_id, old_it->class_id, it->total_size());
+			part_stats_->replace_success(old_it->group_id, old_it->class_id, it->total_size());
 		}
 		if (reason == XIXI_REASON_SUCCESS) {
 			do_replace(old_it, it);
 			// after notify last watch, then add new watch
 			if (watch_id != 0) {
-				it->add_watch(watch_id);
+				add_watch(it, watch_id);
 			}
 			cache_id = it->cache_id;
 		}
 		do_release_reference(old_it);
 	} else {
 		reason = XIXI_REASON_MISMATCH;
-		stats_.replace_mismatch(it->group_id, it->class_id);
+		part_stats_->replace_mismatch(it->group_id, it->class_id);
 		do_release_reference(old_it);
 	}
-	cache_lock_.unlock();
+	unlock_cache();
 	return reason;
 }
 
 xixi_reason Cache_Mgr::append(Cache_Item* it, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
 	xixi_reason reason = XIXI_REASON_SUCCESS;
 
-	cache_lock_.lock();
+	lock_cache();
 
 	Cache_Item* old_it = do_get(it->group_id, it->get_key(), it->key_length, it->hash_value_);
 	if (old_it != NULL) {
 		if (it->cache_id != 0 && it->cache_id != old_it->cache_id) {
-			stats_.append_mismatch(it->group_id, it->class_id);
+			part_stats_->append_mismatch(it->group_id, it->class_id);
 			reason = XIXI_REASON_MISMATCH;
+		} else if (old_it->is_compressed() || old_it->is_counter()) {
+			// compressed values and counters are not concatenated
+			part_stats_->append_mismatch(it->group_id, it->class_id);
+			reason = XIXI_REASON_INVALID_OPERATION;
+			do_release_reference(old_it);
 		} else {
-			Cache_Item* new_it = do_alloc(it->group_id, it->key_length, old_it->flags, old_it->expire_time, it->data_size + old_it->data_size, old_it->ext_size);
+			Cache_Item* new_it = NULL;
+			if (use_segments(old_it)) {
+				new_it = do_link_segments(old_it, old_it, it);
+			} else if (old_it->is_chunked()) {
+				new_it = do_append_chunks(old_it, it);
+			} else if ((uint64_t)it->data_size + old_it->data_size <= UINT32_C(0xFFFFFFFF)) {
+				new_it = do_alloc_value(it->group_id, it->key_length, old_it->flags, old_it->expire_time, it->data_size + old_it->data_size, old_it->ext_size, old_it->total_size());
+				if (new_it != NULL) {
+					new_it->write_data(0, old_it);
+					new_it->write_data(old_it->data_size, it);
+				}
+			}
 			if (new_it != NULL) {
 				new_it->set_key_with_hash(it->get_key(), it->hash_value_);
-				memcpy(new_it->get_data(), old_it->get_data(), old_it->data_size);
-				memcpy(new_it->get_data() + old_it->data_size, it->get_data(), it->data_size);
 				new_it->set_ext(old_it->get_ext());
 				if (watch_id != 0) {
 					if (is_valid_watch_id(watch_id)) {
-						stats_.append_success_watch(it->group_id, it->class_id, it->total_size());
+						part_stats_->append_success_watch(it->group_id, it->class_id, it->total_size());
 					} else {
-						stats_.append_watch_miss(it->group_id, it->class_id);
+						part_stats_->append_watch_miss(it->group_id, it->class_id);
 						reason = XIXI_REASON_WATCH_NOT_FOUND;
 					}
 				} else {
-					stats_.append_success(old_it->group_id, old_it->class_id, it->total_size());
+					part_stats_->append_success(old_it->group_id, old_it->class_id, it->total_size());
 				}
 				if (reason == XIXI_REASON_SUCCESS) {
 					do_replace(old_it, new_it);
 					// after notify last watch, then add new watch
 					if (watch_id != 0) {
-						it->add_watch(watch_id);
+						add_watch(it, watch_id);
 					}
 					cache_id = new_it->cache_id;
+					check_segments(new_it);
 				}
 				do_release_reference(new_it);
 			} else {
-				stats_.append_out_of_memory(it->group_id, it->class_id);
+				part_stats_->append_out_of_memory(it->group_id, it->class_id);
 				reason = XIXI_REASON_OUT_OF_MEMORY;
 			}
 			do_release_reference(old_it);
 		}
 	} else {
-		stats_.append_miss(it->group_id);
+		part_stats_->append_miss(it->group_id);
 		reason = XIXI_REASON_NOT_FOUND;
 	}
 
-	cache_lock_.unlock();
+	unlock_cache();
 	return reason;
 }
 
 xixi_reason Cache_Mgr::prepend(Cache_Item* it, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
 	xixi_reason reason = XIXI_REASON_SUCCESS;
 
-	cache_lock_.lock();
+	lock_cache();
 
 	Cache_Item* old_it = do_get(it->group_id, it->get_key(), it->key_length, it->hash_value_);
 	if (old_it != NULL) {
 		if (it->cache_id != 0 && it->cache_id != old_it->cache_id) {
-			stats_.prepend_mismatch(it->group_id, it->class_id);
+			part_stats_->prepend_mismatch(it->group_id, it->class_id);
 			reason = XIXI_REASON_MISMATCH;
+		} else if (old_it->is_compressed() || old_it->is_counter()) {
+			part_stats_->prepend_mismatch(it->group_id, it->class_id);
+			reason = XIXI_REASON_INVALID_OPERATION;
+			do_release_reference(old_it);
 		} else {
-			Cache_Item* new_it = do_alloc(it->group_id, it->key_length, old_it->flags, old_it->expire_time, it->data_size + old_it->data_size, old_it->ext_size);
+			Cache_Item* new_it = NULL;
+			if (use_segments(old_it)) {
+				new_it = do_link_segments(old_it, it, old_it);
+			} else if ((uint64_t)it->data_size + old_it->data_size <= UINT32_C(0xFFFFFFFF)) {
+				new_it = do_alloc_value(it->group_id, it->key_length, old_it->flags, old_it->expire_time, it->data_size + old_it->data_size, old_it->ext_size, old_it->total_size());
+				if (new_it != NULL) {
+					new_it->write_data(0, it);
+					new_it->write_data(it->data_size, old_it);
+				}
+			}
 			if (new_it != NULL) {
 				new_it->set_key_with_hash(it->get_key(), it->hash_value_);
-				memcpy(new_it->get_data(), it->get_data(), it->data_size);
-				memcpy(new_it->get_data() + it->data_size, old_it->get_data(), old_it->data_size);
 				new_it->set_ext(old_it->get_ext());
 				if (watch_id != 0) {
 					if (is_valid_watch_id(watch_id)) {
-						stats_.prepend_success_watch(it->group_id, it->class_id, it->total_size());
+						part_stats_->prepend_success_watch(it->group_id, it->class_id, it->total_size());
 					} else {
-						stats_.prepend_watch_miss(it->group_id, it->class_id);
+						part_stats_->prepend_watch_miss(it->group_id, it->class_id);
 						reason = XIXI_REASON_WATCH_NOT_FOUND;
 					}
 				} else {
-					stats_.prepend_success(old_it->group_id, old_it->class_id, it->total_size());
+					part_stats_->prepend_success(old_it->group_id, old_it->class_id, it->total_size());
 				}
 				if (reason == XIXI_REASON_SUCCESS) {
 					// after notify last watch, then add new watch
 					if (watch_id != 0) {
-						it->add_watch(watch_id);
+						add_watch(it, watch_id);
 					}
 					do_replace(old_it, new_it);
 					cache_id = new_it->cache_id;
+					check_segments(new_it);
 				}
 				do_release_reference(new_it);
 			} else {
-				stats_.prepend_out_of_memory(it->group_id, it->class_id);
+				part_stats_->prepend_out_of_memory(it->group_id, it->class_id);
 				reason = XIXI_REASON_OUT_OF_MEMORY;
 			}
 			do_release_reference(old_it);
 		}
 	} else {
-		stats_.prepend_miss(it->group_id);
+		part_stats_->prepend_miss(it->group_id);
 		reason = XIXI_REASON_NOT_FOUND;
 	}
 
-	cache_lock_.unlock();
+	unlock_cache();
 	return reason;
 }
 
@@ -984,149 +2174,277 @@ xixi_reason Cache_Mgr::remove(uint32_t group_id, const uint8_t* key, uint32_t ke
 	xixi_reason reason;
 	uint32_t hash_value = hash32(key, key_length, group_id);
 
-	cache_lock_.lock();
+	lock_cache();
 
+	drop_lease(group_id, key, key_length, hash_value);
 	Cache_Item* it = do_get(group_id, key, key_length, hash_value);
 	if (it != NULL) {
 		if (cache_id == 0 || cache_id == it->cache_id) {
-			stats_.delete_success(group_id, it->class_id);
+			part_stats_->delete_success(group_id, it->class_id);
 			do_unlink(it, WATCH_NOTIFY_TYPE_DELETED);
 			reason = XIXI_REASON_SUCCESS;
 		} else {
-			stats_.delete_mismatch(group_id, it->class_id);
+			part_stats_->delete_mismatch(group_id, it->class_id);
 			reason = XIXI_REASON_MISMATCH;
 		}
 		do_release_reference(it);
 	} else {
-		stats_.delete_miss(group_id);
+		part_stats_->delete_miss(group_id);
 		reason = XIXI_REASON_NOT_FOUND;
 	}
 
-	cache_lock_.unlock();
+	unlock_cache();
 	return reason;
 }
 
-#define INT64_MAX_STORAGE_LEN 25
+// The delta is published in the Cache_Delta of this thread and applied by
+// whichever thread takes cache_lock_ first, so concurrent deltas of a hot
+// counter cost one lock handoff per batch instead of one per delta. After
+// DELTA_COMBINE_SPINS failed attempts the thread waits for the lock instead.
+#define DELTA_COMBINE_SPINS 64
 xixi_reason Cache_Mgr::delta(uint32_t group_id, const uint8_t* key, uint32_t key_length, bool incr, int64_t delta, uint64_t&/*in and out*/ cache_id, int64_t&/*out*/ value) {
-	xixi_reason reason;
-	uint32_t hash_value = hash32(key, key_length, group_id);
-	cache_lock_.lock();
+	Cache_Delta* d = delta_.get();
+	if (d == NULL) {
+		d = new Cache_Delta();
+		delta_.reset(d);
+		delta_list_lock_.lock();
+		d->next = delta_list_;
+		memory_barrier();
+		delta_list_ = d;
+		delta_list_lock_.unlock();
+	}
+	d->group_id = group_id;
+	d->key = key;
+	d->key_length = key_length;
+	d->incr = incr;
+	d->delta = delta;
+	d->cache_id = cache_id;
+	memory_barrier();
+	d->pending = true;
+
+	if (reclaim_buf_.get() == NULL) {
+		reclaim_buf_.reset(new Cache_Reclaim());
+	}
+	uint32_t spins = 0;
+	while (d->pending) {
+		if (spins < DELTA_COMBINE_SPINS) {
+			spins++;
+			if (!cache_lock_.try_lock()) {
+				boost::this_thread::yield();
+				continue;
+			}
+		} else {
+			lock_cache();
+		}
+		combine_deltas();
+		unlock_cache();
+	}
+	memory_barrier();
+	cache_id = d->cache_id;
+	value = d->value;
+	return d->reason;
+}
 
-	Cache_Item* it = do_get(group_id, key, key_length, hash_value);
+void Cache_Mgr::combine_deltas() {
+	Cache_Delta* self = delta_.get();
+	for (Cache_Delta* d = delta_list_; d != NULL; d = d->next) {
+		if (d->pending) {
+			memory_barrier();
+			do_delta(d);
+			if (d != self) {
+				part_stats_->delta_combine(d->group_id);
+			}
+			memory_barrier();
+			d->pending = false;
+		}
+	}
+}
+
+// A text value becomes a counter item on its first delta, later deltas
+// change the counter in place and notify watches and feeds as a replace does.
+void Cache_Mgr::do_delta(Cache_Delta* d) {
+	uint32_t group_id = d->group_id;
+	uint32_t hash_value = hash32(d->key, d->key_length, group_id);
+
+	Cache_Item* it = do_get(group_id, d->key, d->key_length, hash_value);
 	if (it == NULL) {
-		cache_id = 0;
-		value = 0;
-		if (incr) {
-			stats_.incr_miss(group_id);
+		d->cache_id = 0;
+		d->value = 0;
+		if (d->incr) {
+			part_stats_->incr_miss(group_id);
 		} else {
-			stats_.decr_miss(group_id);
+			part_stats_->decr_miss(group_id);
 		}
-		reason = XIXI_REASON_NOT_FOUND;
-	} else if (cache_id == 0 || cache_id == it->cache_id) {
-		value = 0;
-		safe_toi64((char*)it->get_data(), it->data_size, value);
-		if (incr) {
-			value += delta;
+		d->reason = XIXI_REASON_NOT_FOUND;
+	} else if (d->cache_id == 0 || d->cache_id == it->cache_id) {
+		int64_t delta = d->incr ? d->delta : -d->delta;
+		d->reason = XIXI_REASON_SUCCESS;
+		if (it->is_counter()) {
+			d->value = atomic_add64(it->get_counter(), delta);
+			if (get_watch_item(it) != NULL) {
+				notify_watch(it, WATCH_NOTIFY_TYPE_DATA_UPDATED);
+			}
+			feed_item(it, WATCH_NOTIFY_TYPE_DATA_UPDATED);
+			it->cache_id = get_cache_id();
+			it->set_update_time(curr_time_.get_current_time());
+			d->cache_id = it->cache_id;
 		} else {
-			value -= delta;
-		}
-
-		char buf[INT64_MAX_STORAGE_LEN];
-		uint32_t data_size = _snprintf(buf, INT64_MAX_STORAGE_LEN, "%"PRId64, value);
-		if (data_size != it->data_size) {
-			Cache_Item* new_it = do_alloc(it->group_id, it->key_length, it->flags, it->expire_time, data_size, it->ext_size);
+			int64_t value = 0;
+			if (!it->is_chunked() && !it->is_segmented() && !it->is_compressed()) {
+				safe_toi64((char*)it->get_data(), it->data_size, value);
+			}
+			value += delta;
+			Cache_Item* new_it = do_alloc(it->group_id, it->key_length, it->flags, it->expire_time, COUNTER_DATA_SIZE, it->ext_size, it->total_size());
 			if (new_it == NULL) {
-				reason = XIXI_REASON_OUT_OF_MEMORY;
+				d->reason = XIXI_REASON_OUT_OF_MEMORY;
 			} else {
 				new_it->set_key_with_hash(it->get_key(), it->hash_value_);
-				memcpy(new_it->get_data(), buf, data_size);
+				new_it->item_flag |= ITEM_FLAG_COUNTER;
+				*new_it->get_counter() = value;
 				new_it->set_ext(it->get_ext());
 				do_replace(it, new_it);
-				cache_id = new_it->cache_id;
+				d->value = value;
+				d->cache_id = new_it->cache_id;
 				do_release_reference(new_it);
-				if (incr) {
-					stats_.incr_success(group_id);
-				} else {
-					stats_.decr_success(group_id);
-				}
-				reason = XIXI_REASON_SUCCESS;
 			}
-		} else {
-			it->cache_id = get_cache_id();
-			it->last_update_time = curr_time_.get_current_time();
-
-			memcpy(it->get_data(), buf, data_size);
-			cache_id = it->cache_id;
-			if (incr) {
-				stats_.incr_success(group_id);
+		}
+		if (d->reason == XIXI_REASON_SUCCESS) {
+			if (d->incr) {
+				part_stats_->incr_success(group_id);
 			} else {
-				stats_.decr_success(group_id);
+				part_stats_->decr_success(group_id);
 			}
-			reason = XIXI_REASON_SUCCESS;
 		}
 		do_release_reference(it);
 	} else {
-		cache_id = 0;
-		value = 0;
-		if (incr) {
-			stats_.incr_mismatch(group_id);
+		d->cache_id = 0;
+		d->value = 0;
+		if (d->incr) {
+			part_stats_->incr_mismatch(group_id);
 		} else {
-			stats_.decr_mismatch(group_id);
+			part_stats_->decr_mismatch(group_id);
 		}
-		reason = XIXI_REASON_MISMATCH;
+		d->reason = XIXI_REASON_MISMATCH;
 		do_release_reference(it);
 	}
-
-	cache_lock_.unlock();
-	return reason;
 }
 
-void Cache_Mgr::flush(uint32_t group_id, uint32_t&/*out*/ flush_count, uint64_t&/*out*/ flush_size) {
+// Every item of the group up to the returned flush_cache_id is flushed, 0 when
+// the group was empty. The feed event is left to the caller, see flush_feed.
+void Cache_Mgr::flush(uint32_t group_id, uint32_t&/*out*/ flush_count, uint64_t&/*out*/ flush_size, uint64_t&/*out*/ flush_cache_id) {
 	flush_count = 0;
 	flush_size = 0;
-	cache_lock_.lock();
-	for (int i = 0; i < 34; i++) {
-		Cache_Item* it = expire_list_[i].front();
-		while (it != NULL) {
-			Cache_Item* next = it->next();
-			if (it->group_id == group_id) {
-				flush_count++;
-				flush_size += it->total_size();
-				//  do_unlink_flush(it);
-				do_unlink(it, WATCH_NOTIFY_TYPE_FLUSHED);
-			}
-			it = next;
+	flush_cache_id = 0;
+	lock_cache();
+	Cache_Group* group = group_map_.find(&group_id, group_id);
+	if (group != NULL && group->curr_items > 0) {
+		flush_count = group->curr_items;
+		flush_size = group->curr_bytes;
+
+		// watched items are notified now, the rest is reclaimed by sweep_flushed_items
+		Cache_Watch_Item* wi = group->watch_list.pop_front();
+		while (wi != NULL) {
+			Cache_Item* it = wi->item;
+			notify_watch(it, WATCH_NOTIFY_TYPE_FLUSHED);
+			free_watch_item(wi);
+			set_watch_item(it, NULL);
+			wi = group->watch_list.pop_front();
+		}
+
+		if (group->flushed_items == 0) {
+			flushed_group_list_.push_back(group);
 		}
+		group->flushed_items += group->curr_items;
+		group->flushed_bytes += group->curr_bytes;
+		flushed_items_ += group->curr_items;
+		group->curr_items = 0;
+		group->curr_bytes = 0;
+		group->flush_cache_id = (uint64_t)atomic_load64(&last_cache_id_);
+		flush_cache_id = group->flush_cache_id;
 	}
-	stats_.flush(group_id);
-	cache_lock_.unlock();
+	part_stats_->flush(group_id);
+	unlock_cache();
 }
 
-uint32_t Cache_Mgr::get_watch_id() {
-	for (int i = 0; i < 100; i++) {
-		if (++last_watch_id_ == 0) {
-			last_watch_id_ = 1;
+void Cache_Mgr::flush_feed(uint32_t group_id, uint64_t flush_cache_id) {
+	lock_cache();
+	add_feed(group_id, flush_cache_id, 0, WATCH_NOTIFY_TYPE_FLUSHED);
+	unlock_cache();
+}
+
+Cache_Watch* Cache_Mgr::find_watch(uint32_t watch_id) {
+	uint32_t index = watch_id & WATCH_INDEX_MASK;
+	if ((index >> WATCH_BLOCK_BITS) >= watch_blocks_.size()) {
+		return NULL;
+	}
+	Cache_Watch* watch = watch_blocks_[index >> WATCH_BLOCK_BITS] + (index & (WATCH_BLOCK_SIZE - 1));
+	return (watch_id != 0 && watch->watch_id_ == watch_id) ? watch : NULL;
+}
+
+// Watch ids of a later partition are checked against watch_home_, a watch
+// freed between the check and the notify is dropped by notify_watch_ids.
+bool Cache_Mgr::is_valid_watch_id(uint32_t watch_id) {
+	if (watch_home_ == this) {
+		return find_watch(watch_id) != NULL;
+	}
+	watch_home_->lock_cache();
+	bool ret = watch_home_->find_watch(watch_id) != NULL;
+	watch_home_->unlock_cache();
+	return ret;
+}
+
+// Free slots are reused in FIFO order so a stale watch_id held by a client is
+// unlikely to match the next generation of its slot.
+Cache_Watch* Cache_Mgr::alloc_watch() {
+	if (free_watch_list_.empty()) {
+		uint32_t first = (uint32_t)watch_blocks_.size() << WATCH_BLOCK_BITS;
+		if (first > WATCH_INDEX_MASK) {
+			return NULL;
 		}
-		if (watch_map_.find(last_watch_id_) == watch_map_.end()) {
-			return last_watch_id_;
+		Cache_Watch* block = new (std::nothrow) Cache_Watch[WATCH_BLOCK_SIZE];
+		if (block == NULL) {
+			return NULL;
+		}
+		watch_blocks_.push_back(block);
+		// index 0 is never used, so no watch_id is 0
+		for (uint32_t i = (first == 0 ? 1 : 0); i < WATCH_BLOCK_SIZE; i++) {
+			block[i].index_ = first + i;
+			free_watch_list_.push_back(block + i);
 		}
 	}
-	return 0;
+	Cache_Watch* watch = free_watch_list_.pop_front();
+	watch->generation_ = (watch->generation_ + 1) & WATCH_GENERATION_MASK;
+	return watch;
 }
 
-bool Cache_Mgr::is_valid_watch_id(uint32_t watch_id) {
-	return watch_map_.find(watch_id) != watch_map_.end();
+void Cache_Mgr::free_watch(Cache_Watch* watch) {
+	watch_wheel_[watch->wheel_slot_].remove(watch);
+	watch->clear();
+	free_watch_list_.push_back(watch);
+	curr_watches_--;
+}
+
+void Cache_Mgr::link_watch(Cache_Watch* watch) {
+	uint32_t t = watch->expire_time_;
+	if (t <= last_expire_watch_time_) {
+		t = last_expire_watch_time_ + 1;
+	}
+	watch->wheel_slot_ = t % WATCH_WHEEL_SIZE;
+	watch_wheel_[watch->wheel_slot_].push_back(watch);
 }
 
 uint32_t Cache_Mgr::create_watch(uint32_t group_id, uint32_t max_next_check_interval) {
-	cache_lock_.lock();
-	uint32_t watch_id = get_watch_id();
-	if (watch_id != 0) {
-		boost::shared_ptr<Cache_Watch> sp(new Cache_Watch(watch_id, curr_time_.realtime(max_next_check_interval)));
-		watch_map_[watch_id] = sp;
-		stats_.create_watch(group_id);
+	uint32_t watch_id = 0;
+	lock_cache();
+	Cache_Watch* watch = alloc_watch();
+	if (watch != NULL) {
+		watch_id = (watch->generation_ << WATCH_INDEX_BITS) | watch->index_;
+		watch->init(watch_id, curr_time_.realtime(max_next_check_interval));
+		link_watch(watch);
+		curr_watches_++;
+		part_stats_->create_watch(group_id);
 	}
-	cache_lock_.unlock();
+	unlock_cache();
 	return watch_id;
 }
 
@@ -1134,56 +2452,257 @@ bool Cache_Mgr::check_watch_and_set_callback(boost::shared_ptr<Cache_Watch_Sink>
 											 uint32_t ack_sequence, uint32_t max_next_check_interval,
 											 uint32_t& sequence, std::vector<uint64_t>& updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list) {
 	 bool ret = true;
-	 cache_lock_.lock();
-	 std::map<uint32_t, boost::shared_ptr<Cache_Watch> >::iterator it = watch_map_.find(watch_id);
-	 if (it != watch_map_.end()) {
-		 it->second->check_and_set_callback(sp, ack_sequence, curr_time_.realtime(max_next_check_interval), sequence, updated_list, updated_type_list);
-		 stats_.check_watch(group_id);
+	 lock_cache();
+	 Cache_Watch* watch = find_watch(watch_id);
+	 if (watch != NULL) {
+		 watch->check_and_set_callback(sp, ack_sequence, curr_time_.realtime(max_next_check_interval), sequence, updated_list, updated_type_list,
+			 watch_wake_list_);
+		 watch_wheel_[watch->wheel_slot_].remove(watch);
+		 link_watch(watch);
+		 part_stats_->check_watch(group_id);
 	 } else {
 		 ret = false;
-		 stats_.check_watch_miss(group_id);
+		 part_stats_->check_watch_miss(group_id);
 	 }
-	 cache_lock_.unlock();
+	 unlock_cache();
 	 return ret;
 }
 
 bool Cache_Mgr::check_watch_and_clear_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t watch_id,
 											   uint32_t& sequence, std::vector<uint64_t>& updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list) {
 	bool ret = true;
-	cache_lock_.lock();
-	std::map<uint32_t, boost::shared_ptr<Cache_Watch> >::iterator it = watch_map_.find(watch_id);
-	if (it != watch_map_.end()) {
-		it->second->check_and_clear_callback(sp, sequence, updated_list, updated_type_list);
+	lock_cache();
+	Cache_Watch* watch = find_watch(watch_id);
+	if (watch != NULL) {
+		watch->check_and_clear_callback(sp, sequence, updated_list, updated_type_list);
 	} else {
 		ret = false;
 	}
-	cache_lock_.unlock();
+	unlock_cache();
 	return ret;
 }
 
+// The sinks are queued on this partition and woken by its unlock_cache.
 void Cache_Mgr::notify_watch(Cache_Item* item, watch_notify_type type) {
-	std::set<uint32_t>::iterator it = item->watch_item->watch_map.begin();
-	while (it != item->watch_item->watch_map.end()) {
-		uint32_t watch_id = *it;
-		std::map<uint32_t, boost::shared_ptr<Cache_Watch> >::iterator it2 = watch_map_.find(watch_id);
-		if (it2 != watch_map_.end()) {
-			it2->second->notify_watch(item->cache_id, type);
-			++it;
-		} else {
-			item->watch_item->watch_map.erase(it++);
+	Cache_Watch_Item* watch_item = get_watch_item(item);
+	if (watch_home_ == this) {
+		notify_watch_ids(watch_item, item->cache_id, type, watch_wake_list_);
+		return;
+	}
+	watch_home_->lock_cache();
+	watch_home_->notify_watch_ids(watch_item, item->cache_id, type, watch_wake_list_);
+	watch_home_->unlock_cache();
+}
+
+void Cache_Mgr::notify_watch_ids(Cache_Watch_Item* watch_item, uint64_t cache_id, watch_notify_type type, Cache_Watch_Wake_List& wake_list) {
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < watch_item->size; i++) {
+		uint32_t watch_id = watch_item->watch_ids[i];
+		Cache_Watch* watch = find_watch(watch_id);
+		if (watch != NULL) {
+			watch->notify_watch(cache_id, type, wake_list);
+			watch_item->watch_ids[size++] = watch_id;
 		}
 	}
+	watch_item->size = size;
 }
 
+// Only the wheel buckets of the seconds passed since the last call are visited.
+// A watch expiring more than WATCH_WHEEL_SIZE seconds ahead stays in its bucket
+// until a later round.
 void Cache_Mgr::expire_watchs(uint32_t curr_time) {
 	//  LOG_INFO("Cache_Mgr::expire_watchs curr_time=" << curr_time);
-	std::map<uint32_t, boost::shared_ptr<Cache_Watch> >::iterator it = watch_map_.begin();
-	while (it != watch_map_.end()) {
-		if (it->second->is_expired(curr_time)) {
-			watch_map_.erase(it++);
+	if (curr_time <= last_expire_watch_time_) {
+		return;
+	}
+	uint32_t count = curr_time - last_expire_watch_time_;
+	if (count > WATCH_WHEEL_SIZE) {
+		count = WATCH_WHEEL_SIZE;
+	}
+	last_expire_watch_time_ = curr_time;
+	for (uint32_t t = curr_time - count + 1; count > 0; t++, count--) {
+		xixi::list<Cache_Watch>& bucket = watch_wheel_[t % WATCH_WHEEL_SIZE];
+		Cache_Watch* watch = bucket.front();
+		while (watch != NULL) {
+			Cache_Watch* next = bucket.next(watch);
+			if (watch->is_expired(curr_time)) {
+				free_watch(watch);
+			}
+			watch = next;
+		}
+	}
+}
+
+// Items removed because their group was flushed are covered by the flush event.
+void Cache_Mgr::feed_item(Cache_Item* it, watch_notify_type type) {
+	if (type == WATCH_NOTIFY_TYPE_FLUSHED) {
+		return;
+	}
+	add_feed(it->group_id, it->cache_id, it->hash_value_, type);
+}
+
+void Cache_Mgr::add_feed(uint32_t group_id, uint64_t cache_id, uint32_t key_hash, watch_notify_type type) {
+	Cache_Mgr* home = watch_home_;
+	if (home->curr_feeds_ == 0) {
+		return;
+	}
+	if (home != this) {
+		home->lock_cache();
+	}
+	Cache_Feed* feed = home->feed_map_.find(&group_id, group_id);
+	if (feed != NULL) {
+		home->add_feed_event(feed, cache_id, key_hash, type, watch_wake_list_);
+	}
+	if (home != this) {
+		home->unlock_cache();
+	}
+}
+
+void Cache_Mgr::add_feed_event(Cache_Feed* feed, uint64_t cache_id, uint32_t key_hash, watch_notify_type type, Cache_Watch_Wake_List& wake_list) {
+	XIXI_Feed_Event& e = feed->ring[feed->next_sequence % feed->ring.size()];
+	e.cache_id = cache_id;
+	e.key_hash = key_hash;
+	e.type = type;
+	feed->next_sequence++;
+	for (size_t i = 0; i < feed->waiters.size(); i++) {
+		wake_list.push_back(Cache_Watch_Wake());
+		wake_list.back().sink.swap(feed->waiters[i]);
+		wake_list.back().watch_id = 0;
+	}
+	feed->waiters.clear();
+}
+
+bool Cache_Mgr::check_feed(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t group_id, uint64_t sequence, uint32_t max_count, bool wait,
+						   uint64_t& first_sequence, uint64_t& next_sequence, std::vector<XIXI_Feed_Event>& events) {
+	if (settings_.feed_size == 0) {
+		return false;
+	}
+	uint32_t curr_time = curr_time_.get_current_time();
+	lock_cache();
+	Cache_Feed* feed = feed_map_.find(&group_id, group_id);
+	if (feed == NULL) {
+		feed = new Cache_Feed(group_id, settings_.feed_size);
+		feed_map_.insert(feed, group_id);
+		feed_list_.push_back(feed);
+		curr_feeds_++;
+	} else {
+		feed_list_.move_to_back(feed);
+	}
+	feed->last_check_time = curr_time;
+
+	next_sequence = feed->next_sequence;
+	if (sequence == 0 || sequence > next_sequence) {
+		first_sequence = next_sequence;
+	} else {
+		first_sequence = sequence < feed->first_sequence() ? feed->first_sequence() : sequence;
+		uint64_t count = next_sequence - first_sequence;
+		if (count > max_count) {
+			count = max_count;
+			next_sequence = first_sequence + count;
+		}
+		for (uint64_t s = first_sequence; s < next_sequence; s++) {
+			events.push_back(feed->ring[s % feed->ring.size()]);
+		}
+	}
+
+	if (wait && events.empty() && first_sequence == sequence) {
+		// drop closed connections and an earlier wait of this one
+		boost::weak_ptr<Cache_Watch_Sink> wp(sp);
+		size_t n = 0;
+		for (size_t i = 0; i < feed->waiters.size(); i++) {
+			boost::weak_ptr<Cache_Watch_Sink>& w = feed->waiters[i];
+			if (!w.expired() && (w < wp || wp < w)) {
+				feed->waiters[n++].swap(w);
+			}
+		}
+		feed->waiters.resize(n);
+		feed->waiters.push_back(wp);
+	}
+	unlock_cache();
+	return true;
+}
+
+void Cache_Mgr::expire_feeds(uint32_t curr_time) {
+	Cache_Feed* feed = feed_list_.front();
+	while (feed != NULL && feed->last_check_time + FEED_IDLE_TIMEOUT <= curr_time) {
+		feed_list_.remove(feed);
+		feed_map_.remove(feed);
+		delete feed;
+		curr_feeds_--;
+		feed = feed_list_.front();
+	}
+}
+
+void Cache_Mgr::sweep_flushed_items() {
+	uint32_t count = 0;
+	Cache_Group* group = flushed_group_list_.front();
+	while (group != NULL && count < FLUSH_SWEEP_MAX_COUNT) {
+		// stale items are always at the front of item_list
+		Cache_Item* it = group->item_list.front();
+		assert(it != NULL && it->cache_id <= group->flush_cache_id);
+		do_unlink(it, WATCH_NOTIFY_TYPE_FLUSHED);
+		count++;
+		group = flushed_group_list_.front();
+	}
+}
+
+void Cache_Mgr::trim_over_quota_groups() {
+	uint32_t count = 0;
+	uint32_t class_id;
+	Cache_Group* group = quota_group_list_.front();
+	while (group != NULL && count < QUOTA_TRIM_MAX_COUNT) {
+		if (group->is_over_quota() && evict_item(group, class_id)) {
+			count++;
 		} else {
-			++it;
+			group = quota_group_list_.next(group);
+		}
+	}
+}
+
+void Cache_Mgr::set_group_quota(uint32_t group_id, uint64_t max_bytes) {
+	lock_cache();
+	Cache_Group* group = group_map_.find(&group_id, group_id);
+	if (group == NULL && max_bytes > 0) {
+		group = get_group(group_id);
+	}
+	if (group != NULL) {
+		if (max_bytes > 0 && group->max_bytes == 0) {
+			quota_group_list_.push_back(group);
+		} else if (max_bytes == 0 && group->max_bytes > 0) {
+			quota_group_list_.remove(group);
+		}
+		group->max_bytes = max_bytes;
+		if (group->empty()) {
+			group_map_.remove(group);
+			delete group;
+		}
+	}
+	unlock_cache();
+}
+
+void Cache_Mgr::get_group_stats(uint32_t group_id, std::string& out, const Cache_Group* others) {
+	Cache_Group* group = group_map_.find(&group_id, group_id);
+	if (group != NULL || others != NULL) {
+		Cache_Group sum(group_id);
+		if (group != NULL) {
+			sum.curr_items = group->curr_items;
+			sum.curr_bytes = group->curr_bytes;
+			sum.flushed_items = group->flushed_items;
+			sum.flushed_bytes = group->flushed_bytes;
+			sum.max_bytes = group->max_bytes;
+		}
+		if (others != NULL) {
+			sum.curr_items += others->curr_items;
+			sum.curr_bytes += others->curr_bytes;
+			sum.flushed_items += others->flushed_items;
+			sum.flushed_bytes += others->flushed_bytes;
+			sum.max_bytes += others->max_bytes;
 		}
+		Group_Stats_Item::append("group_items", sum.curr_items, out);
+		Group_Stats_Item::append("group_bytes", sum.curr_bytes, out);
+		Group_Stats_Item::append("group_flushed_items", sum.flushed_items, out);
+		Group_Stats_Item::append("group_flushed_bytes", sum.flushed_bytes, out);
+		Group_Stats_Item::append("group_max_bytes", sum.max_bytes, out);
 	}
 }
 
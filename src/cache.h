@@ -18,6 +18,9 @@
 #define CACHE_H
 
 // #define USING_BOOST_POOL
+// Drops the per-item watch pointer and update time. Watched items are found
+// through Cache_Mgr::watch_items_ instead, see ITEM_FLAG_WATCHED.
+// #define USING_COMPACT_ITEM
 
 #include "defines.h"
 #include "util.h"
@@ -25,30 +28,66 @@
 #include "xixi_list.hpp"
 #include "xixi_hash_map.hpp"
 #include "hash.h"
+#include "codec.h"
+#include "atomic.h"
+#include "stats.h"
 #ifdef USING_BOOST_POOL
 #include <boost/pool/pool.hpp>
 #endif
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/smart_ptr/weak_ptr.hpp>
+#include <boost/thread/tss.hpp>
+
+struct Group_Stale;
 
 class Cache_Watch_Sink {
 public:
 	virtual void on_cache_watch_notify(uint32_t watch_id) = 0;
 };
 
-class Cache_Watch {
+// A sink to wake once cache_lock_ is released, see Cache_Mgr::unlock_cache.
+struct Cache_Watch_Wake {
+	boost::weak_ptr<Cache_Watch_Sink> sink;
+	uint32_t watch_id;
+};
+
+typedef std::vector<Cache_Watch_Wake> Cache_Watch_Wake_List;
+
+// watch_id is the generation of the slot in the high bits and the slot index in the low bits
+#define WATCH_INDEX_BITS 20
+#define WATCH_INDEX_MASK ((UINT32_C(1) << WATCH_INDEX_BITS) - 1)
+#define WATCH_GENERATION_MASK (UINT32_C(0xFFFFFFFF) >> WATCH_INDEX_BITS)
+#define WATCH_BLOCK_BITS 8
+#define WATCH_BLOCK_SIZE (1 << WATCH_BLOCK_BITS)
+#define WATCH_WHEEL_SIZE 1024
+
+// Watches live in blocks of WATCH_BLOCK_SIZE slots that are never freed. A free
+// slot has watch_id_ 0 and sits on Cache_Mgr::free_watch_list_, a used one is
+// linked into the expire wheel bucket of its expire time.
+class Cache_Watch : public xixi::list_node_base<Cache_Watch> {
+	friend class Cache_Mgr;
 public:
-	Cache_Watch(uint32_t watch_id, uint32_t expire_time_);
+	Cache_Watch();
+	void init(uint32_t watch_id, uint32_t expire_time);
+	void clear();
 	void check_and_set_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t ack_sequence, uint32_t expire_time,
-		uint32_t&/*out*/ sequence, std::vector<uint64_t>&/*out*/ updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list);
+		uint32_t&/*out*/ sequence, std::vector<uint64_t>&/*out*/ updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list,
+		Cache_Watch_Wake_List&/*out*/ wake_list);
 	void check_and_clear_callback(boost::shared_ptr<Cache_Watch_Sink>& sp,
 		uint32_t&/*out*/ sequence, std::vector<uint64_t>& updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list);
-	void notify_watch(uint64_t cache_id, watch_notify_type type);
+	void notify_watch(uint64_t cache_id, watch_notify_type type, Cache_Watch_Wake_List&/*out*/ wake_list);
 	bool is_expired(uint32_t current_time) {
 		return current_time >= expire_time_;
 	}
 
 private:
+	void wake_sink(Cache_Watch_Wake_List& wake_list) {
+		wake_list.push_back(Cache_Watch_Wake());
+		wake_list.back().sink.swap(wp_);
+		wake_list.back().watch_id = watch_id_;
+		has_sink_ = false;
+	}
 	uint32_t next_sequence() {
 		sequence_++;
 		if (sequence_ == 0) {
@@ -57,9 +96,12 @@ private:
 		return sequence_;
 	}
 	uint32_t watch_id_;
-	uint32_t max_check_interval_;
+	uint32_t index_;
+	uint32_t generation_;
 	uint32_t expire_time_;
+	uint32_t wheel_slot_;
 	uint32_t sequence_;
+	bool has_sink_;
 	std::vector<uint64_t> updated_list_;
 	std::vector<uint64_t> wait_updated_list_;
 	std::vector<watch_notify_type> updated_type_list_;
@@ -67,14 +109,169 @@ private:
 	boost::weak_ptr<Cache_Watch_Sink> wp_;
 };
 
-class Cache_Watch_Item {
+class Cache_Item;
+
+#define WATCH_ITEM_INLINE_SIZE 4
+#define WATCH_ITEM_FREE_MAX 4096
+
+// The watch ids of a watched item. Items rarely have more than a few watchers,
+// so ids are kept inline and only spill into a heap array beyond that. Ids of
+// freed watches are dropped the next time the item is notified.
+class Cache_Watch_Item : public xixi::list_node_base<Cache_Watch_Item> {
 public:
-	void add_watch(uint32_t watch_id) {
-		watch_map.insert(watch_id);
+	Cache_Watch_Item() : item(NULL), size(0), capacity(WATCH_ITEM_INLINE_SIZE), watch_ids(inline_ids) {}
+	~Cache_Watch_Item() {
+		reset();
 	}
-	std::set<uint32_t> watch_map;
+	void add_watch(uint32_t watch_id);
+	void reset() {
+		if (watch_ids != inline_ids) {
+			delete[] watch_ids;
+			watch_ids = inline_ids;
+			capacity = WATCH_ITEM_INLINE_SIZE;
+		}
+		item = NULL;
+		size = 0;
+	}
+	Cache_Item* item;
+	uint32_t size;
+	uint32_t capacity;
+	uint32_t* watch_ids;
+	uint32_t inline_ids[WATCH_ITEM_INLINE_SIZE];
 };
 
+#define FEED_IDLE_TIMEOUT 300
+
+// Recent changes of a group, kept while a connection follows the group through
+// XIXI_CHOICE_CHECK_FEED_REQ. Event n is ring[n % ring.size()], so only the last
+// ring.size() events are available. A group flush is a single event carrying
+// the flush cache_id, items it removes are not reported one by one.
+class Cache_Feed : public xixi::hash_node_base<uint32_t, Cache_Feed>, public xixi::list_node_base<Cache_Feed> {
+public:
+	Cache_Feed(uint32_t id, uint32_t size) : ring(size) {
+		group_id = id;
+		next_sequence = 1;
+		last_check_time = 0;
+	}
+	inline bool is_key(const uint32_t* p) const { return group_id == *p; }
+	inline uint64_t first_sequence() const {
+		return next_sequence > ring.size() ? next_sequence - ring.size() : 1;
+	}
+
+	uint32_t group_id;
+	uint64_t next_sequence;
+	uint32_t last_check_time;
+	std::vector<XIXI_Feed_Event> ring;
+	std::vector<boost::weak_ptr<Cache_Watch_Sink> > waiters;
+};
+
+#define GROUP_LIST_FLUSHED 0
+#define GROUP_LIST_QUOTA 1
+#define ITEM_LIST_GROUP 1
+
+// Per-group bookkeeping. A flush only raises flush_cache_id; linked items whose
+// cache_id is not greater than it are stale and get reclaimed lazily.
+// item_list keeps the group's items in LRU order, stale items always first.
+class Cache_Group : public xixi::hash_node_base<uint32_t, Cache_Group>, public xixi::list_node_base<Cache_Group, 2> {
+public:
+	Cache_Group(uint32_t id) {
+		group_id = id;
+		flush_cache_id = 0;
+		curr_items = 0;
+		curr_bytes = 0;
+		flushed_items = 0;
+		flushed_bytes = 0;
+		max_bytes = 0;
+	}
+	inline bool is_key(const uint32_t* p) const { return group_id == *p; }
+	inline bool empty() const { return curr_items == 0 && flushed_items == 0 && max_bytes == 0; }
+	inline uint64_t used_bytes() const { return curr_bytes + flushed_bytes; }
+	inline bool is_over_quota() const { return max_bytes > 0 && used_bytes() > max_bytes; }
+
+	uint32_t group_id;
+	uint64_t flush_cache_id;
+	uint32_t curr_items;
+	uint64_t curr_bytes;
+	uint32_t flushed_items;
+	uint64_t flushed_bytes;
+	uint64_t max_bytes;
+	xixi::list<Cache_Item, ITEM_LIST_GROUP> item_list;
+	xixi::list<Cache_Watch_Item> watch_list;
+};
+
+// Counters of the other partitions, added to those of the first when a stats
+// request is answered, see Cache_Router::stats.
+class Cache_Stats_Merge {
+public:
+	Cache_Stats_Merge(uint32_t group_id) : group(group_id) {
+	}
+	Group_Stats_Item stats;
+	Cache_Group group;
+};
+
+// Response header fields of an item rendered once by Peer_Http, only Expiration
+// varies per request. data holds "<mime>\r\n", "Content-Length: ..\r\n",
+// "CacheID: ..\r\nFlags: ..\r\nExpiration: " and "ETag: ..\r\n\r\n" back to back.
+// A template rendered for an older cache_id stays chained until the item is freed,
+// since responses still being written may reference it.
+struct Http_Header_Template {
+	Http_Header_Template* next;
+	uint64_t cache_id;
+	uint32_t size;
+	uint16_t depth;
+	uint16_t mime_type_length;
+	uint16_t content_length_offset;
+	uint16_t cache_id_offset;
+	uint16_t etag_offset;
+	uint16_t etag_value_length;
+	char data[1];
+};
+
+#define HTTP_HEADER_TEMPLATE_SIZE(data_size) (sizeof(Http_Header_Template) + (data_size))
+#define HTTP_HEADER_TEMPLATE_MAX_DEPTH 4
+
+#define ITEM_FLAG_CHUNKED 1
+#define ITEM_FLAG_WATCHED 2
+#define ITEM_FLAG_COUNTER 4
+#define ITEM_FLAG_SEGMENTED 8
+// the high bits of item_flag hold the codec id of a compressed value
+#define ITEM_FLAG_CODEC_SHIFT 4
+
+// set in ref_count while Cache_Mgr changes a linked item in place
+#define ITEM_REF_EXCLUSIVE 0x8000
+// gets stop taking references here, short of ITEM_REF_EXCLUSIVE, and leave
+// the rest to the references Cache_Mgr takes itself
+#define ITEM_REF_MAX 0x7F00
+
+// The data of a counter item is a native int64, aligned within the data and
+// changed in place by Cache_Mgr::delta. Gets render it as decimal text.
+#define COUNTER_DATA_SIZE (sizeof(int64_t) * 2 - 1)
+#define COUNTER_TEXT_SIZE 24
+
+// Data of a chunked item, kept behind the key and ext of the item header.
+// Every chunk is an unlinked item of chunk_size bytes except the last, which
+// may come from a smaller class. Chunks are reference counted and shared by
+// the versions an append creates.
+struct Cache_Chunk_Table {
+	uint32_t count;
+	uint32_t chunk_size;
+	Cache_Item* chunks[1];
+};
+
+#define CHUNK_TABLE_SIZE(count) (sizeof(Cache_Chunk_Table) + ((count) - 1) * sizeof(Cache_Item*))
+#define CHUNK_TABLE_OFFSET(key_length, ext_size) (((key_length) + (ext_size) + 7) & ~7)
+
+// Data of a segmented item, kept where the chunk table of a chunked item is.
+// Append and prepend link the old value and the new bytes as segments instead
+// of copying them. A segment is the whole data of an unlinked plain or chunked
+// item, shared by reference by the versions that contain it and never changed.
+struct Cache_Segment_Table {
+	uint32_t count;
+	Cache_Item* segments[1];
+};
+
+#define SEGMENT_TABLE_SIZE(count) (sizeof(Cache_Segment_Table) + ((count) - 1) * sizeof(Cache_Item*))
+
 struct Cache_Key {
 	Cache_Key() : group_id(0), size(0), data(NULL) {}
 	Cache_Key(uint32_t g, const void* d, uint32_t s) {
@@ -93,17 +290,149 @@ struct Cache_Key {
 	const void* data;
 };
 
-class Cache_Item : public xixi::list_node_base<Cache_Item>, public xixi::hash_node_base<Cache_Key, Cache_Item> {
+// A delta published by its thread for whichever thread holds cache_lock_ next,
+// see Cache_Mgr::delta. Every thread owns one for its lifetime.
+class Cache_Delta {
+public:
+	Cache_Delta() {
+		next = NULL;
+		pending = false;
+		group_id = 0;
+		key = NULL;
+		key_length = 0;
+		incr = false;
+		delta = 0;
+		cache_id = 0;
+		value = 0;
+		reason = XIXI_REASON_SUCCESS;
+	}
+	Cache_Delta* next;
+	volatile bool pending;
+	uint32_t group_id;
+	const uint8_t* key;
+	uint32_t key_length;
+	bool incr;
+	int64_t delta;
+	uint64_t cache_id;
+	int64_t value;
+	xixi_reason reason;
+};
+
+// Memory released under cache_lock_ is queued here and freed once the lock is
+// dropped, see Cache_Mgr::unlock_cache. Each thread keeps a spare one so the
+// queue swaps in without allocating under the lock. The vectors are reserved
+// up front and never grow under the lock, a full queue frees in place.
+#define RECLAIM_RESERVE 1024
+
+class Cache_Reclaim {
+public:
+	Cache_Reclaim() {
+		blocks.reserve(RECLAIM_RESERVE);
+		watch_items.reserve(RECLAIM_RESERVE);
+	}
+	inline bool empty() const { return blocks.empty() && watch_items.empty(); }
+	inline void swap(Cache_Reclaim& r) {
+		blocks.swap(r.blocks);
+		watch_items.swap(r.watch_items);
+	}
+	void release() {
+		for (size_t i = 0; i < blocks.size(); i++) {
+			::free(blocks[i]);
+		}
+		for (size_t i = 0; i < watch_items.size(); i++) {
+			delete watch_items[i];
+		}
+		blocks.clear();
+		watch_items.clear();
+	}
+	std::vector<void*> blocks;
+	std::vector<Cache_Watch_Item*> watch_items;
+};
+
+// hits of the lock free get path are counted here and added to stats_ in batches
+#define READ_HIT_BATCH 64
+
+struct Cache_Read_Hit {
+	uint32_t group_id;
+	uint32_t class_id;
+	uint32_t bytes;
+};
+
+// The lock free get path of a thread, see Cache_Mgr::get. Every thread owns one
+// for its lifetime, like Cache_Delta.
+class Cache_Reader {
+public:
+	Cache_Reader() {
+		next = NULL;
+		epoch = 0;
+		busy = 0;
+		hit_count = 0;
+	}
+	Cache_Reader* next;
+	volatile uint32_t epoch; // the global epoch while reading, 0 otherwise
+	volatile uint32_t busy; // set while the hits are written, see Cache_Mgr::advance_epoch
+	uint32_t hit_count;
+	Cache_Read_Hit hits[READ_HIT_BATCH];
+};
+
+// A read-through load of a missing key, see Cache_Mgr::begin_load. The last of
+// the loader and its waiters to leave deletes it.
+class Cache_Load : public xixi::hash_node_base<Cache_Key, Cache_Load> {
+public:
+	Cache_Load(uint32_t id, const uint8_t* key, uint32_t key_length) : key_data((const char*)key, key_length) {
+		group_id = id;
+		waiters = 0;
+		done = false;
+		reason = XIXI_REASON_SUCCESS;
+	}
+	inline bool is_key(const Cache_Key* p) const {
+		return (group_id == p->group_id) && (key_data.size() == p->size) && (memcmp(key_data.data(), p->data, p->size) == 0);
+	}
+
+	uint32_t group_id;
+	std::string key_data;
+	uint32_t waiters;
+	bool done;
+	xixi_reason reason;
+};
+
+// The right to fill a missing key, handed to the first client that misses it
+// through a lease get. Expires after settings_.lease_timeout seconds and is
+// dropped when the key is linked or deleted meanwhile.
+class Cache_Lease : public xixi::hash_node_base<Cache_Key, Cache_Lease>, public xixi::list_node_base<Cache_Lease> {
+public:
+	Cache_Lease(uint32_t id, const uint8_t* key, uint32_t key_length) : key_data((const char*)key, key_length) {
+		group_id = id;
+		token = 0;
+		expire_time = 0;
+	}
+	inline bool is_key(const Cache_Key* p) const {
+		return (group_id == p->group_id) && (key_data.size() == p->size) && (memcmp(key_data.data(), p->data, p->size) == 0);
+	}
+
+	uint32_t group_id;
+	std::string key_data;
+	uint64_t token;
+	uint32_t expire_time;
+};
+
+// bytes in front of the key, the body member only marks where the key starts
+#define ITEM_HEADER_SIZE (sizeof(Cache_Item) - sizeof(void*))
+
+class Cache_Item : public xixi::list_node_base<Cache_Item, 2>, public xixi::hash_node_base<Cache_Key, Cache_Item> {
 	friend class Cache_Mgr;
 public:
 	Cache_Item() {
 		expire_time = 0;
+#ifndef USING_COMPACT_ITEM
 		watch_item = NULL;
+		last_update_time = 0;
+#endif
+		http_header = NULL;
 		cache_id = 0;
 		flags = 0;
 		group_id = 0;
 		data_size = 0;
-		last_update_time = 0;
 		ref_count = 0;
 		class_id = 0;
 		expiration_id = 0;
@@ -115,16 +444,23 @@ public:
 		reset();
 	}
 	void reset() {
+#ifndef USING_COMPACT_ITEM
 		if (watch_item != NULL) {
 			delete watch_item;
 			watch_item = NULL;
 		}
+		last_update_time = 0;
+#endif
+		while (http_header != NULL) {
+			Http_Header_Template* t = http_header;
+			http_header = t->next;
+			::free(t);
+		}
 		expire_time = 0;
 		cache_id = 0;
 		flags = 0;
 		group_id = 0;
 		data_size = 0;
-		last_update_time = 0;
 		ref_count = 0;
 		class_id = 0;
 		expiration_id = 0;
@@ -148,31 +484,97 @@ public:
 	inline uint32_t get_key_length() { return key_length; }
 
 	inline uint8_t* get_data() { return ((uint8_t*)body) + key_length; }
-	inline uint8_t* get_ext() { return ((uint8_t*)body) + key_length + data_size; }
+	inline uint8_t* get_ext() { return (is_chunked() || is_segmented()) ? ((uint8_t*)body) + key_length : ((uint8_t*)body) + key_length + data_size; }
+
+	inline bool is_chunked() const { return (item_flag & ITEM_FLAG_CHUNKED) != 0; }
+	inline bool is_counter() const { return (item_flag & ITEM_FLAG_COUNTER) != 0; }
+	inline bool is_segmented() const { return (item_flag & ITEM_FLAG_SEGMENTED) != 0; }
+	inline volatile int64_t* get_counter() { return (volatile int64_t*)(((size_t)get_data() + sizeof(int64_t) - 1) & ~(sizeof(int64_t) - 1)); }
+	// the text of a counter, buf holds COUNTER_TEXT_SIZE bytes
+	inline uint32_t get_counter_text(uint8_t* buf) { return _snprintf((char*)buf, COUNTER_TEXT_SIZE, "%" PRId64, atomic_load64(get_counter())); }
+	inline uint32_t codec_id() const { return item_flag >> ITEM_FLAG_CODEC_SHIFT; }
+	inline bool is_compressed() const { return codec_id() != CODEC_NONE; }
+	inline void add_ref() { atomic_inc16(&ref_count); }
+	// returns the references left
+	inline uint16_t release_ref() { return atomic_dec16(&ref_count); }
+	inline bool is_ref_full() const { return (ref_count & ~ITEM_REF_EXCLUSIVE) > ITEM_REF_MAX; }
+	// fails once the item is being freed, while Cache_Mgr holds it exclusively
+	// or once ITEM_REF_MAX references are held
+	inline bool try_add_ref() {
+		uint16_t r;
+		do {
+			r = ref_count;
+			if (r == 0 || r >= ITEM_REF_MAX) {
+				return false;
+			}
+		} while (!atomic_cas16(&ref_count, r, r + 1));
+		return true;
+	}
+	// expired but still served within the grace period of its group
+	inline bool is_stale(uint32_t curr_time) const { return expire_time != 0 && expire_time <= curr_time; }
+	inline uint32_t uncompressed_size() { return is_compressed() ? get_codec(codec_id())->uncompressed_size(get_data(), data_size) : data_size; }
+	inline Cache_Chunk_Table* get_chunk_table() { return (Cache_Chunk_Table*)(((uint8_t*)body) + CHUNK_TABLE_OFFSET(key_length, ext_size)); }
+	inline Cache_Segment_Table* get_segment_table() { return (Cache_Segment_Table*)(((uint8_t*)body) + CHUNK_TABLE_OFFSET(key_length, ext_size)); }
+	// the data from offset up to the end of its chunk or segment
+	inline uint8_t* get_data_segment(uint32_t offset, uint32_t&/*out*/ size) {
+		if (is_segmented()) {
+			Cache_Segment_Table* table = get_segment_table();
+			uint32_t i = 0;
+			while (offset >= table->segments[i]->data_size) {
+				offset -= table->segments[i]->data_size;
+				i++;
+			}
+			return table->segments[i]->get_data_segment(offset, size);
+		}
+		if (!is_chunked()) {
+			size = data_size - offset;
+			return get_data() + offset;
+		}
+		Cache_Chunk_Table* table = get_chunk_table();
+		uint32_t i = offset / table->chunk_size;
+		uint32_t chunk_offset = offset - i * table->chunk_size;
+		if (i + 1 == table->count) {
+			size = data_size - offset;
+		} else {
+			size = table->chunk_size - chunk_offset;
+		}
+		return table->chunks[i]->get_data() + chunk_offset;
+	}
+	void write_data(uint32_t offset, const uint8_t* data, uint32_t size);
+	void write_data(uint32_t offset, Cache_Item* src);
 	inline uint32_t get_ext_size() { return ext_size; }
-	inline uint32_t total_size() { return sizeof(Cache_Item) + key_length + data_size + ext_size; }
+	inline uint32_t total_size() { return ITEM_HEADER_SIZE + key_length + data_size + ext_size; }
+#ifdef USING_COMPACT_ITEM
+	inline void set_update_time(uint32_t t) {}
+#else
+	inline void set_update_time(uint32_t t) { last_update_time = t; }
+#endif
 
 	inline void calc_hash_value() { hash_value_ = hash32((uint8_t*)body, key_length, group_id); }
-
-protected:
-	void add_watch(uint32_t watch_id) {
-		if (watch_item == NULL) {
-			watch_item = new Cache_Watch_Item();
+	uint32_t http_header_size() {
+		uint32_t size = 0;
+		for (Http_Header_Template* t = http_header; t != NULL; t = t->next) {
+			size += HTTP_HEADER_TEMPLATE_SIZE(t->size);
 		}
-		watch_item->add_watch(watch_id);
+		return size;
 	}
 
 protected:
 	uint32_t expire_time;
+#ifndef USING_COMPACT_ITEM
 	Cache_Watch_Item* watch_item;
+#endif
 public:
+	Http_Header_Template* volatile http_header;
 	uint64_t cache_id;
 	uint32_t group_id;
 	uint32_t flags;
 	uint32_t data_size;
+#ifndef USING_COMPACT_ITEM
 	uint32_t last_update_time;
+#endif
 protected:
-	uint16_t ref_count;
+	volatile uint16_t ref_count;
 public:
 	uint16_t key_length;
 	uint8_t ext_size;
@@ -195,9 +597,11 @@ public:
 	Cache_Mgr();
 	~Cache_Mgr();
 
-	void init(uint64_t limit, uint32_t item_size_max, uint32_t item_size_min, double factor);
-	Cache_Item* alloc_item(uint32_t group_id, uint32_t key_length, uint32_t flags, uint32_t expiration, uint32_t data_size, uint32_t ext_size);
-	void flush(uint32_t group_id, uint32_t&/*out*/ flush_count, uint64_t&/*out*/ flush_size);
+	void init(uint64_t limit, uint32_t item_size_max, uint32_t item_size_min, double factor, Stats* stats);
+	Cache_Item* alloc_item(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t flags, uint32_t expiration, uint32_t data_size, uint32_t ext_size);
+	Cache_Item* compress_item(Cache_Item* it);
+	void flush(uint32_t group_id, uint32_t&/*out*/ flush_count, uint64_t&/*out*/ flush_size, uint64_t&/*out*/ flush_cache_id);
+	void flush_feed(uint32_t group_id, uint64_t flush_cache_id);
 	Cache_Item* get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, bool is_base, uint32_t&/*out*/ expiration, xixi_reason&/*out*/ reason);
 	Cache_Item* get_touch(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, uint32_t expiration, xixi_reason&/*out*/ reason);
 	void release_reference(Cache_Item* item);
@@ -207,6 +611,14 @@ public:
 	bool update_expiration(uint32_t group_id, const uint8_t* key, uint32_t key_length, const XIXI_Update_Expiration_Req_Pdu* pdu, uint64_t&/*out*/ cache_id);
 
 	Cache_Item* load_from_file(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, uint32_t expiration, xixi_reason&/*out*/ reason);
+	bool begin_load(uint32_t group_id, const uint8_t* key, uint32_t key_length, xixi_reason&/*out*/ reason);
+	void end_load(uint32_t group_id, const uint8_t* key, uint32_t key_length, xixi_reason reason);
+
+	xixi_reason get_lease(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t&/*out*/ lease_token);
+	Cache_Item* lease_get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id,
+		uint32_t&/*out*/ expiration, uint64_t&/*out*/ lease_token, xixi_reason&/*out*/ reason);
+	bool get_refresh_lease(Cache_Item* it, uint64_t&/*out*/ lease_token);
+	xixi_reason lease_set(Cache_Item* item, uint64_t lease_token, uint32_t watch_id, uint64_t&/*out*/ cache_id);
 
 	xixi_reason add(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id);
 	xixi_reason set(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id);
@@ -217,6 +629,9 @@ public:
 	xixi_reason remove(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t cache_id);
 	xixi_reason delta(uint32_t group_id, const uint8_t* key, uint32_t key_length, bool incr, int64_t delta, uint64_t&/*in and out*/ cache_id, int64_t&/*out*/ value);
 	bool item_size_ok(uint32_t key_length, uint32_t data_size, uint32_t ext_size);
+	const Http_Header_Template* set_http_header(Cache_Item* item, const Http_Header_Template* t);
+
+	void set_group_quota(uint32_t group_id, uint64_t max_bytes);
 
 	uint32_t create_watch(uint32_t group_id, uint32_t max_next_check_interval);
 	bool check_watch_and_set_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t group_id, uint32_t watch_id, uint32_t ack_sequence, uint32_t max_next_check_interval,
@@ -224,39 +639,116 @@ public:
 	bool check_watch_and_clear_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t watch_id,
 		uint32_t&/*out*/ sequence, std::vector<uint64_t>&/*out*/ updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list);
 
+	bool check_feed(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t group_id, uint64_t sequence, uint32_t max_count, bool wait,
+		uint64_t&/*out*/ first_sequence, uint64_t&/*out*/ next_sequence, std::vector<XIXI_Feed_Event>&/*out*/ events);
+
 	void check_expired();
-	void stats(const XIXI_Stats_Req_Pdu* pdu, std::string& result);
+	void compact_segments();
+	void stats(const XIXI_Stats_Req_Pdu* pdu, std::string& result, const Cache_Stats_Merge* others = NULL);
+	void merge_stats(const XIXI_Stats_Req_Pdu* pdu, Cache_Stats_Merge& others);
 	void print_stats();
+	void set_watch_home(Cache_Mgr* home) {
+		watch_home_ = home;
+	}
 
 	uint64_t get_mem_limit() {
 		return mem_limit_;
 	}
 	uint64_t get_mem_used() {
-		return mem_used_;
+		return atomic_load64(&mem_used_);
+	}
+	uint64_t get_reclaim_deferred_bytes() {
+		return reclaim_deferred_bytes_;
+	}
+	uint64_t get_reclaim_overflows() {
+		return reclaim_overflows_;
+	}
+	uint32_t get_chunk_size() {
+		return chunk_size_;
 	}
 
 private:
+	inline bool mem_available(uint64_t size) { return (uint64_t)atomic_load64(&mem_used_) + size <= mem_limit_; }
+	inline void add_mem_used(int64_t size) { atomic_add64(&mem_used_, size); }
+	inline void lock_cache();
+	inline void unlock_cache();
 	inline void free_item(Cache_Item* it);
 	inline uint64_t get_cache_id();
-	inline Cache_Item* do_alloc(uint32_t group_id, uint32_t key_length, uint32_t flags, uint32_t expire_time, uint32_t data_size, uint32_t ext_size);
+	inline Cache_Item* do_alloc(uint32_t group_id, uint32_t key_length, uint32_t flags, uint32_t expire_time, uint32_t data_size, uint32_t ext_size, uint32_t replaced_size);
+	inline bool check_quota(uint32_t group_id, uint64_t item_size, uint64_t replaced_size);
+	inline Cache_Item* alloc_from_class(uint32_t id, uint32_t group_id);
+	inline Cache_Item* do_alloc_value(uint32_t group_id, uint32_t key_length, uint32_t flags, uint32_t expire_time, uint32_t data_size, uint32_t ext_size, uint32_t replaced_size);
+	inline Cache_Item* do_alloc_chunked(uint32_t group_id, uint32_t key_length, uint32_t flags, uint32_t expire_time, uint32_t data_size, uint32_t ext_size, uint32_t replaced_size);
+	inline bool alloc_chunks(Cache_Item* it, uint32_t first);
+	inline Cache_Item* do_append_chunks(Cache_Item* old_it, Cache_Item* it);
+	inline void release_chunks(Cache_Item* it);
+	inline bool use_segments(Cache_Item* old_it);
+	inline Cache_Item* do_link_segments(Cache_Item* old_it, Cache_Item* first, Cache_Item* second);
+	inline void add_segments(Cache_Segment_Table* table, Cache_Item* it);
+	inline void release_segments(Cache_Item* it);
+	inline void check_segments(Cache_Item* it);
+	inline bool is_chunked_size(uint32_t key_length, uint32_t data_size, uint32_t ext_size);
 	inline void do_link(Cache_Item* it);
 	inline void do_unlink(Cache_Item* it, watch_notify_type type);
 	inline void do_unlink_flush(Cache_Item* it);
+	inline Cache_Group* get_group(uint32_t group_id);
+	inline Cache_Group* group_link(Cache_Item* it);
+	inline void group_unlink(Cache_Item* it);
+	inline void update_lru(Cache_Item* it);
+	inline bool is_flushed(Cache_Item* it);
+	inline bool evict_item(Cache_Group* group, uint32_t&/*out*/ class_id);
+	inline bool evict_for_memory(uint32_t group_id, uint32_t&/*out*/ class_id);
+	inline void release_free_item(uint32_t class_id);
+	inline void add_watch(Cache_Item* it, uint32_t watch_id);
+	inline Cache_Watch_Item* alloc_watch_item(Cache_Item* it);
+	inline void free_watch_item(Cache_Watch_Item* watch_item);
+	inline Cache_Watch_Item* get_watch_item(Cache_Item* it);
+	inline void set_watch_item(Cache_Item* it, Cache_Watch_Item* watch_item);
 	inline void do_release_reference(Cache_Item* it);
 	inline void do_replace(Cache_Item* it, Cache_Item* new_it);
+	inline xixi_reason do_set(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id);
+	inline void do_delta(Cache_Delta* d);
+	void combine_deltas();
+	static void keep_delta(Cache_Delta* d) {}
+	inline Cache_Item* get_shared(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t&/*out*/ expiration);
+	inline Cache_Reader* get_reader();
+	inline void flush_read_hits(Cache_Reader* r);
+	inline bool has_readers();
+	inline void retire_item(Cache_Item* it);
+	inline void defer_free(void* p, uint32_t size);
+	inline void defer_delete(Cache_Watch_Item* watch_item);
+	inline bool advance_epoch();
+	static void keep_reader(Cache_Reader* r) {}
+	inline void drop_lease(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value);
+	bool do_grant_lease(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint64_t&/*out*/ lease_token);
+	inline const Group_Stale* get_group_stale(uint32_t group_id);
+	inline bool is_servable_stale(Cache_Item* it, uint32_t curr_time);
+	inline bool needs_refresh(Cache_Item* it);
 	inline Cache_Item* do_get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value);
 	inline Cache_Item* do_get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t&/*out*/ expiration);
 	inline Cache_Item* do_get_touch(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t expiration);
 	inline uint32_t get_class_id(uint32_t size);
-	inline uint32_t get_watch_id();
+	inline Cache_Watch* find_watch(uint32_t watch_id);
 	inline bool is_valid_watch_id(uint32_t watch_id);
+	inline Cache_Watch* alloc_watch();
+	inline void free_watch(Cache_Watch* watch);
+	inline void link_watch(Cache_Watch* watch);
 	void notify_watch(Cache_Item* it, watch_notify_type type);
+	void notify_watch_ids(Cache_Watch_Item* watch_item, uint64_t cache_id, watch_notify_type type, Cache_Watch_Wake_List&/*out*/ wake_list);
+	inline void feed_item(Cache_Item* it, watch_notify_type type);
+	void add_feed(uint32_t group_id, uint64_t cache_id, uint32_t key_hash, watch_notify_type type);
+	void add_feed_event(Cache_Feed* feed, uint64_t cache_id, uint32_t key_hash, watch_notify_type type, Cache_Watch_Wake_List&/*out*/ wake_list);
 
 	inline uint32_t get_expiration_id(uint32_t curr_time, uint32_t expire_time);
 
 	void expire_items(uint32_t curr_time);
 	void expire_watchs(uint32_t curr_time);
+	void expire_feeds(uint32_t curr_time);
+	void expire_leases(uint32_t curr_time);
 	void free_flushed_items();
+	void sweep_flushed_items();
+	void trim_over_quota_groups();
+	void get_group_stats(uint32_t group_id, std::string& out, const Cache_Group* others);
 
 private:
 	mutex cache_lock_;
@@ -269,6 +761,9 @@ private:
 
 	uint32_t max_size_[CLASSID_MAX];
 	uint32_t class_id_max_;
+	uint32_t chunk_class_id_;
+	uint32_t chunk_size_;
+	uint32_t value_size_max_;
 	uint32_t last_class_id_;
 #ifdef USING_BOOST_POOL
 	boost::pool<>* pools_[CLASSID_MAX];
@@ -277,18 +772,54 @@ private:
 	xixi::list<Cache_Item> free_cache_list_[CLASSID_MAX];
 	xixi::list<Cache_Item> flush_cache_list_;
 
-	uint64_t last_cache_id_;
+	xixi::hash_map<uint32_t, Cache_Group> group_map_;
+	xixi::list<Cache_Group, GROUP_LIST_FLUSHED> flushed_group_list_;
+	xixi::list<Cache_Group, GROUP_LIST_QUOTA> quota_group_list_;
+	uint32_t flushed_items_;
+
+	// shared by every partition, watches, feeds and leases tell items apart by cache id
+	static volatile int64_t last_cache_id_;
 
 	uint64_t mem_limit_;
-	uint64_t mem_used_;
+	static volatile int64_t mem_used_;
+	Stats* part_stats_; // &stats_ unless this is a later partition of Cache_Router
 
 	uint32_t last_print_stats_time_;
 
 	uint32_t last_check_expired_time_;
-	uint32_t last_watch_id_;
-	std::map<uint32_t, boost::shared_ptr<Cache_Watch> > watch_map_;
+	std::vector<Cache_Watch*> watch_blocks_;
+	xixi::list<Cache_Watch> free_watch_list_;
+	xixi::list<Cache_Watch> watch_wheel_[WATCH_WHEEL_SIZE];
+	uint32_t last_expire_watch_time_;
+	uint32_t curr_watches_;
+	xixi::list<Cache_Watch_Item> free_watch_item_list_;
+	Cache_Watch_Wake_List watch_wake_list_;
+	xixi::hash_map<uint32_t, Cache_Feed> feed_map_;
+	xixi::list<Cache_Feed> feed_list_;
+	volatile uint32_t curr_feeds_; // size of feed_map_, read by other partitions without the lock
+	Cache_Mgr* watch_home_; // partition holding the watches and feeds, this one unless partitioned
+	xixi::hash_map<Cache_Key, Cache_Load> load_map_;
+	boost::condition_variable_any load_done_;
+	xixi::hash_map<Cache_Key, Cache_Lease> lease_map_;
+	xixi::list<Cache_Lease> lease_list_;
+	uint32_t refresh_random_;
+	std::vector<Cache_Item*> compact_list_; // segmented items to coalesce, each holds a reference
+	boost::thread_specific_ptr<Cache_Delta> delta_;
+	mutex delta_list_lock_;
+	Cache_Delta* volatile delta_list_;
+	boost::thread_specific_ptr<Cache_Reader> reader_;
+	Cache_Reader* volatile reader_list_; // guarded by delta_list_lock_ for writes
+	volatile uint32_t epoch_;
+	xixi::list<Cache_Item> retire_list_[3]; // unlinked items by epoch_ % 3, waiting for readers to leave
+	uint32_t retire_count_;
+	Cache_Reclaim reclaim_;
+	uint64_t reclaim_bytes_; // queued in reclaim_, at most RECLAIM_MAX_BYTES
+	uint64_t reclaim_deferred_bytes_;
+	uint64_t reclaim_overflows_;
+	boost::thread_specific_ptr<Cache_Reclaim> reclaim_buf_;
+#ifdef USING_COMPACT_ITEM
+	std::map<Cache_Item*, Cache_Watch_Item*> watch_items_;
+#endif
 };
 
-extern Cache_Mgr cache_mgr_;
-
 #endif // CACHE_H
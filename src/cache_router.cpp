@@ -0,0 +1,352 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include "cache_router.h"
+#include "settings.h"
+#include "stats.h"
+#include "log.h"
+#include "peer_cache_pdu.h"
+
+Cache_Router cache_mgr_;
+
+Cache_Router::Cache_Router() : core_(&Cache_Router::keep_core) {
+}
+
+Cache_Router::~Cache_Router() {
+	for (size_t i = 0; i < parts_.size(); i++) {
+		delete parts_[i];
+	}
+	parts_.clear();
+	for (size_t i = 0; i < part_stats_.size(); i++) {
+		delete part_stats_[i];
+	}
+	part_stats_.clear();
+	for (size_t i = 0; i < rings_.size(); i++) {
+		delete rings_[i];
+	}
+	rings_.clear();
+	for (size_t i = 0; i < cores_.size(); i++) {
+		delete cores_[i];
+	}
+	cores_.clear();
+}
+
+// one core per io_service, called before init
+void Cache_Router::init_cores(io_service_pool& pool) {
+	uint32_t n = (uint32_t)pool.get_pool_size();
+	for (uint32_t i = 0; i < n; i++) {
+		cores_.push_back(new Cache_Core(i, &pool.get_io_service(i)));
+	}
+	for (uint32_t i = 0; i < n * n; i++) {
+		rings_.push_back(new xixi::spsc_queue<Cache_Call*>());
+	}
+	LOG_INFO("Cache_Router::init_cores, cores=" << n);
+}
+
+void Cache_Router::bind_core(size_t index) {
+	if (index < cores_.size()) {
+		core_.reset(cores_[index]);
+	}
+}
+
+void Cache_Router::init(uint64_t limit, uint32_t item_size_max, uint32_t item_size_min, double factor) {
+	size_t n = cores_.empty() ? 1 : cores_.size();
+	for (size_t i = 0; i < n; i++) {
+		Stats* stats = &stats_;
+		if (i > 0) {
+			stats = new Stats();
+			part_stats_.push_back(stats);
+			stats_.add_part(stats);
+		}
+		Cache_Mgr* part = new Cache_Mgr();
+		part->init(limit, item_size_max, item_size_min, factor, stats);
+		part->set_watch_home(parts_.empty() ? part : parts_[0]);
+		parts_.push_back(part);
+	}
+
+	std::map<uint32_t, uint64_t>::const_iterator it = settings_.group_quotas.begin();
+	while (it != settings_.group_quotas.end()) {
+		set_group_quota(it->first, it->second);
+		++it;
+	}
+}
+
+void Cache_Router::serve(Cache_Core* core) {
+	size_t n = cores_.size();
+	for (size_t i = 0; i < n; i++) {
+		xixi::spsc_queue<Cache_Call*>* ring = rings_[core->index * n + i];
+		Cache_Call* call;
+		while (ring->pop(call)) {
+			call->run(call);
+			memory_barrier();
+			call->done = true;
+		}
+	}
+}
+
+// at most one drain is queued on a core, a call pushed after it started
+// clearing wake_pending posts the next one
+void Cache_Router::wake(Cache_Core* core) {
+	if (atomic_cas32(&core->wake_pending, 0, 1)) {
+		core->io_service->post(boost::bind(&Cache_Router::drain, this, core));
+	}
+}
+
+void Cache_Router::drain(Cache_Core* core) {
+	core->wake_pending = 0;
+	memory_barrier();
+	serve(core);
+}
+
+// The item comes from its owner, whose group quota and LRU it is charged to,
+// with the key and hash already set.
+Cache_Item* Cache_Router::alloc_item(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t flags, uint32_t expiration,
+									 uint32_t data_size, uint32_t ext_size) {
+	uint32_t hash_value = hash32(key, key_length, group_id);
+	uint32_t owner = get_owner(hash_value);
+	return call(owner, boost::bind(&Cache_Mgr::alloc_item, parts_[owner], group_id, key, key_length, hash_value, flags, expiration, data_size, ext_size));
+}
+
+// the codec runs on the calling thread, the copy is allocated under the owner's cache_lock_
+Cache_Item* Cache_Router::compress_item(Cache_Item* it) {
+	return parts_[get_owner(it->hash_value_)]->compress_item(it);
+}
+
+// Cache ids are global, so the watermark of the last partition flushed covers
+// every partition and feeds see one event. It may also cover items linked to an
+// earlier partition after its flush, a near cache then only drops them early.
+void Cache_Router::flush(uint32_t group_id, uint32_t&/*out*/ flush_count, uint64_t&/*out*/ flush_size) {
+	flush_count = 0;
+	flush_size = 0;
+	uint64_t flush_cache_id = 0;
+	for (size_t i = 0; i < parts_.size(); i++) {
+		uint32_t count = 0;
+		uint64_t size = 0;
+		uint64_t cache_id = 0;
+		parts_[i]->flush(group_id, count, size, cache_id);
+		flush_count += count;
+		flush_size += size;
+		if (cache_id > flush_cache_id) {
+			flush_cache_id = cache_id;
+		}
+	}
+	if (flush_cache_id != 0) {
+		parts_[0]->flush_feed(group_id, flush_cache_id);
+	}
+}
+
+Cache_Item* Cache_Router::get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, bool is_base,
+		uint32_t&/*out*/ expiration, xixi_reason&/*out*/ reason) {
+	uint32_t owner = get_owner(group_id, key, key_length);
+	return call(owner, boost::bind(&Cache_Mgr::get, parts_[owner], group_id, key, key_length, watch_id, is_base,
+		boost::ref(expiration), boost::ref(reason)));
+}
+
+Cache_Item* Cache_Router::get_touch(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, uint32_t expiration,
+		xixi_reason&/*out*/ reason) {
+	uint32_t owner = get_owner(group_id, key, key_length);
+	return call(owner, boost::bind(&Cache_Mgr::get_touch, parts_[owner], group_id, key, key_length, watch_id, expiration,
+		boost::ref(reason)));
+}
+
+// the last reference takes the lock of the owner partition, any thread may drop it
+void Cache_Router::release_reference(Cache_Item* item) {
+	parts_[get_owner(item->hash_value_)]->release_reference(item);
+}
+
+bool Cache_Router::update_flags(uint32_t group_id, const uint8_t* key, uint32_t key_length, const XIXI_Update_Flags_Req_Pdu* pdu,
+		uint64_t&/*out*/ cache_id) {
+	uint32_t owner = get_owner(group_id, key, key_length);
+	return call(owner, boost::bind(&Cache_Mgr::update_flags, parts_[owner], group_id, key, key_length, pdu, boost::ref(cache_id)));
+}
+
+bool Cache_Router::update_expiration(uint32_t group_id, const uint8_t* key, uint32_t key_length, const XIXI_Update_Expiration_Req_Pdu* pdu,
+		uint64_t&/*out*/ cache_id) {
+	uint32_t owner = get_owner(group_id, key, key_length);
+	return call(owner, boost::bind(&Cache_Mgr::update_expiration, parts_[owner], group_id, key, key_length, pdu, boost::ref(cache_id)));
+}
+
+// loads read the disk, they never hold up the owner core
+Cache_Item* Cache_Router::load_from_file(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, uint32_t expiration,
+		xixi_reason&/*out*/ reason) {
+	return parts_[get_owner(group_id, key, key_length)]->load_from_file(group_id, key, key_length, watch_id, expiration, reason);
+}
+
+bool Cache_Router::begin_load(uint32_t group_id, const uint8_t* key, uint32_t key_length, xixi_reason&/*out*/ reason) {
+	return parts_[get_owner(group_id, key, key_length)]->begin_load(group_id, key, key_length, reason);
+}
+
+void Cache_Router::end_load(uint32_t group_id, const uint8_t* key, uint32_t key_length, xixi_reason reason) {
+	parts_[get_owner(group_id, key, key_length)]->end_load(group_id, key, key_length, reason);
+}
+
+xixi_reason Cache_Router::get_lease(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t&/*out*/ lease_token) {
+	uint32_t owner = get_owner(group_id, key, key_length);
+	return call(owner, boost::bind(&Cache_Mgr::get_lease, parts_[owner], group_id, key, key_length, boost::ref(lease_token)));
+}
+
+Cache_Item* Cache_Router::lease_get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id,
+		uint32_t&/*out*/ expiration, uint64_t&/*out*/ lease_token, xixi_reason&/*out*/ reason) {
+	uint32_t owner = get_owner(group_id, key, key_length);
+	return call(owner, boost::bind(&Cache_Mgr::lease_get, parts_[owner], group_id, key, key_length, watch_id,
+		boost::ref(expiration), boost::ref(lease_token), boost::ref(reason)));
+}
+
+bool Cache_Router::get_refresh_lease(Cache_Item* it, uint64_t&/*out*/ lease_token) {
+	uint32_t owner = get_owner(it->hash_value_);
+	return call(owner, boost::bind(&Cache_Mgr::get_refresh_lease, parts_[owner], it, boost::ref(lease_token)));
+}
+
+xixi_reason Cache_Router::lease_set(Cache_Item* item, uint64_t lease_token, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
+	uint32_t owner = get_owner(item->hash_value_);
+	return call(owner, boost::bind(&Cache_Mgr::lease_set, parts_[owner], item, lease_token, watch_id, boost::ref(cache_id)));
+}
+
+xixi_reason Cache_Router::add(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
+	uint32_t owner = get_owner(item->hash_value_);
+	return call(owner, boost::bind(&Cache_Mgr::add, parts_[owner], item, watch_id, boost::ref(cache_id)));
+}
+
+xixi_reason Cache_Router::set(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
+	uint32_t owner = get_owner(item->hash_value_);
+	return call(owner, boost::bind(&Cache_Mgr::set, parts_[owner], item, watch_id, boost::ref(cache_id)));
+}
+
+xixi_reason Cache_Router::replace(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
+	uint32_t owner = get_owner(item->hash_value_);
+	return call(owner, boost::bind(&Cache_Mgr::replace, parts_[owner], item, watch_id, boost::ref(cache_id)));
+}
+
+xixi_reason Cache_Router::append(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
+	uint32_t owner = get_owner(item->hash_value_);
+	return call(owner, boost::bind(&Cache_Mgr::append, parts_[owner], item, watch_id, boost::ref(cache_id)));
+}
+
+xixi_reason Cache_Router::prepend(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id) {
+	uint32_t owner = get_owner(item->hash_value_);
+	return call(owner, boost::bind(&Cache_Mgr::prepend, parts_[owner], item, watch_id, boost::ref(cache_id)));
+}
+
+xixi_reason Cache_Router::remove(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t cache_id) {
+	uint32_t owner = get_owner(group_id, key, key_length);
+	return call(owner, boost::bind(&Cache_Mgr::remove, parts_[owner], group_id, key, key_length, cache_id));
+}
+
+xixi_reason Cache_Router::delta(uint32_t group_id, const uint8_t* key, uint32_t key_length, bool incr, int64_t delta,
+		uint64_t&/*in and out*/ cache_id, int64_t&/*out*/ value) {
+	uint32_t owner = get_owner(group_id, key, key_length);
+	return call(owner, boost::bind(&Cache_Mgr::delta, parts_[owner], group_id, key, key_length, incr, delta,
+		boost::ref(cache_id), boost::ref(value)));
+}
+
+bool Cache_Router::item_size_ok(uint32_t key_length, uint32_t data_size, uint32_t ext_size) {
+	return parts_[0]->item_size_ok(key_length, data_size, ext_size);
+}
+
+const Http_Header_Template* Cache_Router::set_http_header(Cache_Item* item, const Http_Header_Template* t) {
+	uint32_t owner = get_owner(item->hash_value_);
+	return call(owner, boost::bind(&Cache_Mgr::set_http_header, parts_[owner], item, t));
+}
+
+// each partition holds about 1/n of the keys of a group and enforces 1/n of its quota
+void Cache_Router::set_group_quota(uint32_t group_id, uint64_t max_bytes) {
+	for (size_t i = 0; i < parts_.size(); i++) {
+		parts_[i]->set_group_quota(group_id, max_bytes / parts_.size());
+	}
+}
+
+uint32_t Cache_Router::create_watch(uint32_t group_id, uint32_t max_next_check_interval) {
+	return parts_[0]->create_watch(group_id, max_next_check_interval);
+}
+
+bool Cache_Router::check_watch_and_set_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t group_id, uint32_t watch_id, uint32_t ack_sequence,
+		uint32_t max_next_check_interval, uint32_t&/*out*/ sequence, std::vector<uint64_t>&/*out*/ updated_list,
+		std::vector<watch_notify_type>&/*out*/ updated_type_list) {
+	return parts_[0]->check_watch_and_set_callback(sp, group_id, watch_id, ack_sequence, max_next_check_interval,
+		sequence, updated_list, updated_type_list);
+}
+
+bool Cache_Router::check_watch_and_clear_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t watch_id,
+		uint32_t&/*out*/ sequence, std::vector<uint64_t>&/*out*/ updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list) {
+	return parts_[0]->check_watch_and_clear_callback(sp, watch_id, sequence, updated_list, updated_type_list);
+}
+
+bool Cache_Router::check_feed(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t group_id, uint64_t sequence, uint32_t max_count, bool wait,
+		uint64_t&/*out*/ first_sequence, uint64_t&/*out*/ next_sequence, std::vector<XIXI_Feed_Event>&/*out*/ events) {
+	return parts_[0]->check_feed(sp, group_id, sequence, max_count, wait, first_sequence, next_sequence, events);
+}
+
+// housekeeping of a partition runs on its own core
+void Cache_Router::check_expired() {
+	if (cores_.empty()) {
+		parts_[0]->check_expired();
+	} else {
+		for (size_t i = 0; i < cores_.size(); i++) {
+			cores_[i]->io_service->post(boost::bind(&Cache_Mgr::check_expired, parts_[i]));
+		}
+	}
+}
+
+void Cache_Router::compact_segments() {
+	if (cores_.empty()) {
+		parts_[0]->compact_segments();
+	} else {
+		for (size_t i = 0; i < cores_.size(); i++) {
+			cores_[i]->io_service->post(boost::bind(&Cache_Mgr::compact_segments, parts_[i]));
+		}
+	}
+}
+
+void Cache_Router::stats(const XIXI_Stats_Req_Pdu* pdu, std::string& result) {
+	uint8_t sub_op = pdu->sub_op();
+	if (sub_op == XIXI_STATS_SUB_OP_ADD_GROUP || sub_op == XIXI_STATS_SUB_OP_REMOVE_GROUP) {
+		for (size_t i = 1; i < parts_.size(); i++) {
+			std::string r;
+			parts_[i]->stats(pdu, r);
+		}
+		parts_[0]->stats(pdu, result);
+	} else if (parts_.size() > 1 && (sub_op == XIXI_STATS_SUB_OP_GET_STATS_GROUP_ONLY || sub_op == XIXI_STATS_SUB_OP_GET_STATS_SUM_ONLY)) {
+		Cache_Stats_Merge* others = new Cache_Stats_Merge(pdu->group_id);
+		for (size_t i = 1; i < parts_.size(); i++) {
+			parts_[i]->merge_stats(pdu, *others);
+		}
+		parts_[0]->stats(pdu, result, others);
+		delete others;
+	} else {
+		parts_[0]->stats(pdu, result);
+	}
+}
+
+void Cache_Router::print_stats() {
+	parts_[0]->print_stats();
+}
+
+uint64_t Cache_Router::get_reclaim_deferred_bytes() {
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < parts_.size(); i++) {
+		bytes += parts_[i]->get_reclaim_deferred_bytes();
+	}
+	return bytes;
+}
+
+uint64_t Cache_Router::get_reclaim_overflows() {
+	uint64_t overflows = 0;
+	for (size_t i = 0; i < parts_.size(); i++) {
+		overflows += parts_[i]->get_reclaim_overflows();
+	}
+	return overflows;
+}
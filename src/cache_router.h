@@ -0,0 +1,201 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef CACHE_ROUTER_H
+#define CACHE_ROUTER_H
+
+#include "defines.h"
+#include "cache.h"
+#include "spsc_queue.hpp"
+#include "io_service_pool.h"
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+// spins between yields of a core waiting for a forwarded call
+#define CACHE_CALL_YIELD_SPINS 64
+
+// An operation a core forwards to the core owning the key. The caller waits on
+// done, so the call and its arguments stay on the caller's stack.
+class Cache_Call {
+public:
+	void (*run)(Cache_Call* call);
+	volatile bool done;
+};
+
+template <class F>
+class Cache_Task : public Cache_Call {
+public:
+	Cache_Task(const F& f) : f_(f) {
+		run = &Cache_Task::execute;
+		done = false;
+	}
+
+	static void execute(Cache_Call* call) {
+		Cache_Task* task = (Cache_Task*)call;
+		task->result_ = task->f_();
+	}
+
+	F f_;
+	typename F::result_type result_;
+};
+
+class Cache_Core {
+public:
+	Cache_Core(uint32_t index, boost::asio::io_service* io_service) {
+		this->index = index;
+		this->io_service = io_service;
+		wake_pending = 0;
+	}
+
+	uint32_t index;
+	boost::asio::io_service* io_service;
+	volatile uint32_t wake_pending; // a drain is posted to io_service
+};
+
+// Front of the cache partitions, with the interface of Cache_Mgr.
+// In shared mode one Cache_Mgr serves every io thread. In partitioned mode each
+// io thread is a core owning the Cache_Mgr of the keys hashing to it. A keyed
+// operation from another core is pushed on the owner's ring for that sender and
+// the sender serves its own rings until the owner has run it, so two cores
+// waiting on each other still make progress. Threads that are not cores (file
+// loads, file monitor) and blocking loads call the owner partition directly,
+// each partition keeps its own cache_lock_ for them.
+// Watches and feeds live on the first partition, the others check and notify
+// them there under its cache_lock_.
+class Cache_Router {
+public:
+	Cache_Router();
+	~Cache_Router();
+
+	void init_cores(io_service_pool& pool);
+	void bind_core(size_t index);
+	bool is_partitioned() { return !cores_.empty(); }
+
+	void init(uint64_t limit, uint32_t item_size_max, uint32_t item_size_min, double factor);
+	Cache_Item* alloc_item(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t flags, uint32_t expiration, uint32_t data_size, uint32_t ext_size);
+	Cache_Item* compress_item(Cache_Item* it);
+	void flush(uint32_t group_id, uint32_t&/*out*/ flush_count, uint64_t&/*out*/ flush_size);
+	Cache_Item* get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, bool is_base, uint32_t&/*out*/ expiration, xixi_reason&/*out*/ reason);
+	Cache_Item* get_touch(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, uint32_t expiration, xixi_reason&/*out*/ reason);
+	void release_reference(Cache_Item* item);
+	bool update_flags(uint32_t group_id, const uint8_t* key, uint32_t key_length, const XIXI_Update_Flags_Req_Pdu* pdu, uint64_t&/*out*/ cache_id);
+	bool update_expiration(uint32_t group_id, const uint8_t* key, uint32_t key_length, const XIXI_Update_Expiration_Req_Pdu* pdu, uint64_t&/*out*/ cache_id);
+
+	Cache_Item* load_from_file(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id, uint32_t expiration, xixi_reason&/*out*/ reason);
+	bool begin_load(uint32_t group_id, const uint8_t* key, uint32_t key_length, xixi_reason&/*out*/ reason);
+	void end_load(uint32_t group_id, const uint8_t* key, uint32_t key_length, xixi_reason reason);
+
+	xixi_reason get_lease(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t&/*out*/ lease_token);
+	Cache_Item* lease_get(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t watch_id,
+		uint32_t&/*out*/ expiration, uint64_t&/*out*/ lease_token, xixi_reason&/*out*/ reason);
+	bool get_refresh_lease(Cache_Item* it, uint64_t&/*out*/ lease_token);
+	xixi_reason lease_set(Cache_Item* item, uint64_t lease_token, uint32_t watch_id, uint64_t&/*out*/ cache_id);
+
+	xixi_reason add(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id);
+	xixi_reason set(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id);
+	xixi_reason replace(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id);
+	xixi_reason append(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id);
+	xixi_reason prepend(Cache_Item* item, uint32_t watch_id, uint64_t&/*out*/ cache_id);
+
+	xixi_reason remove(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t cache_id);
+	xixi_reason delta(uint32_t group_id, const uint8_t* key, uint32_t key_length, bool incr, int64_t delta, uint64_t&/*in and out*/ cache_id, int64_t&/*out*/ value);
+	bool item_size_ok(uint32_t key_length, uint32_t data_size, uint32_t ext_size);
+	const Http_Header_Template* set_http_header(Cache_Item* item, const Http_Header_Template* t);
+
+	void set_group_quota(uint32_t group_id, uint64_t max_bytes);
+
+	uint32_t create_watch(uint32_t group_id, uint32_t max_next_check_interval);
+	bool check_watch_and_set_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t group_id, uint32_t watch_id, uint32_t ack_sequence, uint32_t max_next_check_interval,
+		uint32_t&/*out*/ sequence, std::vector<uint64_t>&/*out*/ updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list);
+	bool check_watch_and_clear_callback(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t watch_id,
+		uint32_t&/*out*/ sequence, std::vector<uint64_t>&/*out*/ updated_list, std::vector<watch_notify_type>&/*out*/ updated_type_list);
+
+	bool check_feed(boost::shared_ptr<Cache_Watch_Sink>& sp, uint32_t group_id, uint64_t sequence, uint32_t max_count, bool wait,
+		uint64_t&/*out*/ first_sequence, uint64_t&/*out*/ next_sequence, std::vector<XIXI_Feed_Event>&/*out*/ events);
+
+	void check_expired();
+	void compact_segments();
+	void stats(const XIXI_Stats_Req_Pdu* pdu, std::string& result);
+	void print_stats();
+
+	uint64_t get_mem_limit() {
+		return parts_[0]->get_mem_limit();
+	}
+	uint64_t get_mem_used() {
+		return parts_[0]->get_mem_used();
+	}
+	uint32_t get_chunk_size() {
+		return parts_[0]->get_chunk_size();
+	}
+	uint64_t get_reclaim_deferred_bytes();
+	uint64_t get_reclaim_overflows();
+
+private:
+	inline uint32_t get_owner(uint32_t hash_value) {
+		return parts_.size() == 1 ? 0 : hash_value % (uint32_t)parts_.size();
+	}
+	inline uint32_t get_owner(uint32_t group_id, const uint8_t* key, uint32_t key_length) {
+		return parts_.size() == 1 ? 0 : hash32(key, key_length, group_id) % (uint32_t)parts_.size();
+	}
+	inline Cache_Mgr* get_local() {
+		Cache_Core* core = core_.get();
+		return core != NULL ? parts_[core->index] : parts_[0];
+	}
+	template <class F>
+	typename F::result_type call(uint32_t owner, const F& f);
+	void serve(Cache_Core* core);
+	void wake(Cache_Core* core);
+	void drain(Cache_Core* core);
+	static void keep_core(Cache_Core* core) {}
+
+	std::vector<Cache_Mgr*> parts_;
+	std::vector<Stats*> part_stats_;
+	std::vector<Cache_Core*> cores_;
+	std::vector<xixi::spsc_queue<Cache_Call*>*> rings_; // rings_[owner * cores + sender]
+	boost::thread_specific_ptr<Cache_Core> core_;
+};
+
+// f runs on parts_[owner], on the calling thread when it is not a core or owns
+// the partition itself
+template <class F>
+typename F::result_type Cache_Router::call(uint32_t owner, const F& f) {
+	Cache_Core* self = core_.get();
+	if (self == NULL || self->index == owner) {
+		return f();
+	}
+	Cache_Task<F> task(f);
+	xixi::spsc_queue<Cache_Call*>* ring = rings_[owner * cores_.size() + self->index];
+	while (!ring->push(&task)) {
+		serve(self);
+	}
+	wake(cores_[owner]);
+	uint32_t spins = 0;
+	while (!task.done) {
+		serve(self);
+		if (++spins % CACHE_CALL_YIELD_SPINS == 0) {
+			boost::this_thread::yield();
+		}
+	}
+	memory_barrier();
+	return task.result_;
+}
+
+extern Cache_Router cache_mgr_;
+
+#endif // CACHE_ROUTER_H
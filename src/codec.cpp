@@ -0,0 +1,109 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "codec.h"
+#include "log.h"
+#include "zlib.h"
+
+#define LOG_TRACE2(x)  LOG_TRACE("codec " << x)
+#define LOG_WARNING2(x)  LOG_WARNING("codec " << x)
+
+// deflate with a gzip wrapper
+#define GZIP_WINDOW_BITS (15 + 16)
+#define GZIP_MEM_LEVEL 8
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+
+static Gzip_Codec gzip_codec;
+
+static Codec* codecs[CODEC_MAX] = {
+	NULL,
+	&gzip_codec
+};
+
+Codec* get_codec(uint32_t codec_id) {
+	if (codec_id < CODEC_MAX) {
+		return codecs[codec_id];
+	}
+	return NULL;
+}
+
+uint32_t get_codec_id(const char* name) {
+	for (uint32_t i = 1; i < CODEC_MAX; i++) {
+		if (strcmp(codecs[i]->name(), name) == 0) {
+			return i;
+		}
+	}
+	return CODEC_NONE;
+}
+
+uint32_t Gzip_Codec::compress_bound(uint32_t size) {
+	uint64_t bound = (uint64_t)size + (size >> 12) + (size >> 14) + (size >> 25) + 13
+		+ GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE;
+	return bound > UINT32_C(0xFFFFFFFF) ? UINT32_C(0xFFFFFFFF) : (uint32_t)bound;
+}
+
+uint32_t Gzip_Codec::compress(const uint8_t* in, uint32_t in_size, uint8_t* out, uint32_t out_size, int level) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	int rc = deflateInit2(&stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+	if (rc != Z_OK) {
+		LOG_WARNING2("deflateInit2 error, " << rc);
+		return 0;
+	}
+	stream.next_in = (Bytef*)in;
+	stream.avail_in = in_size;
+	stream.next_out = out;
+	stream.avail_out = out_size;
+	rc = deflate(&stream, Z_FINISH);
+	uint32_t size = (uint32_t)stream.total_out;
+	deflateEnd(&stream);
+	if (rc != Z_STREAM_END) {
+		LOG_TRACE2("deflate not finished, " << rc);
+		return 0;
+	}
+	return size;
+}
+
+// ISIZE of the gzip trailer, the input size modulo 2^32
+uint32_t Gzip_Codec::uncompressed_size(const uint8_t* in, uint32_t in_size) {
+	if (in_size < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE) {
+		return 0;
+	}
+	const uint8_t* p = in + in_size - 4;
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool Gzip_Codec::uncompress(const uint8_t* in, uint32_t in_size, uint8_t* out, uint32_t out_size) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	int rc = inflateInit2(&stream, GZIP_WINDOW_BITS);
+	if (rc != Z_OK) {
+		LOG_WARNING2("inflateInit2 error, " << rc);
+		return false;
+	}
+	stream.next_in = (Bytef*)in;
+	stream.avail_in = in_size;
+	stream.next_out = out;
+	stream.avail_out = out_size;
+	rc = inflate(&stream, Z_FINISH);
+	bool ok = (rc == Z_STREAM_END && stream.total_out == out_size);
+	inflateEnd(&stream);
+	if (!ok) {
+		LOG_WARNING2("inflate error, " << rc);
+	}
+	return ok;
+}
@@ -0,0 +1,53 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "defines.h"
+
+// codec ids are stored in Cache_Item::item_flag, 0 means not compressed
+#define CODEC_NONE 0
+#define CODEC_GZIP 1
+#define CODEC_MAX 2
+
+// A value compression codec. The methods are stateless and may be called from
+// any thread without holding cache_lock_.
+class Codec {
+public:
+	virtual ~Codec() {}
+	virtual const char* name() const = 0;
+	virtual uint32_t compress_bound(uint32_t size) = 0;
+	// returns the compressed size, 0 on failure
+	virtual uint32_t compress(const uint8_t* in, uint32_t in_size, uint8_t* out, uint32_t out_size, int level) = 0;
+	virtual uint32_t uncompressed_size(const uint8_t* in, uint32_t in_size) = 0;
+	virtual bool uncompress(const uint8_t* in, uint32_t in_size, uint8_t* out, uint32_t out_size) = 0;
+};
+
+// RFC 1952 gzip members, served as is to HTTP clients accepting gzip
+class Gzip_Codec : public Codec {
+public:
+	const char* name() const { return "gzip"; }
+	uint32_t compress_bound(uint32_t size);
+	uint32_t compress(const uint8_t* in, uint32_t in_size, uint8_t* out, uint32_t out_size, int level);
+	uint32_t uncompressed_size(const uint8_t* in, uint32_t in_size);
+	bool uncompress(const uint8_t* in, uint32_t in_size, uint8_t* out, uint32_t out_size);
+};
+
+Codec* get_codec(uint32_t codec_id);
+uint32_t get_codec_id(const char* name);
+
+#endif // CODEC_H
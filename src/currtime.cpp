@@ -16,6 +16,9 @@
 
 #include "currtime.h"
 #include "time.h"
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#endif
 
 Current_Time curr_time_;
 
@@ -39,3 +42,19 @@ void Current_Time::set_current_time() {
 uint32_t Current_Time::get_start_time() {
 	return start_time_;
 }
+
+uint64_t Current_Time::get_tick_us() {
+#if defined(_WIN32) || defined(_WIN64)
+	static LARGE_INTEGER freq = {0};
+	if (freq.QuadPart == 0) {
+		QueryPerformanceFrequency(&freq);
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / freq.QuadPart * 1000000 + counter.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
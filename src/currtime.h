@@ -29,6 +29,7 @@ public:
 		return current_time_;
 	}
 	uint32_t get_start_time();
+	static uint64_t get_tick_us();
 	uint32_t realtime(uint32_t expiration) {
 		if (expiration == 0) {
 			return 0;
@@ -79,6 +79,7 @@
 #include <inttypes.h>
 
 #define _snprintf snprintf
+#define _vsnprintf vsnprintf
 #define _strtoui64 strtoull
 #define _strtoi64 strtoll
 
@@ -0,0 +1,97 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <boost/bind.hpp>
+#include "file_load_pool.h"
+#include "log.h"
+
+File_Load_Pool file_load_pool_;
+
+File_Load_Pool::File_Load_Pool() {
+	work_ = NULL;
+	queue_size_ = 0;
+	max_queue_size_ = 0;
+	rejects_ = 0;
+}
+
+File_Load_Pool::~File_Load_Pool() {
+	stop();
+}
+
+void File_Load_Pool::start(uint32_t thread_size, uint32_t queue_size) {
+	if (thread_size == 0 || work_ != NULL) {
+		return;
+	}
+	max_queue_size_ = queue_size;
+	work_ = new boost::asio::io_service::work(io_service_);
+	for (uint32_t i = 0; i < thread_size; i++) {
+		threads_.push_back(new boost::thread(
+			boost::bind(&boost::asio::io_service::run, &io_service_)));
+	}
+	LOG_INFO("File_Load_Pool::start threads=" << thread_size << " queue_size=" << queue_size);
+}
+
+void File_Load_Pool::stop() {
+	lock_.lock();
+	boost::asio::io_service::work* work = work_;
+	work_ = NULL;
+	lock_.unlock();
+	if (work == NULL) {
+		return;
+	}
+	delete work;
+	io_service_.stop();
+	for (size_t i = 0; i < threads_.size(); i++) {
+		threads_[i]->join();
+		delete threads_[i];
+	}
+	threads_.clear();
+	LOG_INFO("File_Load_Pool::stop");
+}
+
+bool File_Load_Pool::post(const boost::function0<void>& job) {
+	lock_.lock();
+	if (work_ == NULL || queue_size_ >= max_queue_size_) {
+		rejects_++;
+		lock_.unlock();
+		return false;
+	}
+	queue_size_++;
+	lock_.unlock();
+	io_service_.post(boost::bind(&File_Load_Pool::run_job, this, job));
+	return true;
+}
+
+void File_Load_Pool::run_job(boost::function0<void> job) {
+	lock_.lock();
+	queue_size_--;
+	lock_.unlock();
+	job();
+}
+
+uint32_t File_Load_Pool::get_queue_size() {
+	lock_.lock();
+	uint32_t size = queue_size_;
+	lock_.unlock();
+	return size;
+}
+
+uint64_t File_Load_Pool::get_rejects() {
+	lock_.lock();
+	uint64_t rejects = rejects_;
+	lock_.unlock();
+	return rejects;
+}
@@ -0,0 +1,60 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef FILE_LOAD_POOL_H
+#define FILE_LOAD_POOL_H
+
+#include "defines.h"
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+// Threads that resolve and read /webapps files so that a slow disk never
+// stalls the io_service threads. A job posts its own completion back to the
+// io_service of its peer.
+class File_Load_Pool : private boost::noncopyable {
+public:
+	File_Load_Pool();
+	~File_Load_Pool();
+
+	void start(uint32_t thread_size, uint32_t queue_size);
+	void stop();
+
+	// false when the pool is not running or queue_size jobs are already waiting
+	bool post(const boost::function0<void>& job);
+
+	bool is_running() { return work_ != NULL; }
+	uint32_t get_queue_size();
+	uint64_t get_rejects();
+
+private:
+	void run_job(boost::function0<void> job);
+
+	boost::asio::io_service io_service_;
+	boost::asio::io_service::work* work_;
+	vector<boost::thread*> threads_;
+
+	mutex lock_;
+	uint32_t queue_size_;
+	uint32_t max_queue_size_;
+	uint64_t rejects_;
+};
+
+extern File_Load_Pool file_load_pool_;
+
+#endif // FILE_LOAD_POOL_H
@@ -0,0 +1,331 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include "file_monitor.h"
+#include "cache_router.h"
+#include "currtime.h"
+#include "log.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define FILE_MONITOR_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#define FILE_MONITOR_POLL_MS 500
+#endif
+
+File_Monitor file_monitor_;
+
+File_Monitor::File_Monitor() {
+#ifdef __linux__
+	inotify_fd_ = -1;
+	thread_ = NULL;
+	running_ = false;
+#endif
+	negative_size_ = 0;
+	negative_ttl_ = 0;
+	monitoring_ = false;
+	negative_hits_ = 0;
+	invalidations_ = 0;
+}
+
+File_Monitor::~File_Monitor() {
+	stop();
+}
+
+void File_Monitor::start(const string& root, uint32_t negative_size, uint32_t negative_ttl) {
+	root_ = root;
+	negative_size_ = negative_size;
+	negative_ttl_ = negative_ttl;
+#ifdef __linux__
+	inotify_fd_ = inotify_init();
+	if (inotify_fd_ < 0) {
+		LOG_WARNING("File_Monitor::start inotify_init error, " << errno);
+	} else {
+		add_watch_tree("");
+		lock_.lock();
+		monitoring_ = true;
+		lock_.unlock();
+		running_ = true;
+		thread_ = new boost::thread(boost::bind(&File_Monitor::run, this));
+	}
+#endif
+	LOG_INFO("File_Monitor::start negative_size=" << negative_size << " negative_ttl=" << negative_ttl
+		<< " monitoring=" << monitoring_);
+}
+
+void File_Monitor::stop() {
+#ifdef __linux__
+	if (thread_ != NULL) {
+		running_ = false;
+		thread_->join();
+		delete thread_;
+		thread_ = NULL;
+	}
+	if (inotify_fd_ >= 0) {
+		close(inotify_fd_);
+		inotify_fd_ = -1;
+	}
+	watch_dirs_.clear();
+#endif
+	lock_.lock();
+	monitoring_ = false;
+	missing_.clear();
+	missing_order_.clear();
+	file_items_.clear();
+	lock_.unlock();
+}
+
+bool File_Monitor::is_missing(const uint8_t* key, uint32_t key_length) {
+	if (negative_size_ == 0) {
+		return false;
+	}
+	string k((const char*)key, key_length);
+	uint32_t curr_time = curr_time_.get_current_time();
+	lock_.lock();
+	std::map<string, uint32_t>::iterator it = missing_.find(k);
+	bool missing = (it != missing_.end() && it->second > curr_time);
+	if (missing) {
+		negative_hits_++;
+	}
+	lock_.unlock();
+	return missing;
+}
+
+void File_Monitor::add_missing(const uint8_t* key, uint32_t key_length) {
+	if (negative_size_ == 0 || negative_ttl_ == 0) {
+		return;
+	}
+	string k((const char*)key, key_length);
+	uint32_t curr_time = curr_time_.get_current_time();
+	uint32_t expire_time = curr_time + negative_ttl_;
+	lock_.lock();
+	evict_missing(curr_time);
+	missing_[k] = expire_time;
+	missing_order_.push_back(std::make_pair(expire_time, k));
+	lock_.unlock();
+}
+
+// all entries share one ttl, so the insertion order is also the expiration order
+void File_Monitor::evict_missing(uint32_t curr_time) {
+	while (!missing_order_.empty() && (missing_order_.front().first <= curr_time
+			|| missing_.size() >= negative_size_ || missing_order_.size() >= negative_size_ * 2)) {
+		std::map<string, uint32_t>::iterator it = missing_.find(missing_order_.front().second);
+		if (it != missing_.end() && it->second == missing_order_.front().first) {
+			missing_.erase(it);
+		}
+		missing_order_.pop_front();
+	}
+}
+
+// a path appeared, also forgets the failed welcome file lookup of its directory
+void File_Monitor::erase_missing(const string& key, bool is_dir) {
+	lock_.lock();
+	missing_.erase(key);
+	missing_.erase(key.substr(0, key.rfind('/') + 1));
+	if (is_dir) {
+		string prefix = key + "/";
+		std::map<string, uint32_t>::iterator it = missing_.lower_bound(prefix);
+		while (it != missing_.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+			missing_.erase(it++);
+		}
+	}
+	lock_.unlock();
+}
+
+void File_Monitor::add_file_item(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t cache_id) {
+	string k((const char*)key, key_length);
+	lock_.lock();
+	if (monitoring_) {
+		vector<File_Item_Ref>& refs = file_items_[k];
+		size_t i = 0;
+		while (i < refs.size() && refs[i].group_id != group_id) {
+			i++;
+		}
+		if (i < refs.size()) {
+			refs[i].cache_id = cache_id;
+		} else {
+			refs.push_back(File_Item_Ref(group_id, cache_id));
+		}
+	}
+	lock_.unlock();
+}
+
+// unlinks the items loaded from key, or from any file below it if is_dir,
+// an item stored over a loaded one keeps its newer cache_id and survives
+void File_Monitor::invalidate(const string& key, bool is_dir) {
+	vector<std::pair<string, File_Item_Ref> > items;
+	lock_.lock();
+	if (is_dir) {
+		string prefix = key + "/";
+		std::map<string, vector<File_Item_Ref> >::iterator it = file_items_.lower_bound(prefix);
+		while (it != file_items_.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+			for (size_t i = 0; i < it->second.size(); i++) {
+				items.push_back(std::make_pair(it->first, it->second[i]));
+			}
+			file_items_.erase(it++);
+		}
+	} else {
+		std::map<string, vector<File_Item_Ref> >::iterator it = file_items_.find(key);
+		if (it != file_items_.end()) {
+			for (size_t i = 0; i < it->second.size(); i++) {
+				items.push_back(std::make_pair(it->first, it->second[i]));
+			}
+			file_items_.erase(it);
+		}
+	}
+	lock_.unlock();
+
+	uint64_t count = 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		const string& k = items[i].first;
+		if (cache_mgr_.remove(items[i].second.group_id, (const uint8_t*)k.c_str(), (uint32_t)k.size(),
+				items[i].second.cache_id) == XIXI_REASON_SUCCESS) {
+			LOG_DEBUG("File_Monitor::invalidate " << k << " group_id=" << items[i].second.group_id);
+			count++;
+		}
+	}
+	if (count > 0) {
+		lock_.lock();
+		invalidations_ += count;
+		lock_.unlock();
+	}
+}
+
+uint32_t File_Monitor::get_negative_size() {
+	lock_.lock();
+	uint32_t size = (uint32_t)missing_.size();
+	lock_.unlock();
+	return size;
+}
+
+uint64_t File_Monitor::get_negative_hits() {
+	lock_.lock();
+	uint64_t hits = negative_hits_;
+	lock_.unlock();
+	return hits;
+}
+
+uint64_t File_Monitor::get_invalidations() {
+	lock_.lock();
+	uint64_t invalidations = invalidations_;
+	lock_.unlock();
+	return invalidations;
+}
+
+#ifdef __linux__
+void File_Monitor::run() {
+	uint64_t buf[512];
+	while (running_) {
+		struct pollfd pfd;
+		pfd.fd = inotify_fd_;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, FILE_MONITOR_POLL_MS) <= 0) {
+			continue;
+		}
+		ssize_t len = read(inotify_fd_, buf, sizeof(buf));
+		if (len <= 0) {
+			continue;
+		}
+		char* p = (char*)buf;
+		while (p < (char*)buf + len) {
+			struct inotify_event* event = (struct inotify_event*)p;
+			handle_event(event->wd, event->mask, event->len > 0 ? event->name : "");
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+// symbolic links are not followed, files below them expire as usual
+void File_Monitor::add_watch_tree(const string& dir_key) {
+	string dir = root_ + dir_key;
+	int wd = inotify_add_watch(inotify_fd_, dir.c_str(), FILE_MONITOR_MASK);
+	if (wd < 0) {
+		LOG_WARNING("File_Monitor inotify_add_watch error, " << errno << " " << dir);
+		return;
+	}
+	watch_dirs_[wd] = dir_key;
+	try {
+		boost::filesystem::directory_iterator end;
+		for (boost::filesystem::directory_iterator it(dir); it != end; ++it) {
+			if (is_directory(it->symlink_status())) {
+				add_watch_tree(dir_key + "/" + it->path().filename().string());
+			}
+		}
+	} catch (const boost::filesystem::filesystem_error& ex) {
+		LOG_WARNING("File_Monitor add_watch_tree error, " << ex.what());
+	}
+}
+
+void File_Monitor::remove_watch_tree(const string& dir_key) {
+	string prefix = dir_key + "/";
+	std::map<int, string>::iterator it = watch_dirs_.begin();
+	while (it != watch_dirs_.end()) {
+		if (it->second == dir_key || it->second.compare(0, prefix.size(), prefix) == 0) {
+			inotify_rm_watch(inotify_fd_, it->first);
+			watch_dirs_.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+void File_Monitor::handle_event(int wd, uint32_t mask, const char* name) {
+	if ((mask & IN_Q_OVERFLOW) != 0) {
+		LOG_WARNING("File_Monitor event queue overflow");
+		erase_missing("", true);
+		invalidate("", true);
+		return;
+	}
+	std::map<int, string>::iterator it = watch_dirs_.find(wd);
+	if (it == watch_dirs_.end()) {
+		return;
+	}
+	if ((mask & IN_IGNORED) != 0) {
+		watch_dirs_.erase(it);
+		return;
+	}
+	if (name[0] == '\0') {
+		return;
+	}
+	string key = it->second + "/" + name;
+	bool is_dir = (mask & IN_ISDIR) != 0;
+	LOG_DEBUG("File_Monitor::handle_event " << key << " mask=" << mask);
+
+	if ((mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+		if (is_dir) {
+			add_watch_tree(key);
+		}
+		erase_missing(key, is_dir);
+	}
+	if (is_dir) {
+		if ((mask & IN_MOVED_FROM) != 0) {
+			remove_watch_tree(key);
+		}
+		if ((mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) != 0) {
+			invalidate(key, true);
+		}
+	} else if ((mask & IN_CREATE) == 0) {
+		invalidate(key, false);
+	}
+}
+#endif
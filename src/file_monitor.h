@@ -0,0 +1,87 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef FILE_MONITOR_H
+#define FILE_MONITOR_H
+
+#include "defines.h"
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/noncopyable.hpp>
+
+class File_Item_Ref {
+public:
+	File_Item_Ref(uint32_t group_id, uint64_t cache_id) : group_id(group_id), cache_id(cache_id) {}
+	uint32_t group_id;
+	uint64_t cache_id;
+};
+
+// Keeps the /webapps lookups off the disk. Paths found missing are remembered
+// for negative_ttl seconds so a miss storm does not turn into a stat() storm,
+// and on Linux an inotify watch of the tree drops those entries when a file
+// appears and unlinks items loaded from a file when it changes.
+class File_Monitor : private boost::noncopyable {
+public:
+	File_Monitor();
+	~File_Monitor();
+
+	void start(const string& root, uint32_t negative_size, uint32_t negative_ttl);
+	void stop();
+
+	bool is_missing(const uint8_t* key, uint32_t key_length);
+	void add_missing(const uint8_t* key, uint32_t key_length);
+	// an item loaded from the file of key, unlinked when the file changes
+	void add_file_item(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint64_t cache_id);
+
+	uint32_t get_negative_size();
+	uint64_t get_negative_hits();
+	uint64_t get_invalidations();
+
+private:
+	void evict_missing(uint32_t curr_time);
+	void erase_missing(const string& key, bool is_dir);
+	void invalidate(const string& key, bool is_dir);
+
+#ifdef __linux__
+	void run();
+	void add_watch_tree(const string& dir_key);
+	void remove_watch_tree(const string& dir_key);
+	void handle_event(int wd, uint32_t mask, const char* name);
+
+	int inotify_fd_;
+	std::map<int, string> watch_dirs_; // watch descriptor -> key of the directory
+	boost::thread* thread_;
+	volatile bool running_;
+#endif
+
+	string root_;
+	uint32_t negative_size_;
+	uint32_t negative_ttl_;
+
+	mutex lock_;
+	std::map<string, uint32_t> missing_; // key -> expire time
+	std::deque<std::pair<uint32_t, string> > missing_order_;
+	std::map<string, vector<File_Item_Ref> > file_items_;
+	bool monitoring_;
+	uint64_t negative_hits_;
+	uint64_t invalidations_;
+};
+
+extern File_Monitor file_monitor_;
+
+#endif // FILE_MONITOR_H
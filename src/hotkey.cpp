@@ -0,0 +1,186 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include "hotkey.h"
+
+Hot_Keys hot_keys_;
+
+Hot_Keys::Hot_Keys() {
+	memset(sketch_, 0, sizeof(sketch_));
+	item_count_ = 0;
+	last_decay_time_ = 0;
+}
+
+uint32_t Hot_Keys::update_sketch(uint32_t hash_value) {
+	// derive the row hashes from the key hash the cache already computed
+	uint32_t h2 = ((hash_value >> 17) | (hash_value << 15)) | 1;
+	uint32_t estimate = UINT32_C(0xFFFFFFFF);
+	for (uint32_t i = 0; i < HOT_KEY_SKETCH_DEPTH; i++) {
+		uint32_t& c = sketch_[i][(hash_value + i * h2) % HOT_KEY_SKETCH_WIDTH];
+		if (c != UINT32_C(0xFFFFFFFF)) {
+			c++;
+		}
+		if (c < estimate) {
+			estimate = c;
+		}
+	}
+	return estimate;
+}
+
+void Hot_Keys::sift_up(uint32_t i) {
+	while (i > 0) {
+		uint32_t parent = (i - 1) / 2;
+		if (items_[parent].count <= items_[i].count) {
+			break;
+		}
+		std::swap(items_[parent], items_[i]);
+		i = parent;
+	}
+}
+
+void Hot_Keys::sift_down(uint32_t i) {
+	while (true) {
+		uint32_t min = i;
+		uint32_t left = i * 2 + 1;
+		uint32_t right = left + 1;
+		if (left < item_count_ && items_[left].count < items_[min].count) {
+			min = left;
+		}
+		if (right < item_count_ && items_[right].count < items_[min].count) {
+			min = right;
+		}
+		if (min == i) {
+			break;
+		}
+		std::swap(items_[min], items_[i]);
+		i = min;
+	}
+}
+
+void Hot_Keys::record(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t bytes) {
+	lock_.lock();
+	do_record(group_id, key, key_length, hash_value, bytes);
+	lock_.unlock();
+}
+
+void Hot_Keys::do_record(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t bytes) {
+	uint32_t estimate = update_sketch(hash_value);
+	if (key_length > HOT_KEY_MAX_KEY_LENGTH) {
+		key_length = HOT_KEY_MAX_KEY_LENGTH;
+	}
+
+	for (uint32_t i = 0; i < item_count_; i++) {
+		Hot_Key_Item& item = items_[i];
+		if (item.hash_value == hash_value && item.group_id == group_id && item.key.size() == key_length
+				&& memcmp(item.key.data(), key, key_length) == 0) {
+			item.count = estimate;
+			item.hits++;
+			item.bytes += bytes;
+			sift_down(i);
+			return;
+		}
+	}
+
+	uint32_t i;
+	if (item_count_ < HOT_KEY_TOP_K) {
+		i = item_count_++;
+	} else if (estimate > items_[0].count) {
+		i = 0;
+	} else {
+		return;
+	}
+	Hot_Key_Item& item = items_[i];
+	item.group_id = group_id;
+	item.hash_value = hash_value;
+	item.count = estimate;
+	item.hits = 1;
+	item.bytes = bytes;
+	item.key.assign((const char*)key, key_length);
+	if (i == 0) {
+		sift_down(0);
+	} else {
+		sift_up(i);
+	}
+}
+
+void Hot_Keys::decay(uint32_t curr_time) {
+	lock_.lock();
+	if (curr_time < last_decay_time_ + HOT_KEY_DECAY_INTERVAL) {
+		lock_.unlock();
+		return;
+	}
+	last_decay_time_ = curr_time;
+
+	// halving keeps the heap order
+	for (uint32_t i = 0; i < HOT_KEY_SKETCH_DEPTH; i++) {
+		for (uint32_t j = 0; j < HOT_KEY_SKETCH_WIDTH; j++) {
+			sketch_[i][j] >>= 1;
+		}
+	}
+	for (uint32_t i = 0; i < item_count_; i++) {
+		items_[i].count >>= 1;
+		items_[i].hits >>= 1;
+		items_[i].bytes >>= 1;
+	}
+	lock_.unlock();
+}
+
+static bool hot_key_greater(const Hot_Key_Item* a, const Hot_Key_Item* b) {
+	return a->count > b->count;
+}
+
+static std::string escape_key(const std::string& key) {
+	static const char hex[] = "0123456789ABCDEF";
+	std::string out;
+	for (size_t i = 0; i < key.size(); i++) {
+		uint8_t c = (uint8_t)key[i];
+		if (c > 0x20 && c < 0x7F && c != '%' && c != '=') {
+			out += (char)c;
+		} else {
+			out += '%';
+			out += hex[c >> 4];
+			out += hex[c & 0x0F];
+		}
+	}
+	return out;
+}
+
+void Hot_Keys::get_stats(uint32_t curr_time, std::string& out) {
+	lock_.lock();
+	std::vector<const Hot_Key_Item*> items;
+	for (uint32_t i = 0; i < item_count_; i++) {
+		if (items_[i].count > 0) {
+			items.push_back(&items_[i]);
+		}
+	}
+	std::sort(items.begin(), items.end(), hot_key_greater);
+
+	// with halving every T seconds a steady rate r leaves count ~= r * (T + elapsed) / interval
+	uint32_t window = HOT_KEY_DECAY_INTERVAL + (curr_time - last_decay_time_);
+	for (uint32_t i = 0; i < items.size(); i++) {
+		const Hot_Key_Item* item = items[i];
+		uint64_t qps = (uint64_t)item->count * HOT_KEY_SAMPLE_INTERVAL / window;
+		uint64_t bytes = item->hits > 0 ? qps * (item->bytes / item->hits) : 0;
+		std::string n = boost::lexical_cast<std::string>(i + 1);
+		out += "hotkey_group" + n + "=" + boost::lexical_cast<std::string>(item->group_id) + "\n";
+		out += "hotkey_key" + n + "=" + escape_key(item->key) + "\n";
+		out += "hotkey_qps" + n + "=" + boost::lexical_cast<std::string>(qps) + "\n";
+		out += "hotkey_bytes" + n + "=" + boost::lexical_cast<std::string>(bytes) + "\n";
+	}
+	lock_.unlock();
+}
@@ -0,0 +1,96 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef HOTKEY_H
+#define HOTKEY_H
+
+#include "defines.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#define HOT_KEY_SKETCH_DEPTH 4
+#define HOT_KEY_SKETCH_WIDTH 4096
+#define HOT_KEY_TOP_K 32
+#define HOT_KEY_MAX_KEY_LENGTH 250
+#define HOT_KEY_SAMPLE_INTERVAL 16
+#define HOT_KEY_DECAY_INTERVAL 10
+
+class Hot_Key_Item {
+public:
+	Hot_Key_Item() {
+		group_id = 0;
+		hash_value = 0;
+		count = 0;
+		hits = 0;
+		bytes = 0;
+	}
+
+	uint32_t group_id;
+	uint32_t hash_value;
+	uint32_t count;    // count-min estimate
+	uint32_t hits;     // samples taken while in the top-K
+	uint64_t bytes;    // value bytes of those samples
+	std::string key;
+};
+
+class Hot_Key_Sampler {
+public:
+	Hot_Key_Sampler() : count(0) {}
+	uint32_t count;
+};
+
+// Streaming top-K of the most accessed keys. One access in HOT_KEY_SAMPLE_INTERVAL
+// per thread is counted in a count-min sketch, and all counters are halved every
+// HOT_KEY_DECAY_INTERVAL seconds. record, decay and get_stats take lock_, the
+// cache partitions share one instance.
+class Hot_Keys {
+public:
+	Hot_Keys();
+
+	inline bool sample() {
+		Hot_Key_Sampler* sampler = sampler_.get();
+		if (sampler == NULL) {
+			sampler = new Hot_Key_Sampler();
+			sampler_.reset(sampler);
+		}
+		if (++sampler->count < HOT_KEY_SAMPLE_INTERVAL) {
+			return false;
+		}
+		sampler->count = 0;
+		return true;
+	}
+
+	void record(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t bytes);
+	void decay(uint32_t curr_time);
+	void get_stats(uint32_t curr_time, std::string& out);
+
+private:
+	void do_record(uint32_t group_id, const uint8_t* key, uint32_t key_length, uint32_t hash_value, uint32_t bytes);
+	inline uint32_t update_sketch(uint32_t hash_value);
+	inline void sift_up(uint32_t i);
+	inline void sift_down(uint32_t i);
+
+	uint32_t sketch_[HOT_KEY_SKETCH_DEPTH][HOT_KEY_SKETCH_WIDTH];
+	Hot_Key_Item items_[HOT_KEY_TOP_K]; // min-heap on count
+	uint32_t item_count_;
+	uint32_t last_decay_time_;
+	mutex lock_;
+	boost::thread_specific_ptr<Hot_Key_Sampler> sampler_;
+};
+
+extern Hot_Keys hot_keys_;
+
+#endif // HOTKEY_H
@@ -19,10 +19,15 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include "io_service_pool.h"
+#include "currtime.h"
 #include "log.h"
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <unistd.h>
+#include <pthread.h>
+#endif
 
 io_service_pool::io_service_pool(std::size_t pool_size, std::size_t thread_size) :
-next_io_service_(0) {
+next_io_service_(0), least_loaded_(0), last_sample_tick_(0) {
 	if (pool_size <= 0) {
 		pool_size = 1; // use default 1
 	}
@@ -36,7 +41,15 @@ next_io_service_(0) {
 		boost::asio::io_service::work* work = new boost::asio::io_service::work(*io_service);
 		io_services_.push_back(io_service);
 		work_.push_back(work);
+		loads_.push_back(new Io_Service_Load());
 	}
+
+	for (std::size_t t = 0; t < thread_size_; ++t) {
+		std::size_t index = t % io_services_.size();
+		loads_[index]->threads++;
+		thread_loads_.push_back(new Io_Thread_Load(index));
+	}
+	last_sample_tick_ = Current_Time::get_tick_us();
 }
 
 io_service_pool::~io_service_pool() {
@@ -49,6 +62,21 @@ io_service_pool::~io_service_pool() {
 		delete io_services_[i];
 	}
 	io_services_.clear();
+
+	for (std::size_t i = 0; i < loads_.size(); ++i)  {
+		delete loads_[i];
+	}
+	loads_.clear();
+
+	for (std::size_t i = 0; i < thread_loads_.size(); ++i)  {
+#if defined(_WIN32) || defined(_WIN64)
+		if (thread_loads_[i]->ready) {
+			CloseHandle(thread_loads_[i]->handle);
+		}
+#endif
+		delete thread_loads_[i];
+	}
+	thread_loads_.clear();
 }
 
 void io_service_pool::run() {
@@ -57,7 +85,7 @@ void io_service_pool::run() {
 	for (std::size_t t = 0; t < thread_size_; ++t) {
 		std::size_t index = t % io_services_.size();
 		boost::shared_ptr<boost::thread> thread(new boost::thread(
-			boost::bind(&boost::asio::io_service::run, io_services_[index])));
+			boost::bind(&io_service_pool::run_thread, this, index, thread_loads_[t])));
 		threads.push_back(thread);
 	}
 
@@ -67,15 +95,233 @@ void io_service_pool::run() {
 	}
 }
 
+void io_service_pool::run_thread(size_t index, Io_Thread_Load* load) {
+	load_lock_.lock();
+#if defined(_WIN32) || defined(_WIN64)
+	load->handle = OpenThread(THREAD_QUERY_INFORMATION, FALSE, GetCurrentThreadId());
+	load->ready = (load->handle != NULL);
+#elif defined(__linux__)
+	load->ready = (pthread_getcpuclockid(pthread_self(), &load->clock) == 0);
+#endif
+	if (load->ready) {
+		load->last_cpu_us = get_cpu_us(load);
+	}
+	load_lock_.unlock();
+
+	if (thread_init_) {
+		thread_init_(index);
+	}
+	io_services_[index]->run();
+}
+
 void io_service_pool::stop() {
 	for (std::size_t i = 0; i < io_services_.size(); ++i) {
 		io_services_[i]->stop();
 	}
 }
 
+// round robin over the io_services with the lowest score, then the fewest connections
 boost::asio::io_service& io_service_pool::get_io_service() {
-	boost::asio::io_service& io_service = *io_services_[next_io_service_];
-	next_io_service_ = (next_io_service_ + 1) % io_services_.size();
+	size_t n = io_services_.size();
+	size_t start = next_io_service_;
+	next_io_service_ = (next_io_service_ + 1) % n;
+
+	Io_Service_Load* best = NULL;
+	size_t best_index = start;
+	for (size_t i = 0; i < n; i++) {
+		size_t index = (start + i) % n;
+		Io_Service_Load* load = loads_[index];
+		if (load->threads == 0) {
+			continue;
+		}
+		if (best == NULL || load->score / PLACEMENT_SCORE_STEP < best->score / PLACEMENT_SCORE_STEP
+				|| (load->score / PLACEMENT_SCORE_STEP == best->score / PLACEMENT_SCORE_STEP && load->connections < best->connections)) {
+			best = load;
+			best_index = index;
+		}
+	}
+	return *io_services_[best_index];
+}
+
+size_t io_service_pool::get_index(boost::asio::io_service& io_service) {
+	for (size_t i = 0; i < io_services_.size(); i++) {
+		if (io_services_[i] == &io_service) {
+			return i;
+		}
+	}
+	return io_services_.size();
+}
+
+void io_service_pool::add_connection(boost::asio::io_service& io_service) {
+	size_t index = get_index(io_service);
+	if (index < loads_.size()) {
+		load_lock_.lock();
+		loads_[index]->connections++;
+		load_lock_.unlock();
+	}
+}
+
+void io_service_pool::remove_connection(boost::asio::io_service& io_service) {
+	size_t index = get_index(io_service);
+	if (index < loads_.size()) {
+		load_lock_.lock();
+		loads_[index]->connections--;
+		load_lock_.unlock();
+	}
+}
+
+bool io_service_pool::migrate(boost::asio::ip::tcp::socket*& socket) {
+#if defined(_WIN32) || defined(_WIN64)
+	// a socket stays bound to the completion port it was first used with
+	return false;
+#else
+	size_t from = get_index(socket->get_io_service());
+	size_t to = least_loaded_;
+	if (from == to || from >= loads_.size()) {
+		return false;
+	}
+	Io_Service_Load* from_load = loads_[from];
+	Io_Service_Load* to_load = loads_[to];
+	if (from_load->score < to_load->score + MIGRATION_SCORE_GAP || from_load->connections <= 1) {
+		return false;
+	}
+
+	load_lock_.lock();
+	if (from_load->migrate_budget == 0) {
+		load_lock_.unlock();
+		return false;
+	}
+	from_load->migrate_budget--;
+	load_lock_.unlock();
+
+	boost::system::error_code ec;
+	boost::asio::ip::tcp::endpoint endpoint = socket->local_endpoint(ec);
+	if (ec) {
+		return false;
+	}
+	int fd = ::dup(socket->native_handle());
+	if (fd < 0) {
+		LOG_WARNING("io_service_pool::migrate dup error, errno=" << errno);
+		return false;
+	}
+	boost::asio::ip::tcp::socket* new_socket = new boost::asio::ip::tcp::socket(*io_services_[to]);
+	new_socket->assign(endpoint.protocol(), fd, ec);
+	if (!ec) {
+		boost::asio::ip::tcp::socket::non_blocking_io non_blocking_io(true);
+		new_socket->io_control(non_blocking_io, ec);
+	}
+	if (ec) {
+		LOG_WARNING("io_service_pool::migrate assign error=" << ec.message());
+		if (!new_socket->is_open()) {
+			::close(fd);
+		}
+		delete new_socket;
+		return false;
+	}
+	socket->close(ec);
+	delete socket;
+	socket = new_socket;
+
+	load_lock_.lock();
+	from_load->connections--;
+	from_load->migrations++;
+	to_load->connections++;
+	load_lock_.unlock();
+	return true;
+#endif
+}
+
+uint64_t io_service_pool::get_cpu_us(Io_Thread_Load* load) {
+#if defined(_WIN32) || defined(_WIN64)
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	if (!GetThreadTimes(load->handle, &creation_time, &exit_time, &kernel_time, &user_time)) {
+		return load->last_cpu_us;
+	}
+	uint64_t t = (((uint64_t)kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime)
+		+ (((uint64_t)user_time.dwHighDateTime << 32) | user_time.dwLowDateTime);
+	return t / 10;
+#elif defined(__linux__)
+	struct timespec ts;
+	if (clock_gettime(load->clock, &ts) != 0) {
+		return load->last_cpu_us;
+	}
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	return load->last_cpu_us;
+#endif
+}
+
+// A probe handler is posted to each io_service, the time it waits to run
+// stands in for the depth of the handler queue, which asio does not expose.
+void io_service_pool::sample_load() {
+	uint64_t tick = Current_Time::get_tick_us();
+	load_lock_.lock();
+	uint64_t interval = tick - last_sample_tick_;
+	if (interval == 0) {
+		load_lock_.unlock();
+		return;
+	}
+	last_sample_tick_ = tick;
 
-	return io_service;
+	vector<uint32_t> busy(loads_.size(), 0);
+	for (size_t i = 0; i < thread_loads_.size(); i++) {
+		Io_Thread_Load* load = thread_loads_[i];
+		if (!load->ready) {
+			continue;
+		}
+		uint64_t cpu_us = get_cpu_us(load);
+		uint64_t permille = (cpu_us - load->last_cpu_us) * 1000 / interval;
+		load->last_cpu_us = cpu_us;
+		load->busy_permille = (uint32_t)(permille < 1000 ? permille : 1000);
+		busy[load->index] += load->busy_permille;
+	}
+
+	size_t least_loaded = least_loaded_;
+	Io_Service_Load* least = NULL;
+	for (size_t i = 0; i < loads_.size(); i++) {
+		Io_Service_Load* load = loads_[i];
+		if (load->threads == 0) {
+			continue;
+		}
+		load->busy_permille = busy[i] / load->threads;
+		if (load->probe_pending) {
+			uint64_t delay = tick - load->probe_tick;
+			load->queue_delay_us = (uint32_t)(delay < 0xFFFFFFFF ? delay : 0xFFFFFFFF);
+		}
+		uint64_t delay_permille = (uint64_t)load->queue_delay_us * 1000 / interval;
+		load->score = load->busy_permille + (uint32_t)(delay_permille < 1000 ? delay_permille : 1000);
+		load->migrate_budget = MIGRATION_MAX_PER_SAMPLE;
+		if (least == NULL || load->score < least->score) {
+			least = load;
+			least_loaded = i;
+		}
+		if (!load->probe_pending) {
+			load->probe_pending = true;
+			load->probe_tick = tick;
+			io_services_[i]->post(boost::bind(&io_service_pool::handle_probe, this, i));
+		}
+	}
+	least_loaded_ = least_loaded;
+	load_lock_.unlock();
+}
+
+void io_service_pool::handle_probe(size_t index) {
+	uint64_t tick = Current_Time::get_tick_us();
+	load_lock_.lock();
+	Io_Service_Load* load = loads_[index];
+	uint64_t delay = tick - load->probe_tick;
+	load->queue_delay_us = (uint32_t)(delay < 0xFFFFFFFF ? delay : 0xFFFFFFFF);
+	load->probe_pending = false;
+	load_lock_.unlock();
+}
+
+void io_service_pool::get_loads(vector<Io_Service_Load>& services, vector<Io_Thread_Load>& threads) {
+	load_lock_.lock();
+	for (size_t i = 0; i < loads_.size(); i++) {
+		services.push_back(*loads_[i]);
+	}
+	for (size_t i = 0; i < thread_loads_.size(); i++) {
+		threads.push_back(*thread_loads_[i]);
+	}
+	load_lock_.unlock();
 }
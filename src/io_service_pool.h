@@ -19,7 +19,67 @@
 
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
 #include "defines.h"
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+// scores closer than this count as equal when a new connection is placed
+#define PLACEMENT_SCORE_STEP 50
+// an io_service scoring this much more than the least loaded one gives up connections
+#define MIGRATION_SCORE_GAP 200
+// connections each io_service may give up per load sample
+#define MIGRATION_MAX_PER_SAMPLE 4
+
+// cpu time of one io thread, busy_permille is the share of the last sample interval
+class Io_Thread_Load {
+public:
+	Io_Thread_Load(size_t index) {
+		this->index = index;
+		ready = false;
+		last_cpu_us = 0;
+		busy_permille = 0;
+	}
+
+	size_t index; // of its io_service
+	volatile bool ready;
+#if defined(_WIN32) || defined(_WIN64)
+	HANDLE handle;
+#elif defined(__linux__)
+	clockid_t clock;
+#endif
+	uint64_t last_cpu_us;
+	uint32_t busy_permille;
+};
+
+// Load of the threads sharing one io_service. Fields are written under
+// io_service_pool::load_lock_, placement and migration read them without it.
+class Io_Service_Load {
+public:
+	Io_Service_Load() {
+		threads = 0;
+		connections = 0;
+		busy_permille = 0;
+		queue_delay_us = 0;
+		score = 0;
+		probe_tick = 0;
+		probe_pending = false;
+		migrate_budget = 0;
+		migrations = 0;
+	}
+
+	uint32_t threads;
+	uint32_t connections;
+	uint32_t busy_permille;  // average of its threads
+	uint32_t queue_delay_us; // wait of the last probe handler posted to it
+	uint32_t score;          // busy_permille plus the queue delay in permille of the sample interval
+	uint64_t probe_tick;
+	bool probe_pending;
+	uint32_t migrate_budget;
+	uint64_t migrations;     // connections moved away
+};
 
 class io_service_pool : private boost::noncopyable {
 public:
@@ -30,11 +90,33 @@ public:
 
 	void stop();
 
+	// the least loaded io_service that has a thread
 	boost::asio::io_service& get_io_service();
+	boost::asio::io_service& get_io_service(size_t index) { return *io_services_[index]; }
 
+	size_t get_pool_size() { return io_services_.size(); }
 	size_t get_thread_size() { return thread_size_; }
 
+	// called in each thread with the index of its io_service before it runs
+	void set_thread_init(const boost::function1<void, size_t>& thread_init) { thread_init_ = thread_init; }
+
+	void add_connection(boost::asio::io_service& io_service);
+	void remove_connection(boost::asio::io_service& io_service);
+
+	// moves socket to the least loaded io_service when its own is overloaded,
+	// only while no operation is pending on it
+	bool migrate(boost::asio::ip::tcp::socket*& socket);
+
+	// called periodically, updates the load of every thread and io_service
+	void sample_load();
+	void get_loads(vector<Io_Service_Load>& services, vector<Io_Thread_Load>& threads);
+
 private:
+	void run_thread(size_t index, Io_Thread_Load* load);
+	void handle_probe(size_t index);
+	size_t get_index(boost::asio::io_service& io_service);
+	static uint64_t get_cpu_us(Io_Thread_Load* load);
+
 	vector<boost::asio::io_service*> io_services_;
 
 	vector<boost::asio::io_service::work*> work_;
@@ -42,6 +124,14 @@ private:
 	size_t next_io_service_;
 
 	size_t thread_size_;
+
+	boost::function1<void, size_t> thread_init_;
+
+	mutex load_lock_;
+	vector<Io_Service_Load*> loads_;
+	vector<Io_Thread_Load*> thread_loads_;
+	size_t least_loaded_;
+	uint64_t last_sample_tick_;
 };
 
 #endif // IO_SERVICE_POOL_H
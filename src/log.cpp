@@ -109,7 +109,7 @@ const char* LOG_PREFIX(const char* severity) {
 		*id = next_thread_id++;
 		thread_id.reset(id);
 	}
-//	printf("%"PRIu32"\n", *id);
+//	printf("%" PRIu32 "\n", *id);
 /*
 	stringstream ss;
 	ss << boost::this_thread::get_id();
@@ -119,7 +119,7 @@ const char* LOG_PREFIX(const char* severity) {
 	}
 */
 	const char* p = strTime.c_str();
-	_snprintf(log_prefix, sizeof(log_prefix), "[%4.4s-%2.2s-%2.2s %2.2s:%2.2s:%s %"PRIu32" %s] ",
+	_snprintf(log_prefix, sizeof(log_prefix), "[%4.4s-%2.2s-%2.2s %2.2s:%2.2s:%s %" PRIu32 " %s] ",
 		p, p + 4, p + 6, p + 9, p + 11, p + 13, *id, severity);
 
 	return log_prefix;
@@ -84,7 +84,7 @@ void print_license() {
 #include <boost/version.hpp>
 void printf_system_info() {
 	LOG_INFO("BEGIN-----SYSTEM INFO-----BEGIN");
-	LOG_INFO("BOOST_LIB_VERSION="BOOST_LIB_VERSION);
+	LOG_INFO("BOOST_LIB_VERSION=" BOOST_LIB_VERSION);
 
 #ifdef NDEBUG
 	LOG_INFO("RELEASE");
@@ -129,19 +129,19 @@ void printf_system_info() {
 
 	char tmp[30];
 	int32_t id32 = INT32_C(0x7FFFFFFF);
-	_snprintf(tmp, sizeof(tmp), "%"PRId32, id32);
+	_snprintf(tmp, sizeof(tmp), "%" PRId32, id32);
 	LOG_INFO("max_i32=" << id32);
 
 	int64_t id64 = INT64_C(0x7FFFFFFFFFFFFFFF);
-	_snprintf(tmp, sizeof(tmp), "%"PRId64, id64);
+	_snprintf(tmp, sizeof(tmp), "%" PRId64, id64);
 	LOG_INFO("max_i64=" << id64);
 
 	uint32_t ui32 = UINT32_C(0xFFFFFFFF);
-	_snprintf(tmp, sizeof(tmp), "%"PRIu32, ui32);
+	_snprintf(tmp, sizeof(tmp), "%" PRIu32, ui32);
 	LOG_INFO("max_ui32=" << ui32);
 
 	uint64_t ui64 = UINT64_C(0xFFFFFFFFFFFFFFFF);
-	_snprintf(tmp, sizeof(tmp), "%"PRIu64, ui64);
+	_snprintf(tmp, sizeof(tmp), "%" PRIu64, ui64);
 	LOG_INFO("max_ui64=" << ui64);
 
 #ifdef ENDIAN_LITTLE
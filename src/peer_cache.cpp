@@ -18,6 +18,7 @@
 #include "settings.h"
 #include "currtime.h"
 #include "stats.h"
+#include "cache_router.h"
 #include "log.h"
 #include "auth.h"
 #include "server.h"
@@ -28,7 +29,7 @@
 #define LOG_WARNING2(x)  LOG_WARNING("Peer_Cache id=" << get_peer_id() << " " << x)
 #define LOG_ERROR2(x)  LOG_ERROR("Peer_Cache id=" << get_peer_id() << " " << x)
 
-Peer_Cache::Peer_Cache(boost::asio::ip::tcp::socket* socket) : self_(this), timer_(socket->get_io_service()) {
+Peer_Cache::Peer_Cache(boost::asio::ip::tcp::socket* socket) : self_(this) {
 	LOG_DEBUG2("Peer_Cache::Peer_Cache()");
 /*	op_count_ = 0;
 	socket_ = socket;
@@ -38,20 +39,23 @@ Peer_Cache::Peer_Cache(boost::asio::ip::tcp::socket* socket) : self_(this), time
 	cache_item_ = NULL;
 	write_buf_total_ = 0;
 	read_item_buf_ = NULL;
+	read_data_offset_ = 0;
 	swallow_size_ = 0;
 	next_data_len_ = XIXI_PDU_HEAD_LENGTH;
 	timer_flag_ = false;
 */
 	init();
 	socket_ = socket;
+	svr_->get_io_service_pool().add_connection(socket->get_io_service());
 
 	stats_.new_conn();
 }
 
-Peer_Cache::Peer_Cache(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* socket) : self_(this), timer_(socket->get_io_service()) {
+Peer_Cache::Peer_Cache(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* socket) : self_(this) {
 	LOG_DEBUG2("Peer_Cache::Peer_Cache()");
 	init();
 	socket_ssl_ = socket;
+	svr_->get_io_service_pool().add_connection(socket->get_io_service());
 
 	stats_.new_conn();
 }
@@ -72,9 +76,14 @@ void Peer_Cache::init() {
 	cache_item_ = NULL;
 	write_buf_total_ = 0;
 	read_item_buf_ = NULL;
+	read_data_offset_ = 0;
 	swallow_size_ = 0;
 	next_data_len_ = XIXI_PDU_HEAD_LENGTH;
+	timer_ = NULL;
 	timer_flag_ = false;
+	options_ = 0;
+	op_latency_ = 0;
+	op_start_tick_ = 0;
 }
 
 void Peer_Cache::cleanup() {
@@ -86,22 +95,24 @@ void Peer_Cache::cleanup() {
 	cache_items_.clear();
 
 	if (socket_ != NULL) {
+		svr_->get_io_service_pool().remove_connection(socket_->get_io_service());
 		delete socket_;
 		socket_ = NULL;
 	}
 
 	if (socket_ssl_ != NULL) {
+		svr_->get_io_service_pool().remove_connection(socket_ssl_->get_io_service());
 		delete socket_ssl_;
 		socket_ssl_ = NULL;
 	}
-/*	if (timer_ != NULL) {
+	if (timer_ != NULL) {
 		timer_lock_.lock();
 		if (timer_ != NULL) {
 			delete timer_;
 			timer_ = NULL;
 		}
 		timer_lock_.unlock();
-	}*/
+	}
 }
 
 void Peer_Cache::write_simple_res(xixi_choice choice) {
@@ -152,6 +163,7 @@ void Peer_Cache::write_error(xixi_reason error_code, uint32_t swallow, bool repl
 
 void Peer_Cache::process() {
 	LOG_TRACE2("process length=" << read_buffer_.read_data_size_);
+	uint64_t start_tick = Current_Time::get_tick_us();
 
 	uint32_t process_reqest_count = 0;
 	bool run = true;
@@ -212,7 +224,9 @@ void Peer_Cache::process() {
 
 		case PEER_STATE_READ_BODY_EXTRAS:
 			if (next_data_len_ == 0) {
-				process_pdu_extras(read_pdu_);
+				if (!next_read_segment()) {
+					process_pdu_extras(read_pdu_);
+				}
 			} else if (read_buffer_.read_data_size_ > 0) {
 				uint32_t tmp = read_buffer_.read_data_size_ > next_data_len_ ? next_data_len_ : read_buffer_.read_data_size_;
 	//			if (read_item_buf_ != read_buffer_.read_curr_) {
@@ -282,6 +296,7 @@ void Peer_Cache::process() {
 			break;
 
 		case PEER_STATUS_WRITE:
+			end_op();
 			set_state(next_state_);
 			next_state_ = PEER_STATE_NEW_CMD;
 			if (state_ == PEER_STATE_NEW_CMD && process_reqest_count < 32) {
@@ -310,6 +325,7 @@ void Peer_Cache::process() {
 			break;
 		}
 	}
+	stats_.latency(LATENCY_CACHE_PROCESS, Current_Time::get_tick_us() - start_tick);
 }
 
 void Peer_Cache::set_state(peer_state state) {
@@ -321,9 +337,11 @@ uint32_t Peer_Cache::process_header(uint8_t* data, uint32_t data_len) {
 	LOG_TRACE2("process_header data_len=" << data_len);
 
 	read_pdu_header_.decode(data);
+	begin_op(read_pdu_header_.choice);
 
 	switch (read_pdu_header_.choice) {
 	case XIXI_CHOICE_GET_REQ:
+	case XIXI_CHOICE_LEASE_GET_REQ:
 		next_data_len_ = XIXI_Get_Req_Pdu::get_fixed_body_size();
 		set_state(PEER_STATE_READ_BODY_FIXED);
 		break;
@@ -370,6 +388,10 @@ uint32_t Peer_Cache::process_header(uint8_t* data, uint32_t data_len) {
 	case XIXI_CHOICE_HELLO_REQ:
 		process_hello_req_pdu_fixed();
 		break;
+	case XIXI_CHOICE_SET_OPTIONS_REQ:
+		next_data_len_ = XIXI_Set_Options_Req_Pdu::get_fixed_body_size();
+		set_state(PEER_STATE_READ_BODY_FIXED);
+		break;
 	case XIXI_CHOICE_CREATE_WATCH_REQ:
 		next_data_len_ = XIXI_Create_Watch_Req_Pdu::get_fixed_body_size();
 		set_state(PEER_STATE_READ_BODY_FIXED);
@@ -378,6 +400,10 @@ uint32_t Peer_Cache::process_header(uint8_t* data, uint32_t data_len) {
 		next_data_len_ = XIXI_Check_Watch_Req_Pdu::get_fixed_body_size();
 		set_state(PEER_STATE_READ_BODY_FIXED);
 		break;
+	case XIXI_CHOICE_CHECK_FEED_REQ:
+		next_data_len_ = XIXI_Check_Feed_Req_Pdu::get_fixed_body_size();
+		set_state(PEER_STATE_READ_BODY_FIXED);
+		break;
 	default:
 		LOG_WARNING2("process_header unknown cateory=" << (int)read_pdu_header_.category() << " command=" << (int)read_pdu_header_.command());
 		write_error(XIXI_REASON_UNKNOWN_COMMAND, 0, true);
@@ -391,6 +417,7 @@ void Peer_Cache::process_pdu_fixed(XIXI_Pdu* pdu) {
 	LOG_TRACE2("process_pdu_fixed choice=" << read_pdu_header_.choice);
 	switch (read_pdu_header_.choice) {
 	case XIXI_CHOICE_GET_REQ:
+	case XIXI_CHOICE_LEASE_GET_REQ:
 		next_data_len_ = ((XIXI_Get_Req_Pdu*)pdu)->key_length;
 		set_state(PEER_STATE_READ_BODY_EXTRAS2);
 		break;
@@ -435,6 +462,12 @@ void Peer_Cache::process_pdu_fixed(XIXI_Pdu* pdu) {
 	case XIXI_CHOICE_CHECK_WATCH_REQ:
 		process_check_watch_req_pdu_fixed((XIXI_Check_Watch_Req_Pdu*)pdu);
 		break;
+	case XIXI_CHOICE_SET_OPTIONS_REQ:
+		process_set_options_req_pdu_fixed((XIXI_Set_Options_Req_Pdu*)pdu);
+		break;
+	case XIXI_CHOICE_CHECK_FEED_REQ:
+		process_check_feed_req_pdu_fixed((XIXI_Check_Feed_Req_Pdu*)pdu);
+		break;
 	default:
 		LOG_WARNING2("process_pdu_fixed unknown cateory=" << (int)read_pdu_header_.category() << " command=" << (int)read_pdu_header_.command());
 		write_error(XIXI_REASON_UNKNOWN_COMMAND, 0, true);
@@ -462,8 +495,12 @@ uint32_t Peer_Cache::process_pdu_extras2(XIXI_Pdu* pdu, uint8_t* data, uint32_t
 	switch (read_pdu_header_.choice) {
 	case XIXI_CHOICE_GET_REQ:
 		return process_get_req_pdu_extras((XIXI_Get_Req_Pdu*)pdu, data, data_length);
+	case XIXI_CHOICE_LEASE_GET_REQ:
+		return process_lease_get_req_pdu_extras((XIXI_Get_Req_Pdu*)pdu, data, data_length);
 	case XIXI_CHOICE_GET_TOUCH_REQ:
 		return process_get_touch_req_pdu_extras((XIXI_Get_Touch_Req_Pdu*)pdu, data, data_length);
+	case XIXI_CHOICE_UPDATE_REQ:
+		return process_update_req_pdu_key((XIXI_Update_Req_Pdu*)pdu, data, data_length);
 	case XIXI_CHOICE_UPDATE_FLAGS_REQ:
 		return process_update_flags_req_pdu_extras((XIXI_Update_Flags_Req_Pdu*)pdu, data, data_length);
 	case XIXI_CHOICE_UPDATE_EXPIRATION_REQ:
@@ -498,19 +535,7 @@ uint32_t Peer_Cache::process_get_req_pdu_extras(XIXI_Get_Req_Pdu* pdu, uint8_t*
 		cache_item_ = it;
 		cache_items_.push_back(it);
 
-		uint8_t* cb = cache_buf_.prepare(XIXI_Get_Res_Pdu::calc_encode_size());
-		XIXI_Get_Res_Pdu gsp;
-		gsp.cache_id = it->cache_id;
-		gsp.flags = it->flags;
-		gsp.expiration = expiration;
-		gsp.data_length = it->data_size;
-		gsp.encode(cb);
-
-		add_write_buf(cb, XIXI_Get_Res_Pdu::calc_encode_size());
-		add_write_buf(it->get_data(), it->data_size);
-
-		set_state(PEER_STATUS_WRITE);
-		next_state_ = PEER_STATE_NEW_CMD;
+		write_get_res(it, expiration);
 	} else {
 		write_error(reason, 0, true);
 //		if (watch_error) {
@@ -523,8 +548,11 @@ uint32_t Peer_Cache::process_get_req_pdu_extras(XIXI_Get_Req_Pdu* pdu, uint8_t*
 	return key_length;
 }
 
-uint32_t Peer_Cache::process_get_touch_req_pdu_extras(XIXI_Get_Touch_Req_Pdu* pdu, uint8_t* data, uint32_t data_length) {
-	LOG_TRACE2("process_get_touch_req_pdu_extras");
+// A miss either grants the lease to fill the key or, while another client
+// holds it, answers XIXI_REASON_PLEASE_TRY_AGAIN. A hit that is due for a
+// refresh may hand that lease to this client in front of the value.
+uint32_t Peer_Cache::process_lease_get_req_pdu_extras(XIXI_Get_Req_Pdu* pdu, uint8_t* data, uint32_t data_length) {
+	LOG_TRACE2("process_lease_get_req_pdu_extras");
 	uint8_t* key = data;
 	uint32_t key_length = pdu->key_length;
 	if (data_length < key_length) {
@@ -532,26 +560,52 @@ uint32_t Peer_Cache::process_get_touch_req_pdu_extras(XIXI_Get_Touch_Req_Pdu* pd
 	}
 
 	xixi_reason reason;
-	Cache_Item* it = cache_mgr_.get_touch(pdu->group_id, key, key_length, pdu->watch_id, pdu->expiration, reason);
+	uint32_t expiration;
+	uint64_t lease_token;
+	Cache_Item* it = cache_mgr_.lease_get(pdu->group_id, key, key_length, pdu->watch_id, expiration, lease_token, reason);
 	if (it != NULL) {
-		cache_item_ = it;  
+		cache_item_ = it;
 		cache_items_.push_back(it);
 
-		uint8_t* cb = cache_buf_.prepare(XIXI_Get_Res_Pdu::calc_encode_size());
-		XIXI_Get_Res_Pdu gsp;
-		gsp.cache_id = it->cache_id;
-		gsp.flags = it->flags;
-		gsp.expiration = pdu->expiration;
-		gsp.data_length = it->data_size;
-		gsp.encode(cb);
+		if (lease_token != 0) {
+			uint8_t* cb = cache_buf_.prepare(XIXI_Lease_Get_Res_Pdu::calc_encode_size());
+			XIXI_Lease_Get_Res_Pdu::encode(cb, lease_token);
+			XIXI_Pdu_Header::encode_choice(cb, XIXI_CHOICE_LEASE_REFRESH_RES);
+			add_write_buf(cb, XIXI_Lease_Get_Res_Pdu::calc_encode_size());
+		}
+		write_get_res(it, expiration);
+	} else if (reason == XIXI_REASON_SUCCESS) {
+		uint8_t* cb = cache_buf_.prepare(XIXI_Lease_Get_Res_Pdu::calc_encode_size());
+		XIXI_Lease_Get_Res_Pdu::encode(cb, lease_token);
 
-		add_write_buf(cb, XIXI_Get_Res_Pdu::calc_encode_size());
-		add_write_buf(it->get_data(), it->data_size);
+		add_write_buf(cb, XIXI_Lease_Get_Res_Pdu::calc_encode_size());
 
 		set_state(PEER_STATUS_WRITE);
 		next_state_ = PEER_STATE_NEW_CMD;
 	} else {
 		write_error(reason, 0, true);
+	}
+
+	return key_length;
+}
+
+uint32_t Peer_Cache::process_get_touch_req_pdu_extras(XIXI_Get_Touch_Req_Pdu* pdu, uint8_t* data, uint32_t data_length) {
+	LOG_TRACE2("process_get_touch_req_pdu_extras");
+	uint8_t* key = data;
+	uint32_t key_length = pdu->key_length;
+	if (data_length < key_length) {
+		return 0;
+	}
+
+	xixi_reason reason;
+	Cache_Item* it = cache_mgr_.get_touch(pdu->group_id, key, key_length, pdu->watch_id, pdu->expiration, reason);
+	if (it != NULL) {
+		cache_item_ = it;  
+		cache_items_.push_back(it);
+
+		write_get_res(it, pdu->expiration);
+	} else {
+		write_error(reason, 0, true);
 //		if (watch_error) {
 //			write_error(XIXI_REASON_WATCH_NOT_FOUND, 0, true);
 //		} else {
@@ -604,22 +658,50 @@ void Peer_Cache::process_update_req_pdu_fixed(XIXI_Update_Req_Pdu* pdu) {
 	//    return;
 	//  }
 
-	uint32_t data_len = pdu->key_length + pdu->data_length;
+	// the key is read first, the item is allocated by the partition owning it
+	next_data_len_ = pdu->key_length;
+	set_state(PEER_STATE_READ_BODY_EXTRAS2);
+}
 
-	cache_item_ = cache_mgr_.alloc_item(pdu->group_id, pdu->key_length, pdu->flags,
+uint32_t Peer_Cache::process_update_req_pdu_key(XIXI_Update_Req_Pdu* pdu, uint8_t* data, uint32_t data_length) {
+	LOG_TRACE2("process_update_req_pdu_key");
+	uint8_t* key = data;
+	uint32_t key_length = pdu->key_length;
+	if (data_length < key_length) {
+		return 0;
+	}
+
+	cache_item_ = cache_mgr_.alloc_item(pdu->group_id, key, key_length, pdu->flags,
 		pdu->expiration, pdu->data_length, 0);
 
 	if (cache_item_ == NULL) {
-		if (cache_mgr_.item_size_ok(pdu->key_length, pdu->data_length, 0)) {
-			write_error(XIXI_REASON_OUT_OF_MEMORY, data_len, pdu->reply());
+		if (cache_mgr_.item_size_ok(key_length, pdu->data_length, 0)) {
+			write_error(XIXI_REASON_OUT_OF_MEMORY, pdu->data_length, pdu->reply());
 		} else {
-			write_error(XIXI_REASON_TOO_LARGE, data_len, pdu->reply());
+			write_error(XIXI_REASON_TOO_LARGE, pdu->data_length, pdu->reply());
 		}
 	} else {
-		read_item_buf_ = cache_item_->get_key();
-		next_data_len_ = data_len;
+		if (cache_item_->is_chunked()) {
+			next_data_len_ = 0;
+			read_data_offset_ = 0;
+		} else {
+			read_item_buf_ = cache_item_->get_data();
+			next_data_len_ = pdu->data_length;
+			read_data_offset_ = pdu->data_length;
+		}
 		set_state(PEER_STATE_READ_BODY_EXTRAS);
 	}
+	return key_length;
+}
+
+// the data of a chunked item is read chunk by chunk
+bool Peer_Cache::next_read_segment() {
+	if (read_data_offset_ >= cache_item_->data_size) {
+		return false;
+	}
+	read_item_buf_ = cache_item_->get_data_segment(read_data_offset_, next_data_len_);
+	read_data_offset_ += next_data_len_;
+	return true;
 }
 
 void Peer_Cache::process_update_req_pdu_extras(XIXI_Update_Req_Pdu* pdu) {
@@ -629,9 +711,10 @@ void Peer_Cache::process_update_req_pdu_extras(XIXI_Update_Req_Pdu* pdu) {
 
 //	uint32_t data_len = pdu->key_length + pdu->data_length;
 
-	cache_item_->calc_hash_value();
-
-	cache_item_->cache_id = pdu->cache_id;
+	cache_item_->cache_id = (pdu->sub_op() == XIXI_UPDATE_SUB_OP_LEASE_SET) ? 0 : pdu->cache_id;
+	if (pdu->sub_op() <= XIXI_UPDATE_SUB_OP_REPLACE || pdu->sub_op() == XIXI_UPDATE_SUB_OP_LEASE_SET) {
+		cache_item_ = cache_mgr_.compress_item(cache_item_);
+	}
 
 	uint64_t cache_id;
 	xixi_reason reason;
@@ -652,6 +735,9 @@ void Peer_Cache::process_update_req_pdu_extras(XIXI_Update_Req_Pdu* pdu) {
 	case XIXI_UPDATE_SUB_OP_PREPEND:
 		reason = cache_mgr_.prepend(cache_item_, pdu->watch_id, cache_id);
 		break;
+	case XIXI_UPDATE_SUB_OP_LEASE_SET:
+		reason = cache_mgr_.lease_set(cache_item_, pdu->cache_id, pdu->watch_id, cache_id);
+		break;
 	default:
 		reason = XIXI_REASON_UNKNOWN_COMMAND;
 		break;
@@ -832,6 +918,54 @@ void Peer_Cache::process_hello_req_pdu_fixed() {
 	write_simple_res(XIXI_CHOICE_HELLO_RES);
 }
 
+void Peer_Cache::process_set_options_req_pdu_fixed(XIXI_Set_Options_Req_Pdu* pdu) {
+	LOG_TRACE2("process_set_options_req_pdu_fixed options=" << pdu->options);
+	options_ = pdu->options;
+	write_simple_res(XIXI_CHOICE_SET_OPTIONS_RES);
+}
+
+// A compressed value goes out as is when the connection accepts its codec,
+// otherwise it is uncompressed into cache_buf_. A counter is rendered there.
+void Peer_Cache::write_get_res(Cache_Item* it, uint32_t expiration) {
+	uint8_t* cb = cache_buf_.prepare(XIXI_Get_Res_Pdu::calc_encode_size());
+	XIXI_Get_Res_Pdu gsp;
+	gsp.cache_id = it->cache_id;
+	gsp.flags = it->flags;
+	gsp.expiration = expiration;
+	gsp.data_length = it->data_size;
+
+	if (it->is_counter()) {
+		uint8_t* data = cache_buf_.prepare(COUNTER_TEXT_SIZE);
+		gsp.data_length = it->get_counter_text(data);
+		gsp.encode(cb);
+		add_write_buf(cb, XIXI_Get_Res_Pdu::calc_encode_size());
+		add_write_buf(data, gsp.data_length);
+	} else if (!it->is_compressed()) {
+		gsp.encode(cb);
+		add_write_buf(cb, XIXI_Get_Res_Pdu::calc_encode_size());
+		add_write_data(it);
+	} else if (it->codec_id() == CODEC_GZIP && (options_ & XIXI_OPTION_ACCEPT_GZIP) != 0) {
+		gsp.encode(cb);
+		XIXI_Pdu_Header::encode_choice(cb, XIXI_CHOICE_GET_GZIP_RES);
+		add_write_buf(cb, XIXI_Get_Res_Pdu::calc_encode_size());
+		add_write_buf(it->get_data(), it->data_size);
+	} else {
+		uint32_t size = it->uncompressed_size();
+		uint8_t* data = cache_buf_.prepare(size);
+		if (data == NULL || !get_codec(it->codec_id())->uncompress(it->get_data(), it->data_size, data, size)) {
+			write_error(XIXI_REASON_OUT_OF_MEMORY, 0, true);
+			return;
+		}
+		gsp.data_length = size;
+		gsp.encode(cb);
+		add_write_buf(cb, XIXI_Get_Res_Pdu::calc_encode_size());
+		add_write_buf(data, size);
+	}
+
+	set_state(PEER_STATUS_WRITE);
+	next_state_ = PEER_STATE_NEW_CMD;
+}
+
 void Peer_Cache::process_create_watch_req_pdu_fixed(XIXI_Create_Watch_Req_Pdu* pdu) {
 	LOG_TRACE2("process_create_watch_req_pdu_fixed");
 	uint32_t watchID = cache_mgr_.create_watch(pdu->group_id, pdu->max_next_check_interval);
@@ -875,13 +1009,13 @@ void Peer_Cache::process_check_watch_req_pdu_fixed(XIXI_Check_Watch_Req_Pdu* pdu
 		} else {
 			//    LOG_INFO2("process_check_watch_req_pdu_fixed wait a moment watch_id=" << pdu->watch_id << " updated_count=" << updated_count);
 			timer_lock_.lock();
-		//	timer_ = new boost::asio::deadline_timer(socket_->get_io_service());
-			timer_.expires_from_now(boost::posix_time::seconds(pdu->check_timeout));
-			timer_.async_wait(boost::bind(&Peer_Cache::handle_timer, this,
+			boost::asio::deadline_timer* timer = get_timer();
+			timer->expires_from_now(boost::posix_time::seconds(pdu->check_timeout));
+			timer->async_wait(boost::bind(&Peer_Cache::handle_timer, this,
 				boost::asio::placeholders::error, pdu->watch_id));
 			if (timer_flag_) {
 				boost::system::error_code ec;
-				timer_.cancel(ec);
+				timer->cancel(ec);
 				LOG_INFO2("process_check_watch_req_pdu_fixed timer cancel");
 			} else {
 				timer_flag_ = true;
@@ -892,6 +1026,49 @@ void Peer_Cache::process_check_watch_req_pdu_fixed(XIXI_Check_Watch_Req_Pdu* pdu
 	}
 }
 
+void Peer_Cache::process_check_feed_req_pdu_fixed(XIXI_Check_Feed_Req_Pdu* pdu) {
+	std::vector<XIXI_Feed_Event> events;
+	boost::shared_ptr<Cache_Watch_Sink> sp = self_;
+	timer_flag_ = false;
+	uint64_t first_sequence;
+	uint64_t next_sequence;
+	bool ret = cache_mgr_.check_feed(sp, pdu->group_id, pdu->sequence, pdu->max_count, pdu->check_timeout > 0,
+		first_sequence, next_sequence, events);
+
+	if (!ret) {
+		write_error(XIXI_REASON_INVALID_OPERATION, 0, true);
+	} else if (!events.empty() || first_sequence != pdu->sequence || pdu->check_timeout == 0) {
+		write_check_feed_res(first_sequence, next_sequence, events);
+		set_state(PEER_STATUS_WRITE);
+		next_state_ = PEER_STATE_NEW_CMD;
+	} else {
+		timer_lock_.lock();
+		boost::asio::deadline_timer* timer = get_timer();
+		timer->expires_from_now(boost::posix_time::seconds(pdu->check_timeout));
+		timer->async_wait(boost::bind(&Peer_Cache::handle_feed_timer, this,
+			boost::asio::placeholders::error, pdu->group_id, pdu->sequence, pdu->max_count));
+		if (timer_flag_) {
+			boost::system::error_code ec;
+			timer->cancel(ec);
+		} else {
+			timer_flag_ = true;
+		}
+		timer_lock_.unlock();
+		set_state(PEER_STATUS_ASYNC_WAIT);
+	}
+}
+
+void Peer_Cache::write_check_feed_res(uint64_t first_sequence, uint64_t next_sequence, std::vector<XIXI_Feed_Event>& events) {
+	uint32_t size = XIXI_Check_Feed_Res_Pdu::calc_encode_size((uint32_t)events.size());
+	uint8_t* buf = cache_buf_.prepare(size);
+	if (buf != NULL) {
+		XIXI_Check_Feed_Res_Pdu::encode(buf, first_sequence, next_sequence, events);
+		add_write_buf(buf, size);
+	} else {
+		write_error(XIXI_REASON_OUT_OF_MEMORY, 0, true);
+	}
+}
+
 void Peer_Cache::process_flush_req_pdu_fixed(XIXI_Flush_Req_Pdu* pdu) {
 	uint8_t* cb = cache_buf_.prepare(XIXI_Flush_Res_Pdu::calc_encode_size());
 	XIXI_Flush_Res_Pdu res_pdu;
@@ -922,7 +1099,39 @@ void Peer_Cache::process_stats_req_pdu_fixed(XIXI_Stats_Req_Pdu* pdu) {
 	}
 }
 
+void Peer_Cache::begin_op(xixi_choice choice) {
+	switch (choice) {
+	case XIXI_CHOICE_GET_REQ: op_latency_ = LATENCY_CACHE_GET; break;
+	case XIXI_CHOICE_LEASE_GET_REQ: op_latency_ = LATENCY_CACHE_GET; break;
+	case XIXI_CHOICE_GET_TOUCH_REQ: op_latency_ = LATENCY_CACHE_GET_TOUCH; break;
+	case XIXI_CHOICE_GET_BASE_REQ: op_latency_ = LATENCY_CACHE_GET_BASE; break;
+	case XIXI_CHOICE_UPDATE_REQ: op_latency_ = LATENCY_CACHE_UPDATE; break;
+	case XIXI_CHOICE_UPDATE_FLAGS_REQ: op_latency_ = LATENCY_CACHE_UPDATE_FLAGS; break;
+	case XIXI_CHOICE_UPDATE_EXPIRATION_REQ: op_latency_ = LATENCY_CACHE_UPDATE_EXPIRATION; break;
+	case XIXI_CHOICE_DELETE_REQ: op_latency_ = LATENCY_CACHE_DELETE; break;
+	case XIXI_CHOICE_DELTA_REQ: op_latency_ = LATENCY_CACHE_DELTA; break;
+	case XIXI_CHOICE_FLUSH_REQ: op_latency_ = LATENCY_CACHE_FLUSH; break;
+	case XIXI_CHOICE_AUTH_REQ: op_latency_ = LATENCY_CACHE_AUTH; break;
+	case XIXI_CHOICE_STATS_REQ: op_latency_ = LATENCY_CACHE_STATS; break;
+	case XIXI_CHOICE_CREATE_WATCH_REQ: op_latency_ = LATENCY_CACHE_CREATE_WATCH; break;
+	case XIXI_CHOICE_CHECK_WATCH_REQ: op_latency_ = LATENCY_CACHE_CHECK_WATCH; break;
+	case XIXI_CHOICE_CHECK_FEED_REQ: op_latency_ = LATENCY_CACHE_CHECK_WATCH; break;
+	case XIXI_CHOICE_HELLO_REQ: op_latency_ = LATENCY_CACHE_HELLO; break;
+	case XIXI_CHOICE_SET_OPTIONS_REQ: op_latency_ = LATENCY_CACHE_HELLO; break;
+	default: op_start_tick_ = 0; return;
+	}
+	op_start_tick_ = Current_Time::get_tick_us();
+}
+
+void Peer_Cache::end_op() {
+	if (op_start_tick_ != 0) {
+		stats_.latency(op_latency_, Current_Time::get_tick_us() - op_start_tick_);
+		op_start_tick_ = 0;
+	}
+}
+
 void Peer_Cache::reset_for_new_cmd() {
+	end_op();
 	read_pdu_ = NULL;
 	cache_item_ = NULL;
 	for (uint32_t i = 0; i < cache_items_.size(); i++) {
@@ -933,6 +1142,7 @@ void Peer_Cache::reset_for_new_cmd() {
 	cache_buf_.reset();
 	write_buf_total_ = 0;
 	read_item_buf_ = NULL;
+	read_data_offset_ = 0;
 	next_data_len_ = XIXI_PDU_HEAD_LENGTH;
 	set_state(PEER_STATE_READ_HEADER);
 }
@@ -941,8 +1151,10 @@ void Peer_Cache::on_cache_watch_notify(uint32_t watch_id) {
 //	if (lock_.try_lock()) {
 	timer_lock_.lock();
 		if (timer_flag_) {
-			boost::system::error_code ec;
-			timer_.cancel(ec);
+			if (timer_ != NULL) {
+				boost::system::error_code ec;
+				timer_->cancel(ec);
+			}
 		} else {
 			timer_flag_ = true;
 		}
@@ -1042,8 +1254,39 @@ void Peer_Cache::handle_write(const boost::system::error_code& err) {
 	}
 }
 
+boost::asio::deadline_timer* Peer_Cache::get_timer() {
+	if (timer_ == NULL) {
+		if (socket_ != NULL) {
+			timer_ = new boost::asio::deadline_timer(socket_->get_io_service());
+		} else {
+			timer_ = new boost::asio::deadline_timer(socket_ssl_->get_io_service());
+		}
+	}
+	return timer_;
+}
+
+// Not while a watch or feed wait is pending on the old io_service. The timer
+// is dropped with it and made again on the new one by the next wait.
+bool Peer_Cache::migrate_socket() {
+	if (state_ == PEER_STATUS_ASYNC_WAIT) {
+		return false;
+	}
+	timer_lock_.lock();
+	bool ret = svr_->get_io_service_pool().migrate(socket_);
+	if (ret && timer_ != NULL) {
+		delete timer_;
+		timer_ = NULL;
+		timer_flag_ = false;
+	}
+	timer_lock_.unlock();
+	return ret;
+}
+
 void Peer_Cache::try_read() {
 	if (op_count_ == 0) {
+		if (socket_ != NULL && settings_.connection_migration && migrate_socket()) {
+			LOG_DEBUG2("try_read migrated");
+		}
 		++op_count_;
 		read_buffer_.handle_processed();
 		if (socket_ != NULL) {
@@ -1098,6 +1341,24 @@ uint32_t Peer_Cache::read_some(uint8_t* buf, uint32_t length) {
 	}
 }
 
+void Peer_Cache::handle_feed_timer(const boost::system::error_code& err, uint32_t group_id, uint64_t sequence, uint32_t max_count) {
+	std::vector<XIXI_Feed_Event> events;
+	boost::shared_ptr<Cache_Watch_Sink> sp = self_;
+	uint64_t first_sequence;
+	uint64_t next_sequence;
+	lock_.lock();
+	if (!cache_mgr_.check_feed(sp, group_id, sequence, max_count, false, first_sequence, next_sequence, events)) {
+		write_error(XIXI_REASON_INVALID_OPERATION, 0, true);
+	} else {
+		write_check_feed_res(first_sequence, next_sequence, events);
+		set_state(PEER_STATE_NEW_CMD);
+		next_state_ = PEER_STATE_NEW_CMD;
+	}
+	end_op();
+	try_write();
+	lock_.unlock();
+}
+
 void Peer_Cache::handle_timer(const boost::system::error_code& err, uint32_t watch_id) {
 	//  LOG_INFO("Peer_Cache::handle_timer err=" << err);
 	std::vector<uint64_t> updated_list;
@@ -1125,6 +1386,7 @@ void Peer_Cache::handle_timer(const boost::system::error_code& err, uint32_t wat
 			write_error(XIXI_REASON_OUT_OF_MEMORY, 0, true);
 		}
 	}
+	end_op();
 	try_write();
 	lock_.unlock();
 //	timer_lock_.lock();
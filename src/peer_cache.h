@@ -52,10 +52,12 @@ protected:
 	inline uint32_t process_header(uint8_t* data, uint32_t data_len);
 	inline void process_pdu_fixed(XIXI_Pdu* pdu);
 	inline void process_pdu_extras(XIXI_Pdu* pdu);
+	inline bool next_read_segment();
 	inline uint32_t process_pdu_extras2(XIXI_Pdu* pdu, uint8_t* data, uint32_t data_length);
 
 	// get
 	inline uint32_t process_get_req_pdu_extras(XIXI_Get_Req_Pdu* pdu, uint8_t* data, uint32_t data_length);
+	inline uint32_t process_lease_get_req_pdu_extras(XIXI_Get_Req_Pdu* pdu, uint8_t* data, uint32_t data_length);
 
 	// get touch
 	inline uint32_t process_get_touch_req_pdu_extras(XIXI_Get_Touch_Req_Pdu* pdu, uint8_t* data, uint32_t data_length);
@@ -65,6 +67,7 @@ protected:
 
 	// update
 	inline void process_update_req_pdu_fixed(XIXI_Update_Req_Pdu* pdu);
+	inline uint32_t process_update_req_pdu_key(XIXI_Update_Req_Pdu* pdu, uint8_t* data, uint32_t data_length);
 	inline void process_update_req_pdu_extras(XIXI_Update_Req_Pdu* pdu);
 
 	// update base
@@ -87,12 +90,19 @@ protected:
 	// hello
 	inline void process_hello_req_pdu_fixed();
 
+	// options
+	inline void process_set_options_req_pdu_fixed(XIXI_Set_Options_Req_Pdu* pdu);
+
 	// create watch
 	inline void process_create_watch_req_pdu_fixed(XIXI_Create_Watch_Req_Pdu* pdu);
 
 	// check watch
 	inline void process_check_watch_req_pdu_fixed(XIXI_Check_Watch_Req_Pdu* pdu);
 
+	// check feed
+	inline void process_check_feed_req_pdu_fixed(XIXI_Check_Feed_Req_Pdu* pdu);
+	inline void write_check_feed_res(uint64_t first_sequence, uint64_t next_sequence, std::vector<XIXI_Feed_Event>& events);
+
 	// flush
 	inline void process_flush_req_pdu_fixed(XIXI_Flush_Req_Pdu* pdu);
 
@@ -100,9 +110,12 @@ protected:
 	inline void process_stats_req_pdu_fixed(XIXI_Stats_Req_Pdu* pdu);
 
 	inline void reset_for_new_cmd();
+	inline void begin_op(xixi_choice choice);
+	inline void end_op();
 	inline void write_simple_res(xixi_choice choice, uint32_t request_id);
 	inline void write_simple_res(xixi_choice choice);
 	inline void write_error(xixi_reason error_code, uint32_t swallow, bool reply);
+	inline void write_get_res(Cache_Item* it, uint32_t expiration);
 
 	inline void cleanup();
 
@@ -111,14 +124,26 @@ protected:
 	inline void handle_write(const boost::system::error_code& err);
 
 	inline void try_read();
+	bool migrate_socket();
+	boost::asio::deadline_timer* get_timer();
 	inline bool try_write();
 	inline uint32_t read_some(uint8_t* buf, uint32_t length);
 	inline void add_write_buf(const uint8_t* buf, uint32_t size) {
 		write_buf_.push_back(boost::asio::const_buffer(buf, size));
 		write_buf_total_ += size;
 	}
+	inline void add_write_data(Cache_Item* it) {
+		uint32_t offset = 0;
+		while (offset < it->data_size) {
+			uint32_t size;
+			const uint8_t* data = it->get_data_segment(offset, size);
+			add_write_buf(data, size);
+			offset += size;
+		}
+	}
 
 	void handle_timer(const boost::system::error_code& err, uint32_t watch_id);
+	void handle_feed_timer(const boost::system::error_code& err, uint32_t group_id, uint64_t sequence, uint32_t max_count);
 
 protected:
 	boost::shared_ptr<Peer_Cache> self_;
@@ -137,18 +162,23 @@ protected:
 	uint32_t write_buf_total_;
 
 	uint8_t* read_item_buf_;
+	uint32_t read_data_offset_;
 
 	Cache_Item* cache_item_;
 	vector<Cache_Item*> cache_items_;
 
 	uint32_t    swallow_size_;
 
+	uint32_t options_;
+	uint32_t op_latency_;
+	uint64_t op_start_tick_;
+
 	Cache_Buffer<MAX_PDU_FIXED_LENGTH * 5> cache_buf_;
 
 	Receive_Buffer<2048, 8192> read_buffer_;
 	vector<boost::asio::const_buffer> write_buf_;
 
-	boost::asio::deadline_timer timer_;
+	boost::asio::deadline_timer* timer_; // made on the io_service of the socket, guarded by timer_lock_
 	bool timer_flag_;
 
 	boost::asio::ip::tcp::socket* socket_;
@@ -58,12 +58,32 @@ const xixi_choice XIXI_CHOICE_CREATE_WATCH_RES = XIXI_CHOICE_CACHE_BASE + 23;
 const xixi_choice XIXI_CHOICE_CHECK_WATCH_REQ = XIXI_CHOICE_CACHE_BASE + 24;
 const xixi_choice XIXI_CHOICE_CHECK_WATCH_RES = XIXI_CHOICE_CACHE_BASE + 25;
 
+const xixi_choice XIXI_CHOICE_SET_OPTIONS_REQ = XIXI_CHOICE_CACHE_BASE + 26;
+const xixi_choice XIXI_CHOICE_SET_OPTIONS_RES = XIXI_CHOICE_CACHE_BASE + 27;
+
+// same body as XIXI_CHOICE_GET_RES, the data is a gzip member
+const xixi_choice XIXI_CHOICE_GET_GZIP_RES = XIXI_CHOICE_CACHE_BASE + 28;
+
+const xixi_choice XIXI_CHOICE_CHECK_FEED_REQ = XIXI_CHOICE_CACHE_BASE + 29;
+const xixi_choice XIXI_CHOICE_CHECK_FEED_RES = XIXI_CHOICE_CACHE_BASE + 30;
+
+// same body as XIXI_CHOICE_GET_REQ, a hit is answered with XIXI_CHOICE_GET_RES
+const xixi_choice XIXI_CHOICE_LEASE_GET_REQ = XIXI_CHOICE_CACHE_BASE + 31;
+const xixi_choice XIXI_CHOICE_LEASE_GET_RES = XIXI_CHOICE_CACHE_BASE + 32;
+// same body as XIXI_CHOICE_LEASE_GET_RES, the lease to refresh a stale or early
+// expiring value, followed by the get response of that value
+const xixi_choice XIXI_CHOICE_LEASE_REFRESH_RES = XIXI_CHOICE_CACHE_BASE + 33;
+
+// connection options
+const uint32_t XIXI_OPTION_ACCEPT_GZIP = 1;
+
 typedef uint8_t watch_notify_type;
 const watch_notify_type WATCH_NOTIFY_TYPE_BASE_INFO_UPDATED = 1;
 const watch_notify_type WATCH_NOTIFY_TYPE_DATA_UPDATED = 2;
 const watch_notify_type WATCH_NOTIFY_TYPE_DELETED = 3;
 const watch_notify_type WATCH_NOTIFY_TYPE_EXPIRED = 4;
 const watch_notify_type WATCH_NOTIFY_TYPE_FLUSHED = 5;
+const watch_notify_type WATCH_NOTIFY_TYPE_EVICTED = 6;
 
 class XIXI_Get_Req_Pdu : public XIXI_Pdu {
 public:
@@ -164,6 +184,8 @@ const uint8_t XIXI_UPDATE_SUB_OP_ADD = 1;
 const uint8_t XIXI_UPDATE_SUB_OP_REPLACE = 2;
 const uint8_t XIXI_UPDATE_SUB_OP_APPEND = 3;
 const uint8_t XIXI_UPDATE_SUB_OP_PREPEND = 4;
+// a set that carries the lease token in the cache_id field
+const uint8_t XIXI_UPDATE_SUB_OP_LEASE_SET = 5;
 const uint8_t XIXI_UPDATE_REPLY = 128;
 class XIXI_Update_Req_Pdu : public XIXI_Pdu {
 public:
@@ -212,6 +234,18 @@ public:
 	uint64_t cache_id;
 };
 
+// the key was missing and the lease to fill it was granted
+class XIXI_Lease_Get_Res_Pdu : public XIXI_Pdu {
+public:
+	static uint32_t calc_encode_size() {
+		return XIXI_PDU_CHOICE_LENGTH + 8; // sizeof(lease_token)
+	}
+	static void encode(uint8_t* buf, uint64_t lease_token) {
+		ENCODE_CHOICE(buf, XIXI_CHOICE_LEASE_GET_RES); buf += XIXI_PDU_CHOICE_LENGTH;
+		ENCODE_UINT64(buf, lease_token);
+	}
+};
+
 const uint8_t XIXI_UPDATE_FLAGS_REPLY = 128;
 class XIXI_Update_Flags_Req_Pdu : public XIXI_Pdu {
 public:
@@ -427,6 +461,8 @@ const uint8_t XIXI_STATS_SUB_OP_GET_STATS_GROUP_ONLY = 2;
 //const uint8_t XIXI_STATS_SUB_OP_GET_AND_CLEAR_STATS_GROUP_ONLY = 3;
 const uint8_t XIXI_STATS_SUB_OP_GET_STATS_SUM_ONLY = 4;
 //const uint8_t XIXI_STATS_SUB_OP_GET_AND_CLEAR_STATS_SUM_ONLY = 5;
+const uint8_t XIXI_STATS_SUB_OP_GET_HOT_KEYS = 6;
+const uint8_t XIXI_STATS_SUB_OP_GET_LATENCY = 7;
 class XIXI_Stats_Req_Pdu : public XIXI_Pdu {
 public:
 	static uint32_t get_fixed_body_size() {
@@ -531,4 +567,62 @@ public:
 	uint32_t update_count;
 };
 
+struct XIXI_Feed_Event {
+	uint64_t cache_id;
+	uint32_t key_hash;
+	watch_notify_type type;
+};
+
+// sequence 0 subscribes at the current end of the feed
+class XIXI_Check_Feed_Req_Pdu : public XIXI_Pdu {
+public:
+	static uint32_t get_fixed_body_size() {
+		return 20;
+	}
+	void decode_fixed(uint8_t* buf, uint32_t length) {
+		group_id = DECODE_UINT32(buf);
+		sequence = DECODE_UINT64(buf + 4);
+		max_count = DECODE_UINT32(buf + 12);
+		check_timeout = DECODE_UINT32(buf + 16);
+	}
+
+	uint32_t group_id;
+	uint64_t sequence;
+	uint32_t max_count;
+	uint32_t check_timeout;
+};
+
+// Events first_sequence .. next_sequence - 1 of the group. A first_sequence
+// other than the requested one means events were missed.
+class XIXI_Check_Feed_Res_Pdu : public XIXI_Pdu {
+public:
+	static uint32_t calc_encode_size(uint32_t event_count) {
+		return XIXI_PDU_CHOICE_LENGTH + 20 + event_count * (8 + 4 + sizeof(watch_notify_type));
+	}
+	static void encode(uint8_t* buf, uint64_t first_sequence, uint64_t next_sequence, const std::vector<XIXI_Feed_Event>& events) {
+		uint32_t event_count = (uint32_t)events.size();
+		ENCODE_CHOICE(buf, XIXI_CHOICE_CHECK_FEED_RES); buf += XIXI_PDU_CHOICE_LENGTH;
+		ENCODE_UINT64(buf, first_sequence); buf += 8;
+		ENCODE_UINT64(buf, next_sequence); buf += 8;
+		ENCODE_UINT32(buf, event_count); buf += 4;
+		for (uint32_t i = 0; i < event_count; i++) {
+			ENCODE_UINT64(buf, events[i].cache_id); buf += 8;
+			ENCODE_UINT32(buf, events[i].key_hash); buf += 4;
+			ENCODE_UINT8(buf, events[i].type); buf++;
+		}
+	}
+};
+
+class XIXI_Set_Options_Req_Pdu : public XIXI_Pdu {
+public:
+	static uint32_t get_fixed_body_size() {
+		return 4;
+	}
+	void decode_fixed(uint8_t* buf, uint32_t length) {
+		options = DECODE_UINT32(buf);
+	}
+
+	uint32_t options;
+};
+
 #endif // PEER_CACHE_PDU_H
@@ -20,39 +20,61 @@
 #include "settings.h"
 #include "currtime.h"
 #include "stats.h"
+#include "cache_router.h"
 #include "log.h"
 #include "auth.h"
 #include "server.h"
+#include "file_load_pool.h"
+#include "file_monitor.h"
 
-#define DEFAULT_RES_200_KEEP_ALIVE "HTTP/1.1 200 OK\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: "
-#define DEFAULT_RES_200_CLOSE "HTTP/1.1 200 OK\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: "
+#define DEFAULT_RES_200_KEEP_ALIVE "HTTP/1.1 200 OK\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: "
+#define DEFAULT_RES_200_CLOSE "HTTP/1.1 200 OK\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: "
 
-#define GET_RES_200_KEEP_ALIVE "HTTP/1.1 200 OK\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: "
-#define GET_RES_200_CLOSE "HTTP/1.1 200 OK\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: "
+#define METRICS_RES_200_KEEP_ALIVE "HTTP/1.1 200 OK\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+#define METRICS_RES_200_CLOSE "HTTP/1.1 200 OK\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
 
-#define GET_RES_304_KEEP_ALIVE "HTTP/1.1 304 Not Modified\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: "
-#define GET_RES_304_CLOSE "HTTP/1.1 304 Not Modified\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: "
+#define GET_RES_200_KEEP_ALIVE "HTTP/1.1 200 OK\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nAccept-Ranges: bytes\r\nContent-Type: "
+#define GET_RES_200_CLOSE "HTTP/1.1 200 OK\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nAccept-Ranges: bytes\r\nContent-Type: "
 
-#define GET_RES_301_KEEP_ALIVE "HTTP/1.1 301 Moved Permanently\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: "
-#define GET_RES_301_CLOSE "HTTP/1.1 301 Moved Permanently\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: "
+#define GET_RES_206_KEEP_ALIVE "HTTP/1.1 206 Partial Content\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nAccept-Ranges: bytes\r\nContent-Type: "
+#define GET_RES_206_CLOSE "HTTP/1.1 206 Partial Content\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nAccept-Ranges: bytes\r\nContent-Type: "
 
-#define DELETE_RES_200_KEEP_ALIVE "HTTP/1.1 200 OK\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 0\r\n\r\n"
-#define DELETE_RES_200_CLOSE "HTTP/1.1 200 OK\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 0\r\n\r\n"
+#define GET_RES_416_KEEP_ALIVE "HTTP/1.1 416 Range Not Satisfiable\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 0\r\nContent-Range: bytes */"
+#define GET_RES_416_CLOSE "HTTP/1.1 416 Range Not Satisfiable\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 0\r\nContent-Range: bytes */"
 
-#define ERROR_RES_400_KEEP_ALIVE "HTTP/1.1 400 Bad Request\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 24\r\n\r\n<H1>400 Bad Request</H1>"
-#define ERROR_RES_400_CLOSE "HTTP/1.1 400 Bad Request\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 24\r\n\r\n<H1>400 Bad Request</H1>"
+#define BYTERANGES_BOUNDARY "XIXIBASE_BYTERANGES_3A7F"
+#define BYTERANGES_CONTENT_TYPE "multipart/byteranges; boundary=" BYTERANGES_BOUNDARY "\r\n"
+#define BYTERANGES_END "\r\n--" BYTERANGES_BOUNDARY "--\r\n"
 
-#define ERROR_RES_401_KEEP_ALIVE "HTTP/1.1 401 Unauthorized\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 25\r\n\r\n<H1>401 Unauthorized</H1>"
-#define ERROR_RES_401_CLOSE "HTTP/1.1 401 Unauthorized\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 25\r\n\r\n<H1>401 Unauthorized</H1>"
+#define GET_RES_304_KEEP_ALIVE "HTTP/1.1 304 Not Modified\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: "
+#define GET_RES_304_CLOSE "HTTP/1.1 304 Not Modified\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: "
 
-#define ERROR_RES_404_KEEP_ALIVE "HTTP/1.1 404 Not Found\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 22\r\n\r\n<H1>404 Not Found</H1>"
-#define ERROR_RES_404_CLOSE "HTTP/1.1 404 Not Found\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 22\r\n\r\n<H1>404 Not Found</H1>"
+#define GET_RES_301_KEEP_ALIVE "HTTP/1.1 301 Moved Permanently\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: "
+#define GET_RES_301_CLOSE "HTTP/1.1 301 Moved Permanently\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: "
 
-#define ERROR_RES_413_KEEP_ALIVE "HTTP/1.1 413 Request Entity Too Large\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 37\r\n\r\n<H1>413 Request Entity Too Large</H1>"
-#define ERROR_RES_413_CLOSE "HTTP/1.1 413 Request Entity Too Large\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 37\r\n\r\n<H1>413 Request Entity Too Large</H1>"
+#define DELETE_RES_200_KEEP_ALIVE "HTTP/1.1 200 OK\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 0\r\n\r\n"
+#define DELETE_RES_200_CLOSE "HTTP/1.1 200 OK\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 0\r\n\r\n"
 
-#define ERROR_RES_500_KEEP_ALIVE "HTTP/1.1 500 Internal Server Error\r\nServer: "HTTP_SERVER"\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 34\r\n\r\n<H1>500 Internal Server Error</H1>"
-#define ERROR_RES_500_CLOSE "HTTP/1.1 500 Internal Server Error\r\nServer: "HTTP_SERVER"\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 34\r\n\r\n<H1>500 Internal Server Error</H1>"
+#define ERROR_RES_400_KEEP_ALIVE "HTTP/1.1 400 Bad Request\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 24\r\n\r\n<H1>400 Bad Request</H1>"
+#define ERROR_RES_400_CLOSE "HTTP/1.1 400 Bad Request\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 24\r\n\r\n<H1>400 Bad Request</H1>"
+
+#define ERROR_RES_401_KEEP_ALIVE "HTTP/1.1 401 Unauthorized\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 25\r\n\r\n<H1>401 Unauthorized</H1>"
+#define ERROR_RES_401_CLOSE "HTTP/1.1 401 Unauthorized\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 25\r\n\r\n<H1>401 Unauthorized</H1>"
+
+#define ERROR_RES_404_KEEP_ALIVE "HTTP/1.1 404 Not Found\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 22\r\n\r\n<H1>404 Not Found</H1>"
+#define ERROR_RES_404_CLOSE "HTTP/1.1 404 Not Found\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 22\r\n\r\n<H1>404 Not Found</H1>"
+
+#define ERROR_RES_413_KEEP_ALIVE "HTTP/1.1 413 Request Entity Too Large\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 37\r\n\r\n<H1>413 Request Entity Too Large</H1>"
+#define ERROR_RES_413_CLOSE "HTTP/1.1 413 Request Entity Too Large\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 37\r\n\r\n<H1>413 Request Entity Too Large</H1>"
+
+#define ERROR_RES_500_KEEP_ALIVE "HTTP/1.1 500 Internal Server Error\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: 34\r\n\r\n<H1>500 Internal Server Error</H1>"
+#define LEASE_RES_404_KEEP_ALIVE "HTTP/1.1 404 Not Found\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nContent-Type: text/html\r\nContent-Length: "
+#define LEASE_RES_404_CLOSE "HTTP/1.1 404 Not Found\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: "
+
+#define ERROR_RES_503_KEEP_ALIVE "HTTP/1.1 503 Service Unavailable\r\nServer: " HTTP_SERVER "\r\nConnection: Keep-Alive\r\nRetry-After: 1\r\nContent-Type: text/html\r\nContent-Length: 32\r\n\r\n<H1>503 Service Unavailable</H1>"
+#define ERROR_RES_503_CLOSE "HTTP/1.1 503 Service Unavailable\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nRetry-After: 1\r\nContent-Type: text/html\r\nContent-Length: 32\r\n\r\n<H1>503 Service Unavailable</H1>"
+
+#define ERROR_RES_500_CLOSE "HTTP/1.1 500 Internal Server Error\r\nServer: " HTTP_SERVER "\r\nConnection: close\r\nContent-Type: text/html\r\nContent-Length: 34\r\n\r\n<H1>500 Internal Server Error</H1>"
 
 #define LOG_TRACE2(x)  LOG_TRACE("Peer_Http id=" << get_peer_id() << " " << x)
 #define LOG_DEBUG2(x)  LOG_DEBUG("Peer_Http id=" << get_peer_id() << " " << x)
@@ -72,6 +94,7 @@
 // i: interval
 // t: timeout
 // s: sub op
+// l: lease token
 
 // XIXI_Get_Req_Pdu
 // uint32_t group_id;
@@ -88,6 +111,10 @@
 // uint8_t* key;
 // GET /xixibase/get?g=xxx&w=xxx&k=xxx&e=xxx
 
+// lease get, a miss answers 404 {"lease":xxx} to one client and 503 to the rest
+// GET /xixibase/lease?g=xxx&w=xxx&k=xxx
+// POST /xixibase/set?g=xxx&k=xxx&v=xxx&l=xxx
+
 // data: must not be NULL
 // length: must > 0
 // sub: must not be NULL
@@ -143,11 +170,9 @@ char* get_arg(char*& arg, uint32_t& arg_size) {
 	}
 }
 
+// decodes in place, the decoded text is never longer than the encoded one
 char* Peer_Http::decode_uri(char* uri, uint32_t length, uint32_t& out) {
-	char* buf = (char*)request_buf_.prepare(length + 1);
-	if (buf == NULL) {
-		return NULL;
-	}
+	char* buf = uri;
 	char* p = buf;
 	out = 0;
 	for (uint32_t i = 0; i < length; i++) {
@@ -196,6 +221,7 @@ Peer_Http::Peer_Http(boost::asio::ip::tcp::socket* socket) : self_(this) {
 	LOG_DEBUG2("Peer_Http::Peer_Http()");
 	init();
 	socket_ = socket;
+	svr_->get_io_service_pool().add_connection(socket->get_io_service());
 	stats_.new_conn();
 }
 
@@ -203,6 +229,7 @@ Peer_Http::Peer_Http(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* soc
 	LOG_DEBUG2("Peer_Http::Peer_Http()");
 	init();
 	socket_ssl_ = socket;
+	svr_->get_io_service_pool().add_connection(socket->get_io_service());
 	stats_.new_conn();
 }
 
@@ -222,13 +249,17 @@ void Peer_Http::init() {
 	cache_item_ = NULL;
 	write_buf_total_ = 0;
 	read_item_buf_ = NULL;
+	read_data_offset_ = 0;
 	next_data_len_ = XIXI_PDU_HEAD_LENGTH;
+	header_scan_offset_ = 0;
+	pipeline_count_ = 0;
 	timer_ = NULL;
 	timer_flag_ = false;
 
 	group_id_ = 0;
 	watch_id_ = 0;
 	cache_id_ = 0;
+	lease_token_ = 0;
 	key_ = NULL;
 	key_length_ = 0;
 	value_ = NULL;
@@ -245,6 +276,9 @@ void Peer_Http::init() {
 	interval_ = 120;
 	timeout_ = 30;
 	sub_op_ = 0;
+	body_type_ = HTTP_BODY_FORM;
+	update_sub_op_ = XIXI_UPDATE_SUB_OP_SET;
+	body_latency_op_ = LATENCY_HTTP_SET;
 }
 
 void Peer_Http::reset_for_new_cmd() {
@@ -252,10 +286,28 @@ void Peer_Http::reset_for_new_cmd() {
 		cache_mgr_.release_reference(cache_item_);
 		cache_item_ = NULL;
 	}
+	for (uint32_t i = 0; i < cache_items_.size(); i++) {
+		cache_mgr_.release_reference(cache_items_[i]);
+	}
+	cache_items_.clear();
+
+	request_buf_.reset();
+	write_buf_total_ = 0;
+	pipeline_count_ = 0;
+	reset_request();
+}
+
+// keeps the responses of the previous pipelined requests alive until they are written
+void Peer_Http::reset_request() {
+	if (cache_item_ != NULL) {
+		cache_items_.push_back(cache_item_);
+		cache_item_ = NULL;
+	}
 
 	group_id_ = 0;
 	watch_id_ = 0;
 	cache_id_ = 0;
+	lease_token_ = 0;
 	key_ = NULL;
 	key_length_ = 0;
 	value_ = NULL;
@@ -272,12 +324,15 @@ void Peer_Http::reset_for_new_cmd() {
 	interval_ = 120;
 	timeout_ = 30;
 	sub_op_ = 0;
+	body_type_ = HTTP_BODY_FORM;
+	update_sub_op_ = XIXI_UPDATE_SUB_OP_SET;
+	body_latency_op_ = LATENCY_HTTP_SET;
 	http_request_.reset();
 
-	request_buf_.reset();
-	write_buf_total_ = 0;
 	read_item_buf_ = NULL;
+	read_data_offset_ = 0;
 	next_data_len_ = XIXI_PDU_HEAD_LENGTH;
+	header_scan_offset_ = 0;
 	set_state(PEER_STATE_READ_HEADER);
 }
 
@@ -286,11 +341,19 @@ void Peer_Http::cleanup() {
 		cache_mgr_.release_reference(cache_item_);
 		cache_item_ = NULL;
 	}
+	for (uint32_t i = 0; i < cache_items_.size(); i++) {
+		cache_mgr_.release_reference(cache_items_[i]);
+	}
+	cache_items_.clear();
 
 	if (socket_ != NULL) {
+		svr_->get_io_service_pool().remove_connection(socket_->get_io_service());
 		delete socket_;
 		socket_ = NULL;
 	}
+	if (socket_ssl_ != NULL) {
+		svr_->get_io_service_pool().remove_connection(socket_ssl_->get_io_service());
+	}
 	SAFE_DELETE(socket_ssl_);
 
 	if (timer_ != NULL) {
@@ -340,6 +403,15 @@ void Peer_Http::write_error(xixi_reason error_code) {
 				res_size = sizeof(ERROR_RES_500_CLOSE) - 1;
 			}
 			break;
+		case XIXI_REASON_PLEASE_TRY_AGAIN:
+			if (http_request_.keepalive) {
+				res = ERROR_RES_503_KEEP_ALIVE;
+				res_size = sizeof(ERROR_RES_503_KEEP_ALIVE) - 1;
+			} else {
+				res = ERROR_RES_503_CLOSE;
+				res_size = sizeof(ERROR_RES_503_CLOSE) - 1;
+			}
+			break;
 		case XIXI_REASON_EXISTS:
 		case XIXI_REASON_INVALID_PARAMETER:
 		case XIXI_REASON_INVALID_OPERATION:
@@ -399,7 +471,7 @@ void Peer_Http::process() {
 
 		case PEER_STATE_READ_BODY_EXTRAS:
 			if (next_data_len_ == 0) {
-				process_post();
+				process_body();
 			} else if (read_buffer_.read_data_size_ > 0) {
 				tmp = read_buffer_.read_data_size_ > next_data_len_ ? next_data_len_ : read_buffer_.read_data_size_;
 				memcpy(read_item_buf_, read_buffer_.read_curr_, tmp);
@@ -428,9 +500,9 @@ void Peer_Http::process() {
 			}
 			set_state(next_state_);
 			next_state_ = PEER_STATE_NEW_CMD;
-			if (state_ == PEER_STATE_NEW_CMD && process_reqest_count < 1) {
+			if (state_ == PEER_STATE_NEW_CMD && ++pipeline_count_ < HTTP_PIPELINE_MAX_COUNT) {
 				if (read_buffer_.read_data_size_ >= 10) {
-					set_state(PEER_STATE_READ_HEADER);
+					reset_request();
 				} else {
 					run = false;
 				}
@@ -462,8 +534,11 @@ void Peer_Http::set_state(peer_state state) {
 }
 
 uint32_t Peer_Http::try_read_command(char* data, uint32_t data_len) {
-	char* p = memfind(data, data_len, "\r\n\r\n", 4);
+	// resume the scan where the previous partial read stopped
+	uint32_t offset = header_scan_offset_ > 3 ? header_scan_offset_ - 3 : 0;
+	char* p = memfind(data + offset, data_len - offset, "\r\n\r\n", 4);
 	if (p != NULL) {
+		header_scan_offset_ = 0;
 		*p = '\0';
 
 		assert(p < (data + data_len));
@@ -475,10 +550,12 @@ uint32_t Peer_Http::try_read_command(char* data, uint32_t data_len) {
 
 	if (data_len >= 8192) {
 		LOG_WARNING2("try_read_command header too large > " << data_len);
+		header_scan_offset_ = 0;
 		write_error(XIXI_REASON_TOO_LARGE);
 		return data_len; // ?
 	}
 
+	header_scan_offset_ = data_len;
 	set_state(PEER_STATE_READ_HEADER);
 	return 0;
 }
@@ -512,6 +589,9 @@ void Peer_Http::process_request_header(char* request_header, uint32_t length) {
 		} else if (IS_METHOD(request_header, 'H', 'E', 'A', 'D')) {
 			offset = 5;
 			method = HEAD_METHOD;
+		} else if (IS_METHOD(request_header, 'P', 'U', 'T', ' ')) {
+			offset = 4;
+			method = PUT_METHOD;
 		} else {
 //			LOG_WARNING2("process_request_header error method=" << method);
 			write_error(XIXI_REASON_INVALID_PARAMETER);
@@ -539,25 +619,51 @@ void Peer_Http::process_request_header(char* request_header, uint32_t length) {
 				write_error(XIXI_REASON_TOO_LARGE);
 				return;
 			}
-			post_data_ = request_buf_.prepare(content_length_ + 1);
-			if (post_data_ == NULL) {
-				LOG_WARNING2("process_request_header out of memory " << content_length_);
-				write_error(XIXI_REASON_OUT_OF_MEMORY);
-				return;
-			}
-			post_data_[content_length_] = '\0';
-			read_item_buf_ = post_data_;
-			next_data_len_ = content_length_;
-			set_state(PEER_STATE_READ_BODY_EXTRAS);
-
 			char* buf = (char*)request_buf_.prepare(http_request_.uri_length + 1);
 			if (buf == NULL) {
 				LOG_WARNING2("process_request_header uri out of memory " << (http_request_.uri_length + 1));
 				write_error(XIXI_REASON_OUT_OF_MEMORY);
+				return;
 			}
 			memcpy(buf, http_request_.uri, http_request_.uri_length);
 			buf[http_request_.uri_length] = '\0';
 			http_request_.uri = buf;
+
+			char* args;
+			const Http_Command* command = NULL;
+			if (is_manager_uri()) {
+				command = find_command(buf + settings_.manager_base_url.size(), http_request_.uri_length - settings_.manager_base_url.size(), args);
+			}
+			if (content_length_ > HTTP_STREAM_BODY_MIN_SIZE && command != NULL && command->update_sub_op != HTTP_NO_UPDATE
+					&& http_request_.content_type_length == 19
+					&& strcasecmp(http_request_.content_type, "multipart/form-data", http_request_.content_type_length) == 0
+					&& http_request_.boundary_length > 0) {
+				// read the fields in front of the value first, the value itself goes straight into the item
+				post_data_ = request_buf_.prepare(HTTP_FORM_HEAD_SIZE + 1);
+				if (post_data_ == NULL) {
+					LOG_WARNING2("process_request_header out of memory " << HTTP_FORM_HEAD_SIZE);
+					write_error(XIXI_REASON_OUT_OF_MEMORY);
+					return;
+				}
+				post_data_[HTTP_FORM_HEAD_SIZE] = '\0';
+				next_data_len_ = HTTP_FORM_HEAD_SIZE;
+				update_sub_op_ = (uint8_t)command->update_sub_op;
+				body_latency_op_ = command->latency_op;
+				body_type_ = HTTP_BODY_FORM_HEAD;
+			} else {
+				post_data_ = request_buf_.prepare(content_length_ + 1);
+				if (post_data_ == NULL) {
+					LOG_WARNING2("process_request_header out of memory " << content_length_);
+					write_error(XIXI_REASON_OUT_OF_MEMORY);
+					return;
+				}
+				post_data_[content_length_] = '\0';
+				next_data_len_ = content_length_;
+			}
+			read_item_buf_ = post_data_;
+			set_state(PEER_STATE_READ_BODY_EXTRAS);
+		} else if (method == PUT_METHOD) {
+			process_put();
 		} else {
 			process_command();
 		}
@@ -609,21 +715,68 @@ bool Peer_Http::process_request_header_fields(char* request_header_field, uint32
 	return true;
 }
 
+char* Peer_Http::hold_header_value(char* value, uint32_t value_length) {
+	// the header stays in read_buffer_ until the request is done, except while a body is read
+	if (http_request_.method != POST_METHOD && http_request_.method != PUT_METHOD) {
+		return value;
+	}
+	char* buf = (char*)request_buf_.prepare(value_length + 1);
+	if (buf != NULL) {
+		memcpy(buf, value, value_length);
+		buf[value_length] = '\0';
+	}
+	return buf;
+}
+
+const uint32_t HTTP_HEADER_CONNECTION = 1;
+const uint32_t HTTP_HEADER_CONTENT_TYPE = 2;
+const uint32_t HTTP_HEADER_IF_NONE_MATCH = 3;
+const uint32_t HTTP_HEADER_CONTENT_LENGTH = 4;
+const uint32_t HTTP_HEADER_ACCEPT_ENCODING = 5;
+const uint32_t HTTP_HEADER_RANGE = 6;
+const uint32_t HTTP_HEADER_IF_RANGE = 7;
+
+struct Http_Header_Field {
+	const char* name;
+	uint32_t id;
+};
+
+// every header we handle has a distinct name length, so the length is a perfect hash
+static const Http_Header_Field http_header_fields[16] = {
+	{NULL, 0}, {NULL, 0}, {NULL, 0}, {NULL, 0}, {NULL, 0},
+	{"range", HTTP_HEADER_RANGE},
+	{NULL, 0}, {NULL, 0},
+	{"if-range", HTTP_HEADER_IF_RANGE},
+	{NULL, 0},
+	{"connection", HTTP_HEADER_CONNECTION},
+	{NULL, 0},
+	{"content-type", HTTP_HEADER_CONTENT_TYPE},
+	{"if-none-match", HTTP_HEADER_IF_NONE_MATCH},
+	{"content-length", HTTP_HEADER_CONTENT_LENGTH},
+	{"accept-encoding", HTTP_HEADER_ACCEPT_ENCODING}
+};
+
 bool Peer_Http::handle_request_header_field(char* name, uint32_t name_length, char* value, uint32_t value_length) {
-	if (name_length == 10) {
-		if (strcasecmp(name, "Connection", name_length) == 0) {
-			if (value_length >= 10 && strcasecmp(value, "Keep-Alive", 10) == 0) {
-				http_request_.keepalive = true;
-			}
+	if (name_length >= sizeof(http_header_fields) / sizeof(http_header_fields[0])) {
+		return true;
+	}
+	const Http_Header_Field& field = http_header_fields[name_length];
+	if (field.name == NULL || strcasecmp(name, field.name, name_length) != 0) {
+		return true;
+	}
+
+	switch (field.id) {
+	case HTTP_HEADER_CONNECTION:
+		if (value_length >= 10 && strcasecmp(value, "Keep-Alive", 10) == 0) {
+			http_request_.keepalive = true;
 		}
-	} else if (name_length == 12) {
-		if (strcasecmp(name, "content-type", name_length) == 0 && value_length > 0) {
-			char* buf = (char*)request_buf_.prepare(value_length + 1);
+		break;
+	case HTTP_HEADER_CONTENT_TYPE:
+		if (value_length > 0) {
+			char* buf = hold_header_value(value, value_length);
 			if (buf == NULL) {
 				return false;
 			}
-			memcpy(buf, value, value_length);
-			buf[value_length] = '\0';
 			http_request_.content_type = buf;
 			http_request_.content_type_length = value_length;
 
@@ -640,130 +793,105 @@ bool Peer_Http::handle_request_header_field(char* name, uint32_t name_length, ch
 				http_request_.content_type_length = 19;
 			}
 		}
-	} else if (name_length == 13) {
-		if (strcasecmp(name, "if-none-match", name_length) == 0) {
-			char* buf = (char*)request_buf_.prepare(value_length + 1);
-			if (buf == NULL) {
-				return false;
-			}
-			memcpy(buf, value, value_length);
-			buf[value_length] = '\0';
-			http_request_.entity_tag = buf;
-			http_request_.entity_tag_length = value_length;
-		}
-	} else if (name_length == 14) {
-		if (strcasecmp(name, "content-length", name_length) == 0) {
-			if (!safe_toui32(value, value_length, content_length_)) {
-				return false;
-			}
+		break;
+	case HTTP_HEADER_IF_NONE_MATCH:
+		http_request_.entity_tag = hold_header_value(value, value_length);
+		if (http_request_.entity_tag == NULL) {
+			return false;
+		}
+		http_request_.entity_tag_length = value_length;
+		break;
+	case HTTP_HEADER_CONTENT_LENGTH:
+		if (!safe_toui32(value, value_length, content_length_)) {
+			return false;
 		}
-	} else if (name_length == 15) {
-		if (strcasecmp(name, "Accept-Encoding", name_length) == 0) {
-			char* buf = memfind(value, value_length, "gzip", 4);
-			http_request_.accept_gzip = (buf != NULL);
+		break;
+	case HTTP_HEADER_ACCEPT_ENCODING:
+		http_request_.accept_gzip = (memfind(value, value_length, "gzip", 4) != NULL);
+		break;
+	case HTTP_HEADER_RANGE:
+		http_request_.range = hold_header_value(value, value_length);
+		if (http_request_.range == NULL) {
+			return false;
 		}
+		http_request_.range_length = value_length;
+		break;
+	case HTTP_HEADER_IF_RANGE:
+		http_request_.if_range = hold_header_value(value, value_length);
+		if (http_request_.if_range == NULL) {
+			return false;
+		}
+		http_request_.if_range_length = value_length;
+		break;
 	}
 	return true;
 }
 
+const Http_Command Peer_Http::http_commands_[] = {
+	{"get", 3, LATENCY_HTTP_GET, HTTP_NO_UPDATE, &Peer_Http::process_get},
+	{"set", 3, LATENCY_HTTP_SET, XIXI_UPDATE_SUB_OP_SET, &Peer_Http::process_set},
+	{"add", 3, LATENCY_HTTP_ADD, XIXI_UPDATE_SUB_OP_ADD, &Peer_Http::process_add},
+	{"del", 3, LATENCY_HTTP_DEL, HTTP_NO_UPDATE, &Peer_Http::process_delete},
+	{"incr", 4, LATENCY_HTTP_INCR, HTTP_NO_UPDATE, &Peer_Http::process_incr},
+	{"decr", 4, LATENCY_HTTP_DECR, HTTP_NO_UPDATE, &Peer_Http::process_decr},
+	{"flush", 5, LATENCY_HTTP_FLUSH, HTTP_NO_UPDATE, &Peer_Http::process_flush},
+	{"touch", 5, LATENCY_HTTP_TOUCH, HTTP_NO_UPDATE, &Peer_Http::process_touch},
+	{"flags", 5, LATENCY_HTTP_FLAGS, HTTP_NO_UPDATE, &Peer_Http::process_update_flags},
+	{"lease", 5, LATENCY_HTTP_GET, HTTP_NO_UPDATE, &Peer_Http::process_lease},
+	{"stats", 5, LATENCY_HTTP_STATS, HTTP_NO_UPDATE, &Peer_Http::process_stats},
+	{"quota", 5, LATENCY_HTTP_QUOTA, HTTP_NO_UPDATE, &Peer_Http::process_quota},
+	{"watch", 5, LATENCY_HTTP_WATCH, HTTP_NO_UPDATE, &Peer_Http::process_watch},
+	{"append", 6, LATENCY_HTTP_APPEND, XIXI_UPDATE_SUB_OP_APPEND, &Peer_Http::process_append},
+	{"replace", 7, LATENCY_HTTP_REPLACE, XIXI_UPDATE_SUB_OP_REPLACE, &Peer_Http::process_replace},
+	{"prepend", 7, LATENCY_HTTP_PREPEND, XIXI_UPDATE_SUB_OP_PREPEND, &Peer_Http::process_prepend},
+	{"getbase", 7, LATENCY_HTTP_GETBASE, HTTP_NO_UPDATE, &Peer_Http::process_get_base},
+	{"metrics", 7, LATENCY_HTTP_METRICS, HTTP_NO_UPDATE, &Peer_Http::process_metrics},
+	{"createwatch", 11, LATENCY_HTTP_CREATEWATCH, HTTP_NO_UPDATE, &Peer_Http::process_create_watch},
+	{NULL, 0, 0, 0, NULL}
+};
+
+bool Peer_Http::is_manager_uri() {
+	return http_request_.uri_length >= settings_.manager_base_url.size()
+		&& memcmp(http_request_.uri, settings_.manager_base_url.c_str(), settings_.manager_base_url.size()) == 0;
+}
+
+// cmd is the uri after the manager base url, args is set to its query string if any
+const Http_Command* Peer_Http::find_command(char* cmd, uint32_t length, char*& args) {
+	uint32_t cmd_length = length;
+	args = (char*)memchr(cmd, '?', length);
+	if (args != NULL) {
+		cmd_length = (uint32_t)(args - cmd);
+		args++;
+	}
+	const Http_Command* command = http_commands_;
+	while (command->name != NULL && !BUF_CMP(cmd, cmd_length, command->name, command->name_length)) {
+		command++;
+	}
+	return command->name != NULL ? command : NULL;
+}
+
 void Peer_Http::process_command() {
-	if (http_request_.method != HEAD_METHOD && http_request_.uri_length >= settings_.manager_base_url.size()
-		&& memcmp(http_request_.uri, settings_.manager_base_url.c_str(), settings_.manager_base_url.size()) == 0) { // manager
-		uint32_t cmd_length = 0;
-		char* arg = strrchr(http_request_.uri, '?');
-		if (arg != NULL) {
-			cmd_length = (uint32_t)(arg - http_request_.uri) - settings_.manager_base_url.size();
-			if (!process_request_arg(arg + 1)) {
-				LOG_WARNING2("process_command failed arg=" << (arg + 1));
-				return;
-			}
-		} else {
-			cmd_length = http_request_.uri_length - settings_.manager_base_url.size();
-		}
-
-		char* cmd = http_request_.uri + settings_.manager_base_url.size();
-		if (cmd_length == 3) {
-			if (memcmp(cmd, "get", cmd_length) == 0) {
-				process_get();
-			} else if (memcmp(cmd, "set", cmd_length) == 0) {
-				process_update(XIXI_UPDATE_SUB_OP_SET);
-			} else if (memcmp(cmd, "add", cmd_length) == 0) {
-				process_update(XIXI_UPDATE_SUB_OP_ADD);
-			} else if (memcmp(cmd, "del", cmd_length) == 0) {
-				process_delete();
-			} else {
-				LOG_WARNING2("process_command error unkown request=" << http_request_.uri);
-				write_error(XIXI_REASON_INVALID_PARAMETER);
-				return;
-			}
-		} else if (cmd_length == 4) {
-			if (memcmp(cmd, "incr", cmd_length) == 0) {
-				process_delta(true);
-			} else if (memcmp(cmd, "decr", cmd_length) == 0) {
-				process_delta(false);
-			} else {
-				LOG_WARNING2("process_command error unkown request=" << http_request_.uri);
-				write_error(XIXI_REASON_INVALID_PARAMETER);
-				return;
-			}
-		} else if (cmd_length == 5) {
-			if (memcmp(cmd, "flush", cmd_length) == 0) {
-				process_flush();
-			} else if (memcmp(cmd, "touch", cmd_length) == 0) {
-				process_touch();
-			} else if (memcmp(cmd, "flags", cmd_length) == 0) {
-				process_update_flags();
-			} else if (memcmp(cmd, "stats", cmd_length) == 0) {
-				process_stats();
-			} else {
-				LOG_WARNING2("process_command error unkown request=" << http_request_.uri);
-				write_error(XIXI_REASON_INVALID_PARAMETER);
-				return;
-			}
-		} else if (cmd_length == 6) {
-			if (memcmp(cmd, "append", cmd_length) == 0) {
-				process_update(XIXI_UPDATE_SUB_OP_APPEND);
-			} else {
-				LOG_WARNING2("process_command error unkown request=" << http_request_.uri);
-				write_error(XIXI_REASON_INVALID_PARAMETER);
-				return;
-			}
-		} else if (cmd_length == 7) {
-			if (memcmp(cmd, "replace", cmd_length) == 0) {
-				process_update(XIXI_UPDATE_SUB_OP_REPLACE);
-			} else if (memcmp(cmd, "prepend", cmd_length) == 0) {
-				process_update(XIXI_UPDATE_SUB_OP_PREPEND);
-			} else if (memcmp(cmd, "getbase", cmd_length) == 0) {
-				process_get_base();
-			} else {
-				LOG_WARNING2("process_command error unkown request=" << http_request_.uri);
-				write_error(XIXI_REASON_INVALID_PARAMETER);
-				return;
-			}
-		} else if (cmd_length == 10) {
-			if (memcmp(cmd, "watch", cmd_length) == 0) {
-				process_watch();
-			} else {
-				LOG_WARNING2("process_command error unkown request=" << http_request_.uri);
-				write_error(XIXI_REASON_INVALID_PARAMETER);
-				return;
-			}
-		} else if (cmd_length == 11) {
-			if (memcmp(cmd, "createwatch", cmd_length) == 0) {
-				process_create_watch();
-			} else {
-				LOG_WARNING2("process_command error unkown request=" << http_request_.uri);
-				write_error(XIXI_REASON_INVALID_PARAMETER);
-				return;
-			}
-		} else {
-			LOG_WARNING2("process_command error unkown cmd_length=" << cmd_length);
+	uint64_t start_tick = Current_Time::get_tick_us();
+	if (http_request_.method != HEAD_METHOD && is_manager_uri()) { // manager
+		char* args;
+		const Http_Command* command = find_command(http_request_.uri + settings_.manager_base_url.size(),
+			http_request_.uri_length - settings_.manager_base_url.size(), args);
+		if (args != NULL && !process_request_arg(args)) {
+			LOG_WARNING2("process_command failed arg=" << args);
+			return;
+		}
+		if (command == NULL) {
+			LOG_WARNING2("process_command error unkown request=" << http_request_.uri);
 			write_error(XIXI_REASON_INVALID_PARAMETER);
+			return;
 		}
+		(this->*command->handler)();
+		stats_.latency(command->latency_op, Current_Time::get_tick_us() - start_tick);
 	} else {
 		key_ = (uint8_t*)http_request_.uri;
 		key_length_ = http_request_.uri_length;
 		process_get();
+		stats_.latency(LATENCY_HTTP_RESOURCE, Current_Time::get_tick_us() - start_tick);
 	}
 }
 
@@ -840,12 +968,53 @@ bool Peer_Http::process_request_arg(char* args) {
 					write_error(XIXI_REASON_INVALID_PARAMETER);
 					return false;
 				}
+			} else if (arg[0] =='l') {
+				if (!safe_toui64(arg + 2, arg_size - 2, lease_token_)) {
+					write_error(XIXI_REASON_INVALID_PARAMETER);
+					return false;
+				}
 			}
 		}
 	}
 	return true;
 }
 
+// Parses the headers of the multipart part that follows a boundary delimiter.
+// Returns the start of the part value, or NULL when the headers are incomplete.
+static char* parse_form_part(char* data, uint32_t length, char*& name, uint32_t& name_length,
+		char*& content_type, uint32_t& content_type_length) {
+	char* end = memfind(data, length, "\r\n\r\n", 4);
+	if (end == NULL) {
+		return NULL;
+	}
+	name = NULL;
+	name_length = 0;
+	content_type = NULL;
+	content_type_length = 0;
+
+	uint32_t header_length = (uint32_t)(end - data);
+	char* p = memfind(data, header_length, " name=\"", 7);
+	if (p != NULL) {
+		p += 7;
+		char* q = (char*)memchr(p, '"', end - p);
+		if (q != NULL) {
+			name = p;
+			name_length = (uint32_t)(q - p);
+		}
+	}
+	p = memfind(data, header_length, "\r\nContent-Type:", 15);
+	if (p != NULL) {
+		p += 15;
+		while (p < end && *p == ' ') {
+			p++;
+		}
+		char* q = memfind(p, (uint32_t)(end - p), "\r\n", 2);
+		content_type = p;
+		content_type_length = (uint32_t)((q != NULL ? q : end) - p);
+	}
+	return end + 4;
+}
+
 void Peer_Http::process_post() {
 	if (http_request_.content_type_length == 33
 			&& strcasecmp(http_request_.content_type, "application/x-www-form-urlencoded", http_request_.content_type_length) == 0) {
@@ -858,108 +1027,25 @@ void Peer_Http::process_post() {
 	} else if (http_request_.content_type_length == 19
 			&& strcasecmp(http_request_.content_type, "multipart/form-data", http_request_.content_type_length) == 0
 			&& http_request_.boundary_length > 0) {
-		char* buf = (char*)memfind((char*)post_data_, content_length_, (char*)http_request_.boundary, http_request_.boundary_length);
+		char* end = (char*)post_data_ + content_length_;
+		char* buf = memfind((char*)post_data_, content_length_, http_request_.boundary, http_request_.boundary_length);
 		while (buf != NULL) {
-			buf += http_request_.boundary_length + 2;
-			buf = strstr(buf, " name=\"");
-			if (buf != NULL) {
-				char* name = buf + 7;
-				uint32_t name_length = 0;
-				char* end = strstr(name, "\"");
-				if (end != NULL) {
-					name_length = (uint32_t)(end - name);
-				}
-
-				if (name_length == 1 && name[0] == 'v')  {
-					char* content_type = strstr(name + 2, "\r\nContent-Type:");
-					if (content_type != NULL) {
-						content_type += 15;
-						while (*content_type == ' ') {
-							content_type++;
-						}
-						end = strstr(content_type, "\r\n");
-						if (end != NULL) {
-							uint32_t content_type_length_ = (uint32_t)(end - content_type);
-							if (content_type_length_ < 128) {
-								value_content_type_ = content_type;
-								value_content_type_length_ = content_type_length_;
-							}
-						}
-					}
-				}
-				
-				char* value = strstr(name + 2, "\r\n\r\n");
-				if (value != NULL) {
-					value += 4;
-				}
-				
-				buf = (char*)memfind((char*)value, content_length_ - (value - (char*)post_data_), (char*)http_request_.boundary, http_request_.boundary_length);
-				if (buf == NULL) {
-					break;
-				}
-				if (name_length == 1) {
-					if (name[0] == 'g') {
-						if (!safe_toui32(value, (uint32_t)(buf - value) - 4, group_id_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] == 'w') {
-						if (!safe_toui32(value, (uint32_t)(buf - value) - 4, watch_id_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] == 'k') {
-						key_ = (uint8_t*)value;
-						key_length_ = (uint32_t)(buf - value) - 4;
-					} else if (name[0] == 'v') {
-						value_ = (uint8_t*)value;
-						value_length_ = (uint32_t)(buf - value) - 4;
-					} else if (name[0] == 'f') {
-						if (!safe_toui32(value, (uint32_t)(buf - value) - 4, flags_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] == 'c') {
-						if (!safe_toui64(value, (uint32_t)(buf - value) - 4, cache_id_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] == 'd') {
-						if (!safe_toi64(value, (uint32_t)(buf - value) - 4, delta_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] == 'e') {
-						touch_flag_ = true;
-						if (!safe_toui32(value, (uint32_t)(buf - value) - 4, expiration_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] =='a') {
-						if (!safe_toui32(value, (uint32_t)(buf - value) - 4, ack_sequence_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] =='i') {
-						if (!safe_toui32(value, (uint32_t)(buf - value) - 4, interval_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] =='t') {
-						if (!safe_toui32(value, (uint32_t)(buf - value - 4), timeout_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					} else if (name[0] =='s') {
-						if (!safe_toui32(value, (uint32_t)(buf - value) - 4, sub_op_)) {
-							write_error(XIXI_REASON_INVALID_PARAMETER);
-							return;
-						}
-					}
-				}
-			} else {
+			buf += http_request_.boundary_length;
+			char* name;
+			uint32_t name_length;
+			char* content_type;
+			uint32_t content_type_length;
+			char* value = parse_form_part(buf, (uint32_t)(end - buf), name, name_length, content_type, content_type_length);
+			if (value == NULL) {
+				break;
+			}
+			buf = memfind(value, (uint32_t)(end - value), http_request_.boundary, http_request_.boundary_length);
+			if (buf == NULL || buf - value < 4) {
 				break;
 			}
+			if (!set_form_field(name, name_length, content_type, content_type_length, value, (uint32_t)(buf - value) - 4)) {
+				return;
+			}
 		}
 		process_command();
 	} else {
@@ -968,127 +1054,672 @@ void Peer_Http::process_post() {
 	}
 }
 
+bool Peer_Http::set_form_field(char* name, uint32_t name_length, char* content_type, uint32_t content_type_length, char* value, uint32_t value_length) {
+	if (name_length != 1) {
+		return true;
+	}
+	bool ok = true;
+	switch (name[0]) {
+	case 'g':
+		ok = safe_toui32(value, value_length, group_id_);
+		break;
+	case 'w':
+		ok = safe_toui32(value, value_length, watch_id_);
+		break;
+	case 'k':
+		key_ = (uint8_t*)value;
+		key_length_ = value_length;
+		break;
+	case 'v':
+		value_ = (uint8_t*)value;
+		value_length_ = value_length;
+		if (content_type != NULL && content_type_length < MAX_MIME_TYPE_LENGTH) {
+			value_content_type_ = content_type;
+			value_content_type_length_ = content_type_length;
+		}
+		break;
+	case 'f':
+		ok = safe_toui32(value, value_length, flags_);
+		break;
+	case 'c':
+		ok = safe_toui64(value, value_length, cache_id_);
+		break;
+	case 'd':
+		ok = safe_toi64(value, value_length, delta_);
+		break;
+	case 'e':
+		touch_flag_ = true;
+		ok = safe_toui32(value, value_length, expiration_);
+		break;
+	case 'a':
+		ok = safe_toui32(value, value_length, ack_sequence_);
+		break;
+	case 'i':
+		ok = safe_toui32(value, value_length, interval_);
+		break;
+	case 't':
+		ok = safe_toui32(value, value_length, timeout_);
+		break;
+	case 's':
+		ok = safe_toui32(value, value_length, sub_op_);
+		break;
+	case 'l':
+		ok = safe_toui64(value, value_length, lease_token_);
+		break;
+	}
+	if (!ok) {
+		write_error(XIXI_REASON_INVALID_PARAMETER);
+	}
+	return ok;
+}
+
+void Peer_Http::process_body() {
+	uint64_t start_tick;
+	switch (body_type_) {
+	case HTTP_BODY_FORM_HEAD:
+		process_form_head();
+		break;
+	case HTTP_BODY_FORM_VALUE:
+		start_tick = Current_Time::get_tick_us();
+		process_form_value();
+		stats_.latency(body_latency_op_, Current_Time::get_tick_us() - start_tick);
+		break;
+	case HTTP_BODY_VALUE:
+		if (next_read_segment()) {
+			break;
+		}
+		start_tick = Current_Time::get_tick_us();
+		store_item(update_sub_op_);
+		stats_.latency(body_latency_op_, Current_Time::get_tick_us() - start_tick);
+		break;
+	default:
+		process_post();
+		break;
+	}
+}
+
+// The first HTTP_FORM_HEAD_SIZE bytes of a large multipart update are read. If the
+// value part starts in there and the key is known, the item is allocated for the
+// rest of the body and the remaining bytes are read straight into it.
+void Peer_Http::process_form_head() {
+	// the rest of the body is still on the wire
+	bool keepalive = http_request_.keepalive;
+	http_request_.keepalive = false;
+
+	char* data = (char*)post_data_;
+	char* end = data + HTTP_FORM_HEAD_SIZE;
+	char* value = NULL;
+	char* buf = memfind(data, HTTP_FORM_HEAD_SIZE, http_request_.boundary, http_request_.boundary_length);
+	while (buf != NULL) {
+		buf += http_request_.boundary_length;
+		char* name;
+		uint32_t name_length;
+		char* content_type;
+		uint32_t content_type_length;
+		char* part = parse_form_part(buf, (uint32_t)(end - buf), name, name_length, content_type, content_type_length);
+		if (part == NULL) {
+			break;
+		}
+		if (name_length == 1 && name[0] == 'v') {
+			if (content_type != NULL && content_type_length < MAX_MIME_TYPE_LENGTH) {
+				value_content_type_ = content_type;
+				value_content_type_length_ = content_type_length;
+			}
+			value = part;
+			break;
+		}
+		buf = memfind(part, (uint32_t)(end - part), http_request_.boundary, http_request_.boundary_length);
+		if (buf == NULL || buf - part < 4) {
+			break;
+		}
+		if (!set_form_field(name, name_length, content_type, content_type_length, part, (uint32_t)(buf - part) - 4)) {
+			return;
+		}
+	}
+
+	if (value != NULL) {
+		// the query string is decoded in place, work on a copy so the buffered path can still use the uri
+		char* args = (char*)memchr(http_request_.uri, '?', http_request_.uri_length);
+		if (args != NULL) {
+			args++;
+			uint32_t args_length = http_request_.uri_length - (uint32_t)(args - http_request_.uri);
+			char* copy = (char*)request_buf_.prepare(args_length + 1);
+			if (copy == NULL) {
+				write_error(XIXI_REASON_OUT_OF_MEMORY);
+				return;
+			}
+			memcpy(copy, args, args_length);
+			copy[args_length] = '\0';
+			if (!process_request_arg(copy)) {
+				return;
+			}
+		}
+	}
+	http_request_.keepalive = keepalive;
+	if (value == NULL || key_ == NULL) {
+		read_form_body(HTTP_FORM_HEAD_SIZE);
+		return;
+	}
+
+	// the value size is bounded by the rest of the body, the item is trimmed once the closing delimiter is found
+	uint32_t value_offset = (uint32_t)(value - data);
+	uint32_t data_size = content_length_ - value_offset;
+	cache_item_ = cache_mgr_.alloc_item(group_id_, key_, key_length_, flags_, expiration_, data_size, value_content_type_length_);
+	if (cache_item_ != NULL && cache_item_->is_chunked()) {
+		cache_mgr_.release_reference(cache_item_);
+		cache_item_ = NULL;
+	}
+	if (cache_item_ == NULL) {
+		read_form_body(HTTP_FORM_HEAD_SIZE);
+		return;
+	}
+	uint32_t head_value_size = HTTP_FORM_HEAD_SIZE - value_offset;
+	memcpy(cache_item_->get_data(), value, head_value_size);
+
+	read_item_buf_ = cache_item_->get_data() + head_value_size;
+	next_data_len_ = content_length_ - HTTP_FORM_HEAD_SIZE;
+	body_type_ = HTTP_BODY_FORM_VALUE;
+}
+
+// falls back to buffering the whole body, the first head_size bytes are already in post_data_
+void Peer_Http::read_form_body(uint32_t head_size) {
+	uint8_t* buf = request_buf_.prepare(content_length_ + 1);
+	if (buf == NULL) {
+		LOG_WARNING2("read_form_body out of memory " << content_length_);
+		http_request_.keepalive = false;
+		write_error(XIXI_REASON_OUT_OF_MEMORY);
+		return;
+	}
+	memcpy(buf, post_data_, head_size);
+	buf[content_length_] = '\0';
+	post_data_ = buf;
+	read_item_buf_ = buf + head_size;
+	next_data_len_ = content_length_ - head_size;
+	body_type_ = HTTP_BODY_FORM;
+}
+
+void Peer_Http::process_form_value() {
+	Cache_Item* it = cache_item_;
+	char* data = (char*)it->get_data();
+	char* end = data + it->data_size;
+	char* buf = memfind(data, it->data_size, http_request_.boundary, http_request_.boundary_length);
+	if (buf == NULL || buf - data < 4) {
+		LOG_WARNING2("process_form_value no closing delimiter");
+		write_error(XIXI_REASON_INVALID_PARAMETER);
+		return;
+	}
+	uint32_t value_length = (uint32_t)(buf - data) - 4;
+
+	// fields behind the value
+	bool reshape = false;
+	while (buf != NULL) {
+		buf += http_request_.boundary_length;
+		char* name;
+		uint32_t name_length;
+		char* content_type;
+		uint32_t content_type_length;
+		char* part = parse_form_part(buf, (uint32_t)(end - buf), name, name_length, content_type, content_type_length);
+		if (part == NULL) {
+			break;
+		}
+		buf = memfind(part, (uint32_t)(end - part), http_request_.boundary, http_request_.boundary_length);
+		if (buf == NULL || buf - part < 4) {
+			break;
+		}
+		if (name_length == 1) {
+			if (name[0] == 'v') {
+				continue;
+			}
+			if (name[0] == 'g' || name[0] == 'k' || name[0] == 'e') {
+				reshape = true;
+			}
+		}
+		if (!set_form_field(name, name_length, content_type, content_type_length, part, (uint32_t)(buf - part) - 4)) {
+			return;
+		}
+	}
+
+	if (reshape) {
+		// the item was allocated before these fields were known, store a copy instead
+		value_ = it->get_data();
+		value_length_ = value_length;
+		cache_item_ = NULL;
+		process_update(update_sub_op_);
+		cache_mgr_.release_reference(it);
+	} else {
+		it->data_size = value_length;
+		it->flags = flags_;
+		it->set_ext((uint8_t*)value_content_type_);
+		it->cache_id = cache_id_;
+		store_item(update_sub_op_);
+	}
+}
+
+// PUT <manager_base_url><update command>?k=<key>&... or PUT /<resource>?g=..&e=..
+// The body is the value and is read straight into the item.
+void Peer_Http::process_put() {
+	// the body is still on the wire until the item is allocated
+	bool keepalive = http_request_.keepalive;
+	http_request_.keepalive = false;
+
+	if (is_manager_uri()) {
+		char* args;
+		const Http_Command* command = find_command(http_request_.uri + settings_.manager_base_url.size(),
+			http_request_.uri_length - settings_.manager_base_url.size(), args);
+		if (args != NULL && !process_request_arg(args)) {
+			LOG_WARNING2("process_put failed arg=" << args);
+			return;
+		}
+		if (command == NULL || command->update_sub_op == HTTP_NO_UPDATE) {
+			LOG_WARNING2("process_put error unkown request=" << http_request_.uri);
+			write_error(XIXI_REASON_INVALID_PARAMETER);
+			return;
+		}
+		update_sub_op_ = (uint8_t)command->update_sub_op;
+		body_latency_op_ = command->latency_op;
+	} else {
+		key_ = (uint8_t*)http_request_.uri;
+		char* args = (char*)memchr(http_request_.uri, '?', http_request_.uri_length);
+		if (args != NULL) {
+			*args = '\0';
+			key_length_ = (uint32_t)(args - http_request_.uri);
+			if (!process_request_arg(args + 1)) {
+				LOG_WARNING2("process_put failed arg=" << (args + 1));
+				return;
+			}
+		} else {
+			key_length_ = http_request_.uri_length;
+		}
+	}
+	if (key_ == NULL) {
+		write_error(XIXI_REASON_INVALID_PARAMETER);
+		return;
+	}
+	if (http_request_.content_type_length > 0 && http_request_.content_type_length < MAX_MIME_TYPE_LENGTH) {
+		value_content_type_ = http_request_.content_type;
+		value_content_type_length_ = http_request_.content_type_length;
+	}
+
+	cache_item_ = cache_mgr_.alloc_item(group_id_, key_, key_length_, flags_,
+		expiration_, content_length_, value_content_type_length_);
+	if (cache_item_ == NULL) {
+		if (cache_mgr_.item_size_ok(key_length_, content_length_, value_content_type_length_)) {
+			write_error(XIXI_REASON_OUT_OF_MEMORY);
+		} else {
+			write_error(XIXI_REASON_TOO_LARGE);
+		}
+		return;
+	}
+	cache_item_->set_ext((uint8_t*)value_content_type_);
+	cache_item_->cache_id = cache_id_;
+
+	http_request_.keepalive = keepalive;
+	read_data_offset_ = 0;
+	next_data_len_ = 0;
+	next_read_segment();
+	body_type_ = HTTP_BODY_VALUE;
+	set_state(PEER_STATE_READ_BODY_EXTRAS);
+}
+
+// the value of a chunked item is read chunk by chunk
+bool Peer_Http::next_read_segment() {
+	if (read_data_offset_ >= cache_item_->data_size) {
+		return false;
+	}
+	read_item_buf_ = cache_item_->get_data_segment(read_data_offset_, next_data_len_);
+	read_data_offset_ += next_data_len_;
+	return true;
+}
+
 void Peer_Http::process_get() {
 	xixi_reason reason;
 	uint32_t expiration;
-	Cache_Item* it = get_cache_item(false, reason, expiration);
+	Cache_Item* it = get_cache_item(false, &Peer_Http::finish_get, reason, expiration);
+	if (state_ != PEER_STATUS_ASYNC_WAIT) {
+		finish_get(it, reason, expiration);
+	}
+}
 
+void Peer_Http::finish_get(Cache_Item* it, xixi_reason reason, uint32_t expiration) {
 	if (it != NULL) {
-		cache_item_ = it;
-		uint32_t mime_type_length;
-		const char* mime_type = get_mime_type(it, mime_type_length);
+		write_get_res(it, expiration);
+	} else {
+		write_get_error(reason);
+	}
+}
 
-		char etag[30];
-		uint32_t etag_length = _snprintf((char*)etag, sizeof(etag), "\"%"PRIu64"\"", it->cache_id);
-		if (etag_length == http_request_.entity_tag_length && memcmp(etag, http_request_.entity_tag, etag_length) == 0) {
-			uint8_t* header = request_buf_.prepare(200);
-			uint32_t header_size = _snprintf((char*)header, 200, "%s\r\n"
-				"CacheID: %"PRIu64"\r\n"
-				"Flags: %"PRIu32"\r\n"
-				"Expiration: %"PRIu32"\r\n"
-				"ETag: %s\r\n\r\n",
-				mime_type, it->cache_id, it->flags, expiration, etag);
+// A miss grants the lease to fill the key and answers 404 with the lease
+// token, while the lease is held other clients get 503 with Retry-After.
+// A hit due for a refresh may carry that lease in a Lease header.
+void Peer_Http::process_lease() {
+	xixi_reason reason;
+	uint32_t expiration;
+	Cache_Item* it = get_cache_item(false, &Peer_Http::finish_lease, reason, expiration);
+	if (state_ != PEER_STATUS_ASYNC_WAIT) {
+		finish_lease(it, reason, expiration);
+	}
+}
+
+void Peer_Http::finish_lease(Cache_Item* it, xixi_reason reason, uint32_t expiration) {
+	if (it != NULL) {
+		uint64_t lease_token = 0;
+		cache_mgr_.get_refresh_lease(it, lease_token);
+		write_get_res(it, expiration, lease_token);
+		return;
+	}
+	if (reason == XIXI_REASON_NOT_FOUND) {
+		uint64_t lease_token = 0;
+		reason = cache_mgr_.get_lease(group_id_, (uint8_t*)key_, key_length_, lease_token);
+		if (reason == XIXI_REASON_SUCCESS) {
+			uint8_t* body = request_buf_.prepare(50);
+			uint32_t body_size = _snprintf((char*)body, 50, "{\"lease\":%" PRIu64 "}", lease_token);
+			uint8_t* header = request_buf_.prepare(30);
+			uint32_t header_size = _snprintf((char*)header, 30, "%" PRIu32 "\r\n\r\n", body_size);
 
 			if (http_request_.keepalive) {
-				add_write_buf((uint8_t*)GET_RES_304_KEEP_ALIVE, sizeof(GET_RES_304_KEEP_ALIVE) - 1);
+				add_write_buf((uint8_t*)LEASE_RES_404_KEEP_ALIVE, sizeof(LEASE_RES_404_KEEP_ALIVE) - 1);
 			} else {
-				add_write_buf((uint8_t*)GET_RES_304_CLOSE, sizeof(GET_RES_304_CLOSE) - 1);
+				add_write_buf((uint8_t*)LEASE_RES_404_CLOSE, sizeof(LEASE_RES_404_CLOSE) - 1);
 			}
-			add_write_buf((uint8_t*)header, header_size);
+			add_write_buf(header, header_size);
+			add_write_buf(body, body_size);
+			set_state(PEER_STATUS_WRITE);
+			next_state_ = PEER_STATE_NEW_CMD;
+			return;
+		}
+	}
+	write_get_error(reason);
+}
+
+void Peer_Http::write_get_res(Cache_Item* it, uint32_t expiration, uint64_t lease_token) {
+	cache_item_ = it;
+	const Http_Header_Template* t = get_http_header(it);
+	if (t == NULL) {
+		write_error(XIXI_REASON_OUT_OF_MEMORY);
+		return;
+	}
+	// the expiration value and the headers that follow it
+	uint8_t* exp = request_buf_.prepare(96);
+	uint32_t exp_size = _snprintf((char*)exp, 96, "%" PRIu32 "\r\n", expiration);
+	if (it->is_stale(curr_time_.get_current_time())) {
+		exp_size += _snprintf((char*)exp + exp_size, 96 - exp_size, "Warning: 110 - \"Response is Stale\"\r\n");
+	}
+	if (lease_token != 0) {
+		exp_size += _snprintf((char*)exp + exp_size, 96 - exp_size, "Lease: %" PRIu64 "\r\n", lease_token);
+	}
+
+	// ranges of a compressed value or a counter are not served, the whole value is sent instead
+	Byte_Range ranges[HTTP_RANGE_MAX_COUNT];
+	int range_count = (it->is_compressed() || it->is_counter()) ? -1 : get_byte_ranges(t, it->data_size, ranges);
+
+	const uint8_t* data = (const uint8_t*)t->data;
+	if (t->etag_value_length == http_request_.entity_tag_length
+			&& memcmp(data + t->etag_offset + 6, http_request_.entity_tag, t->etag_value_length) == 0) {
+		if (http_request_.keepalive) {
+			add_write_buf((uint8_t*)GET_RES_304_KEEP_ALIVE, sizeof(GET_RES_304_KEEP_ALIVE) - 1);
 		} else {
-			uint32_t gzip_size = 0;
-			vector<Const_Data> write_buf;
-			if (http_request_.method != HEAD_METHOD && http_request_.accept_gzip
-					&& it->data_size >= settings_.min_gzip_size
-					&& it->data_size <= settings_.max_gzip_size
-					&& settings_.is_gzip_mime_type((const uint8_t*)mime_type, mime_type_length)) {
-				gzip_size = gzip_encode(it->get_data(), it->data_size, write_buf);
-				if (gzip_size + 50 >= it->data_size) {
-					gzip_size = 0;
-				}
+			add_write_buf((uint8_t*)GET_RES_304_CLOSE, sizeof(GET_RES_304_CLOSE) - 1);
+		}
+		add_write_buf(data, t->content_length_offset);
+		add_write_buf(data + t->cache_id_offset, t->etag_offset - t->cache_id_offset);
+		add_write_buf(exp, exp_size);
+		add_write_buf(data + t->etag_offset, t->size - t->etag_offset);
+	} else if (range_count >= 0) {
+		write_range_response(it, t, exp, exp_size, ranges, range_count);
+	} else {
+		uint32_t gzip_size = 0;
+		vector<Const_Data> write_buf;
+		uint8_t* body = NULL; // uncompressed copy of a compressed value, or the text of a counter
+		uint32_t body_size = 0;
+		if (it->is_counter()) {
+			body = request_buf_.prepare(COUNTER_TEXT_SIZE);
+			if (body == NULL) {
+				write_error(XIXI_REASON_OUT_OF_MEMORY);
+				return;
 			}
-			uint8_t* header = request_buf_.prepare(300);
-			uint32_t header_size;
-			if (gzip_size > 0) {
-				header_size = _snprintf((char*)header, 300, "%s\r\nContent-Encoding: gzip\r\nContent-Length: %"PRIu32"\r\n"
-					"CacheID: %"PRIu64"\r\n"
-					"Flags: %"PRIu32"\r\n"
-					"Expiration: %"PRIu32"\r\n"
-					"ETag: %s\r\n\r\n",
-					mime_type, gzip_size, it->cache_id, it->flags, expiration, etag);
+			body_size = it->get_counter_text(body);
+		} else if (it->is_compressed()) {
+			if (it->codec_id() == CODEC_GZIP && http_request_.accept_gzip) {
+				gzip_size = it->data_size;
+				write_buf.push_back(Const_Data(it->get_data(), it->data_size));
 			} else {
-				header_size = _snprintf((char*)header, 300, "%s\r\nContent-Length: %"PRIu32"\r\n"
-					"CacheID: %"PRIu64"\r\n"
-					"Flags: %"PRIu32"\r\n"
-					"Expiration: %"PRIu32"\r\n"
-					"ETag: %s\r\n\r\n",
-					mime_type, it->data_size, it->cache_id, it->flags, expiration, etag);
+				body_size = it->uncompressed_size();
+				body = request_buf_.prepare(body_size);
+				if (body == NULL || (http_request_.method != HEAD_METHOD
+						&& !get_codec(it->codec_id())->uncompress(it->get_data(), it->data_size, body, body_size))) {
+					write_error(XIXI_REASON_OUT_OF_MEMORY);
+					return;
+				}
 			}
-			if (http_request_.keepalive) {
-				add_write_buf((uint8_t*)GET_RES_200_KEEP_ALIVE, sizeof(GET_RES_200_KEEP_ALIVE) - 1);
-			} else {
-				add_write_buf((uint8_t*)GET_RES_200_CLOSE, sizeof(GET_RES_200_CLOSE) - 1);
+		} else if (http_request_.method != HEAD_METHOD && http_request_.accept_gzip && !it->is_chunked() && !it->is_segmented()
+				&& it->data_size >= settings_.min_gzip_size
+				&& it->data_size <= settings_.max_gzip_size
+				&& settings_.is_gzip_mime_type(data, t->mime_type_length)) {
+			gzip_size = gzip_encode(it->get_data(), it->data_size, write_buf);
+			if (gzip_size + 50 >= it->data_size) {
+				gzip_size = 0;
 			}
+		}
+		if (http_request_.keepalive) {
+			add_write_buf((uint8_t*)GET_RES_200_KEEP_ALIVE, sizeof(GET_RES_200_KEEP_ALIVE) - 1);
+		} else {
+			add_write_buf((uint8_t*)GET_RES_200_CLOSE, sizeof(GET_RES_200_CLOSE) - 1);
+		}
+		if (gzip_size > 0) {
+			uint8_t* header = request_buf_.prepare(60);
+			uint32_t header_size = _snprintf((char*)header, 60, "Content-Encoding: gzip\r\nContent-Length: %" PRIu32 "\r\n", gzip_size);
+			add_write_buf(data, t->content_length_offset);
 			add_write_buf(header, header_size);
-			if (http_request_.method != HEAD_METHOD) {
-				if (gzip_size > 0) {
-					for (size_t i = 0; i < write_buf.size(); i++) {
-						Const_Data& cd = write_buf[i];
-						add_write_buf(cd.data, cd.size); 
-					}
-				} else {
-					add_write_buf(it->get_data(), it->data_size);
+			add_write_buf(data + t->cache_id_offset, t->etag_offset - t->cache_id_offset);
+		} else if (body != NULL) {
+			uint8_t* header = request_buf_.prepare(40);
+			uint32_t header_size = _snprintf((char*)header, 40, "Content-Length: %" PRIu32 "\r\n", body_size);
+			add_write_buf(data, t->content_length_offset);
+			add_write_buf(header, header_size);
+			add_write_buf(data + t->cache_id_offset, t->etag_offset - t->cache_id_offset);
+		} else {
+			add_write_buf(data, t->etag_offset);
+		}
+		add_write_buf(exp, exp_size);
+		add_write_buf(data + t->etag_offset, t->size - t->etag_offset);
+		if (http_request_.method != HEAD_METHOD) {
+			if (gzip_size > 0) {
+				for (size_t i = 0; i < write_buf.size(); i++) {
+					Const_Data& cd = write_buf[i];
+					add_write_buf(cd.data, cd.size); 
 				}
+			} else if (body != NULL) {
+				add_write_buf(body, body_size);
+			} else {
+				add_write_data(it, 0, it->data_size);
 			}
 		}
+	}
+	set_state(PEER_STATUS_WRITE);
+	next_state_ = PEER_STATE_NEW_CMD;
+}
+
+void Peer_Http::write_get_error(xixi_reason reason) {
+	if (reason == XIXI_REASON_MOVED_PERMANENTLY) {
+		uint32_t prepare_size = 150 + key_length_;
+		uint8_t* body = request_buf_.prepare(prepare_size);
+		uint32_t body_size = _snprintf((char*)body, prepare_size, "<HTML><HEAD><TITLE>301 Moved</TITLE></HEAD><BODY><H1>301 Moved</H1>The document has moved"
+			"<A HREF=\"%s/\">here</A>.</BODY></HTML>",
+			(char*)key_);
+		prepare_size = 35 +key_length_;
+		uint8_t* header = request_buf_.prepare(prepare_size);
+		uint32_t header_size = _snprintf((char*)header, prepare_size, "%" PRIu32 "\r\nLocation: %s/\r\n\r\n",
+			body_size, (char*)key_);
+
+		if (http_request_.keepalive) {
+			add_write_buf((uint8_t*)GET_RES_301_KEEP_ALIVE, sizeof(GET_RES_301_KEEP_ALIVE) - 1);
+		} else {
+			add_write_buf((uint8_t*)GET_RES_301_CLOSE, sizeof(GET_RES_301_CLOSE) - 1);
+		}
+		add_write_buf((uint8_t*)header, header_size);
+		add_write_buf((uint8_t*)body, body_size);
 		set_state(PEER_STATUS_WRITE);
 		next_state_ = PEER_STATE_NEW_CMD;
 	} else {
-		if (reason == XIXI_REASON_MOVED_PERMANENTLY) {
-			uint32_t prepare_size = 150 + key_length_;
-			uint8_t* body = request_buf_.prepare(prepare_size);
-			uint32_t body_size = _snprintf((char*)body, prepare_size, "<HTML><HEAD><TITLE>301 Moved</TITLE></HEAD><BODY><H1>301 Moved</H1>The document has moved"
-				"<A HREF=\"%s/\">here</A>.</BODY></HTML>",
-				(char*)key_);
-			prepare_size = 35 +key_length_;
-			uint8_t* header = request_buf_.prepare(prepare_size);
-			uint32_t header_size = _snprintf((char*)header, prepare_size, "%"PRIu32"\r\nLocation: %s/\r\n\r\n",
-				body_size, (char*)key_);
+		write_error(reason);
+	}
+}
 
-			if (http_request_.keepalive) {
-				add_write_buf((uint8_t*)GET_RES_301_KEEP_ALIVE, sizeof(GET_RES_301_KEEP_ALIVE) - 1);
-			} else {
-				add_write_buf((uint8_t*)GET_RES_301_CLOSE, sizeof(GET_RES_301_CLOSE) - 1);
+static bool parse_range_number(const char*& p, const char* end, uint64_t& value) {
+	const char* start = p;
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		value = value * 10 + (*p - '0');
+		if (value > UINT32_C(0xFFFFFFFF)) {
+			value = UINT32_C(0xFFFFFFFF);
+		}
+		p++;
+	}
+	return p > start;
+}
+
+// Parses the Range header against a body of size bytes. Returns the number of satisfiable
+// ranges, 0 if none is, or -1 if there is no usable Range header and the whole body is sent.
+int Peer_Http::get_byte_ranges(const Http_Header_Template* t, uint32_t size, Byte_Range* ranges) {
+	if (http_request_.range == NULL || http_request_.range_length < 6 || memcmp(http_request_.range, "bytes=", 6) != 0) {
+		return -1;
+	}
+	if (http_request_.if_range != NULL && (http_request_.if_range_length != t->etag_value_length
+			|| memcmp(http_request_.if_range, t->data + t->etag_offset + 6, t->etag_value_length) != 0)) {
+		return -1;
+	}
+
+	int count = 0;
+	const char* p = http_request_.range + 6;
+	const char* end = http_request_.range + http_request_.range_length;
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == ',')) {
+			p++;
+		}
+		if (p == end) {
+			break;
+		}
+		uint64_t first;
+		uint64_t last;
+		if (*p == '-') {
+			p++;
+			if (!parse_range_number(p, end, last)) {
+				return -1;
 			}
-			add_write_buf((uint8_t*)header, header_size);
-			add_write_buf((uint8_t*)body, body_size);
-			set_state(PEER_STATUS_WRITE);
-			next_state_ = PEER_STATE_NEW_CMD;
+			if (last == 0 || size == 0) {
+				continue;
+			}
+			first = (last < size) ? size - last : 0;
+			last = size - 1;
 		} else {
-			write_error(reason);
+			if (!parse_range_number(p, end, first) || p == end || *p != '-') {
+				return -1;
+			}
+			p++;
+			if (!parse_range_number(p, end, last)) {
+				last = size - 1;
+			} else if (last < first) {
+				return -1;
+			}
+			if (first >= size) {
+				continue;
+			}
+			if (last >= size) {
+				last = size - 1;
+			}
 		}
+		if (p < end && *p != ',' && *p != ' ') {
+			return -1;
+		}
+		if (count == HTTP_RANGE_MAX_COUNT) {
+			return -1;
+		}
+		ranges[count].first = (uint32_t)first;
+		ranges[count].last = (uint32_t)last;
+		count++;
+	}
+	return count;
+}
+
+// 206 with sub buffers of the item data, a multipart/byteranges body for several ranges,
+// or 416 if no range is satisfiable
+void Peer_Http::write_range_response(Cache_Item* it, const Http_Header_Template* t, const uint8_t* exp, uint32_t exp_size,
+		const Byte_Range* ranges, int range_count) {
+	const uint8_t* data = (const uint8_t*)t->data;
+	if (range_count == 0) {
+		uint8_t* header = request_buf_.prepare(20);
+		uint32_t header_size = _snprintf((char*)header, 20, "%" PRIu32 "\r\n\r\n", it->data_size);
+		if (http_request_.keepalive) {
+			add_write_buf((uint8_t*)GET_RES_416_KEEP_ALIVE, sizeof(GET_RES_416_KEEP_ALIVE) - 1);
+		} else {
+			add_write_buf((uint8_t*)GET_RES_416_CLOSE, sizeof(GET_RES_416_CLOSE) - 1);
+		}
+		add_write_buf(header, header_size);
+		return;
+	}
+
+	if (http_request_.keepalive) {
+		add_write_buf((uint8_t*)GET_RES_206_KEEP_ALIVE, sizeof(GET_RES_206_KEEP_ALIVE) - 1);
+	} else {
+		add_write_buf((uint8_t*)GET_RES_206_CLOSE, sizeof(GET_RES_206_CLOSE) - 1);
+	}
+	if (range_count == 1) {
+		uint32_t length = ranges[0].last - ranges[0].first + 1;
+		uint8_t* header = request_buf_.prepare(100);
+		uint32_t header_size = _snprintf((char*)header, 100, "Content-Range: bytes %" PRIu32 "-%" PRIu32 "/%" PRIu32 "\r\nContent-Length: %" PRIu32 "\r\n",
+			ranges[0].first, ranges[0].last, it->data_size, length);
+		add_write_buf(data, t->content_length_offset);
+		add_write_buf(header, header_size);
+		add_write_buf(data + t->cache_id_offset, t->etag_offset - t->cache_id_offset);
+		add_write_buf(exp, exp_size);
+		add_write_buf(data + t->etag_offset, t->size - t->etag_offset);
+		if (http_request_.method != HEAD_METHOD) {
+			add_write_data(it, ranges[0].first, length);
+		}
+		return;
+	}
+
+	uint8_t* part_header[HTTP_RANGE_MAX_COUNT];
+	uint32_t part_header_size[HTTP_RANGE_MAX_COUNT];
+	uint32_t part_header_max = t->mime_type_length + 120 + sizeof(BYTERANGES_BOUNDARY);
+	uint64_t content_length = sizeof(BYTERANGES_END) - 1;
+	for (int i = 0; i < range_count; i++) {
+		part_header[i] = request_buf_.prepare(part_header_max);
+		part_header_size[i] = _snprintf((char*)part_header[i], part_header_max,
+			"\r\n--" BYTERANGES_BOUNDARY "\r\nContent-Type: %.*s\r\nContent-Range: bytes %" PRIu32 "-%" PRIu32 "/%" PRIu32 "\r\n\r\n",
+			(int)t->mime_type_length, t->data, ranges[i].first, ranges[i].last, it->data_size);
+		content_length += part_header_size[i] + (ranges[i].last - ranges[i].first + 1);
+	}
+	uint8_t* header = request_buf_.prepare(40);
+	uint32_t header_size = _snprintf((char*)header, 40, "Content-Length: %" PRIu64 "\r\n", content_length);
+
+	add_write_buf((uint8_t*)BYTERANGES_CONTENT_TYPE, sizeof(BYTERANGES_CONTENT_TYPE) - 1);
+	add_write_buf(header, header_size);
+	add_write_buf(data + t->cache_id_offset, t->etag_offset - t->cache_id_offset);
+	add_write_buf(exp, exp_size);
+	add_write_buf(data + t->etag_offset, t->size - t->etag_offset);
+	if (http_request_.method != HEAD_METHOD) {
+		for (int i = 0; i < range_count; i++) {
+			add_write_buf(part_header[i], part_header_size[i]);
+			add_write_data(it, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+		}
+		add_write_buf((uint8_t*)BYTERANGES_END, sizeof(BYTERANGES_END) - 1);
 	}
 }
 
 const char* Peer_Http::get_mime_type(Cache_Item* it, uint32_t& mime_type_length) {
-	const char* content_type = "";
+	const char* content_type;
 	uint32_t ext_size = it->get_ext_size();
 	if (ext_size > 0 && ext_size <= MAX_MIME_TYPE_LENGTH) {
-		char* tmp = (char*)this->request_buf_.prepare(ext_size + 1);
-		memcpy(tmp, it->get_ext(), ext_size);
-		tmp[ext_size] = '\0';
-		content_type = tmp;
+		content_type = (const char*)it->get_ext();
 		mime_type_length = ext_size;
 	} else {
 		uint32_t suffix_size;
-		const char* suffix = get_suffix((const char*)key_, key_length_, suffix_size);
+		const char* suffix = get_suffix((const char*)it->get_key(), it->get_key_length(), suffix_size);
 		if (suffix != NULL) {
 			const uint8_t* mime_type = settings_.get_mime_type((const uint8_t*)suffix, suffix_size, mime_type_length);
 			if (mime_type != NULL && mime_type_length <= MAX_MIME_TYPE_LENGTH) {
-				char* tmp = (char*)request_buf_.prepare(mime_type_length + 1);
-				memcpy(tmp, mime_type, mime_type_length);
-				tmp[mime_type_length] = '\0';
-				content_type = tmp;
+				content_type = (const char*)mime_type;
 			} else {
 				content_type = settings_.get_default_mime_type(mime_type_length);
 			}
@@ -1099,67 +1730,176 @@ const char* Peer_Http::get_mime_type(Cache_Item* it, uint32_t& mime_type_length)
 	return content_type;
 }
 
-Cache_Item* Peer_Http::get_cache_item(bool is_base, xixi_reason& reason, uint32_t& expiration) {
-	Cache_Item* it;
+const Http_Header_Template* Peer_Http::get_http_header(Cache_Item* it) {
+	const Http_Header_Template* t = it->http_header;
+	if (t != NULL && t->cache_id == it->cache_id) {
+		return t;
+	}
+
+	uint32_t mime_type_length;
+	const char* mime_type = get_mime_type(it, mime_type_length);
+	uint32_t data_size = mime_type_length + 160;
+	uint8_t* buf = request_buf_.prepare(HTTP_HEADER_TEMPLATE_SIZE(data_size) + 7);
+	if (buf == NULL) {
+		return NULL;
+	}
+	Http_Header_Template* nt = (Http_Header_Template*)(((size_t)buf + 7) & ~(size_t)7);
+	char* p = nt->data;
+	memcpy(p, mime_type, mime_type_length);
+	uint32_t size = mime_type_length;
+	size += _snprintf(p + size, data_size - size, "\r\n");
+	nt->content_length_offset = (uint16_t)size;
+	size += _snprintf(p + size, data_size - size, "Content-Length: %" PRIu32 "\r\n", it->data_size);
+	nt->cache_id_offset = (uint16_t)size;
+	size += _snprintf(p + size, data_size - size, "CacheID: %" PRIu64 "\r\nFlags: %" PRIu32 "\r\nExpiration: ", it->cache_id, it->flags);
+	nt->etag_offset = (uint16_t)size;
+	size += _snprintf(p + size, data_size - size, "ETag: \"%" PRIu64 "\"\r\n\r\n", it->cache_id);
+	nt->etag_value_length = (uint16_t)(size - nt->etag_offset - 10);
+	nt->next = NULL;
+	nt->cache_id = it->cache_id;
+	nt->size = size;
+	nt->depth = 0;
+	nt->mime_type_length = (uint16_t)mime_type_length;
+
+	t = cache_mgr_.set_http_header(it, nt);
+	return (t != NULL) ? t : nt;
+}
+
+Cache_Item* Peer_Http::find_cache_item(const uint8_t* key, uint32_t key_length, bool is_base, xixi_reason& reason, uint32_t& expiration) {
 	if (touch_flag_) {
 		expiration = expiration_;
-		it = cache_mgr_.get_touch(group_id_, (uint8_t*)key_, key_length_, watch_id_, expiration, reason);
-	} else {
-		it = cache_mgr_.get(group_id_, (uint8_t*)key_, key_length_, watch_id_, is_base, expiration, reason);
+		return cache_mgr_.get_touch(group_id_, key, key_length, watch_id_, expiration, reason);
 	}
+	return cache_mgr_.get(group_id_, key, key_length, watch_id_, is_base, expiration, reason);
+}
 
-	// try load from file /webapps
+// A miss of a /webapps path is loaded by file_load_pool_ when it runs, the peer
+// waits in PEER_STATUS_ASYNC_WAIT and handler finishes the request.
+Cache_Item* Peer_Http::get_cache_item(bool is_base, Http_Load_Handler handler, xixi_reason& reason, uint32_t& expiration) {
+	Cache_Item* it = find_cache_item((uint8_t*)key_, key_length_, is_base, reason, expiration);
 	if (it == NULL && key_length_ > 0 && key_[0] == '/') {
-		boost::filesystem::path key_path = (char*)key_;
-		boost::filesystem::path::const_iterator pit = key_path.begin();
-		uint32_t path_count = 0;
-		while (true) {
-			if (pit != key_path.end()) {
-				if (*pit == "..") {
-					if (path_count <= 1) {
-						reason = XIXI_REASON_NOT_FOUND;
-						return NULL;
-					}
-					path_count--;
-				} else if (*pit == ".") {
-				} else {
-					path_count++;
+		if (file_monitor_.is_missing(key_, key_length_)) {
+			reason = XIXI_REASON_NOT_FOUND;
+		} else if (file_load_pool_.is_running()) {
+			if (file_load_pool_.post(boost::bind(&Peer_Http::run_file_load, this, is_base, handler, Current_Time::get_tick_us()))) {
+				set_state(PEER_STATUS_ASYNC_WAIT);
+			} else {
+				reason = XIXI_REASON_PLEASE_TRY_AGAIN;
+			}
+		} else {
+			it = get_file_item(is_base, reason, expiration);
+		}
+	}
+	return it;
+}
+
+// try load from file /webapps, concurrent misses of a key share one load
+Cache_Item* Peer_Http::get_file_item(bool is_base, xixi_reason& reason, uint32_t& expiration) {
+	Cache_Item* it = NULL;
+	if (cache_mgr_.begin_load(group_id_, (uint8_t*)key_, key_length_, reason)) {
+		it = load_cache_item(is_base, reason, expiration);
+		cache_mgr_.end_load(group_id_, (uint8_t*)key_, key_length_, reason);
+	} else if (reason != XIXI_REASON_NOT_FOUND && reason != XIXI_REASON_MOVED_PERMANENTLY) {
+		// answer from the item loaded by the other peer
+		it = find_cache_item((uint8_t*)key_, key_length_, is_base, reason, expiration);
+		// a welcome file is cached under its own key
+		if (it == NULL) {
+			it = load_cache_item(is_base, reason, expiration);
+		}
+	}
+	return it;
+}
+
+// runs on a file_load_pool_ thread, the peer is parked until handle_file_load
+void Peer_Http::run_file_load(bool is_base, Http_Load_Handler handler, uint64_t post_tick) {
+	xixi_reason reason = XIXI_REASON_NOT_FOUND;
+	uint32_t expiration = 0;
+	Cache_Item* it = get_file_item(is_base, reason, expiration);
+	stats_.latency(LATENCY_FILE_LOAD, Current_Time::get_tick_us() - post_tick);
+
+	boost::asio::io_service& io_service = (socket_ != NULL) ? socket_->get_io_service() : socket_ssl_->get_io_service();
+	io_service.post(boost::bind(&Peer_Http::handle_file_load, this, handler, it, reason, expiration));
+}
+
+void Peer_Http::handle_file_load(Http_Load_Handler handler, Cache_Item* it, xixi_reason reason, uint32_t expiration) {
+	LOG_TRACE2("handle_file_load reason=" << reason);
+	lock_.lock();
+	(this->*handler)(it, reason, expiration);
+
+	process();
+
+	if (state_ != PEER_STATUS_ASYNC_WAIT) {
+		if (!is_closed()) {
+			if (!try_write()) {
+				try_read();
+			}
+		}
+	} else {
+		try_write();
+	}
+
+	bool closed = (op_count_ == 0 && state_ != PEER_STATUS_ASYNC_WAIT);
+	lock_.unlock();
+	if (closed) {
+		self_.reset();
+	}
+}
+
+Cache_Item* Peer_Http::load_cache_item(bool is_base, xixi_reason& reason, uint32_t& expiration) {
+	Cache_Item* it = NULL;
+	boost::filesystem::path key_path = (char*)key_;
+	boost::filesystem::path::const_iterator pit = key_path.begin();
+	uint32_t path_count = 0;
+	while (true) {
+		if (pit != key_path.end()) {
+			if (*pit == "..") {
+				if (path_count <= 1) {
+					reason = XIXI_REASON_NOT_FOUND;
+					return NULL;
 				}
-				pit = boost::next(pit);
+				path_count--;
+			} else if (*pit == ".") {
 			} else {
-				break;
+				path_count++;
 			}
+			pit = boost::next(pit);
+		} else {
+			break;
 		}
+	}
 
-		string filename = settings_.home_dir + "webapps" + (char*)key_;
-	//	LOG_INFO("get_cache_item " << filename);
-		try {
-			boost::filesystem::path p(filename);
-			if (exists(p)) {
-				if (is_directory(p)) {
-					if (key_[key_length_ - 1] == '/') {
-						// load welcome file
-						it = get_welcome_file(is_base, reason, expiration);
-					} else {
-						// localion to the directary
-						reason = XIXI_REASON_MOVED_PERMANENTLY;
+	string filename = settings_.home_dir + "webapps" + (char*)key_;
+//	LOG_INFO("get_cache_item " << filename);
+	try {
+		boost::filesystem::path p(filename);
+		if (exists(p)) {
+			if (is_directory(p)) {
+				if (key_[key_length_ - 1] == '/') {
+					// load welcome file
+					it = get_welcome_file(is_base, reason, expiration);
+					if (reason == XIXI_REASON_NOT_FOUND) {
+						file_monitor_.add_missing(key_, key_length_);
 					}
 				} else {
-					// load from file
-					if (!touch_flag_) {
-						expiration = settings_.default_cache_expiration;
-					}
-					it = cache_mgr_.load_from_file(group_id_, (uint8_t*)key_, key_length_, watch_id_, expiration, reason);
+					// localion to the directary
+					reason = XIXI_REASON_MOVED_PERMANENTLY;
 				}
 			} else {
-				reason = XIXI_REASON_NOT_FOUND;
-				return NULL;
+				// load from file
+				if (!touch_flag_) {
+					expiration = settings_.default_cache_expiration;
+				}
+				it = cache_mgr_.load_from_file(group_id_, (uint8_t*)key_, key_length_, watch_id_, expiration, reason);
 			}
-		} catch (const boost::system::system_error& ex) {
-			cout << ex.what() << endl;
+		} else {
+			file_monitor_.add_missing(key_, key_length_);
 			reason = XIXI_REASON_NOT_FOUND;
 			return NULL;
 		}
+	} catch (const boost::system::system_error& ex) {
+		cout << ex.what() << endl;
+		reason = XIXI_REASON_NOT_FOUND;
+		return NULL;
 	}
 	return it;
 }
@@ -1175,12 +1915,7 @@ Cache_Item* Peer_Http::get_welcome_file(bool is_base, xixi_reason& reason, uint3
 		memcpy(new_key + key_length_, welcome.c_str(), welcome.size());
 		new_key[new_key_length] = '\0';
 
-		if (touch_flag_) {
-			expiration = expiration_;
-			it = cache_mgr_.get_touch(group_id_, (uint8_t*)new_key, new_key_length, watch_id_, expiration, reason);
-		} else {
-			it = cache_mgr_.get(group_id_, (uint8_t*)new_key, new_key_length, watch_id_, is_base, expiration, reason);
-		}
+		it = find_cache_item(new_key, new_key_length, is_base, reason, expiration);
 		if (it != NULL) {
 			reason = XIXI_REASON_SUCCESS;
 			break;
@@ -1200,7 +1935,7 @@ Cache_Item* Peer_Http::get_welcome_file(bool is_base, xixi_reason& reason, uint3
 }
 
 void Peer_Http::process_update(uint8_t sub_op) {
-	cache_item_ = cache_mgr_.alloc_item(group_id_, key_length_, flags_,
+	cache_item_ = cache_mgr_.alloc_item(group_id_, key_, key_length_, flags_,
 		expiration_, value_length_, value_content_type_length_);
 
 	if (cache_item_ == NULL) {
@@ -1212,20 +1947,30 @@ void Peer_Http::process_update(uint8_t sub_op) {
 		return;
 	}
 
-	memcpy(cache_item_->get_key(), key_, key_length_);
-	memcpy(cache_item_->get_data(), value_, value_length_);
+	cache_item_->write_data(0, value_, value_length_);
 	cache_item_->set_ext((uint8_t*)value_content_type_);
 
-	cache_item_->calc_hash_value();
-
 	cache_item_->cache_id = cache_id_;
 
+	store_item(sub_op);
+}
+
+// links cache_item_ and writes the response, the reference is released either way
+void Peer_Http::store_item(uint8_t sub_op) {
 	uint64_t cache_id;
 	xixi_reason reason;
 
+	if (sub_op <= XIXI_UPDATE_SUB_OP_REPLACE) {
+		cache_item_ = cache_mgr_.compress_item(cache_item_);
+	}
+
 	switch (sub_op) {
 	case XIXI_UPDATE_SUB_OP_SET:
-		reason = cache_mgr_.set(cache_item_, watch_id_, cache_id);
+		if (lease_token_ != 0) {
+			reason = cache_mgr_.lease_set(cache_item_, lease_token_, watch_id_, cache_id);
+		} else {
+			reason = cache_mgr_.set(cache_item_, watch_id_, cache_id);
+		}
 		break;
 	case XIXI_UPDATE_SUB_OP_ADD:
 		reason = cache_mgr_.add(cache_item_, watch_id_, cache_id);
@@ -1246,9 +1991,9 @@ void Peer_Http::process_update(uint8_t sub_op) {
 
 	if (reason == XIXI_REASON_SUCCESS) {
 		uint8_t* body = request_buf_.prepare(50);
-		uint32_t body_size = _snprintf((char*)body, 50, "{\"cacheid\":%"PRIu64"}", cache_id);
+		uint32_t body_size = _snprintf((char*)body, 50, "{\"cacheid\":%" PRIu64 "}", cache_id);
 		uint8_t* header = request_buf_.prepare(30);
-		uint32_t header_size = _snprintf((char*)header, 30, "%"PRIu32"\r\n\r\n", body_size);
+		uint32_t header_size = _snprintf((char*)header, 30, "%" PRIu32 "\r\n\r\n", body_size);
 
 		if (http_request_.keepalive) {
 			add_write_buf((uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
@@ -1295,10 +2040,10 @@ void Peer_Http::process_delta(bool incr) {
 	xixi_reason reason = cache_mgr_.delta(group_id_, (uint8_t*)key_, key_length_, incr, delta_, cache_id_, value);
 	if (reason == XIXI_REASON_SUCCESS) {
 		uint8_t* body = request_buf_.prepare(100);
-		uint32_t body_size = _snprintf((char*)body, 100, "{\"value\":%"PRId64",\"cacheid\":%"PRIu64"}", value, cache_id_);
+		uint32_t body_size = _snprintf((char*)body, 100, "{\"value\":%" PRId64 ",\"cacheid\":%" PRIu64 "}", value, cache_id_);
 
 		uint8_t* header = request_buf_.prepare(50);
-		uint32_t header_size = _snprintf((char*)header, 50, "%"PRIu32"\r\n\r\n", body_size);
+		uint32_t header_size = _snprintf((char*)header, 50, "%" PRIu32 "\r\n\r\n", body_size);
 
 		if (http_request_.keepalive) {
 			add_write_buf((uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
@@ -1320,22 +2065,27 @@ void Peer_Http::process_get_base() {
 
 	xixi_reason reason;
 	uint32_t expiration;
-	Cache_Item* it = get_cache_item(true, reason, expiration);
+	Cache_Item* it = get_cache_item(true, &Peer_Http::finish_get_base, reason, expiration);
+	if (state_ != PEER_STATUS_ASYNC_WAIT) {
+		finish_get_base(it, reason, expiration);
+	}
+}
 
+void Peer_Http::finish_get_base(Cache_Item* it, xixi_reason reason, uint32_t expiration) {
 	if (it != NULL) {
 		uint32_t mime_type_length;
 		const char* mime_type = get_mime_type(it, mime_type_length);
 
-		uint8_t* body = request_buf_.prepare(200);
-		uint32_t body_size = _snprintf((char*)body, 200,
-			"{\"cacheid\":%"PRIu64",\"flags\":%"PRIu32",\"expiration\":%"PRIu32",\"mime_type\":\"%s\",\"size\":%"PRIu32"}",
-			it->cache_id, it->flags, expiration, mime_type, it->data_size);
+		uint8_t* body = request_buf_.prepare(300);
+		uint32_t body_size = _snprintf((char*)body, 300,
+			"{\"cacheid\":%" PRIu64 ",\"flags\":%" PRIu32 ",\"expiration\":%" PRIu32 ",\"mime_type\":\"%.*s\",\"size\":%" PRIu32 "}",
+			it->cache_id, it->flags, expiration, (int)mime_type_length, mime_type, it->data_size);
 
 		cache_mgr_.release_reference(it);
 		it = NULL;
 
 		uint8_t* header = request_buf_.prepare(30);
-		uint32_t header_size = _snprintf((char*)header, 30, "%"PRIu32"\r\n\r\n", body_size);
+		uint32_t header_size = _snprintf((char*)header, 30, "%" PRIu32 "\r\n\r\n", body_size);
 
 		if (http_request_.keepalive) {
 			add_write_buf((uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
@@ -1363,10 +2113,10 @@ void Peer_Http::process_update_flags() {
 	bool ret = cache_mgr_.update_flags(group_id_, key_, key_length_, &pdu, cache_id);
 	if (ret) {
 		uint8_t* body = request_buf_.prepare(50);
-		uint32_t body_size = _snprintf((char*)body, 50, "{\"cacheid\":%"PRIu64"}", cache_id);
+		uint32_t body_size = _snprintf((char*)body, 50, "{\"cacheid\":%" PRIu64 "}", cache_id);
 
 		uint8_t* header = request_buf_.prepare(50);
-		uint32_t header_size = _snprintf((char*)header, 50, "%"PRIu32"\r\n\r\n", body_size);
+		uint32_t header_size = _snprintf((char*)header, 50, "%" PRIu32 "\r\n\r\n", body_size);
 
 		if (http_request_.keepalive) {
 			add_write_buf((uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
@@ -1397,10 +2147,10 @@ void Peer_Http::process_touch() {
 	bool ret = cache_mgr_.update_expiration(group_id_, (uint8_t*)key_, key_length_, &pdu, cache_id);
 	if (ret) {
 		uint8_t* body = request_buf_.prepare(50);
-		uint32_t body_size = _snprintf((char*)body, 50, "{\"cacheid\":%"PRIu64"}", cache_id);
+		uint32_t body_size = _snprintf((char*)body, 50, "{\"cacheid\":%" PRIu64 "}", cache_id);
 
 		uint8_t* header = request_buf_.prepare(50);
-		uint32_t header_size = _snprintf((char*)header, 50, "%"PRIu32"\r\n\r\n", body_size);
+		uint32_t header_size = _snprintf((char*)header, 50, "%" PRIu32 "\r\n\r\n", body_size);
 
 		if (http_request_.keepalive) {
 			add_write_buf((uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
@@ -1441,10 +2191,10 @@ void Peer_Http::process_create_watch() {
 	uint32_t watch_id = cache_mgr_.create_watch(group_id_, interval_);
 
 	uint8_t* body = request_buf_.prepare(50);
-	uint32_t body_size = _snprintf((char*)body, 50, "{\"watchid\":%"PRIu32"}", watch_id);
+	uint32_t body_size = _snprintf((char*)body, 50, "{\"watchid\":%" PRIu32 "}", watch_id);
 
 	uint8_t* header = request_buf_.prepare(50);
-	uint32_t header_size = _snprintf((char*)header, 50, "%"PRIu32"\r\n\r\n", body_size);
+	uint32_t header_size = _snprintf((char*)header, 50, "%" PRIu32 "\r\n\r\n", body_size);
 
 	if (http_request_.keepalive) {
 		add_write_buf((uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
@@ -1464,6 +2214,7 @@ void Peer_Http::encode_update_list(uint32_t sequence, std::vector<uint64_t>& upd
 	uint32_t total_size = 0;
 	bool is_begin = true;
 	if (buf != NULL) {
+		uint32_t header_index = (uint32_t)write_buf_.size();
 		add_write_buf(NULL, 0); // will update next
 		add_write_buf(NULL, 0); // will update next
 		uint32_t write_buf_count = 2;
@@ -1476,9 +2227,9 @@ void Peer_Http::encode_update_list(uint32_t sequence, std::vector<uint64_t>& upd
 			uint32_t data_size = 0;
 			if (is_begin) {
 				is_begin = false;
-				data_size = _snprintf((char*)buf + offset, 30, "%"PRIu64, cache_id);
+				data_size = _snprintf((char*)buf + offset, 30, "%" PRIu64, cache_id);
 			} else {
-				data_size = _snprintf((char*)buf + offset, 30, ",%"PRIu64, cache_id);
+				data_size = _snprintf((char*)buf + offset, 30, ",%" PRIu64, cache_id);
 			}
 			offset += data_size;
 			total_size += data_size;
@@ -1501,14 +2252,14 @@ void Peer_Http::encode_update_list(uint32_t sequence, std::vector<uint64_t>& upd
 			}
 
 			uint8_t* buf2 = request_buf_.prepare(50);
-			uint32_t data_size2 = _snprintf((char*)buf2, 50, "%"PRIu32"\r\n\r\n", total_size);
+			uint32_t data_size2 = _snprintf((char*)buf2, 50, "%" PRIu32 "\r\n\r\n", total_size);
 
 			if (http_request_.keepalive) {
-				update_write_buf(0, (uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
+				update_write_buf(header_index, (uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
 			} else {
-				update_write_buf(0, (uint8_t*)DEFAULT_RES_200_CLOSE, sizeof(DEFAULT_RES_200_CLOSE) - 1);
+				update_write_buf(header_index, (uint8_t*)DEFAULT_RES_200_CLOSE, sizeof(DEFAULT_RES_200_CLOSE) - 1);
 			}
-			update_write_buf(1, buf2, data_size2);
+			update_write_buf(header_index + 1, buf2, data_size2);
 
 			set_state(PEER_STATUS_WRITE);
 			next_state_ = PEER_STATE_NEW_CMD;
@@ -1564,10 +2315,10 @@ void Peer_Http::process_flush() {
 	cache_mgr_.flush(group_id_, flush_count, flush_size);
 
 	uint8_t* body = request_buf_.prepare(50);
-	uint32_t body_size = _snprintf((char*)body, 50, "{\"flushcount\":%"PRIu32",\"flushsize\":%"PRIu64"}", flush_count, flush_size);
+	uint32_t body_size = _snprintf((char*)body, 50, "{\"flushcount\":%" PRIu32 ",\"flushsize\":%" PRIu64 "}", flush_count, flush_size);
 
 	uint8_t* header = request_buf_.prepare(50);
-	uint32_t header_size = _snprintf((char*)header, 50, "%"PRIu32"\r\n\r\n", body_size);
+	uint32_t header_size = _snprintf((char*)header, 50, "%" PRIu32 "\r\n\r\n", body_size);
 
 	if (http_request_.keepalive) {
 		add_write_buf((uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
@@ -1586,11 +2337,12 @@ void Peer_Http::process_stats() {
 	XIXI_Stats_Req_Pdu pdu;
 	pdu.group_id = group_id_;
 	pdu.op_flag = sub_op_;
+	pdu.class_id = 0;
 	cache_mgr_.stats(&pdu, result);
 	uint32_t size = (uint32_t)result.size();
 
 	uint8_t* buf2 = request_buf_.prepare(50);
-	uint32_t data_size2 = _snprintf((char*)buf2, 50, "%"PRIu32"\r\n\r\n", size);
+	uint32_t data_size2 = _snprintf((char*)buf2, 50, "%" PRIu32 "\r\n\r\n", size);
 
 	uint8_t* buf = request_buf_.prepare(size);
 	memcpy(buf, result.c_str(), size);
@@ -1607,11 +2359,66 @@ void Peer_Http::process_stats() {
 	next_state_ = PEER_STATE_NEW_CMD;
 }
 
+void Peer_Http::process_quota() {
+	uint64_t max_bytes = 0;
+	if (value_ != NULL && !safe_toui64((char*)value_, value_length_, max_bytes)) {
+		write_error(XIXI_REASON_INVALID_PARAMETER);
+		return;
+	}
+	cache_mgr_.set_group_quota(group_id_, max_bytes);
+
+	uint8_t* body = request_buf_.prepare(60);
+	uint32_t body_size = _snprintf((char*)body, 60, "{\"group\":%" PRIu32 ",\"maxbytes\":%" PRIu64 "}", group_id_, max_bytes);
+
+	uint8_t* header = request_buf_.prepare(50);
+	uint32_t header_size = _snprintf((char*)header, 50, "%" PRIu32 "\r\n\r\n", body_size);
+
+	if (http_request_.keepalive) {
+		add_write_buf((uint8_t*)DEFAULT_RES_200_KEEP_ALIVE, sizeof(DEFAULT_RES_200_KEEP_ALIVE) - 1);
+	} else {
+		add_write_buf((uint8_t*)DEFAULT_RES_200_CLOSE, sizeof(DEFAULT_RES_200_CLOSE) - 1);
+	}
+	add_write_buf(header, header_size);
+	add_write_buf(body, body_size);
+
+	set_state(PEER_STATUS_WRITE);
+	next_state_ = PEER_STATE_NEW_CMD;
+}
+
+void Peer_Http::process_metrics() {
+	Metrics_Buffer& metrics = stats_.get_thread_stats_item()->metrics_buf_;
+	stats_.get_metrics(metrics);
+	uint32_t size = metrics.size();
+
+	uint8_t* body = request_buf_.prepare(size);
+	if (body == NULL) {
+		write_error(XIXI_REASON_OUT_OF_MEMORY);
+		return;
+	}
+	memcpy(body, metrics.data(), size);
+
+	uint8_t* header = request_buf_.prepare(50);
+	uint32_t header_size = _snprintf((char*)header, 50, "%" PRIu32 "\r\n\r\n", size);
+
+	if (http_request_.keepalive) {
+		add_write_buf((uint8_t*)METRICS_RES_200_KEEP_ALIVE, sizeof(METRICS_RES_200_KEEP_ALIVE) - 1);
+	} else {
+		add_write_buf((uint8_t*)METRICS_RES_200_CLOSE, sizeof(METRICS_RES_200_CLOSE) - 1);
+	}
+	add_write_buf(header, header_size);
+	add_write_buf(body, size);
+
+	set_state(PEER_STATUS_WRITE);
+	next_state_ = PEER_STATE_NEW_CMD;
+}
+
 void Peer_Http::on_cache_watch_notify(uint32_t watch_id) {
 	timer_lock_.lock();
 		if (timer_flag_) {
-			boost::system::error_code ec;
-			timer_->cancel(ec);
+			if (timer_ != NULL) {
+				boost::system::error_code ec;
+				timer_->cancel(ec);
+			}
 		} else {
 			timer_flag_ = true;
 		}
@@ -1682,6 +2489,10 @@ void Peer_Http::handle_write(const boost::system::error_code& err) {
 	lock_.lock();
 	--op_count_;
 	if (!err) {
+		if (state_ == PEER_STATE_READ_HEADER) {
+			// the pipelined responses are written, only a partial header is buffered
+			reset_for_new_cmd();
+		}
 
 		process();
 
@@ -1703,8 +2514,28 @@ void Peer_Http::handle_write(const boost::system::error_code& err) {
 	}
 }
 
+// Not while a watch wait is pending on the old io_service. The timer is
+// dropped with it and made again on the new one by the next wait.
+bool Peer_Http::migrate_socket() {
+	if (state_ == PEER_STATUS_ASYNC_WAIT) {
+		return false;
+	}
+	timer_lock_.lock();
+	bool ret = svr_->get_io_service_pool().migrate(socket_);
+	if (ret && timer_ != NULL) {
+		delete timer_;
+		timer_ = NULL;
+		timer_flag_ = false;
+	}
+	timer_lock_.unlock();
+	return ret;
+}
+
 void Peer_Http::try_read() {
 	if (op_count_ == 0) {
+		if (socket_ != NULL && settings_.connection_migration && migrate_socket()) {
+			LOG_DEBUG2("try_read migrated");
+		}
 		++op_count_;
 		read_buffer_.handle_processed();
 		if (socket_ != NULL) {
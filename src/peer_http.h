@@ -33,6 +33,39 @@
 const uint32_t HEAD_METHOD = 'H'; // "HEAD"
 const uint32_t GET_METHOD = 'G'; // "GET "
 const uint32_t POST_METHOD = 'P'; // "POST"
+const uint32_t PUT_METHOD = 'U'; // "PUT "
+
+// how a request body is consumed once it has been read
+const uint32_t HTTP_BODY_FORM = 0; // whole body buffered, parsed by process_post
+const uint32_t HTTP_BODY_FORM_HEAD = 1; // multipart fields in front of the value
+const uint32_t HTTP_BODY_FORM_VALUE = 2; // multipart value read into cache_item_
+const uint32_t HTTP_BODY_VALUE = 3; // PUT body read into cache_item_
+
+// multipart bodies larger than this are streamed into the item
+#define HTTP_STREAM_BODY_MIN_SIZE 16384
+#define HTTP_FORM_HEAD_SIZE 4096
+#define HTTP_NO_UPDATE 0xFF
+
+#define HTTP_PIPELINE_MAX_COUNT 32
+#define HTTP_RANGE_MAX_COUNT 8
+class Peer_Http;
+
+// finishes a get type request once its item is looked up or loaded
+typedef void (Peer_Http::*Http_Load_Handler)(Cache_Item* it, xixi_reason reason, uint32_t expiration);
+
+struct Http_Command {
+	const char* name;
+	uint32_t name_length;
+	uint32_t latency_op;
+	uint32_t update_sub_op;
+	void (Peer_Http::*handler)();
+};
+
+struct Byte_Range {
+	uint32_t first;
+	uint32_t last;
+};
+
 /*
 typedef struct token_s {
     char* value;
@@ -57,6 +90,10 @@ public:
 		entity_tag_length = 0;
 		boundary = NULL;
 		boundary_length = 0;
+		range = NULL;
+		range_length = 0;
+		if_range = NULL;
+		if_range_length = 0;
 	}
 	bool http_11;
 	bool keepalive;
@@ -70,6 +107,10 @@ public:
 	uint32_t entity_tag_length;
 	char* boundary;
 	uint32_t boundary_length;
+	char* range;
+	uint32_t range_length;
+	char* if_range;
+	uint32_t if_range_length;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -97,29 +138,62 @@ protected:
 	inline void process_request_header(char* request_header, uint32_t length);
 	inline bool process_request_header_fields(char* request_header_field, uint32_t length);
 	inline bool handle_request_header_field(char* name, uint32_t name_length, char* value, uint32_t value_length);
+	inline char* hold_header_value(char* value, uint32_t value_length);
 	inline void process_command();
+	inline bool is_manager_uri();
+	inline const Http_Command* find_command(char* cmd, uint32_t length, char*&/*out*/ args);
 	inline bool process_request_arg(char* agrs);
 	inline char* decode_uri(char* uri, uint32_t length, uint32_t& out);
 	inline void process_post();
+	inline bool set_form_field(char* name, uint32_t name_length, char* content_type, uint32_t content_type_length, char* value, uint32_t value_length);
+	inline void process_body();
+	inline bool next_read_segment();
+	inline void process_form_head();
+	inline void process_form_value();
+	inline void read_form_body(uint32_t head_size);
+	inline void process_put();
 
 	// get
 	inline void process_get();
+	void finish_get(Cache_Item* it, xixi_reason reason, uint32_t expiration);
+	inline void process_lease();
+	void finish_lease(Cache_Item* it, xixi_reason reason, uint32_t expiration);
+	inline void write_get_res(Cache_Item* it, uint32_t expiration, uint64_t lease_token = 0);
+	inline void write_get_error(xixi_reason reason);
 
 	// get content type
 
 	inline const char* get_mime_type(Cache_Item* it, uint32_t& mime_type_length);
+	inline const Http_Header_Template* get_http_header(Cache_Item* it);
+
+	// range
+	inline int get_byte_ranges(const Http_Header_Template* t, uint32_t size, Byte_Range* ranges);
+	inline void write_range_response(Cache_Item* it, const Http_Header_Template* t, const uint8_t* exp, uint32_t exp_size,
+		const Byte_Range* ranges, int range_count);
 
 	// get cache item
-	inline Cache_Item* get_cache_item(bool is_base, xixi_reason& reason, uint32_t& expiration);
+	inline Cache_Item* get_cache_item(bool is_base, Http_Load_Handler handler, xixi_reason& reason, uint32_t& expiration);
+	inline Cache_Item* find_cache_item(const uint8_t* key, uint32_t key_length, bool is_base, xixi_reason& reason, uint32_t& expiration);
+	Cache_Item* get_file_item(bool is_base, xixi_reason& reason, uint32_t& expiration);
+	inline Cache_Item* load_cache_item(bool is_base, xixi_reason& reason, uint32_t& expiration);
+	void run_file_load(bool is_base, Http_Load_Handler handler, uint64_t post_tick);
+	void handle_file_load(Http_Load_Handler handler, Cache_Item* it, xixi_reason reason, uint32_t expiration);
 
 	// get welcome file
 	Cache_Item* get_welcome_file(bool is_base, xixi_reason& reason, uint32_t& expiration);
 
 	// get base
 	inline void process_get_base();
+	void finish_get_base(Cache_Item* it, xixi_reason reason, uint32_t expiration);
 
 	// update
-	inline void process_update(uint8_t sub_op);
+	void process_update(uint8_t sub_op);
+	void process_set() { process_update(XIXI_UPDATE_SUB_OP_SET); }
+	void process_add() { process_update(XIXI_UPDATE_SUB_OP_ADD); }
+	void process_replace() { process_update(XIXI_UPDATE_SUB_OP_REPLACE); }
+	void process_append() { process_update(XIXI_UPDATE_SUB_OP_APPEND); }
+	void process_prepend() { process_update(XIXI_UPDATE_SUB_OP_PREPEND); }
+	inline void store_item(uint8_t sub_op);
 
 	// update base
 	inline void process_update_flags();
@@ -135,7 +209,9 @@ protected:
 	inline uint32_t process_auth_req_pdu_extras(XIXI_Auth_Req_Pdu* pdu, uint8_t* data, uint32_t data_length);
 
 	// delta
-	inline void process_delta(bool incr);
+	void process_delta(bool incr);
+	void process_incr() { process_delta(true); }
+	void process_decr() { process_delta(false); }
 
 	// create watch
 	inline void process_create_watch();
@@ -149,7 +225,14 @@ protected:
 	// stats
 	inline void process_stats();
 
+	// quota
+	inline void process_quota();
+
+	// metrics
+	inline void process_metrics();
+
 	inline void reset_for_new_cmd();
+	inline void reset_request();
 	inline void write_error(xixi_reason error_code);
 
 	inline void cleanup();
@@ -159,12 +242,25 @@ protected:
 	inline void handle_write(const boost::system::error_code& err);
 
 	inline void try_read();
+	bool migrate_socket();
 	inline bool try_write();
 	inline uint32_t read_some(uint8_t* buf, uint32_t length);
 	inline void add_write_buf(const uint8_t* buf, uint32_t size) {
 		write_buf_.push_back(boost::asio::const_buffer(buf, size));
 		write_buf_total_ += size;
 	}
+	inline void add_write_data(Cache_Item* it, uint32_t offset, uint32_t length) {
+		while (length > 0) {
+			uint32_t size;
+			const uint8_t* data = it->get_data_segment(offset, size);
+			if (size > length) {
+				size = length;
+			}
+			add_write_buf(data, size);
+			offset += size;
+			length -= size;
+		}
+	}
 	inline void update_write_buf(uint32_t index, const uint8_t* buf, uint32_t size) {
 		if (write_buf_.size() > index) {
 			write_buf_[index] = boost::asio::const_buffer(buf, size);
@@ -182,6 +278,8 @@ protected:
 
 	uint32_t gzip_encode(uint8_t* data_in, uint32_t data_in_size, vector<Const_Data>& data_out);
 protected:
+	static const Http_Command http_commands_[];
+
 	boost::shared_ptr<Peer_Http> self_;
 
 	mutex lock_;
@@ -196,6 +294,7 @@ protected:
 	uint32_t group_id_;
 	uint32_t watch_id_;
 	uint64_t cache_id_;
+	uint64_t lease_token_;
 	uint8_t* key_;
 	uint32_t key_length_;
 	uint8_t* value_;
@@ -213,11 +312,20 @@ protected:
 	uint32_t timeout_;
 	uint32_t sub_op_;
 
+	uint32_t body_type_;
+	uint8_t update_sub_op_;
+	uint32_t body_latency_op_;
+
 	uint32_t write_buf_total_;
 
 	uint8_t* read_item_buf_;
+	uint32_t read_data_offset_;
 
 	Cache_Item* cache_item_;
+	vector<Cache_Item*> cache_items_;
+
+	uint32_t header_scan_offset_;
+	uint32_t pipeline_count_;
 
 	Cache_Buffer<2048> request_buf_;
 
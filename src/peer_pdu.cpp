@@ -19,6 +19,7 @@
 bool XIXI_Pdu::decode_pdu(uint8_t* pdu_buffer, XIXI_Pdu_Header& header, uint8_t* buf, uint32_t length) {
 	switch (header.choice) {
 	case XIXI_CHOICE_GET_REQ:
+	case XIXI_CHOICE_LEASE_GET_REQ:
 		((XIXI_Get_Req_Pdu*)pdu_buffer)->decode_fixed(buf, length);
 		break;
 	case XIXI_CHOICE_GET_TOUCH_REQ:
@@ -59,6 +60,12 @@ bool XIXI_Pdu::decode_pdu(uint8_t* pdu_buffer, XIXI_Pdu_Header& header, uint8_t*
 	case XIXI_CHOICE_CHECK_WATCH_REQ:
 		((XIXI_Check_Watch_Req_Pdu*)pdu_buffer)->decode_fixed(buf, length);
 		break;
+	case XIXI_CHOICE_SET_OPTIONS_REQ:
+		((XIXI_Set_Options_Req_Pdu*)pdu_buffer)->decode_fixed(buf, length);
+		break;
+	case XIXI_CHOICE_CHECK_FEED_REQ:
+		((XIXI_Check_Feed_Req_Pdu*)pdu_buffer)->decode_fixed(buf, length);
+		break;
 	default:
 		return false;
 	}
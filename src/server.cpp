@@ -19,10 +19,16 @@
 #include "log.h"
 #include "peer_cache.h"
 #include "peer_http.h"
-#include "cache.h"
+#include "cache_router.h"
 #include "currtime.h"
+#include "file_load_pool.h"
+#include "file_monitor.h"
 #include <boost/lexical_cast.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 Server* svr_ = NULL;
 
@@ -124,7 +130,8 @@ public:
 				return;
 			}
 
-			if (IS_METHOD(data, 'G', 'E', 'T', ' ') || IS_METHOD(data, 'P', 'O', 'S', 'T') || IS_METHOD(data, 'H', 'E', 'A', 'D')) {
+			if (IS_METHOD(data, 'G', 'E', 'T', ' ') || IS_METHOD(data, 'P', 'O', 'S', 'T') || IS_METHOD(data, 'H', 'E', 'A', 'D')
+					|| IS_METHOD(data, 'P', 'U', 'T', ' ')) {
 				Peer_Http* peer = new Peer_Http(socket_);
 				data[data_len] = '\0';
 				peer->start(read_buf_, read_data_size_);
@@ -265,7 +272,8 @@ public:
 				return;
 			}
 
-			if (IS_METHOD(data, 'G', 'E', 'T', ' ') || IS_METHOD(data, 'P', 'O', 'S', 'T') || IS_METHOD(data, 'H', 'E', 'A', 'D')) {
+			if (IS_METHOD(data, 'G', 'E', 'T', ' ') || IS_METHOD(data, 'P', 'O', 'S', 'T') || IS_METHOD(data, 'H', 'E', 'A', 'D')
+					|| IS_METHOD(data, 'P', 'U', 'T', ' ')) {
 				Peer_Http* peer = new Peer_Http(socket_);
 				data[data_len] = '\0';
 				peer->start(read_buf_, read_data_size_);
@@ -339,7 +347,13 @@ bool Server::start() {
 		return false;
 	}
 
+	if (settings_.partitioned) {
+		cache_mgr_.init_cores(io_service_pool_);
+		io_service_pool_.set_thread_init(boost::bind(&Server::init_core, this, _1));
+	}
 	cache_mgr_.init(settings_.max_bytes, settings_.item_size_max, settings_.item_size_min, settings_.factor);
+	file_load_pool_.start(settings_.file_load_threads, settings_.file_load_queue_size);
+	file_monitor_.start(settings_.home_dir + "webapps", settings_.negative_cache_size, settings_.negative_cache_ttl);
 
 	timer_.async_wait(boost::bind(&Server::handle_timer, this,
 		boost::asio::placeholders::error));
@@ -365,6 +379,8 @@ void Server::stop() {
 	resolver_.cancel();
 	//  timer_.cancel();
 	io_service_pool_.stop();
+	file_load_pool_.stop();
+	file_monitor_.stop();
 	LOG_INFO("Server::stop leave");
 }
 
@@ -376,6 +392,27 @@ boost::asio::ip::tcp::socket* Server::create_socket() {
 	return new boost::asio::ip::tcp::socket(io_service_pool_.get_io_service());
 }
 
+// pins the thread of a partitioned core to one cpu and binds it to its partition
+void Server::init_core(size_t index) {
+	uint32_t cpus = boost::thread::hardware_concurrency();
+	if (cpus > 0) {
+		uint32_t cpu = (uint32_t)(index % cpus);
+#if defined(_WIN32) || defined(_WIN64)
+		if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) == 0) {
+			LOG_WARNING("Server::init_core, set affinity error, core=" << index << " cpu=" << cpu);
+		}
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+			LOG_WARNING("Server::init_core, set affinity error, core=" << index << " cpu=" << cpu);
+		}
+#endif
+	}
+	cache_mgr_.bind_core(index);
+}
+
 std::string Server::get_password() const {
 	return "test";
 }
@@ -474,7 +511,9 @@ void Server::handle_accept_ssl(Connection_SSL_Help* help, const boost::system::e
 
 void Server::handle_timer(const boost::system::error_code& err) {
 	curr_time_.set_current_time();
+	io_service_pool_.sample_load();
 	cache_mgr_.check_expired();
+	cache_mgr_.compact_segments();
 	cache_mgr_.print_stats();
 
 	timer_.expires_at(timer_.expires_at() + boost::posix_time::millisec(500));
@@ -41,6 +41,7 @@ public:
 
 	boost::asio::ip::tcp::socket* create_socket();
 	boost::asio::ip::tcp::resolver& get_resolver() { return resolver_; }
+	io_service_pool& get_io_service_pool() { return io_service_pool_; }
 
 	std::string& get_server_id() {
 		return server_id_;
@@ -54,6 +55,7 @@ private:
 	void handle_accept(Connection_Help* help, const boost::system::error_code& err);
 	void handle_accept_ssl(Connection_SSL_Help* help, const boost::system::error_code& err);
 	void handle_timer(const boost::system::error_code& err);
+	void init_core(size_t index);
 	std::string get_password() const;
 
 private:
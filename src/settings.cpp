@@ -15,6 +15,7 @@
 */
 
 #include "settings.h"
+#include "codec.h"
 #include "util.h"
 #include "log.h"
 #include "tinyxml.h"
@@ -57,8 +58,20 @@ void Settings::init() {
 	factor = 1.25;
 	pool_size = 2;
 	num_threads = 4;
+	partitioned = false;
+	connection_migration = false;
+	lock_free_get = true;
+	file_load_threads = 2;
+	file_load_queue_size = 1024;
+	negative_cache_size = 4096;
+	negative_cache_ttl = 5;
 	item_size_min = 48;
 	item_size_max = 5 * 1024 * 1024;
+	chunk_size = 1024 * 1024;
+	value_size_max = 64 * 1024 * 1024;
+	segment_max = 16;
+	feed_size = 4096;
+	lease_timeout = 10;
 
 	log_level = log_level_info;
 
@@ -187,6 +200,122 @@ string Settings::load_conf_server() {
 				return "[server.xml] reading key-value.max-item-size error";
 			}
 		}
+		elem = kv->FirstChildElement("chunk-size");
+		if (elem != NULL && elem->GetText() != NULL) {
+			string t = elem->GetText();
+			if (!safe_toui32(t.c_str(), t.size(), chunk_size) || chunk_size == 0) {
+				return "[server.xml] reading key-value.chunk-size error";
+			}
+		}
+		elem = kv->FirstChildElement("max-value-size");
+		if (elem != NULL && elem->GetText() != NULL) {
+			string t = elem->GetText();
+			if (!safe_toui32(t.c_str(), t.size(), value_size_max)) {
+				return "[server.xml] reading key-value.max-value-size error";
+			}
+		}
+		elem = kv->FirstChildElement("max-segments");
+		if (elem != NULL && elem->GetText() != NULL) {
+			string t = elem->GetText();
+			if (!safe_toui32(t.c_str(), t.size(), segment_max)) {
+				return "[server.xml] reading key-value.max-segments error";
+			}
+		}
+		elem = kv->FirstChildElement("group-feed-size");
+		if (elem != NULL && elem->GetText() != NULL) {
+			string t = elem->GetText();
+			if (!safe_toui32(t.c_str(), t.size(), feed_size)) {
+				return "[server.xml] reading key-value.group-feed-size error";
+			}
+		}
+		elem = kv->FirstChildElement("lease-timeout");
+		if (elem != NULL && elem->GetText() != NULL) {
+			string t = elem->GetText();
+			if (!safe_toui32(t.c_str(), t.size(), lease_timeout) || lease_timeout == 0) {
+				return "[server.xml] reading key-value.lease-timeout error";
+			}
+		}
+		elem = kv->FirstChildElement("group-quota");
+		while (elem != NULL) {
+			const char* g = elem->Attribute("group-id");
+			if (g == NULL || elem->GetText() == NULL) {
+				return "[server.xml] reading key-value.group-quota error";
+			}
+			uint32_t group_id;
+			uint64_t quota;
+			string t = g;
+			if (!safe_toui32(t.c_str(), t.size(), group_id)) {
+				return "[server.xml] reading key-value.group-quota.group-id error";
+			}
+			t = elem->GetText();
+			if (!safe_toui64(t.c_str(), t.size(), quota)) {
+				return "[server.xml] reading key-value.group-quota error";
+			}
+			group_quotas[group_id] = quota;
+			elem = elem->NextSiblingElement("group-quota");
+		}
+		elem = kv->FirstChildElement("group-compression");
+		while (elem != NULL) {
+			const char* g = elem->Attribute("group-id");
+			if (g == NULL || elem->GetText() == NULL) {
+				return "[server.xml] reading key-value.group-compression error";
+			}
+			uint32_t group_id;
+			string t = g;
+			if (!safe_toui32(t.c_str(), t.size(), group_id)) {
+				return "[server.xml] reading key-value.group-compression.group-id error";
+			}
+			Group_Compression gc;
+			gc.codec_id = get_codec_id(elem->GetText());
+			if (gc.codec_id == CODEC_NONE) {
+				return "[server.xml] reading key-value.group-compression unknown codec";
+			}
+			gc.level = -1;
+			const char* level = elem->Attribute("level");
+			if (level != NULL) {
+				gc.level = atoi(level);
+				if (gc.level < -1 || gc.level > 9) {
+					return "[server.xml] reading key-value.group-compression.level error";
+				}
+			}
+			gc.min_size = 1024;
+			const char* min_size = elem->Attribute("min-size");
+			if (min_size != NULL) {
+				t = min_size;
+				if (!safe_toui32(t.c_str(), t.size(), gc.min_size)) {
+					return "[server.xml] reading key-value.group-compression.min-size error";
+				}
+			}
+			group_compressions[group_id] = gc;
+			elem = elem->NextSiblingElement("group-compression");
+		}
+		elem = kv->FirstChildElement("group-stale");
+		while (elem != NULL) {
+			const char* g = elem->Attribute("group-id");
+			if (g == NULL || elem->GetText() == NULL) {
+				return "[server.xml] reading key-value.group-stale error";
+			}
+			uint32_t group_id;
+			string t = g;
+			if (!safe_toui32(t.c_str(), t.size(), group_id)) {
+				return "[server.xml] reading key-value.group-stale.group-id error";
+			}
+			Group_Stale gs;
+			t = elem->GetText();
+			if (!safe_toui32(t.c_str(), t.size(), gs.grace)) {
+				return "[server.xml] reading key-value.group-stale error";
+			}
+			gs.early = 0;
+			const char* early = elem->Attribute("early");
+			if (early != NULL) {
+				t = early;
+				if (!safe_toui32(t.c_str(), t.size(), gs.early)) {
+					return "[server.xml] reading key-value.group-stale.early error";
+				}
+			}
+			group_stales[group_id] = gs;
+			elem = elem->NextSiblingElement("group-stale");
+		}
 	}
 	elem = hRoot.FirstChildElement("log").Element();
 	if (elem != NULL && elem->GetText() != NULL) {
@@ -212,6 +341,82 @@ string Settings::load_conf_server() {
 		}
 	}
 
+	elem = hRoot.FirstChildElement("execution-mode").Element();
+	if (elem != NULL && elem->GetText() != NULL) {
+		string t = elem->GetText();
+		if (t == "partitioned") {
+			partitioned = true;
+		} else if (t == "shared") {
+			partitioned = false;
+		} else {
+			return "[server.xml] reading execution-mode error";
+		}
+	}
+	if (partitioned) {
+		// one io_service per thread, the thread is the core owning a partition
+		pool_size = num_threads;
+	}
+
+	elem = hRoot.FirstChildElement("connection-migration").Element();
+	if (elem != NULL && elem->GetText() != NULL) {
+		string t = elem->GetText();
+		if (t == "true") {
+			connection_migration = true;
+		} else if (t == "false") {
+			connection_migration = false;
+		} else {
+			return "[server.xml] reading connection-migration error";
+		}
+	}
+	if (partitioned && connection_migration) {
+		// a connection stays on the core that accepted it
+		return "[server.xml] connection-migration is not supported in partitioned execution-mode";
+	}
+
+	elem = hRoot.FirstChildElement("lock-free-get").Element();
+	if (elem != NULL && elem->GetText() != NULL) {
+		string t = elem->GetText();
+		if (t == "true") {
+			lock_free_get = true;
+		} else if (t == "false") {
+			lock_free_get = false;
+		} else {
+			return "[server.xml] reading lock-free-get error";
+		}
+	}
+
+	elem = hRoot.FirstChildElement("file-load-thread-number").Element();
+	if (elem != NULL && elem->GetText() != NULL) {
+		string t = elem->GetText();
+		if (!safe_toui32(t.c_str(), t.size(), file_load_threads)) {
+			return "[server.xml] reading file-load-thread-number error";
+		}
+	}
+
+	elem = hRoot.FirstChildElement("file-load-queue-size").Element();
+	if (elem != NULL && elem->GetText() != NULL) {
+		string t = elem->GetText();
+		if (!safe_toui32(t.c_str(), t.size(), file_load_queue_size)) {
+			return "[server.xml] reading file-load-queue-size error";
+		}
+	}
+
+	elem = hRoot.FirstChildElement("negative-cache-size").Element();
+	if (elem != NULL && elem->GetText() != NULL) {
+		string t = elem->GetText();
+		if (!safe_toui32(t.c_str(), t.size(), negative_cache_size)) {
+			return "[server.xml] reading negative-cache-size error";
+		}
+	}
+
+	elem = hRoot.FirstChildElement("negative-cache-ttl").Element();
+	if (elem != NULL && elem->GetText() != NULL) {
+		string t = elem->GetText();
+		if (!safe_toui32(t.c_str(), t.size(), negative_cache_ttl)) {
+			return "[server.xml] reading negative-cache-ttl error";
+		}
+	}
+
 	return "";
 }
 
@@ -389,7 +594,35 @@ void Settings::print() {
 	LOG_INFO("factor=" << factor);
 	LOG_INFO("pool_size=" << pool_size);
 	LOG_INFO("num_threads=" << num_threads);
+	LOG_INFO("execution_mode=" << (partitioned ? "partitioned" : "shared"));
+	LOG_INFO("connection_migration=" << connection_migration);
+	LOG_INFO("lock_free_get=" << lock_free_get);
+	LOG_INFO("file_load_threads=" << file_load_threads);
+	LOG_INFO("file_load_queue_size=" << file_load_queue_size);
+	LOG_INFO("negative_cache_size=" << negative_cache_size);
+	LOG_INFO("negative_cache_ttl=" << negative_cache_ttl);
 	LOG_INFO("item_size_min=" << item_size_min);
 	LOG_INFO("item_size_max=" << item_size_max);
+	LOG_INFO("chunk_size=" << chunk_size);
+	LOG_INFO("value_size_max=" << value_size_max);
+	LOG_INFO("segment_max=" << segment_max);
+	LOG_INFO("feed_size=" << feed_size);
+	LOG_INFO("lease_timeout=" << lease_timeout);
+	std::map<uint32_t, uint64_t>::const_iterator it = group_quotas.begin();
+	while (it != group_quotas.end()) {
+		LOG_INFO("group_quota." << it->first << "=" << it->second);
+		++it;
+	}
+	std::map<uint32_t, Group_Compression>::const_iterator gc = group_compressions.begin();
+	while (gc != group_compressions.end()) {
+		LOG_INFO("group_compression." << gc->first << "=" << get_codec(gc->second.codec_id)->name()
+			<< " level=" << gc->second.level << " min_size=" << gc->second.min_size);
+		++gc;
+	}
+	std::map<uint32_t, Group_Stale>::const_iterator gs = group_stales.begin();
+	while (gs != group_stales.end()) {
+		LOG_INFO("group_stale." << gs->first << "=" << gs->second.grace << " early=" << gs->second.early);
+		++gs;
+	}
 	LOG_INFO("END-----SETTINGS INFO-----END");
 }
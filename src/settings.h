@@ -35,6 +35,17 @@ public:
 	Simple_Data mime_type;
 };
 
+struct Group_Compression {
+	uint32_t codec_id;
+	int level;
+	uint32_t min_size;  // values below this size are stored as is
+};
+
+struct Group_Stale {
+	uint32_t grace;     // seconds an expired item is still served
+	uint32_t early;     // XFetch delta * beta in seconds, 0 disables early refresh
+};
+
 class Gzip_Mime_Type_Item : public xixi::hash_node_base<Const_Data, Gzip_Mime_Type_Item>, public xixi::list_node_base<Gzip_Mime_Type_Item> {
 public:
 	inline bool is_key(const Const_Data* p) const {
@@ -74,12 +85,27 @@ public:
 	double factor;            // chunk size growth factor
 	uint32_t pool_size;       // number of io_service to run
 	uint32_t num_threads;     // number of threads to run
+	bool partitioned;         // each io thread owns a cache partition, see Cache_Router
+	bool connection_migration; // idle plain connections move off overloaded io_services
+	bool lock_free_get;       // plain gets read the hash table without the cache lock
+	uint32_t file_load_threads; // threads reading /webapps files, 0 reads on the io threads
+	uint32_t file_load_queue_size; // file loads waiting for a thread before misses get 503
+	uint32_t negative_cache_size; // missing /webapps paths remembered, 0 disables
+	uint32_t negative_cache_ttl;  // seconds a missing path is remembered
 	uint32_t item_size_min;
 	uint32_t item_size_max;
+	uint32_t chunk_size;      // values above item_size_max are stored in chunks of this size
+	uint32_t value_size_max;  // 0 disables chunked values
+	uint32_t segment_max;     // segments an appended value keeps before compaction, 0 copies on append
+	uint32_t feed_size;       // events kept per followed group, 0 disables group feeds
+	uint32_t lease_timeout;   // seconds a lease on a missing key is held
 
 	uint32_t log_level;
 
 	uint32_t max_stats_group;
+	std::map<uint32_t, uint64_t> group_quotas; // group_id -> max bytes
+	std::map<uint32_t, Group_Compression> group_compressions; // group_id -> value compression policy
+	std::map<uint32_t, Group_Stale> group_stales; // group_id -> serve stale policy
 
 	uint32_t default_cache_expiration;
 	string manager_base_url;
@@ -0,0 +1,72 @@
+/*
+   Copyright [2011] [Yao Yuan(yeaya@163.com)]
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef XIXI_SPSC_QUEUE_H
+#define XIXI_SPSC_QUEUE_H
+
+#include "defines.h"
+#include "atomic.h"
+
+namespace xixi {
+
+	// Bounded ring with exactly one producer thread and one consumer thread, N a
+	// power of two. Each index is written by one side only, so no lock is needed.
+	template <class T, uint32_t N = 64>
+	class spsc_queue {
+	public:
+		spsc_queue() {
+			head_ = 0;
+			tail_ = 0;
+		}
+
+		// producer side, false when full
+		inline bool push(const T& t) {
+			uint32_t tail = tail_;
+			if (tail - head_ == N) {
+				return false;
+			}
+			ring_[tail % N] = t;
+			memory_barrier();
+			tail_ = tail + 1;
+			return true;
+		}
+
+		// consumer side, false when empty
+		inline bool pop(T& t) {
+			uint32_t head = head_;
+			if (head == tail_) {
+				return false;
+			}
+			memory_barrier();
+			t = ring_[head % N];
+			memory_barrier();
+			head_ = head + 1;
+			return true;
+		}
+
+		inline bool empty() const { return head_ == tail_; }
+
+	private:
+		T ring_[N];
+		volatile uint32_t head_;
+		char pad_[64];
+		volatile uint32_t tail_;
+	};
+
+} // namespace xixi
+
+#endif // XIXI_SPSC_QUEUE_H
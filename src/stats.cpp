@@ -14,15 +14,212 @@
    limitations under the License.
 */
 
+#include <stdarg.h>
 #include <boost/lexical_cast.hpp>
 #include "stats.h"
 #include "settings.h"
 #include "currtime.h"
-#include "cache.h"
+#include "cache_router.h"
 #include "log.h"
+#include "file_load_pool.h"
+#include "file_monitor.h"
+#include "server.h"
 
 Stats stats_;
 
+static const char* latency_names[LATENCY_OP_COUNT] = {
+	"lock_wait",
+	"cache_process",
+	"get",
+	"get_touch",
+	"get_base",
+	"update",
+	"update_flags",
+	"update_expiration",
+	"delete",
+	"delta",
+	"flush",
+	"auth",
+	"stats",
+	"create_watch",
+	"check_watch",
+	"hello",
+	"http_resource",
+	"http_get",
+	"http_set",
+	"http_add",
+	"http_del",
+	"http_incr",
+	"http_decr",
+	"http_flush",
+	"http_touch",
+	"http_flags",
+	"http_stats",
+	"http_quota",
+	"http_append",
+	"http_replace",
+	"http_prepend",
+	"http_getbase",
+	"http_watch",
+	"http_createwatch",
+	"http_metrics",
+	"file_load"
+};
+
+struct Cache_Stats_Field {
+	const char* name;
+	uint64_t Cache_Stats_Item::* field;
+};
+
+static const Cache_Stats_Field cache_stats_fields[] = {
+	{"get_hit_no_watch", &Cache_Stats_Item::get_hit_no_watch},
+	{"get_hit_watch", &Cache_Stats_Item::get_hit_watch},
+	{"get_hit_watch_miss", &Cache_Stats_Item::get_hit_watch_miss},
+	{"get_touch_hit_no_watch", &Cache_Stats_Item::get_touch_hit_no_watch},
+	{"get_touch_hit_watch", &Cache_Stats_Item::get_touch_hit_watch},
+	{"get_touch_hit_watch_miss", &Cache_Stats_Item::get_touch_hit_watch_miss},
+	{"get_base_hit", &Cache_Stats_Item::get_base_hit},
+	{"class_get_base_miss", &Cache_Stats_Item::get_base_miss}, // get_base_miss is the group counter
+	{"update_flags_success", &Cache_Stats_Item::update_flags_success},
+	{"update_flags_mismatch", &Cache_Stats_Item::update_flags_mismatch},
+	{"update_expiration_success", &Cache_Stats_Item::update_expiration_success},
+	{"update_expiration_mismatch", &Cache_Stats_Item::update_expiration_mismatch},
+	{"add_success", &Cache_Stats_Item::add_success},
+	{"add_success_watch", &Cache_Stats_Item::add_success_watch},
+	{"add_watch_miss", &Cache_Stats_Item::add_watch_miss},
+	{"add_fail", &Cache_Stats_Item::add_fail},
+	{"set_success", &Cache_Stats_Item::set_success},
+	{"set_success_watch", &Cache_Stats_Item::set_success_watch},
+	{"set_watch_miss", &Cache_Stats_Item::set_watch_miss},
+	{"set_mismatch", &Cache_Stats_Item::set_mismatch},
+	{"replace_success", &Cache_Stats_Item::replace_success},
+	{"replace_success_watch", &Cache_Stats_Item::replace_success_watch},
+	{"replace_watch_miss", &Cache_Stats_Item::replace_watch_miss},
+	{"replace_mismatch", &Cache_Stats_Item::replace_mismatch},
+	{"append_success", &Cache_Stats_Item::append_success},
+	{"append_success_watch", &Cache_Stats_Item::append_success_watch},
+	{"append_watch_miss", &Cache_Stats_Item::append_watch_miss},
+	{"append_mismatch", &Cache_Stats_Item::append_mismatch},
+	{"append_out_of_memory", &Cache_Stats_Item::append_out_of_memory},
+	{"prepend_success", &Cache_Stats_Item::prepend_success},
+	{"prepend_success_watch", &Cache_Stats_Item::prepend_success_watch},
+	{"prepend_watch_miss", &Cache_Stats_Item::prepend_watch_miss},
+	{"prepend_mismatch", &Cache_Stats_Item::prepend_mismatch},
+	{"prepend_out_of_memory", &Cache_Stats_Item::prepend_out_of_memory},
+	{"delete_success", &Cache_Stats_Item::delete_success},
+	{"delete_mismatch", &Cache_Stats_Item::delete_mismatch}
+};
+
+struct Group_Stats_Field {
+	const char* name;
+	uint64_t Group_Stats_Item::* field;
+};
+
+static const Group_Stats_Field group_stats_fields[] = {
+	{"get_miss", &Group_Stats_Item::get_miss_},
+	{"get_touch_miss", &Group_Stats_Item::get_touch_miss_},
+	{"get_base_miss", &Group_Stats_Item::get_base_miss_},
+	{"update_flags_miss", &Group_Stats_Item::update_flags_miss_},
+	{"update_expiration_miss", &Group_Stats_Item::update_expiration_miss_},
+	{"replace_miss", &Group_Stats_Item::replace_miss_},
+	{"append_miss", &Group_Stats_Item::append_miss_},
+	{"prepend_miss", &Group_Stats_Item::prepend_miss_},
+	{"delete_miss", &Group_Stats_Item::delete_miss_},
+	{"incr_success", &Group_Stats_Item::incr_success_},
+	{"incr_mismatch", &Group_Stats_Item::incr_mismatch_},
+	{"incr_miss", &Group_Stats_Item::incr_miss_},
+	{"decr_success", &Group_Stats_Item::decr_success_},
+	{"decr_mismatch", &Group_Stats_Item::decr_mismatch_},
+	{"decr_miss", &Group_Stats_Item::decr_miss_},
+	{"create_watch", &Group_Stats_Item::create_watch_},
+	{"check_watch", &Group_Stats_Item::check_watch_},
+	{"check_watch_miss", &Group_Stats_Item::check_watch_miss_},
+	{"bytes_read", &Group_Stats_Item::bytes_read_},
+	{"bytes_write", &Group_Stats_Item::bytes_write_},
+	{"link_items", &Group_Stats_Item::link_items_},
+	{"unlink_items", &Group_Stats_Item::unlink_items_},
+	{"link_bytes", &Group_Stats_Item::link_bytes_},
+	{"unlink_bytes", &Group_Stats_Item::unlink_bytes_},
+	{"flush", &Group_Stats_Item::flush_},
+	{"evictions", &Group_Stats_Item::evictions_},
+	{"quota_rejects", &Group_Stats_Item::quota_rejects_},
+	{"compress_items", &Group_Stats_Item::compress_items_},
+	{"compress_bytes_in", &Group_Stats_Item::compress_bytes_in_},
+	{"compress_bytes_out", &Group_Stats_Item::compress_bytes_out_},
+	{"compress_us", &Group_Stats_Item::compress_us_},
+	{"load_waits", &Group_Stats_Item::load_waits_},
+	{"lease_grants", &Group_Stats_Item::lease_grants_},
+	{"lease_retries", &Group_Stats_Item::lease_retries_},
+	{"stale_hits", &Group_Stats_Item::stale_hits_},
+	{"refresh_hints", &Group_Stats_Item::refresh_hints_},
+	{"delta_combines", &Group_Stats_Item::delta_combines_},
+	{"segment_compacts", &Group_Stats_Item::segment_compacts_}
+};
+
+// largest histogram bucket exported as a metrics le boundary, 2^24 - 1 us
+#define METRICS_LATENCY_MAX_BUCKET 91
+
+void Metrics_Buffer::append(const char* format, ...) {
+	while (true) {
+		if (capacity_ - size_ < 256 && !reserve(capacity_ * 2)) {
+			return;
+		}
+		va_list args;
+		va_start(args, format);
+		int n = _vsnprintf(buf_ + size_, capacity_ - size_, format, args);
+		va_end(args);
+		if (n >= 0 && (uint32_t)n < capacity_ - size_) {
+			size_ += n;
+			return;
+		}
+		if (!reserve(capacity_ * 2)) {
+			return;
+		}
+	}
+}
+
+bool Metrics_Buffer::reserve(uint32_t size) {
+	if (size < 64 * 1024) {
+		size = 64 * 1024;
+	}
+	if (size <= capacity_) {
+		return true;
+	}
+	char* buf = (char*)realloc(buf_, size);
+	if (buf == NULL) {
+		return false;
+	}
+	buf_ = buf;
+	capacity_ = size;
+	return true;
+}
+
+uint64_t Latency_Histogram::get_bucket_upper(uint32_t i) {
+	i++;
+	if (i < LATENCY_SUB_BUCKET_COUNT) {
+		return i - 1;
+	}
+	uint32_t e = i / LATENCY_SUB_BUCKET_COUNT + LATENCY_SUB_BUCKET_BITS - 1;
+	uint64_t lower = (uint64_t)(LATENCY_SUB_BUCKET_COUNT + i % LATENCY_SUB_BUCKET_COUNT) << (e - LATENCY_SUB_BUCKET_BITS);
+	return lower - 1;
+}
+
+uint64_t Latency_Histogram::percentile(uint32_t per_mille) const {
+	if (count_ == 0) {
+		return 0;
+	}
+	uint64_t target = (count_ * per_mille + 999) / 1000;
+	uint64_t n = 0;
+	for (uint32_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+		n += buckets_[i];
+		if (n >= target) {
+			uint64_t upper = get_bucket_upper(i);
+			return upper < max_ ? upper : max_;
+		}
+	}
+	return max_;
+}
+
 void Cache_Stats_Item::append(uint32_t class_id, const char* k, uint32_t v, std::string& out) {
 	if (v != 0) {
 		std::string c = boost::lexical_cast<std::string>(class_id);
@@ -59,7 +256,7 @@ void Group_Stats_Item::append(const char* k, const char* v, std::string& out) {
 	}
 }
 
-Stats::Stats() {
+Stats::Stats() : threadLocal_(release_thread_stats_item) {
 	max_class_id_ = 200;
 	curr_conns_ = 0;
 	total_conns_ = 0;
@@ -72,6 +269,13 @@ Stats::~Stats() {
 		++it;
 	}
 	group_map_.clear();
+
+	std::set<Thread_Stats_Item*>::iterator it2 = thread_set_.begin();
+	while (it2 != thread_set_.end()) {
+		delete *it2;
+		++it2;
+	}
+	thread_set_.clear();
 }
 
 void Stats::merage(Cache_Stats_Item& cache_stat) {
@@ -90,10 +294,22 @@ void Stats::print() {
 		<< ":" << mem_free << "/" << mem_free_rate << "%");
 	LOG_INFO("item=" << (group_sum_.link_items_ - group_sum_.unlink_items_) << "/" << (group_sum_.link_bytes_ - group_sum_.unlink_bytes_)
 		<< " link=" << group_sum_.link_items_ << "/" << group_sum_.link_bytes_
-		<< " unlink=" << group_sum_.unlink_items_ << "/" << group_sum_.unlink_bytes_);
+		<< " unlink=" << group_sum_.unlink_items_ << "/" << group_sum_.unlink_bytes_
+		<< " evictions=" << group_sum_.evictions_ << " quota_rejects=" << group_sum_.quota_rejects_);
 	LOG_INFO("get hit/w=" << cs.get_hit_no_watch << "/" << cs.get_hit_watch << " miss=" << group_sum_.get_miss_ << " w_miss=" << cs.get_hit_watch_miss);
 	LOG_INFO("get_touch hit/w=" << cs.get_touch_hit_no_watch << "/" << cs.get_touch_hit_watch << " miss=" << group_sum_.get_touch_miss_ << " w_miss=" << cs.get_touch_hit_watch_miss);
 	LOG_INFO("set success=" << cs.set_success << " mismatch=" << cs.set_mismatch);
+
+	Latency_Histogram latency[LATENCY_OP_COUNT];
+	get_latency(latency);
+	for (uint32_t i = 0; i < LATENCY_OP_COUNT; i++) {
+		const Latency_Histogram& h = latency[i];
+		if (h.count_ > 0) {
+			LOG_INFO("latency " << latency_names[i] << " count=" << h.count_ << " p50=" << h.percentile(500)
+				<< " p90=" << h.percentile(900) << " p99=" << h.percentile(990) << " p999=" << h.percentile(999)
+				<< " max=" << h.max_ << "us");
+		}
+	}
 	//  LOG_INFO("get_base hit=" << cs.get_base_hit << " miss=" << group_sum_.get_base_miss_);
 	//  LOG_INFO("update_flags success=" << cs.update_flags_success << " miss=" << group_sum_.update_flags_miss_ << " mismatch=" << cs.update_flags_mismatch);
 }
@@ -128,17 +344,44 @@ void Stats::get_base_stats(std::string& out) {
 	Group_Stats_Item::append("curr_stats_group", (uint64_t)group_map_.size(), out);
 	Group_Stats_Item::append("memory_limit", cache_mgr_.get_mem_limit(), out);
 	Group_Stats_Item::append("memory_used", cache_mgr_.get_mem_used(), out);
+	Group_Stats_Item::append("item_header_size", (uint32_t)ITEM_HEADER_SIZE, out);
+	Group_Stats_Item::append("chunk_size", cache_mgr_.get_chunk_size(), out);
+	Group_Stats_Item::append("file_load_queue", file_load_pool_.get_queue_size(), out);
+	Group_Stats_Item::append("file_load_rejects", file_load_pool_.get_rejects(), out);
+	Group_Stats_Item::append("negative_cache_size", file_monitor_.get_negative_size(), out);
+	Group_Stats_Item::append("negative_cache_hits", file_monitor_.get_negative_hits(), out);
+	Group_Stats_Item::append("file_invalidations", file_monitor_.get_invalidations(), out);
+	Group_Stats_Item::append("reclaim_deferred_bytes", cache_mgr_.get_reclaim_deferred_bytes(), out);
+	Group_Stats_Item::append("reclaim_overflows", cache_mgr_.get_reclaim_overflows(), out);
+	get_thread_stats(out);
 	lock_.lock();
 	Group_Stats_Item::append("curr_conns", curr_conns_, out);
 	Group_Stats_Item::append("total_conns", total_conns_, out);
 	lock_.unlock();
 }
 
-bool Stats::get_stats(uint32_t group_id, uint8_t class_id, std::string& out) {
+void Group_Stats_Item::merge(Group_Stats_Item& to) const {
+	for (uint32_t i = 0; i < sizeof(group_stats_fields) / sizeof(group_stats_fields[0]); i++) {
+		const Group_Stats_Field& f = group_stats_fields[i];
+		to.*f.field += this->*f.field;
+	}
+	for (int i = 0; i < 200; i++) {
+		cache_stats_[i].merge(to.cache_stats_[i]);
+	}
+}
+
+bool Stats::get_stats(uint32_t group_id, uint8_t class_id, std::string& out, const Group_Stats_Item* others) {
 	get_base_stats(out);
 	Group_Stats_Item* item = get_group_item(group_id);
 	if (item != NULL) {
-		item->to_string(class_id, max_class_id_, out);
+		if (others != NULL) {
+			Group_Stats_Item* sum = new Group_Stats_Item(*others);
+			item->merge(*sum);
+			sum->to_string(class_id, max_class_id_, out);
+			delete sum;
+		} else {
+			item->to_string(class_id, max_class_id_, out);
+		}
 		return true;
 	}
 	return false;
@@ -155,9 +398,16 @@ bool Stats::get_and_clear_stats(uint32_t group_id, uint8_t class_id,  std::strin
 	return false;
 }
 
-bool Stats::get_stats(uint8_t class_id, std::string& out) {
+bool Stats::get_stats(uint8_t class_id, std::string& out, const Group_Stats_Item* others) {
 	get_base_stats(out);
-	group_sum_.to_string(class_id, max_class_id_, out);
+	if (others != NULL) {
+		Group_Stats_Item* sum = new Group_Stats_Item(*others);
+		group_sum_.merge(*sum);
+		sum->to_string(class_id, max_class_id_, out);
+		delete sum;
+	} else {
+		group_sum_.to_string(class_id, max_class_id_, out);
+	}
 	return true;
 }
 
@@ -167,3 +417,164 @@ bool Stats::get_and_clear_stats(uint8_t class_id, std::string& out) {
 	group_sum_.clear();
 	return true;
 }
+
+// utilisation of every io thread and the io_service it runs
+void Stats::get_thread_stats(std::string& out) {
+	if (svr_ == NULL) {
+		return;
+	}
+	vector<Io_Service_Load> services;
+	vector<Io_Thread_Load> threads;
+	svr_->get_io_service_pool().get_loads(services, threads);
+	for (uint32_t i = 0; i < services.size(); i++) {
+		std::string k = "io_service" + boost::lexical_cast<std::string>(i);
+		Group_Stats_Item::append((k + "_threads").c_str(), services[i].threads, out);
+		Group_Stats_Item::append((k + "_connections").c_str(), services[i].connections, out);
+		Group_Stats_Item::append((k + "_busy_permille").c_str(), services[i].busy_permille, out);
+		Group_Stats_Item::append((k + "_queue_delay_us").c_str(), services[i].queue_delay_us, out);
+		Group_Stats_Item::append((k + "_migrations").c_str(), services[i].migrations, out);
+	}
+	for (uint32_t i = 0; i < threads.size(); i++) {
+		std::string k = "thread" + boost::lexical_cast<std::string>(i);
+		Group_Stats_Item::append((k + "_io_service").c_str(), (uint32_t)threads[i].index, out);
+		Group_Stats_Item::append((k + "_busy_permille").c_str(), threads[i].busy_permille, out);
+	}
+}
+
+void Stats::get_latency(Latency_Histogram* latency) {
+	lock_.lock();
+	std::set<Thread_Stats_Item*>::iterator it = thread_set_.begin();
+	while (it != thread_set_.end()) {
+		for (uint32_t i = 0; i < LATENCY_OP_COUNT; i++) {
+			(*it)->latency_[i].merge(latency[i]);
+		}
+		++it;
+	}
+	lock_.unlock();
+}
+
+void Stats::get_latency_stats(std::string& out) {
+	Latency_Histogram latency[LATENCY_OP_COUNT];
+	get_latency(latency);
+	for (uint32_t i = 0; i < LATENCY_OP_COUNT; i++) {
+		const Latency_Histogram& h = latency[i];
+		if (h.count_ > 0) {
+			std::string k = std::string("latency_") + latency_names[i];
+			Group_Stats_Item::append((k + "_count").c_str(), h.count_, out);
+			Group_Stats_Item::append((k + "_avg").c_str(), h.sum_ / h.count_, out);
+			Group_Stats_Item::append((k + "_p50").c_str(), h.percentile(500), out);
+			Group_Stats_Item::append((k + "_p90").c_str(), h.percentile(900), out);
+			Group_Stats_Item::append((k + "_p99").c_str(), h.percentile(990), out);
+			Group_Stats_Item::append((k + "_p999").c_str(), h.percentile(999), out);
+			Group_Stats_Item::append((k + "_max").c_str(), h.max_, out);
+		}
+	}
+}
+
+void Stats::snapshot() {
+	snapshot_lock_.lock();
+	snapshot_.memory_limit_ = cache_mgr_.get_mem_limit();
+	snapshot_.memory_used_ = cache_mgr_.get_mem_used();
+	snapshot_.group_sum_ = group_sum_;
+	snapshot_lock_.unlock();
+}
+
+void Stats::get_metrics(Metrics_Buffer& out) {
+	out.reset();
+
+	lock_.lock();
+	uint32_t curr_conns = curr_conns_;
+	uint64_t total_conns = total_conns_;
+	lock_.unlock();
+
+	out.append("# TYPE xixibase_uptime_seconds gauge\nxixibase_uptime_seconds %" PRIu32 "\n", curr_time_.get_current_time());
+	out.append("# TYPE xixibase_curr_connections gauge\nxixibase_curr_connections %" PRIu32 "\n", curr_conns);
+	out.append("# TYPE xixibase_connections_total counter\nxixibase_connections_total %" PRIu64 "\n", total_conns);
+	out.append("# TYPE xixibase_file_load_queue gauge\nxixibase_file_load_queue %" PRIu32 "\n", file_load_pool_.get_queue_size());
+	out.append("# TYPE xixibase_file_load_rejects_total counter\nxixibase_file_load_rejects_total %" PRIu64 "\n", file_load_pool_.get_rejects());
+	out.append("# TYPE xixibase_negative_cache_size gauge\nxixibase_negative_cache_size %" PRIu32 "\n", file_monitor_.get_negative_size());
+	out.append("# TYPE xixibase_negative_cache_hits_total counter\nxixibase_negative_cache_hits_total %" PRIu64 "\n", file_monitor_.get_negative_hits());
+	out.append("# TYPE xixibase_file_invalidations_total counter\nxixibase_file_invalidations_total %" PRIu64 "\n", file_monitor_.get_invalidations());
+	out.append("# TYPE xixibase_reclaim_deferred_bytes_total counter\nxixibase_reclaim_deferred_bytes_total %" PRIu64 "\n", cache_mgr_.get_reclaim_deferred_bytes());
+	out.append("# TYPE xixibase_reclaim_overflows_total counter\nxixibase_reclaim_overflows_total %" PRIu64 "\n", cache_mgr_.get_reclaim_overflows());
+
+	if (svr_ != NULL) {
+		vector<Io_Service_Load> services;
+		vector<Io_Thread_Load> threads;
+		svr_->get_io_service_pool().get_loads(services, threads);
+		out.append("# TYPE xixibase_io_service_connections gauge\n");
+		for (uint32_t i = 0; i < services.size(); i++) {
+			out.append("xixibase_io_service_connections{io_service=\"%" PRIu32 "\"} %" PRIu32 "\n", i, services[i].connections);
+		}
+		out.append("# TYPE xixibase_io_service_queue_delay_us gauge\n");
+		for (uint32_t i = 0; i < services.size(); i++) {
+			out.append("xixibase_io_service_queue_delay_us{io_service=\"%" PRIu32 "\"} %" PRIu32 "\n", i, services[i].queue_delay_us);
+		}
+		out.append("# TYPE xixibase_io_service_migrations_total counter\n");
+		for (uint32_t i = 0; i < services.size(); i++) {
+			out.append("xixibase_io_service_migrations_total{io_service=\"%" PRIu32 "\"} %" PRIu64 "\n", i, services[i].migrations);
+		}
+		out.append("# TYPE xixibase_thread_busy_ratio gauge\n");
+		for (uint32_t i = 0; i < threads.size(); i++) {
+			out.append("xixibase_thread_busy_ratio{thread=\"%" PRIu32 "\",io_service=\"%" PRIu32 "\"} %.3f\n",
+				i, (uint32_t)threads[i].index, threads[i].busy_permille / 1000.0);
+		}
+	}
+
+	snapshot_lock_.lock();
+	Group_Stats_Item* sum_all = new Group_Stats_Item(snapshot_.group_sum_);
+	for (size_t i = 0; i < part_stats_.size(); i++) {
+		Stats* part = part_stats_[i];
+		part->snapshot_lock_.lock();
+		part->snapshot_.group_sum_.merge(*sum_all);
+		part->snapshot_lock_.unlock();
+	}
+	const Group_Stats_Item& sum = *sum_all;
+	out.append("# TYPE xixibase_memory_limit_bytes gauge\nxixibase_memory_limit_bytes %" PRIu64 "\n", snapshot_.memory_limit_);
+	out.append("# TYPE xixibase_memory_used_bytes gauge\nxixibase_memory_used_bytes %" PRIu64 "\n", snapshot_.memory_used_);
+	out.append("# TYPE xixibase_curr_items gauge\nxixibase_curr_items %" PRIu64 "\n", sum.link_items_ - sum.unlink_items_);
+	out.append("# TYPE xixibase_curr_item_bytes gauge\nxixibase_curr_item_bytes %" PRIu64 "\n", sum.link_bytes_ - sum.unlink_bytes_);
+
+	for (uint32_t i = 0; i < sizeof(group_stats_fields) / sizeof(group_stats_fields[0]); i++) {
+		const Group_Stats_Field& f = group_stats_fields[i];
+		out.append("# TYPE xixibase_%s_total counter\nxixibase_%s_total %" PRIu64 "\n", f.name, f.name, sum.*f.field);
+	}
+
+	for (uint32_t i = 0; i < sizeof(cache_stats_fields) / sizeof(cache_stats_fields[0]); i++) {
+		const Cache_Stats_Field& f = cache_stats_fields[i];
+		bool first = true;
+		for (uint32_t class_id = 1; class_id < max_class_id_; class_id++) {
+			uint64_t v = sum.cache_stats_[class_id].*f.field;
+			if (v != 0) {
+				if (first) {
+					out.append("# TYPE xixibase_%s_total counter\n", f.name);
+					first = false;
+				}
+				out.append("xixibase_%s_total{class=\"%" PRIu32 "\"} %" PRIu64 "\n", f.name, class_id, v);
+			}
+		}
+	}
+	snapshot_lock_.unlock();
+	delete sum_all;
+
+	Latency_Histogram latency[LATENCY_OP_COUNT];
+	get_latency(latency);
+	out.append("# TYPE xixibase_latency_us histogram\n");
+	for (uint32_t i = 0; i < LATENCY_OP_COUNT; i++) {
+		const Latency_Histogram& h = latency[i];
+		if (h.count_ == 0) {
+			continue;
+		}
+		uint64_t n = 0;
+		for (uint32_t b = 0; b <= METRICS_LATENCY_MAX_BUCKET; b++) {
+			n += h.buckets_[b];
+			if (b % LATENCY_SUB_BUCKET_COUNT == LATENCY_SUB_BUCKET_COUNT - 1) {
+				out.append("xixibase_latency_us_bucket{op=\"%s\",le=\"%" PRIu64 "\"} %" PRIu64 "\n",
+					latency_names[i], Latency_Histogram::get_bucket_upper(b), n);
+			}
+		}
+		out.append("xixibase_latency_us_bucket{op=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", latency_names[i], h.count_);
+		out.append("xixibase_latency_us_sum{op=\"%s\"} %" PRIu64 "\n", latency_names[i], h.sum_);
+		out.append("xixibase_latency_us_count{op=\"%s\"} %" PRIu64 "\n", latency_names[i], h.count_);
+	}
+}
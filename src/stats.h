@@ -18,8 +18,9 @@
 #define STATS_H
 
 #include "defines.h"
+#include <stdio.h>
 #include <boost/thread/mutex.hpp>
-//#include <boost/thread/tss.hpp>
+#include <boost/thread/tss.hpp>
 
 class Cache_Stats_Item {
 public:
@@ -258,11 +259,29 @@ public:
 
 		flush_ = 0;
 
+		evictions_ = 0;
+		quota_rejects_ = 0;
+
+		compress_items_ = 0;
+		compress_bytes_in_ = 0;
+		compress_bytes_out_ = 0;
+		compress_us_ = 0;
+
+		load_waits_ = 0;
+		lease_grants_ = 0;
+		lease_retries_ = 0;
+		stale_hits_ = 0;
+		refresh_hints_ = 0;
+		delta_combines_ = 0;
+		segment_compacts_ = 0;
+
 		for (int i = 0; i < 200; i++) {
 			cache_stats_[i].clear();
 		}
 	}
 
+	void merge(Group_Stats_Item& to) const;
+
 	void static append(const char* k, uint32_t v, std::string& out);
 
 	void static append(const char* k, uint64_t v, std::string& out);
@@ -300,6 +319,27 @@ public:
 
 		append("flush", flush_, out);
 
+		append("evictions", evictions_, out);
+		append("quota_rejects", quota_rejects_, out);
+
+		append("compress_items", compress_items_, out);
+		append("compress_bytes_in", compress_bytes_in_, out);
+		append("compress_bytes_out", compress_bytes_out_, out);
+		append("compress_us", compress_us_, out);
+		if (compress_bytes_out_ > 0) {
+			char ratio[32];
+			_snprintf(ratio, sizeof(ratio), "%.2f", (double)compress_bytes_in_ / (double)compress_bytes_out_);
+			append("compress_ratio", ratio, out);
+		}
+
+		append("load_waits", load_waits_, out);
+		append("lease_grants", lease_grants_, out);
+		append("lease_retries", lease_retries_, out);
+		append("stale_hits", stale_hits_, out);
+		append("refresh_hints", refresh_hints_, out);
+		append("delta_combines", delta_combines_, out);
+		append("segment_compacts", segment_compacts_, out);
+
 		if (class_id > 0 && class_id < 200) {
 			cache_stats_[class_id].to_string(class_id, out);
 		} else {
@@ -337,13 +377,168 @@ public:
 	uint64_t link_bytes_;
 	uint64_t unlink_bytes_;
 
-	uint32_t flush_;
+	uint64_t flush_;
+
+	uint64_t evictions_;
+	uint64_t quota_rejects_;
+	uint64_t compress_items_;
+	uint64_t compress_bytes_in_;
+	uint64_t compress_bytes_out_;
+	uint64_t compress_us_;
+
+	uint64_t load_waits_;
+	uint64_t lease_grants_;
+	uint64_t lease_retries_;
+	uint64_t stale_hits_;
+	uint64_t refresh_hints_;
+	uint64_t delta_combines_;
+	uint64_t segment_compacts_;
 	Cache_Stats_Item cache_stats_[200];
 };
 
-class Thread_Stats_Item {
+const uint32_t LATENCY_LOCK_WAIT = 0;
+const uint32_t LATENCY_CACHE_PROCESS = 1;
+const uint32_t LATENCY_CACHE_GET = 2;
+const uint32_t LATENCY_CACHE_GET_TOUCH = 3;
+const uint32_t LATENCY_CACHE_GET_BASE = 4;
+const uint32_t LATENCY_CACHE_UPDATE = 5;
+const uint32_t LATENCY_CACHE_UPDATE_FLAGS = 6;
+const uint32_t LATENCY_CACHE_UPDATE_EXPIRATION = 7;
+const uint32_t LATENCY_CACHE_DELETE = 8;
+const uint32_t LATENCY_CACHE_DELTA = 9;
+const uint32_t LATENCY_CACHE_FLUSH = 10;
+const uint32_t LATENCY_CACHE_AUTH = 11;
+const uint32_t LATENCY_CACHE_STATS = 12;
+const uint32_t LATENCY_CACHE_CREATE_WATCH = 13;
+const uint32_t LATENCY_CACHE_CHECK_WATCH = 14;
+const uint32_t LATENCY_CACHE_HELLO = 15;
+const uint32_t LATENCY_HTTP_RESOURCE = 16;
+const uint32_t LATENCY_HTTP_GET = 17;
+const uint32_t LATENCY_HTTP_SET = 18;
+const uint32_t LATENCY_HTTP_ADD = 19;
+const uint32_t LATENCY_HTTP_DEL = 20;
+const uint32_t LATENCY_HTTP_INCR = 21;
+const uint32_t LATENCY_HTTP_DECR = 22;
+const uint32_t LATENCY_HTTP_FLUSH = 23;
+const uint32_t LATENCY_HTTP_TOUCH = 24;
+const uint32_t LATENCY_HTTP_FLAGS = 25;
+const uint32_t LATENCY_HTTP_STATS = 26;
+const uint32_t LATENCY_HTTP_QUOTA = 27;
+const uint32_t LATENCY_HTTP_APPEND = 28;
+const uint32_t LATENCY_HTTP_REPLACE = 29;
+const uint32_t LATENCY_HTTP_PREPEND = 30;
+const uint32_t LATENCY_HTTP_GETBASE = 31;
+const uint32_t LATENCY_HTTP_WATCH = 32;
+const uint32_t LATENCY_HTTP_CREATEWATCH = 33;
+const uint32_t LATENCY_HTTP_METRICS = 34;
+const uint32_t LATENCY_FILE_LOAD = 35; // queue wait and load of a webapps file
+const uint32_t LATENCY_OP_COUNT = 36;
+
+// log-linear buckets in microseconds, 4 linear sub buckets per power of two
+#define LATENCY_SUB_BUCKET_BITS 2
+#define LATENCY_SUB_BUCKET_COUNT (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKET_COUNT 128
+
+class Latency_Histogram {
 public:
+	Latency_Histogram() {
+		clear();
+	}
+
+	void clear() {
+		count_ = 0;
+		sum_ = 0;
+		max_ = 0;
+		memset(buckets_, 0, sizeof(buckets_));
+	}
 
+	static inline uint32_t get_bucket(uint64_t us) {
+		if (us < LATENCY_SUB_BUCKET_COUNT) {
+			return (uint32_t)us;
+		}
+		uint32_t e = LATENCY_SUB_BUCKET_BITS;
+		while ((us >> (e + 1)) != 0) {
+			e++;
+		}
+		uint32_t i = (e - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKET_COUNT
+			+ (uint32_t)((us >> (e - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKET_COUNT - 1));
+		return i < LATENCY_BUCKET_COUNT ? i : LATENCY_BUCKET_COUNT - 1;
+	}
+
+	static uint64_t get_bucket_upper(uint32_t i);
+
+	inline void add(uint64_t us) {
+		buckets_[get_bucket(us)]++;
+		count_++;
+		sum_ += us;
+		if (us > max_) {
+			max_ = us;
+		}
+	}
+
+	void merge(Latency_Histogram& h) const {
+		for (uint32_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+			h.buckets_[i] += buckets_[i];
+		}
+		h.count_ += count_;
+		h.sum_ += sum_;
+		if (max_ > h.max_) {
+			h.max_ = max_;
+		}
+	}
+
+	uint64_t percentile(uint32_t per_mille) const;
+
+	uint64_t count_;
+	uint64_t sum_;
+	uint64_t max_;
+	uint64_t buckets_[LATENCY_BUCKET_COUNT];
+};
+
+class Metrics_Buffer {
+public:
+	Metrics_Buffer() : buf_(NULL), size_(0), capacity_(0) {
+	}
+	~Metrics_Buffer() {
+		if (buf_ != NULL) {
+			free(buf_);
+		}
+	}
+
+	void reset() {
+		size_ = 0;
+	}
+	void append(const char* format, ...);
+
+	const char* data() const {
+		return buf_;
+	}
+	uint32_t size() const {
+		return size_;
+	}
+
+private:
+	bool reserve(uint32_t size);
+
+	char* buf_;
+	uint32_t size_;
+	uint32_t capacity_;
+};
+
+class Stats_Snapshot {
+public:
+	Stats_Snapshot() : memory_limit_(0), memory_used_(0) {
+	}
+
+	uint64_t memory_limit_;
+	uint64_t memory_used_;
+	Group_Stats_Item group_sum_;
+};
+
+class Thread_Stats_Item {
+public:
+	Latency_Histogram latency_[LATENCY_OP_COUNT];
+	Metrics_Buffer metrics_buf_;
 };
 
 class Stats {
@@ -357,9 +552,10 @@ public:
 	bool remove_group(uint32_t group_id);
 
 	void get_base_stats(std::string& out);
-	bool get_stats(uint32_t group_id, uint8_t class_id, std::string& out);
+	void get_thread_stats(std::string& out);
+	bool get_stats(uint32_t group_id, uint8_t class_id, std::string& out, const Group_Stats_Item* others = NULL);
 	bool get_and_clear_stats(uint32_t group_id, uint8_t class_id,  std::string& out);
-	bool get_stats(uint8_t class_id, std::string& out);
+	bool get_stats(uint8_t class_id, std::string& out, const Group_Stats_Item* others = NULL);
 	bool get_and_clear_stats(uint8_t class_id, std::string& out);
 
 	inline Group_Stats_Item* get_group_item(uint32_t group_id) {
@@ -880,7 +1076,103 @@ public:
 		Group_Stats_Item* item = get_group_item(group_id);
 		if (item != NULL) {
 			item->unlink_items_++;
-			item->link_bytes_ += size;
+			item->unlink_bytes_ += size;
+		}
+	}
+
+	inline void evict(uint32_t group_id, uint32_t class_id) {
+		group_sum_.evictions_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->evictions_++;
+		}
+	}
+	inline void quota_reject(uint32_t group_id) {
+		group_sum_.quota_rejects_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->quota_rejects_++;
+		}
+	}
+
+	inline void compress(uint32_t group_id, uint32_t bytes_in, uint32_t bytes_out, uint64_t us) {
+		group_sum_.compress_items_++;
+		group_sum_.compress_bytes_in_ += bytes_in;
+		group_sum_.compress_bytes_out_ += bytes_out;
+		group_sum_.compress_us_ += us;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->compress_items_++;
+			item->compress_bytes_in_ += bytes_in;
+			item->compress_bytes_out_ += bytes_out;
+			item->compress_us_ += us;
+		}
+	}
+
+	inline void load_wait(uint32_t group_id) {
+		group_sum_.load_waits_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->load_waits_++;
+		}
+	}
+
+	inline void lease_grant(uint32_t group_id) {
+		group_sum_.lease_grants_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->lease_grants_++;
+		}
+	}
+
+	inline void lease_retry(uint32_t group_id) {
+		group_sum_.lease_retries_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->lease_retries_++;
+		}
+	}
+
+	// a delta applied by the thread holding cache_lock_ for another thread
+	inline void delta_combine(uint32_t group_id) {
+		group_sum_.delta_combines_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->delta_combines_++;
+		}
+	}
+
+	inline void segment_compact(uint32_t group_id) {
+		group_sum_.segment_compacts_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->segment_compacts_++;
+		}
+	}
+
+	inline void stale_hit(uint32_t group_id) {
+		group_sum_.stale_hits_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->stale_hits_++;
+		}
+	}
+
+	inline void refresh_hint(uint32_t group_id) {
+		group_sum_.refresh_hints_++;
+
+		Group_Stats_Item* item = get_group_item(group_id);
+		if (item != NULL) {
+			item->refresh_hints_++;
 		}
 	}
 
@@ -900,7 +1192,22 @@ public:
 	void set_max_class_id(uint32_t max_class_id) {
 		max_class_id_ = max_class_id;
 	}
-/*
+
+	inline void latency(uint32_t op, uint64_t us) {
+		get_thread_stats_item()->latency_[op].add(us);
+	}
+
+	void get_latency(Latency_Histogram* latency);
+	void get_latency_stats(std::string& out);
+
+	void snapshot();
+	void get_metrics(Metrics_Buffer& out);
+
+	// counters of the other cache partitions, summed into the metrics
+	void add_part(Stats* part) {
+		part_stats_.push_back(part);
+	}
+
 	inline Thread_Stats_Item* get_thread_stats_item() {
 		Thread_Stats_Item* item = threadLocal_.get();
 		if (item != NULL) {
@@ -914,9 +1221,10 @@ public:
 			return item;
 		}
 	}
-*/
+
 private:
 	void merage(Cache_Stats_Item& cache_stat);
+	static void release_thread_stats_item(Thread_Stats_Item* item) {}
 
 public:
 	mutex lock_;
@@ -927,8 +1235,12 @@ public:
 
 	Group_Stats_Item group_sum_;
 	std::map<uint32_t, Group_Stats_Item*> group_map_;
-//	boost::thread_specific_ptr<Thread_Stats_Item> threadLocal_;
+	boost::thread_specific_ptr<Thread_Stats_Item> threadLocal_;
 	std::set<Thread_Stats_Item*> thread_set_;
+
+	mutex snapshot_lock_;
+	Stats_Snapshot snapshot_;
+	std::vector<Stats*> part_stats_;
 };
 
 extern Stats stats_;
@@ -218,25 +218,29 @@ extern const char* get_suffix(const char* key, uint32_t length, uint32_t& suffix
 	return NULL;
 }
 
+// memchr is vectorized by the C runtime, so let it skip to each candidate first byte
 char* memfind(char* data, uint32_t length, const char* sub, uint32_t sub_len) {
 	if (length < sub_len) {
 		return NULL;
 	}
-	for (uint32_t i = 0; i <= length - sub_len; i++) {
-		uint32_t j = 0;
-		for (; j < sub_len; j++) {
-			if (data[i + j] != sub[j]) {
-				break;
-			}
+	if (sub_len == 0) {
+		return data;
+	}
+	char* end = data + (length - sub_len + 1);
+	while (data < end) {
+		data = (char*)memchr(data, sub[0], end - data);
+		if (data == NULL) {
+			return NULL;
 		}
-		if (j == sub_len) {
-			return data + i;
+		if (memcmp(data + 1, sub + 1, sub_len - 1) == 0) {
+			return data;
 		}
+		data++;
 	}
 	return NULL;
 }
 
-int strcasecmp(char* str1, char* str2, uint32_t length) {
+int strcasecmp(const char* str1, const char* str2, uint32_t length) {
 	for (uint32_t i = 0; i < length; i++) {
 		char c1 = str1[i];
 		char c2 = str2[i];
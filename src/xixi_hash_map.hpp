@@ -19,6 +19,7 @@
 
 #include "util.h"
 #include "defines.h"
+#include "atomic.h"
 #include <stdio.h>
 
 namespace xixi {
@@ -70,26 +71,28 @@ namespace xixi {
 		bool inline is_key(const K* k, const T* t) const { return t->is_key(k); }
 	};
 
+	// Writers must be serialized by the owner. find_shared may run concurrently with
+	// them: nodes are published with a barrier, a removed node keeps its hash_next_,
+	// and tables replaced by expand are kept until the map is destroyed. A reader
+	// may miss a key while the map changes, but never sees a node it cannot follow.
 	template <class K, class T, class PK = default_PK<K, T>, class hash_value_type = uint32_t, class size_type = uint32_t>
 	class hash_map {
 	public:
 		hash_map(size_type bucket_size = 7) {
-			hash_table_ = NULL;
 			size_ = 0;
-			bucket_size_ = bucket_size;
-			expand_size_ = bucket_size_ * 3 / 2;
-			hash_table_ = (T**)malloc(bucket_size_ * sizeof(T*));
-			if (hash_table_ == NULL) {
+			expand_size_ = bucket_size * 3 / 2;
+			table_ = alloc_table(bucket_size);
+			if (table_ == NULL) {
 				printf("Failed to init hash map.\n");
 				exit(EXIT_FAILURE);
 			}
-			memset(hash_table_, 0, sizeof(T*) * bucket_size_);
 		}
 
 		~hash_map() {
-			if (hash_table_ != NULL) {
-				free(hash_table_);
-				hash_table_ = NULL;
+			free((bucket_table*)table_);
+			table_ = NULL;
+			for (size_t i = 0; i < old_tables_.size(); i++) {
+				free(old_tables_[i]);
 			}
 		}
 
@@ -108,7 +111,7 @@ namespace xixi {
 		}
 
 		inline T* find(const K* k, hash_value_type hash_value) const {
-			T* p = hash_table_[hash_value % bucket_size_];
+			T* p = table_->buckets[hash_value % table_->bucket_size];
 			while (p != NULL) {
 				if (pk_.is_key(k, p)) {
 					return p;
@@ -118,42 +121,39 @@ namespace xixi {
 			return NULL;
 		}
 
+		// lookup without the writers' lock, the caller keeps found nodes alive
+		inline T* find_shared(const K* k, hash_value_type hash_value) const {
+			const bucket_table* table = table_;
+			T* p = ((T* volatile*)table->buckets)[hash_value % table->bucket_size];
+			while (p != NULL) {
+				if (pk_.is_key(k, p)) {
+					return p;
+				}
+				p = ((T* volatile&)p->hash_next_);
+			}
+			return NULL;
+		}
+
 		inline void insert(T* p, hash_value_type hash_value) {
 			p->hash_value_ = hash_value;
-			hash_value_type bucket = hash_value % bucket_size_;
-			p->hash_next_ = hash_table_[bucket];
-			hash_table_[bucket] = p;
+			hash_value_type bucket = hash_value % table_->bucket_size;
+			p->hash_next_ = table_->buckets[bucket];
+			memory_barrier();
+			table_->buckets[bucket] = p;
 
 			++size_;
 			if (size_ > expand_size_) {
 				expand();
 			}
 		}
-		/*
-		inline void insert(T* p) {
-		ST bucket = p->hash_value_ % bucket_size_;
-		p->hash_next_ = hash_table_[bucket];
-		hash_table_[bucket] = p;
-
-		++size_;
-		if (size_ > expand_size_) {
-		expand();
-		}
-		}
-		*/
+
 		inline T* remove(const T* t) {
-			hash_value_type bucket = t->hash_value_ % bucket_size_;
-			T* curr = hash_table_[bucket];
+			hash_value_type bucket = t->hash_value_ % table_->bucket_size;
+			T* curr = table_->buckets[bucket];
 			T* prev = NULL;
 			while (curr != NULL) {
 				if (curr == t) {
-					if (prev != NULL) {
-						prev->hash_next_ = curr->hash_next_;
-					} else {
-						hash_table_[bucket] = curr->hash_next_;
-					}
-					curr->hash_next_ = NULL;
-					--size_;
+					unlink(bucket, prev, curr);
 					return curr;
 				}
 				prev = curr;
@@ -163,18 +163,12 @@ namespace xixi {
 		}
 
 		inline T* remove(const K* k, hash_value_type hash_value) {
-			hash_value_type bucket = hash_value % bucket_size_;
-			T* curr = hash_table_[bucket];
+			hash_value_type bucket = hash_value % table_->bucket_size;
+			T* curr = table_->buckets[bucket];
 			T* prev = NULL;
 			while (curr != NULL) {
 				if (pk_.is_key(k, curr)) {
-					if (prev != NULL) {
-						prev->hash_next_ = curr->hash_next_;
-					} else {
-						hash_table_[bucket] = curr->hash_next_;
-					}
-					curr->hash_next_ = NULL;
-					--size_;
+					unlink(bucket, prev, curr);
 					return curr;
 				}
 				prev = curr;
@@ -187,36 +181,58 @@ namespace xixi {
 		inline bool empty() { return size_ == 0; }
 
 	private:
+		struct bucket_table {
+			size_type bucket_size;
+			T* buckets[1];
+		};
+
+		static bucket_table* alloc_table(size_type bucket_size) {
+			bucket_table* table = (bucket_table*)malloc(sizeof(bucket_table) + (bucket_size - 1) * sizeof(T*));
+			if (table != NULL) {
+				table->bucket_size = bucket_size;
+				memset(table->buckets, 0, sizeof(T*) * bucket_size);
+			}
+			return table;
+		}
+
+		// curr->hash_next_ is left as is for readers standing on curr
+		inline void unlink(hash_value_type bucket, T* prev, T* curr) {
+			if (prev != NULL) {
+				prev->hash_next_ = curr->hash_next_;
+			} else {
+				table_->buckets[bucket] = curr->hash_next_;
+			}
+			--size_;
+		}
+
 		void expand() {
-			size_type new_bucket_size = next_bucket_size(bucket_size_);
-			T** new_hashtable = (T**)malloc(new_bucket_size * sizeof(T*));
-			if (new_hashtable != NULL) {
-				memset(new_hashtable, 0, sizeof(T*) * new_bucket_size);
+			bucket_table* new_table = alloc_table(next_bucket_size(table_->bucket_size));
+			if (new_table != NULL) {
+				size_type new_bucket_size = new_table->bucket_size;
 				T* p;
 				T* next;
 				hash_value_type bucket;
-				for (size_type i = 0; i < bucket_size_; ++i) {
-					for (p = hash_table_[i]; NULL != p;) {
+				for (size_type i = 0; i < table_->bucket_size; ++i) {
+					for (p = table_->buckets[i]; NULL != p;) {
 						bucket = p->hash_value_ % new_bucket_size;
 						next = p->hash_next_;
-						p->hash_next_ = new_hashtable[bucket];
-						new_hashtable[bucket] = p;
+						p->hash_next_ = new_table->buckets[bucket];
+						new_table->buckets[bucket] = p;
 						p = next;
 					}
-					hash_table_[i] = NULL;
 				}
-				bucket_size_ = new_bucket_size;
-				expand_size_ = bucket_size_ * 3 / 2;
-				free(hash_table_);
-				hash_table_ = new_hashtable;
+				expand_size_ = new_bucket_size * 3 / 2;
+				memory_barrier();
+				old_tables_.push_back((bucket_table*)table_);
+				table_ = new_table;
 			}
 		}
 
 		PK pk_;
-		size_type bucket_size_;
 		size_type expand_size_;
-		T** hash_table_;
+		bucket_table* volatile table_;
 		size_type size_;
+		std::vector<bucket_table*> old_tables_;
 	};
 
 } // namespace xixi